@@ -0,0 +1,11 @@
+@echo off
+rem Doesn't clean build, so the game build and the results and baseline of earlier runs stay
+if not exist build\benchmarks (
+  mkdir build\benchmarks
+)
+
+pushd build\benchmarks
+
+clang -o benchmarks.exe ../../build_benchmarks.c -O2 -DNDEBUG -std=c11 -D_CRT_SECURE_NO_WARNINGS -Wextra -Wno-incompatible-library-redeclaration -Wno-sign-compare -Wno-unused-parameter -Wno-builtin-requires-header -lkernel32 -lgdi32 -luser32 -lruntimeobject -lwinmm -ld3d11 -ldxguid -ld3dcompiler -lshlwapi -lole32 -lavrt -lksuser -ldbghelp
+
+popd
@@ -0,0 +1,20 @@
+
+
+///
+// Benchmark target, see oogabooga/benchmarks.c
+// Headless so it builds & runs on Linux too:
+//     cc -O2 -o benchmarks build_benchmarks.c -lm -ldl -lpthread
+
+#define INITIAL_PROGRAM_MEMORY_SIZE MB(5)
+#define TEMPORARY_STORAGE_SIZE MB(2)
+
+#define OOGABOOGA_HEADLESS 1
+
+#define ENTRY_PROC entry
+
+#include "oogabooga/oogabooga.c"
+
+int entry(int argc, char **argv) {
+	// Nonzero exit code if anything regressed against the baseline
+	return oogabooga_run_benchmarks(argc, argv) ? 1 : 0;
+}
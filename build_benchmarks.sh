@@ -0,0 +1,5 @@
+#!/bin/sh
+mkdir -p build/benchmarks
+cd build/benchmarks
+
+${CC:-cc} -o benchmarks ../../build_benchmarks.c -O2 -DNDEBUG -std=gnu11 -lm -ldl -lpthread
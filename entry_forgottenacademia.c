@@ -152,7 +152,25 @@ int entry(int argc, char **argv) {
 	window.y 				= 200;
 	window.clear_color 		= hex_to_rgba(0x4f4263ff);
 
-	float64 last_time 		= os_get_current_time_in_seconds();
+	// :replay
+	// --record <file> records this session, --replay <file> [--frame-times <file>] plays it back
+	string replay_path 		= {0};
+	string frame_times_path = {0};
+	for (int i = 1; i+1 < argc; i++) {
+		string arg = STR(argv[i]);
+		if (strings_match(arg, STR("--record"))) {
+			input_record_begin(STR(argv[i+1]));
+		} else if (strings_match(arg, STR("--replay"))) {
+			replay_path = STR(argv[i+1]);
+		} else if (strings_match(arg, STR("--frame-times"))) {
+			frame_times_path = STR(argv[i+1]);
+		}
+	}
+	if (replay_path.count) {
+		input_replay_begin(replay_path, frame_times_path);
+	}
+
+	float64 game_time 		= 0.0;
 	float64 seconds_count 	= 0.0f;
 	int frame_count 		= 0;
 
@@ -192,9 +210,8 @@ int entry(int argc, char **argv) {
 		world_frame = (WorldFrame){0};
 		
 		// :time
-		float64 now 	= os_get_current_time_in_seconds();
-		float64 delta_t	= now - last_time;
-		last_time 		= now;
+		float64 delta_t	= get_frame_delta_time();
+		game_time 		+= delta_t;
 
 		// :view
 		animate_v2_to_target(&camera_pos, player_entity->pos, delta_t, 30.0f);
@@ -226,7 +243,7 @@ int entry(int argc, char **argv) {
 				Matrix4 xform		= m4_scalar(1.0);
 				xform				= m4_translate(xform, v3(entity->pos.x, entity->pos.y, 0));
 				if(entity->is_item) {
-					xform			= m4_translate(xform, v3(0, sin_breathe(os_get_current_time_in_seconds(), 8.0), 0));
+					xform			= m4_translate(xform, v3(0, sin_breathe(game_time, 8.0), 0));
 				}
 				draw_image_xform(sprite->image, xform, sprite->size, COLOR_WHITE);
 
@@ -243,6 +260,11 @@ int entry(int argc, char **argv) {
 			window.should_close = true;
 		}
 
+		// Captures this frame for offline profiling of the renderer (see oogabooga/quad_pipeline.c)
+		if (is_key_just_pressed(KEY_F9)) {
+			capture_next_draw_frame(STR("draw_frame.capture"));
+		}
+
 		Vector2 input_axis = v2(0, 0);
 		if (is_key_down('Q')) {
 			input_axis.x -= 1.0f;
@@ -0,0 +1,368 @@
+
+/*
+
+	Allocation tracking
+
+	Wraps any Allocator and counts what goes through it, per tag:
+	live bytes & count, totals, a power of two size histogram, peak and per-frame rate.
+
+	Each thread counts into its own buffer with plain stores, so tracking an allocation
+	doesn't take any locks or atomics. Buffers are summed up when you ask for stats, or
+	once per frame in allocation_tracking_end_frame().
+
+	Usage:
+
+		// Everything allocated with this is counted under "Particles"
+		Allocator particles = make_tracking_allocator(get_heap_allocator(), STR("Particles"));
+
+		// Or, with ENABLE_ALLOCATION_TRACKING, get_heap_allocator() is tracked and counts
+		// into whatever tag is pushed on the current thread ("heap" if none).
+		push_allocation_tag(STR("Audio"));
+		...
+		pop_allocation_tag();
+
+		Allocation_Tag_Stats stats = get_allocation_tag_stats(get_allocation_tag(STR("Audio")));
+
+	With ENABLE_ALLOCATION_TRACKING:
+		- allocation_tracking_end_frame() is called from os_update(). With ENABLE_PROFILING
+		  it also reports live bytes & allocations per frame per tag as counter tracks in
+		  google_trace.json.
+		- Anything still allocated when the program exits is logged by allocation_tracking_log_leaks().
+
+	Peak live bytes are sampled (each frame & when you get stats), so a spike that
+	comes and goes within a frame won't show up in it.
+
+*/
+
+#define ALLOCATION_TAG_MAX 64
+// Bucket i counts allocations of size (2^(i-1), 2^i], the last bucket is everything larger.
+#define ALLOCATION_SIZE_BUCKET_COUNT 32
+
+#define ALLOCATION_TRACKING_SIGNATURE 0x7A66ED01
+
+typedef struct Allocation_Tag_Stats {
+	string name;
+
+	u64 live_bytes;
+	u64 live_count;
+	u64 peak_live_bytes;
+
+	u64 total_allocations;
+	u64 total_deallocations;
+	u64 total_bytes_allocated;
+
+	u64 allocations_last_frame;
+	u64 bytes_allocated_last_frame;
+
+	u64 size_histogram[ALLOCATION_SIZE_BUCKET_COUNT];
+} Allocation_Tag_Stats;
+
+// Only ever written by the owning thread
+typedef struct Allocation_Thread_Counters Allocation_Thread_Counters;
+typedef struct Allocation_Thread_Counters {
+	s64 live_bytes[ALLOCATION_TAG_MAX];
+	s64 live_count[ALLOCATION_TAG_MAX];
+	u64 allocations[ALLOCATION_TAG_MAX];
+	u64 deallocations[ALLOCATION_TAG_MAX];
+	u64 bytes_allocated[ALLOCATION_TAG_MAX];
+	u64 size_histogram[ALLOCATION_TAG_MAX][ALLOCATION_SIZE_BUCKET_COUNT];
+
+	Allocation_Thread_Counters *next;
+} Allocation_Thread_Counters;
+
+// Prepended to every tracked allocation so we know what to take off on dealloc.
+typedef alignat(16) struct Allocation_Tracking_Header {
+	u64 size;
+	u32 tag;
+	u32 signature;
+} Allocation_Tracking_Header;
+
+typedef struct Allocation_Tracker {
+	Allocator parent;
+	u32 tag; // Ignored if use_thread_tag
+	bool use_thread_tag;
+} Allocation_Tracker;
+
+#define ALLOCATION_TAG_STACK_MAX 64
+
+// #Global
+ogb_instance string allocation_tag_names[ALLOCATION_TAG_MAX];
+ogb_instance volatile u64 allocation_tag_count;
+ogb_instance Spinlock allocation_tag_lock;
+ogb_instance Allocation_Thread_Counters * volatile allocation_thread_counters;
+ogb_instance volatile u64 allocation_tag_peaks[ALLOCATION_TAG_MAX];
+ogb_instance u64 allocation_tag_last_frame_allocations[ALLOCATION_TAG_MAX];
+ogb_instance u64 allocation_tag_last_frame_bytes[ALLOCATION_TAG_MAX];
+ogb_instance u64 allocation_tag_frame_allocations[ALLOCATION_TAG_MAX];
+ogb_instance u64 allocation_tag_frame_bytes[ALLOCATION_TAG_MAX];
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+string allocation_tag_names[ALLOCATION_TAG_MAX] = { {4, (u8*)"heap"} };
+volatile u64 allocation_tag_count = 1;
+Spinlock allocation_tag_lock;
+Allocation_Thread_Counters * volatile allocation_thread_counters = 0;
+volatile u64 allocation_tag_peaks[ALLOCATION_TAG_MAX];
+u64 allocation_tag_last_frame_allocations[ALLOCATION_TAG_MAX];
+u64 allocation_tag_last_frame_bytes[ALLOCATION_TAG_MAX];
+u64 allocation_tag_frame_allocations[ALLOCATION_TAG_MAX];
+u64 allocation_tag_frame_bytes[ALLOCATION_TAG_MAX];
+
+thread_local Allocation_Thread_Counters *thread_allocation_counters = 0;
+thread_local u32 allocation_tag_stack[ALLOCATION_TAG_STACK_MAX];
+thread_local u64 allocation_tag_stack_count = 0;
+
+Allocation_Tracker heap_allocation_tracker = { {heap_allocator_proc, 0}, 0, true };
+#endif
+
+// Finds or makes the tag with this name. The name is copied.
+ogb_instance u32
+get_allocation_tag(string name);
+
+ogb_instance void
+push_allocation_tag(string name);
+ogb_instance void
+pop_allocation_tag();
+
+ogb_instance Allocator
+make_tracking_allocator(Allocator parent, string tag);
+
+ogb_instance Allocation_Tag_Stats
+get_allocation_tag_stats(u32 tag);
+ogb_instance u64
+get_allocation_tag_count();
+
+ogb_instance void
+allocation_tracking_end_frame();
+
+// Returns number of tags with live allocations
+ogb_instance u64
+allocation_tracking_log_leaks();
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
+u32
+get_allocation_tag(string name) {
+	u64 count = allocation_tag_count;
+	for (u64 i = 0; i < count; i++) {
+		if (strings_match(allocation_tag_names[i], name)) return (u32)i;
+	}
+
+	// #Sync
+	spinlock_acquire_or_wait(&allocation_tag_lock);
+	for (u64 i = count; i < allocation_tag_count; i++) {
+		if (strings_match(allocation_tag_names[i], name)) {
+			spinlock_release(&allocation_tag_lock);
+			return (u32)i;
+		}
+	}
+	assert(allocation_tag_count < ALLOCATION_TAG_MAX, "Too many allocation tags (max %d)", ALLOCATION_TAG_MAX);
+	u32 tag = (u32)allocation_tag_count;
+	string copy;
+	copy.count = name.count;
+	copy.data = (u8*)heap_alloc(max(name.count, 1));
+	memcpy(copy.data, name.data, name.count);
+	allocation_tag_names[tag] = copy;
+	MEMORY_BARRIER;
+	allocation_tag_count += 1;
+	spinlock_release(&allocation_tag_lock);
+
+	return tag;
+}
+
+void
+push_allocation_tag(string name) {
+	assert(allocation_tag_stack_count < ALLOCATION_TAG_STACK_MAX, "Allocation tag stack overflow");
+	allocation_tag_stack[allocation_tag_stack_count] = get_allocation_tag(name);
+	allocation_tag_stack_count += 1;
+}
+void
+pop_allocation_tag() {
+	assert(allocation_tag_stack_count > 0, "Allocation tag stack underflow");
+	allocation_tag_stack_count -= 1;
+}
+
+Allocation_Thread_Counters *
+get_thread_allocation_counters() {
+	if (thread_allocation_counters) return thread_allocation_counters;
+
+	// Straight from the heap so we don't track ourselves. Never freed since the counts
+	// need to outlive the thread.
+	Allocation_Thread_Counters *counters = (Allocation_Thread_Counters*)heap_alloc(sizeof(Allocation_Thread_Counters));
+	memset(counters, 0, sizeof(Allocation_Thread_Counters));
+
+	while (true) {
+		Allocation_Thread_Counters *head = allocation_thread_counters;
+		counters->next = head;
+		if (compare_and_swap_64((volatile u64*)&allocation_thread_counters, (u64)counters, (u64)head)) break;
+	}
+
+	thread_allocation_counters = counters;
+	return counters;
+}
+
+inline u32
+get_allocation_size_bucket(u64 size) {
+	if (size <= 1) return 0;
+	u32 bucket = bit_scan_reverse_64(size-1)+1;
+	return min(bucket, ALLOCATION_SIZE_BUCKET_COUNT-1);
+}
+
+inline void
+allocation_tracking_count_alloc(u32 tag, u64 size) {
+	Allocation_Thread_Counters *c = get_thread_allocation_counters();
+	c->live_bytes[tag] += (s64)size;
+	c->live_count[tag] += 1;
+	c->allocations[tag] += 1;
+	c->bytes_allocated[tag] += size;
+	c->size_histogram[tag][get_allocation_size_bucket(size)] += 1;
+}
+inline void
+allocation_tracking_count_dealloc(u32 tag, u64 size) {
+	Allocation_Thread_Counters *c = get_thread_allocation_counters();
+	c->live_bytes[tag] -= (s64)size;
+	c->live_count[tag] -= 1;
+	c->deallocations[tag] += 1;
+}
+
+void*
+tracking_allocator_proc(u64 size, void *p, Allocator_Message message, void* data) {
+	Allocation_Tracker *tracker = (Allocation_Tracker*)data;
+	Allocator parent = tracker->parent;
+
+	switch (message) {
+		case ALLOCATOR_ALLOCATE: {
+			Allocation_Tracking_Header *header = (Allocation_Tracking_Header*)parent.proc(size+sizeof(Allocation_Tracking_Header), 0, ALLOCATOR_ALLOCATE, parent.data);
+			if (!header) return 0;
+
+			u32 tag = tracker->tag;
+			if (tracker->use_thread_tag) tag = allocation_tag_stack_count ? allocation_tag_stack[allocation_tag_stack_count-1] : 0;
+
+			header->size = size;
+			header->tag = tag;
+			header->signature = ALLOCATION_TRACKING_SIGNATURE;
+			allocation_tracking_count_alloc(tag, size);
+
+			return header+1;
+		}
+		case ALLOCATOR_DEALLOCATE: {
+			Allocation_Tracking_Header *header = ((Allocation_Tracking_Header*)p)-1;
+			assert(header->signature == ALLOCATION_TRACKING_SIGNATURE, "Pointer passed to a tracking allocator was not allocated by a tracking allocator");
+			allocation_tracking_count_dealloc(header->tag, header->size);
+			header->signature = 0;
+			parent.proc(0, header, ALLOCATOR_DEALLOCATE, parent.data);
+			return 0;
+		}
+		case ALLOCATOR_REALLOCATE: {
+			if (!p) return tracking_allocator_proc(size, 0, ALLOCATOR_ALLOCATE, data);
+
+			Allocation_Tracking_Header *header = ((Allocation_Tracking_Header*)p)-1;
+			assert(header->signature == ALLOCATION_TRACKING_SIGNATURE, "Pointer passed to a tracking allocator was not allocated by a tracking allocator");
+			u32 tag = header->tag;
+			u64 old_size = header->size;
+
+			// 0 tells reallocate() to go through us with alloc + copy + dealloc instead
+			Allocation_Tracking_Header *new_header = (Allocation_Tracking_Header*)parent.proc(size+sizeof(Allocation_Tracking_Header), header, ALLOCATOR_REALLOCATE, parent.data);
+			if (!new_header) return 0;
+
+			new_header->size = size;
+			allocation_tracking_count_dealloc(tag, old_size);
+			allocation_tracking_count_alloc(tag, size);
+
+			return new_header+1;
+		}
+	}
+	return 0;
+}
+
+Allocator
+make_tracking_allocator(Allocator parent, string tag) {
+	// Lives as long as the program since allocations can outlive the Allocator value
+	Allocation_Tracker *tracker = (Allocation_Tracker*)heap_alloc(sizeof(Allocation_Tracker));
+	tracker->parent = parent;
+	tracker->tag = get_allocation_tag(tag);
+	tracker->use_thread_tag = false;
+
+	Allocator a;
+	a.proc = tracking_allocator_proc;
+	a.data = tracker;
+	return a;
+}
+
+u64
+get_allocation_tag_count() {
+	return allocation_tag_count;
+}
+
+Allocation_Tag_Stats
+get_allocation_tag_stats(u32 tag) {
+	assert(tag < allocation_tag_count, "Invalid allocation tag %u", tag);
+
+	Allocation_Tag_Stats stats = ZERO(Allocation_Tag_Stats);
+	stats.name = allocation_tag_names[tag];
+
+	// Other threads keep counting while we read so this is a close snapshot, not an exact one.
+	s64 live_bytes = 0;
+	s64 live_count = 0;
+	for (Allocation_Thread_Counters *c = allocation_thread_counters; c; c = c->next) {
+		live_bytes += c->live_bytes[tag];
+		live_count += c->live_count[tag];
+		stats.total_allocations += c->allocations[tag];
+		stats.total_deallocations += c->deallocations[tag];
+		stats.total_bytes_allocated += c->bytes_allocated[tag];
+		for (u64 i = 0; i < ALLOCATION_SIZE_BUCKET_COUNT; i++) {
+			stats.size_histogram[i] += c->size_histogram[tag][i];
+		}
+	}
+	stats.live_bytes = (u64)max(live_bytes, 0);
+	stats.live_count = (u64)max(live_count, 0);
+
+	// Any thread can ask for stats, so don't let a lower peak overwrite a higher one
+	u64 peak;
+	do {
+		peak = allocation_tag_peaks[tag];
+		if (stats.live_bytes <= peak) break;
+	} while (!compare_and_swap_64(&allocation_tag_peaks[tag], stats.live_bytes, peak));
+	stats.peak_live_bytes = max(peak, stats.live_bytes);
+	stats.allocations_last_frame = allocation_tag_frame_allocations[tag];
+	stats.bytes_allocated_last_frame = allocation_tag_frame_bytes[tag];
+
+	return stats;
+}
+
+void
+allocation_tracking_end_frame() {
+	u64 tag_count = allocation_tag_count;
+#if ENABLE_PROFILING
+	u64 now = rdtsc();
+#endif
+	for (u32 tag = 0; tag < tag_count; tag++) {
+		Allocation_Tag_Stats stats = get_allocation_tag_stats(tag);
+
+		allocation_tag_frame_allocations[tag] = stats.total_allocations-allocation_tag_last_frame_allocations[tag];
+		allocation_tag_frame_bytes[tag] = stats.total_bytes_allocated-allocation_tag_last_frame_bytes[tag];
+		allocation_tag_last_frame_allocations[tag] = stats.total_allocations;
+		allocation_tag_last_frame_bytes[tag] = stats.total_bytes_allocated;
+
+#if ENABLE_PROFILING
+		if (stats.total_allocations == 0) continue;
+		_profiler_report_counter(tprint("%s live bytes", stats.name), (float64)stats.live_bytes, now);
+		_profiler_report_counter(tprint("%s allocations per frame", stats.name), (float64)allocation_tag_frame_allocations[tag], now);
+#endif
+	}
+}
+
+u64
+allocation_tracking_log_leaks() {
+	u64 leaking_tags = 0;
+	u64 tag_count = allocation_tag_count;
+	for (u32 tag = 0; tag < tag_count; tag++) {
+		Allocation_Tag_Stats stats = get_allocation_tag_stats(tag);
+		if (stats.live_count == 0) continue;
+
+		log_warning("Allocation tag '%s' leaked %llu allocations, %llu bytes (peak %llu bytes)", stats.name, stats.live_count, stats.live_bytes, stats.peak_live_bytes);
+		leaking_tags += 1;
+	}
+	return leaking_tags;
+}
+
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
@@ -0,0 +1,305 @@
+
+/*
+
+	Typed dynamic arrays.
+
+	Unlike growing_array, the element type is known at compile time, so pushing and indexing
+	compile to a compare and a store with no function call, header lookup or memcpy. Only
+	growing goes out of line. Counts are 64 bit and live in the array itself.
+
+	define_array(Entity); // Once per type at file scope, this declares Array(Entity)
+
+	Array(Entity) entities;
+	array_init(&entities, get_heap_allocator());
+	array_init_reserve(&entities, 1024, get_heap_allocator());
+	array_deinit(&entities);
+
+	// A zeroed array works as well and uses the heap allocator
+	Array(Entity) entities = {0};
+
+	array_push(&entities, entity); // entity is copied
+	Entity *e = array_push_empty(&entities); // Zeroed
+	Entity last = array_pop(&entities);
+	Entity *nth = &entities.data[n]; // Or array_at(&entities, n) which is bounds checked in debug
+	Entity *last = array_last(&entities);
+
+	array_append(&entities, other_entities, count);
+	array_insert(&entities, index, other_entities, count);
+
+	array_ordered_remove(&entities, index);
+	array_ordered_remove_range(&entities, index, count);
+	array_unordered_remove(&entities, index); // Moves the last item into index
+
+	array_reserve(&entities, 690);
+	array_resize(&entities, 69);
+	array_clear(&entities);
+
+	// Bitwise compare, -1 if not found. SIMD for 1, 2, 4 & 8 byte elements.
+	s64 index = array_find(&entities, &entity);
+
+	for (u64 i = 0; i < entities.count; i++) { Entity *e = &entities.data[i]; }
+	array_foreach(Entity, e, &entities) { ... } // e is a pointer
+
+	Arrays of the base types are predefined (Array(u32), Array(float32), Array(string), ...).
+
+	Note:
+		The array argument is evaluated more than once, so pass a plain pointer.
+		Pointers to items are invalidated when the array grows.
+*/
+
+#define Array(T) Array_##T
+
+// All arrays have this layout
+typedef struct Array_Raw {
+	void *data;
+	u64 count;
+	u64 capacity;
+	Allocator allocator;
+} Array_Raw;
+
+#define define_array(T) \
+	typedef struct Array_##T { \
+		T *data; \
+		u64 count; \
+		u64 capacity; \
+		Allocator allocator; \
+	} Array_##T
+
+#define _array_raw(a) ((Array_Raw*)(a))
+#define _array_item_size(a) sizeof(*(a)->data)
+// Type checks items against the array while evaluating to items
+#define _array_checked_items(a, items) (1 ? (items) : (a)->data)
+
+#define array_init(a, allocator)                       _array_init_reserve(_array_raw(a), _array_item_size(a), 0, (allocator))
+#define array_init_reserve(a, new_capacity, allocator) _array_init_reserve(_array_raw(a), _array_item_size(a), (new_capacity), (allocator))
+#define array_deinit(a)                                _array_deinit(_array_raw(a))
+
+#define array_reserve(a, new_capacity) \
+	((new_capacity) > (a)->capacity ? _array_grow(_array_raw(a), _array_item_size(a), (new_capacity)) : (void)0)
+#define array_resize(a, new_count) \
+	_array_resize(_array_raw(a), _array_item_size(a), (new_count))
+#define array_clear(a) ((a)->count = 0)
+
+#define array_push(a, item) \
+	(array_reserve((a), (a)->count+1), (a)->data[(a)->count++] = (item))
+#define array_push_empty(a) \
+	(array_reserve((a), (a)->count+1), _array_zero_item(&(a)->data[(a)->count], _array_item_size(a)), &(a)->data[(a)->count++])
+#define array_pop(a) \
+	(_array_check_index(0, (a)->count), (a)->data[--(a)->count])
+#define array_at(a, index) \
+	(_array_check_index((index), (a)->count), &(a)->data[(index)])
+#define array_last(a) \
+	(_array_check_index(0, (a)->count), &(a)->data[(a)->count-1])
+
+#define array_append(a, items, item_count) \
+	_array_insert(_array_raw(a), _array_item_size(a), (a)->count, _array_checked_items(a, items), (item_count))
+#define array_insert(a, index, items, item_count) \
+	_array_insert(_array_raw(a), _array_item_size(a), (index), _array_checked_items(a, items), (item_count))
+
+#define array_ordered_remove(a, index) \
+	_array_ordered_remove_range(_array_raw(a), _array_item_size(a), (index), 1)
+#define array_ordered_remove_range(a, index, item_count) \
+	_array_ordered_remove_range(_array_raw(a), _array_item_size(a), (index), (item_count))
+#define array_unordered_remove(a, index) \
+	(_array_check_index((index), (a)->count), (a)->data[(index)] = (a)->data[--(a)->count])
+
+#define array_find(a, item) \
+	_array_find((a)->data, (a)->count, _array_item_size(a), _array_checked_items(a, item))
+
+#define array_foreach(T, it, a) for (T *it = (a)->data; it < (a)->data+(a)->count; it++)
+
+inline void
+_array_check_index(u64 index, u64 count) {
+	assert(index < count, "Array index %llu out of range (count is %llu)", index, count);
+}
+
+inline void
+_array_zero_item(void *item, u64 item_size) {
+	memset(item, 0, item_size);
+}
+
+void
+_array_init_reserve(Array_Raw *a, u64 item_size, u64 capacity, Allocator allocator) {
+	*a = ZERO(Array_Raw);
+	a->allocator = allocator;
+	if (capacity) {
+		a->data = alloc(allocator, capacity*item_size);
+		a->capacity = capacity;
+	}
+}
+
+void
+_array_deinit(Array_Raw *a) {
+	if (a->data) dealloc(a->allocator, a->data);
+	*a = ZERO(Array_Raw);
+}
+
+// Out of line so the fast path of pushes stays small
+void
+_array_grow(Array_Raw *a, u64 item_size, u64 required_capacity) {
+	if (a->capacity >= required_capacity) return;
+
+	if (!a->allocator.proc) a->allocator = get_heap_allocator();
+
+	u64 new_capacity = max(get_next_power_of_two(required_capacity), 8);
+	if (a->data) {
+		// Heap allocator grows in place when there's free space right after the array
+		a->data = reallocate(a->allocator, a->data, a->capacity*item_size, new_capacity*item_size);
+	} else {
+		a->data = alloc(a->allocator, new_capacity*item_size);
+	}
+	a->capacity = new_capacity;
+}
+
+void
+_array_resize(Array_Raw *a, u64 item_size, u64 new_count) {
+	_array_grow(a, item_size, new_count);
+	if (new_count > a->count) {
+		memset((u8*)a->data + a->count*item_size, 0, (new_count-a->count)*item_size);
+	}
+	a->count = new_count;
+}
+
+void
+_array_insert(Array_Raw *a, u64 item_size, u64 index, const void *items, u64 item_count) {
+	assert(index <= a->count, "Array insert index %llu out of range (count is %llu)", index, a->count);
+	if (item_count == 0) return;
+
+	// Items might be in the array itself, which moves when we grow or shift
+	void *copy = 0;
+	if (a->data && (u8*)items < (u8*)a->data + a->count*item_size && (u8*)items + item_count*item_size > (u8*)a->data) {
+		copy = alloc(get_heap_allocator(), item_count*item_size);
+		memcpy(copy, items, item_count*item_size);
+		items = copy;
+	}
+
+	_array_grow(a, item_size, a->count+item_count);
+
+	u8 *data = (u8*)a->data;
+	if (index < a->count) {
+		memmove(data + (index+item_count)*item_size, data + index*item_size, (a->count-index)*item_size);
+	}
+	memcpy(data + index*item_size, items, item_count*item_size);
+	
+	if (copy) dealloc(get_heap_allocator(), copy);
+	
+	a->count += item_count;
+}
+
+void
+_array_ordered_remove_range(Array_Raw *a, u64 item_size, u64 index, u64 item_count) {
+	assert(index+item_count <= a->count, "Array remove range %llu..%llu out of range (count is %llu)", index, index+item_count, a->count);
+
+	u8 *data = (u8*)a->data;
+	memmove(data + index*item_size, data + (index+item_count)*item_size, (a->count-index-item_count)*item_size);
+	a->count -= item_count;
+}
+
+// Items are any type of that size, so they're loaded with memcpy to not break strict aliasing
+#define _ARRAY_DEFINE_LOAD(T) \
+	inline T \
+	_array_load_##T(const void *p) { \
+		T x; \
+		memcpy(&x, p, sizeof(T)); \
+		return x; \
+	}
+_ARRAY_DEFINE_LOAD(u8)
+_ARRAY_DEFINE_LOAD(u16)
+_ARRAY_DEFINE_LOAD(u32)
+_ARRAY_DEFINE_LOAD(u64)
+
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+// SSE2 has no 64 bit compare, both 32 bit halves need to match
+inline __m128i
+_array_cmpeq_epi64(__m128i a, __m128i b) {
+	__m128i c = _mm_cmpeq_epi32(a, b);
+	return _mm_and_si128(c, _mm_shuffle_epi32(c, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+// Compares 64 bytes at a time. We only need to know if anything matched which is just an OR
+// of the four compares, and then we look closer.
+#define _ARRAY_DEFINE_FIND_SSE2(T, set1, cmpeq) \
+	s64 \
+	_array_find_##T(T *data, u64 count, T value) { \
+		const u64 per_vector = 16/sizeof(T); \
+		__m128i v = set1(value); \
+		u64 i = 0; \
+		for (; i+per_vector*4 <= count; i += per_vector*4) { \
+			__m128i c0 = cmpeq(_mm_loadu_si128((__m128i*)(data+i)), v); \
+			__m128i c1 = cmpeq(_mm_loadu_si128((__m128i*)(data+i+per_vector)), v); \
+			__m128i c2 = cmpeq(_mm_loadu_si128((__m128i*)(data+i+per_vector*2)), v); \
+			__m128i c3 = cmpeq(_mm_loadu_si128((__m128i*)(data+i+per_vector*3)), v); \
+			__m128i any = _mm_or_si128(_mm_or_si128(c0, c1), _mm_or_si128(c2, c3)); \
+			if (_mm_movemask_epi8(any)) { \
+				u64 mask = (u64)(u16)_mm_movemask_epi8(c0) \
+				         | ((u64)(u16)_mm_movemask_epi8(c1) << 16) \
+				         | ((u64)(u16)_mm_movemask_epi8(c2) << 32) \
+				         | ((u64)(u16)_mm_movemask_epi8(c3) << 48); \
+				return i + bit_scan_forward_64(mask)/sizeof(T); \
+			} \
+		} \
+		for (; i+per_vector <= count; i += per_vector) { \
+			u64 mask = (u64)(u16)_mm_movemask_epi8(cmpeq(_mm_loadu_si128((__m128i*)(data+i)), v)); \
+			if (mask) return i + bit_scan_forward_64(mask)/sizeof(T); \
+		} \
+		for (; i < count; i++) { \
+			if (_array_load_##T(data+i) == value) return i; \
+		} \
+		return -1; \
+	}
+
+_ARRAY_DEFINE_FIND_SSE2(u8,  _mm_set1_epi8,   _mm_cmpeq_epi8)
+_ARRAY_DEFINE_FIND_SSE2(u16, _mm_set1_epi16,  _mm_cmpeq_epi16)
+_ARRAY_DEFINE_FIND_SSE2(u32, _mm_set1_epi32,  _mm_cmpeq_epi32)
+_ARRAY_DEFINE_FIND_SSE2(u64, _mm_set1_epi64x, _array_cmpeq_epi64)
+
+#else
+
+#define _ARRAY_DEFINE_FIND_BASIC(T) \
+	s64 \
+	_array_find_##T(T *data, u64 count, T value) { \
+		for (u64 i = 0; i < count; i++) { \
+			if (_array_load_##T(data+i) == value) return i; \
+		} \
+		return -1; \
+	}
+
+_ARRAY_DEFINE_FIND_BASIC(u8)
+_ARRAY_DEFINE_FIND_BASIC(u16)
+_ARRAY_DEFINE_FIND_BASIC(u32)
+_ARRAY_DEFINE_FIND_BASIC(u64)
+
+#endif // ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+// Returns index of first item which is bitwise equal to *item, or -1.
+// Note that's not the same as == for floats (-0.0 vs 0.0, NaN).
+s64
+_array_find(const void *data, u64 count, u64 item_size, const void *item) {
+	switch (item_size) {
+		case 1: return _array_find_u8 ((u8*) data, count, _array_load_u8 (item));
+		case 2: return _array_find_u16((u16*)data, count, _array_load_u16(item));
+		case 4: return _array_find_u32((u32*)data, count, _array_load_u32(item));
+		case 8: return _array_find_u64((u64*)data, count, _array_load_u64(item));
+		default: {
+			for (u64 i = 0; i < count; i++) {
+				if (bytes_match((u8*)data + i*item_size, (void*)item, item_size)) return i;
+			}
+			return -1;
+		}
+	}
+}
+
+define_array(u8);
+define_array(u16);
+define_array(u32);
+define_array(u64);
+define_array(s8);
+define_array(s16);
+define_array(s32);
+define_array(s64);
+define_array(float32);
+define_array(float64);
+define_array(f32);
+define_array(f64);
+define_array(string);
@@ -5,6 +5,7 @@
 		
 	bool audio_open_source_stream(Audio_Source *src, string path, Allocator allocator);
 	bool audio_open_source_load(Audio_Source *src, string path, Allocator allocator);
+	bool audio_open_source_load_adpcm(Audio_Source *src, string path, Allocator allocator); // 4:1 compressed in memory
 	void audio_source_destroy(Audio_Source *src);
 
 		Playing audio (the simple way):
@@ -14,12 +15,19 @@
 	void play_one_audio_clip_source_config(Audio_Source source, Audio_Playback_Config config);
 	void play_one_audio_clip_config(string path, Audio_Playback_Config config);
 	
+		Clips played by path are cached (short ones decoded to memory, shared between players):
+		
+	audio_clip_cache_budget_bytes = ...; // Unused clips are evicted LRU over this (64mb by default)
+	audio_clip_cache_stats               // Hits, misses, evictions, bytes
+	void audio_clip_cache_trim(u64 budget_bytes);
+	
 		Playing audio (with players):
 	
 	Audio_Player * audio_player_get_one();
 	void           audio_player_release(Audio_Player *p);
 
-		BEWARE! Most of these operations are potentially slow because they may need to synchronize with audio thread.
+		These never wait for the audio thread. Setters are queued and applied at the start of the
+		next mix, so getters might lag behind by one mix (a few milliseconds).
 		
 	void    audio_player_set_state(Audio_Player *p, Audio_Player_State state);
 	void    audio_player_set_time_stamp(Audio_Player *p, float64 time_in_seconds);
@@ -37,6 +45,42 @@
 	player->config.position_ndc          = v3(...);
 	player->config.volume                = ...; // (1.0 by default)
 	player->config.playback_speed        = ...; // (1.0 by default)
+	player->config.category              = AUDIO_VOICE_CATEGORY_xxx; // (SFX by default)
+	player->config.priority              = ...; // (1.0 by default)
+	player->config.bus                   = ...; // (bus for the category by default)
+	
+		Buses & DSP (players mix into buses, buses mix into their parent, up to the master bus):
+		
+	audio_master_bus, audio_music_bus, audio_sfx_bus, audio_ui_bus
+	Audio_Bus *audio_bus_make(Audio_Bus *parent);
+	Audio_Dsp *audio_bus_add_dsp(Audio_Bus *bus, Audio_Dsp dsp);
+	Audio_Dsp  audio_dsp_make_gain(float32 gain);
+	Audio_Dsp  audio_dsp_make_biquad(Audio_Biquad_Kind kind, float32 cutoff_hz, float32 q);
+	Audio_Dsp  audio_dsp_make_compressor(float32 threshold_db, float32 ratio, float32 attack_ms, float32 release_ms);
+	Audio_Dsp  audio_dsp_make_limiter(float32 ceiling_db);
+	Audio_Dsp  audio_dsp_make_reverb(float32 room_size, float32 damping, float32 wet);
+	Audio_Dsp  audio_dsp_make_user(Audio_Dsp_Proc proc, void *data);
+	bus->gain = ...; bus->muted = ...;
+	
+		Voice management (only the most important voices are actually mixed):
+		
+	audio_voice_limits.max_voices = ...;
+	audio_voice_limits.max_voices_per_category[AUDIO_VOICE_CATEGORY_xxx] = ...;
+	audio_voice_limits.min_audibility = ...;
+	player->is_virtual // Playing but not mixed
+	audio_voice_stats  // Voice counts from the last mix
+	
+		Output without an audio device (headless, CI, benchmarks, rendering to file):
+		
+	bool audio_output_start_null(Audio_Null_Output_Config config);
+	void audio_output_stop_null();
+	bool audio_render_offline(void *output, u64 number_of_frames, Audio_Format format);
+	bool audio_write_wav_file(string path, void *frames, u64 number_of_frames, Audio_Format format);
+	
+		Timing (mix time min/avg/p99, period jitter, underruns, voices, per-voice cost, lock waits):
+		
+	Audio_Timing_Stats audio_get_timing_stats();
+	void               audio_reset_timing_stats();
 	
 */
 
@@ -90,6 +134,7 @@ typedef enum Audio_Decoder_Kind {
 typedef enum Audio_Source_Kind {
 	AUDIO_SOURCE_FILE_STREAM,
 	AUDIO_SOURCE_MEMORY, // Raw pcm frames
+	AUDIO_SOURCE_ADPCM,  // IMA ADPCM blocks in memory, see audio_open_source_load_adpcm()
 } Audio_Source_Kind;
 
 typedef struct {
@@ -137,22 +182,58 @@ typedef struct Audio_Source {
 		stb_vorbis *ogg;
 	};
 	
-	// #Memory #Incomplete #StbVorbisFileStream
+	// #StbVorbisFileStream
 	// I tried replacing the stdio stuff in stb_vorbis with oogabooga file api, but now
 	// stb_vorbis is shitting itself.
-	// So, for now, we're just reading the file into memory and then streaming from that
-	// memory.
-	// Luckily, ogg compression is pretty good so it's not going to completely butcher
-	// memory usage, but it's definitely suboptimal.
-	string ogg_raw;
+	// So instead we map the file into memory and let stb_vorbis read from the mapping.
+	// The OS only pages in what's actually decoded, so a long song doesn't cost its full
+	// file size up front. Each player decodes with its own Audio_Source_Cursor on top of
+	// this, the ogg decoder here is just for opening and one-off reads.
+	string ogg_raw; // Mapped with os_file_map(), read only
 	
 	// For memory source
 	void *pcm_frames;
 	
-	Mutex mutex_for_destroy; // This should ONLY be used so a source isnt sampled on audio thread while it's being destroyed
+	// For ADPCM source
+	u8 *adpcm_blocks;
+	u64 adpcm_block_count;
 	
 } Audio_Source;
 
+// How many frames we decode past what was asked for, so the next callback can be served
+// from memory and rounding in the sample rate ratio never forces a seek.
+#define AUDIO_DECODE_AHEAD_FRAMES 2048
+// If playback jumps forward by less than this, we decode and throw away frames rather than seeking.
+// Vorbis seeking is a page bisection followed by a pre-roll decode so it's not cheap.
+#define AUDIO_CURSOR_MAX_SKIP_FRAMES 8192
+
+// Per-player decoding state for streamed sources.
+// Players sharing one Audio_Source would otherwise fight over the same decoder and seek back
+// and forth on every callback. With a cursor each player decodes sequentially and only seeks
+// when playback actually jumps (looping, set_time_stamp, etc).
+typedef struct Audio_Source_Cursor {
+	u64 source_uid;
+	Allocator allocator;
+	stb_vorbis *ogg;
+
+	// Decoded-ahead frames in the decoders native channels & sample rate, but with the bit
+	// width of the source format.
+	// The decoder is always positioned at cache_first_frame+cache_frame_count.
+	void *cache;
+	u64 cache_capacity; // In frames
+	u64 cache_first_frame;
+	u64 cache_frame_count;
+
+	u64 number_of_seeks; // For debugging/profiling
+	
+	// For ADPCM sources, the last decoded block as s16
+	s16 *adpcm_block;
+	u64 adpcm_block_index;
+	
+	// For when the audio thread hands it back to be freed, see audio_released_cursors
+	struct Audio_Source_Cursor *next_released;
+} Audio_Source_Cursor;
+
 int 
 convert_frames(void *dst, Audio_Format dst_format, 
                void *src, Audio_Format src_format, u64 src_frame_count);
@@ -554,8 +635,6 @@ audio_open_source_stream_format(Audio_Source *src, string path, Audio_Format for
 	src->uid = next_audio_source_uid;
 	next_audio_source_uid += 1;
 	
-	mutex_init(&src->mutex_for_destroy);
-	
 	src->allocator = allocator;
 	src->kind = AUDIO_SOURCE_FILE_STREAM;
 	
@@ -577,7 +656,7 @@ audio_open_source_stream_format(Audio_Source *src, string path, Audio_Format for
 	} else if (check_ogg_header(header)) {
 		src->decoder = AUDIO_DECODER_OGG;
 		
-		ok = os_read_entire_file(path, &src->ogg_raw, src->allocator);
+		ok = os_file_map(path, &src->ogg_raw);
 		if (!ok) return false;
 		
 		third_party_allocator = src->allocator;
@@ -585,7 +664,10 @@ audio_open_source_stream_format(Audio_Source *src, string path, Audio_Format for
 		src->ogg = stb_vorbis_open_memory(src->ogg_raw.data, src->ogg_raw.count, &err, 0);
 		third_party_allocator = ZERO(Allocator);
 		
-		if (err != 0 || src->ogg == 0) return false;
+		if (err != 0 || src->ogg == 0) {
+			os_file_unmap(src->ogg_raw);
+			return false;
+		}
 		
 		third_party_allocator = src->allocator;
 		src->number_of_frames = stb_vorbis_stream_length_in_samples(src->ogg);
@@ -612,8 +694,6 @@ audio_open_source_load_format(Audio_Source *src, string path, Audio_Format forma
 	src->uid = next_audio_source_uid;
 	next_audio_source_uid += 1;
 	
-	mutex_init(&src->mutex_for_destroy);
-	
 	src->allocator = allocator;
 	src->kind = AUDIO_SOURCE_MEMORY;
 	src->format = format;
@@ -636,7 +716,7 @@ audio_open_source_load_format(Audio_Source *src, string path, Audio_Format forma
 	} else if (check_ogg_header(header)) {
 		src->decoder = AUDIO_DECODER_OGG;
 		
-		ok = os_read_entire_file(path, &src->ogg_raw, src->allocator);
+		ok = os_file_map(path, &src->ogg_raw);
 		if (!ok) return false;
 		
 		third_party_allocator = src->allocator;
@@ -644,7 +724,10 @@ audio_open_source_load_format(Audio_Source *src, string path, Audio_Format forma
 		src->ogg = stb_vorbis_open_memory(src->ogg_raw.data, src->ogg_raw.count, &err, 0);
 		third_party_allocator = ZERO(Allocator);
 		
-		if (err != 0 || src->ogg == 0) return false;
+		if (err != 0 || src->ogg == 0) {
+			os_file_unmap(src->ogg_raw);
+			return false;
+		}
 		
 		third_party_allocator = src->allocator;
 		src->number_of_frames = stb_vorbis_stream_length_in_samples(src->ogg);
@@ -663,6 +746,9 @@ audio_open_source_load_format(Audio_Source *src, string path, Audio_Format forma
 		stb_vorbis_close(src->ogg);
 		third_party_allocator = ZERO(Allocator);
 		
+		os_file_unmap(src->ogg_raw);
+		src->ogg_raw = ZERO(string);
+		
 		if (retrieved != src->number_of_frames) {
 			dealloc(src->allocator, src->pcm_frames);
 			return false;
@@ -682,11 +768,246 @@ audio_open_source_load(Audio_Source *src, string path, Allocator allocator) {
 	return audio_open_source_load_format(src, path, format, allocator);
 }
 
-void 
-audio_source_destroy(Audio_Source *src) {
+#define U8_MAX  255
+#define S16_MIN -32768
+#define S16_MAX 32767
+#define S24_MIN -8388608
+#define S24_MAX 8388607
+#define S32_MIN -2147483648
+#define S32_MAX 2147483647
+
+///
+// ADPCM sources
+// IMA ADPCM kept in memory and decoded on the fly, 4 bits per sample. That's 4x smaller than
+// s16 and 8x smaller than f32 pcm_frames, for long ambience & music that needs to be in memory
+// without paying for a full decode. The quality loss is audible on very clean signals, so
+// keep short or sensitive sounds as normal memory sources.
+//
+// Blocks are independent so seeking is free. Each block is, per channel:
+//     s16 predictor, u8 step index, u8 unused
+// followed by, per channel, AUDIO_ADPCM_BLOCK_FRAMES 4-bit codes (low nibble first).
+
+#define AUDIO_ADPCM_BLOCK_FRAMES 1024
+#define AUDIO_ADPCM_CHANNEL_HEADER_SIZE 4
+#define AUDIO_ADPCM_MAX_CHANNELS 8
+
+const s16 ima_adpcm_step_table[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66,
+	73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408,
+	449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630,
+	9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+const s8 ima_adpcm_index_table[16] = {
+	-1, -1, -1, -1, 2, 4, 6, 8,
+	-1, -1, -1, -1, 2, 4, 6, 8
+};
+
+u64
+audio_adpcm_block_size(int channels) {
+	return channels*(AUDIO_ADPCM_CHANNEL_HEADER_SIZE + AUDIO_ADPCM_BLOCK_FRAMES/2);
+}
+
+inline s32
+ima_adpcm_decode_nibble(u8 nibble, s32 *predictor, s32 *step_index) {
+	s32 step = ima_adpcm_step_table[*step_index];
+	
+	s32 diff = step >> 3;
+	if (nibble & 4) diff += step;
+	if (nibble & 2) diff += step >> 1;
+	if (nibble & 1) diff += step >> 2;
+	
+	s32 p = (nibble & 8) ? *predictor - diff : *predictor + diff;
+	*predictor = clamp(p, S16_MIN, S16_MAX);
+	*step_index = clamp(*step_index + ima_adpcm_index_table[nibble], 0, 88);
+	
+	return *predictor;
+}
+
+inline u8
+ima_adpcm_encode_sample(s16 sample, s32 *predictor, s32 *step_index) {
+	s32 step = ima_adpcm_step_table[*step_index];
+	s32 diff = (s32)sample - *predictor;
+	
+	u8 nibble = 0;
+	if (diff < 0) {
+		nibble = 8;
+		diff = -diff;
+	}
+	if (diff >= step) { nibble |= 4; diff -= step; }
+	step >>= 1;
+	if (diff >= step) { nibble |= 2; diff -= step; }
+	step >>= 1;
+	if (diff >= step) { nibble |= 1; }
+	
+	// Step the predictor exactly like the decoder will
+	ima_adpcm_decode_nibble(nibble, predictor, step_index);
+	
+	return nibble;
+}
+
+// Encodes interleaved s16 frames into ADPCM blocks, the last block is padded with silence.
+void
+audio_adpcm_encode(u8 *blocks, s16 *frames, u64 number_of_frames, int channels) {
+	u64 block_size = audio_adpcm_block_size(channels);
+	u64 block_count = (number_of_frames+AUDIO_ADPCM_BLOCK_FRAMES-1)/AUDIO_ADPCM_BLOCK_FRAMES;
+	
+	s32 predictors[AUDIO_ADPCM_MAX_CHANNELS] = {0};
+	s32 step_indices[AUDIO_ADPCM_MAX_CHANNELS] = {0};
+	
+	for (u64 b = 0; b < block_count; b++) {
+		u8 *block = blocks + b*block_size;
+		u64 first_frame = b*AUDIO_ADPCM_BLOCK_FRAMES;
+		
+		for (int c = 0; c < channels; c++) {
+			u8 *header = block + c*AUDIO_ADPCM_CHANNEL_HEADER_SIZE;
+			*(s16*)header = (s16)predictors[c];
+			header[2] = (u8)step_indices[c];
+			header[3] = 0;
+			
+			u8 *codes = block + channels*AUDIO_ADPCM_CHANNEL_HEADER_SIZE + c*(AUDIO_ADPCM_BLOCK_FRAMES/2);
+			for (u64 i = 0; i < AUDIO_ADPCM_BLOCK_FRAMES; i += 2) {
+				s16 a = first_frame+i   < number_of_frames ? frames[(first_frame+i)*channels+c]   : 0;
+				s16 b = first_frame+i+1 < number_of_frames ? frames[(first_frame+i+1)*channels+c] : 0;
+				u8 low  = ima_adpcm_encode_sample(a, &predictors[c], &step_indices[c]);
+				u8 high = ima_adpcm_encode_sample(b, &predictors[c], &step_indices[c]);
+				codes[i/2] = low | (high << 4);
+			}
+		}
+	}
+}
+
+// Decodes one whole block into interleaved s16 frames
+void
+audio_adpcm_decode_block(s16 *dst, u8 *block, int channels) {
+	for (int c = 0; c < channels; c++) {
+		u8 *header = block + c*AUDIO_ADPCM_CHANNEL_HEADER_SIZE;
+		s32 predictor = *(s16*)header;
+		s32 step_index = clamp(header[2], 0, 88);
+		
+		u8 *codes = block + channels*AUDIO_ADPCM_CHANNEL_HEADER_SIZE + c*(AUDIO_ADPCM_BLOCK_FRAMES/2);
+		s16 *out = dst + c;
+		
+		// The predictor makes this serial, so no simd here. It's a handful of instructions per
+		// sample either way, the conversion after is the bigger cost with f32 output.
+		for (u64 i = 0; i < AUDIO_ADPCM_BLOCK_FRAMES/2; i++) {
+			u8 code = codes[i];
+			out[(i*2+0)*channels] = (s16)ima_adpcm_decode_nibble(code & 0xF, &predictor, &step_index);
+			out[(i*2+1)*channels] = (s16)ima_adpcm_decode_nibble(code >> 4,  &predictor, &step_index);
+		}
+	}
+}
+
+void
+audio_convert_s16_to_f32(f32 *dst, s16 *src, u64 number_of_samples) {
+	simd_convert_s16_to_float32_array(dst, src, number_of_samples);
+}
+
+void audio_source_free_now(Audio_Source *src);
+
+bool
+audio_open_source_load_adpcm_format(Audio_Source *src, string path, Audio_Format format, 
+                                    Allocator allocator) {
+	assert(format.channels <= AUDIO_ADPCM_MAX_CHANNELS, "Too many channels for ADPCM source (max %d)", AUDIO_ADPCM_MAX_CHANNELS);
+	
+	Audio_Source pcm;
+	Audio_Format pcm_format = (Audio_Format){AUDIO_BITS_16, format.channels, format.sample_rate};
+	bool ok = audio_open_source_load_format(&pcm, path, pcm_format, get_heap_allocator());
+	if (!ok) return false;
+	
+	*src = ZERO(Audio_Source);
+	src->uid = next_audio_source_uid;
+	next_audio_source_uid += 1;
+	
+	src->allocator = allocator;
+	src->kind = AUDIO_SOURCE_ADPCM;
+	src->format = format;
+	src->number_of_frames = pcm.number_of_frames;
+	
+	src->adpcm_block_count = (pcm.number_of_frames+AUDIO_ADPCM_BLOCK_FRAMES-1)/AUDIO_ADPCM_BLOCK_FRAMES;
+	src->adpcm_blocks = alloc(allocator, src->adpcm_block_count*audio_adpcm_block_size(format.channels));
+	
+	audio_adpcm_encode(src->adpcm_blocks, (s16*)pcm.pcm_frames, pcm.number_of_frames, format.channels);
+	
+	audio_source_free_now(&pcm);
+	
+	return true;
+}
+// Loads the whole file and keeps it compressed in memory, see AUDIO_SOURCE_ADPCM
+bool
+audio_open_source_load_adpcm(Audio_Source *src, string path, Allocator allocator) {
+	mutex_acquire_or_wait(&audio_init_mutex);
+	Audio_Format format = audio_output_format;
+	mutex_release(&audio_init_mutex);
+	return audio_open_source_load_adpcm_format(src, path, format, allocator);
+}
 
-	mutex_acquire_or_wait(&src->mutex_for_destroy);
+// Cursor may be 0, but then every call has to decode its first block again
+u64 // Number of frames retrieved
+audio_adpcm_get_frames(Audio_Source *src, Audio_Source_Cursor *cursor, 
+                       u64 first_frame_index, u64 number_of_frames, void *output_buffer) {
+	
+	thread_local local_persist s16 *scratch = 0;
+	thread_local local_persist u64 scratch_channels = 0;
+	
+	s16 *block_frames;
+	u64 *decoded_block_index;
+	u64 no_cursor_index = UINT64_MAX;
+	if (cursor) {
+		block_frames = cursor->adpcm_block;
+		decoded_block_index = &cursor->adpcm_block_index;
+	} else {
+		if (!scratch || scratch_channels < src->format.channels) {
+			if (scratch) dealloc(get_heap_allocator(), scratch);
+			scratch = alloc(get_heap_allocator(), AUDIO_ADPCM_BLOCK_FRAMES*src->format.channels*sizeof(s16));
+			scratch_channels = src->format.channels;
+		}
+		block_frames = scratch;
+		decoded_block_index = &no_cursor_index;
+	}
+	
+	int channels = src->format.channels;
+	u64 comp_size = get_audio_bit_width_byte_size(src->format.bit_width);
+	u64 frame_size = channels*comp_size;
+	u64 block_size = audio_adpcm_block_size(channels);
+	
+	number_of_frames = min(number_of_frames, src->number_of_frames-min(first_frame_index, src->number_of_frames));
+	
+	u64 done = 0;
+	while (done < number_of_frames) {
+		u64 frame = first_frame_index+done;
+		u64 block_index = frame / AUDIO_ADPCM_BLOCK_FRAMES;
+		u64 offset = frame % AUDIO_ADPCM_BLOCK_FRAMES;
+		u64 count = min(AUDIO_ADPCM_BLOCK_FRAMES-offset, number_of_frames-done);
+		
+		void *dst = (u8*)output_buffer + done*frame_size;
+		
+		if (offset == 0 && count == AUDIO_ADPCM_BLOCK_FRAMES && src->format.bit_width == AUDIO_BITS_16) {
+			// Whole block, straight to the output
+			audio_adpcm_decode_block((s16*)dst, src->adpcm_blocks + block_index*block_size, channels);
+		} else {
+			if (*decoded_block_index != block_index) {
+				audio_adpcm_decode_block(block_frames, src->adpcm_blocks + block_index*block_size, channels);
+				*decoded_block_index = block_index;
+			}
+			s16 *first = block_frames + offset*channels;
+			switch (src->format.bit_width) {
+				case AUDIO_BITS_16: memcpy(dst, first, count*channels*sizeof(s16)); break;
+				case AUDIO_BITS_32: audio_convert_s16_to_f32((f32*)dst, first, count*channels); break;
+				default: panic("Invalid bits value");
+			}
+		}
+		
+		done += count;
+	}
+	
+	return done;
+}
 
+// Frees what the source holds right away.
+// Only safe once the audio thread can't be sampling it, see audio_source_destroy().
+void
+audio_source_free_now(Audio_Source *src) {
 	switch (src->kind) {
 		case AUDIO_SOURCE_FILE_STREAM: {
 			third_party_allocator = src->allocator;
@@ -697,7 +1018,7 @@ audio_source_destroy(Audio_Source *src) {
 				}
 				case AUDIO_DECODER_OGG: {
 					stb_vorbis_close(src->ogg);
-					dealloc_string(src->allocator, src->ogg_raw);
+					os_file_unmap(src->ogg_raw);
 					break;
 				}
 			}
@@ -708,11 +1029,16 @@ audio_source_destroy(Audio_Source *src) {
 			dealloc(src->allocator, src->pcm_frames);
 			break;
 		}
+		case AUDIO_SOURCE_ADPCM: {
+			dealloc(src->allocator, src->adpcm_blocks);
+			break;
+		}
 	}
-	
-	mutex_release(&src->mutex_for_destroy);
 }
 
+// Implemented further down with the player commands
+void audio_source_destroy(Audio_Source *src);
+
 int
 audio_source_get_frames(Audio_Source *src, u64 first_frame_index, 
 					    u64 number_of_frames, void *output_buffer) {
@@ -815,9 +1141,209 @@ audio_source_get_frames(Audio_Source *src, u64 first_frame_index,
 	return retrieved;
 }
 
+void
+audio_source_cursor_destroy(Audio_Source_Cursor *c) {
+	if (c->ogg) {
+		third_party_allocator = c->allocator;
+		stb_vorbis_close(c->ogg);
+		third_party_allocator = ZERO(Allocator);
+	}
+	if (c->cache) dealloc(get_heap_allocator(), c->cache);
+	if (c->adpcm_block) dealloc(get_heap_allocator(), c->adpcm_block);
+	
+	*c = ZERO(Audio_Source_Cursor);
+}
+
+// Makes sure the cursor has its own decoder for src.
+// Returns false if the source doesn't need one (only ogg streams & ADPCM do), in which case
+// audio_source_get_frames() should be used directly.
+bool
+audio_source_cursor_prepare(Audio_Source_Cursor *c, Audio_Source *src) {
+	if ((c->ogg || c->adpcm_block) && c->source_uid == src->uid) return true;
+	
+	audio_source_cursor_destroy(c);
+	
+	if (src->kind == AUDIO_SOURCE_ADPCM) {
+		c->adpcm_block = alloc(get_heap_allocator(), AUDIO_ADPCM_BLOCK_FRAMES*src->format.channels*sizeof(s16));
+		c->adpcm_block_index = UINT64_MAX;
+		c->source_uid = src->uid;
+		c->allocator = src->allocator;
+		return true;
+	}
+	
+	if (src->kind != AUDIO_SOURCE_FILE_STREAM || src->decoder != AUDIO_DECODER_OGG) return false;
+	
+	third_party_allocator = src->allocator;
+	int err = 0;
+	c->ogg = stb_vorbis_open_memory(src->ogg_raw.data, src->ogg_raw.count, &err, 0);
+	third_party_allocator = ZERO(Allocator);
+	
+	if (err != 0 || c->ogg == 0) {
+		c->ogg = 0;
+		return false;
+	}
+	
+	c->source_uid = src->uid;
+	c->allocator = src->allocator;
+	
+	return true;
+}
+
+u64 // Number of frames decoded, 0 at end of stream
+audio_source_cursor_decode(Audio_Source_Cursor *c, Audio_Format_Bits bits, 
+                           void *dst, u64 number_of_frames) {
+	int decoded = 0;
+	
+	third_party_allocator = c->allocator;
+	switch (bits) {
+	case AUDIO_BITS_32: {
+		decoded = stb_vorbis_get_samples_float_interleaved(
+			c->ogg, 
+			c->ogg->channels, 
+			(f32*)dst, 
+			number_of_frames * c->ogg->channels
+		);
+		break;
+	}
+	case AUDIO_BITS_16: {
+		decoded = stb_vorbis_get_samples_short_interleaved(
+			c->ogg, 
+			c->ogg->channels, 
+			(s16*)dst, 
+			number_of_frames * c->ogg->channels
+		); 
+		break;
+	}
+	default: panic("Invalid bits value");
+	}
+	third_party_allocator = ZERO(Allocator);
+	
+	return (u64)decoded;
+}
+
+// Lines up the cache so it starts at first_frame (in the decoders native sample rate) and
+// decodes until it holds number_of_frames+AUDIO_DECODE_AHEAD_FRAMES.
+// Only seeks if first_frame is behind the cache or too far ahead of it.
+u64 // Number of frames available at the start of the cache, less than number_of_frames at end of stream
+audio_source_cursor_fill(Audio_Source_Cursor *c, Audio_Format_Bits bits, 
+                         u64 first_frame, u64 number_of_frames) {
+	u64 frame_size = c->ogg->channels*get_audio_bit_width_byte_size(bits);
+	
+	u64 wanted_frames = number_of_frames + AUDIO_DECODE_AHEAD_FRAMES;
+	if (!c->cache || c->cache_capacity < wanted_frames) {
+		u64 new_capacity = get_next_power_of_two(wanted_frames);
+		void *new_cache = alloc(get_heap_allocator(), new_capacity*frame_size);
+		if (c->cache) {
+			memcpy(new_cache, c->cache, c->cache_frame_count*frame_size);
+			dealloc(get_heap_allocator(), c->cache);
+		}
+		c->cache = new_cache;
+		c->cache_capacity = new_capacity;
+	}
+	
+	u64 cache_end = c->cache_first_frame + c->cache_frame_count;
+	
+	if (first_frame >= c->cache_first_frame && first_frame <= cache_end) {
+		// Contiguous playback, just drop what has already been consumed
+		u64 consumed = first_frame - c->cache_first_frame;
+		if (consumed > 0) {
+			c->cache_frame_count -= consumed;
+			memmove(c->cache, (u8*)c->cache + consumed*frame_size, c->cache_frame_count*frame_size);
+			c->cache_first_frame = first_frame;
+		}
+	} else if (first_frame > cache_end && first_frame-cache_end <= AUDIO_CURSOR_MAX_SKIP_FRAMES) {
+		// Small jump forward, decoding through it is cheaper than a seek
+		while (cache_end < first_frame) {
+			u64 to_skip = min(first_frame-cache_end, c->cache_capacity);
+			u64 decoded = audio_source_cursor_decode(c, bits, c->cache, to_skip);
+			if (decoded == 0) break;
+			cache_end += decoded;
+		}
+		c->cache_first_frame = cache_end;
+		c->cache_frame_count = 0;
+	} else {
+		third_party_allocator = c->allocator;
+		bool seek_ok = first_frame == 0 
+			? stb_vorbis_seek_start(c->ogg) 
+			: stb_vorbis_seek(c->ogg, first_frame);
+		third_party_allocator = ZERO(Allocator);
+		assert(seek_ok);
+		
+		c->cache_first_frame = first_frame;
+		c->cache_frame_count = 0;
+		c->number_of_seeks += 1;
+	}
+	
+	while (c->cache_frame_count < wanted_frames) {
+		u64 decoded = audio_source_cursor_decode(
+			c, 
+			bits, 
+			(u8*)c->cache + c->cache_frame_count*frame_size, 
+			wanted_frames-c->cache_frame_count
+		);
+		if (decoded == 0) break;
+		c->cache_frame_count += decoded;
+	}
+	
+	if (c->cache_first_frame != first_frame) return 0; // Skipped past end of stream
+	
+	return min(c->cache_frame_count, number_of_frames);
+}
+
+// Same as audio_source_get_frames(), but decodes sequentially with the cursor instead of
+// seeking on the sources shared decoder. Cursor may be 0.
+int
+audio_source_get_frames_with_cursor(Audio_Source *src, Audio_Source_Cursor *cursor, 
+                                    u64 first_frame_index, u64 number_of_frames, 
+                                    void *output_buffer) {
+	if (!cursor || !audio_source_cursor_prepare(cursor, src)) {
+		return audio_source_get_frames(src, first_frame_index, number_of_frames, output_buffer);
+	}
+	
+	stb_vorbis *ogg = cursor->ogg;
+	
+	u64 comp_size = get_audio_bit_width_byte_size(src->format.bit_width);
+	u64 frame_size = src->format.channels*comp_size;
+	
+	f64 ratio = (f64)ogg->sample_rate/(f64)src->format.sample_rate;
+	
+	bool need_convert = ogg->sample_rate != src->format.sample_rate 
+	                 || ogg->channels != src->format.channels;
+	
+	u64 native_first_frame = (u64)round(first_frame_index*ratio);
+	u64 native_number_of_frames = number_of_frames;
+	if (need_convert) native_number_of_frames = (u64)round(ratio * (f64)number_of_frames);
+	
+	u64 available = audio_source_cursor_fill(
+		cursor, 
+		src->format.bit_width, 
+		native_first_frame, 
+		native_number_of_frames
+	);
+	
+	if (!need_convert) {
+		memcpy(output_buffer, cursor->cache, available*frame_size);
+		return (int)available;
+	}
+	
+	u64 output_frames = number_of_frames;
+	if (available < native_number_of_frames) {
+		output_frames = (u64)((f64)available/ratio);
+	}
+	
+	return convert_frames(
+		output_buffer, 
+		src->format,
+		cursor->cache, 
+		(Audio_Format){src->format.bit_width, ogg->channels, ogg->sample_rate},
+		output_frames
+	);
+}
+
 u64 // New frame index 
-audio_source_sample_next_frames(Audio_Source *src, u64 first_frame_index, u64 number_of_frames, 
-						   void *output_buffer, bool looping) {
+audio_source_sample_next_frames_with_cursor(Audio_Source *src, Audio_Source_Cursor *cursor, 
+                                            u64 first_frame_index, u64 number_of_frames, 
+                                            void *output_buffer, bool looping) {
 	
 	u64 comp_size = get_audio_bit_width_byte_size(src->format.bit_width);
     u64 frame_size = comp_size * src->format.channels;
@@ -835,8 +1361,9 @@ audio_source_sample_next_frames(Audio_Source *src, u64 first_frame_index, u64 nu
 	switch (src->kind) {
 	case AUDIO_SOURCE_FILE_STREAM: {
 	
-		num_retrieved = audio_source_get_frames(
+		num_retrieved = audio_source_get_frames_with_cursor(
 			src, 
+			cursor,
 			first_frame_index, 
 			number_of_frames, 
 			output_buffer
@@ -848,13 +1375,14 @@ audio_source_sample_next_frames(Audio_Source *src, u64 first_frame_index, u64 nu
 		if (num_retrieved < number_of_frames) {
 			void *dst_remain = ((u8*)output_buffer) + num_retrieved*frame_size;
 			if (looping) {
-				num_retrieved = audio_source_get_frames(
+				num_retrieved = audio_source_get_frames_with_cursor(
 					src, 
+					cursor,
 					0, 
 					number_of_frames-num_retrieved, 
 					dst_remain
 				);
-				new_index = number_of_frames-num_retrieved;
+				new_index = num_retrieved;
 			} else {
 				memset(dst_remain, 0, frame_size * (number_of_frames - num_retrieved));
 			}	
@@ -883,47 +1411,45 @@ audio_source_sample_next_frames(Audio_Source *src, u64 first_frame_index, u64 nu
 		
 		break;
 	}
+	case AUDIO_SOURCE_ADPCM: {
+		if (cursor && !audio_source_cursor_prepare(cursor, src)) cursor = 0;
+		
+		u64 first_number_of_frames = audio_adpcm_get_frames(src, cursor, first_frame_index, number_of_frames, output_buffer);
+		new_index += first_number_of_frames;
+		
+		u64 remainder = number_of_frames-first_number_of_frames;
+		if (remainder > 0) {
+			void *dst_remain = (u8*)output_buffer + first_number_of_frames*frame_size;
+			
+			if (looping) {
+				audio_adpcm_get_frames(src, cursor, 0, remainder, dst_remain);
+				new_index = remainder;
+			} else {
+				memset(dst_remain, 0, frame_size*remainder);
+			}
+		}
+		
+		break;
+	}
 	}
 	
 	if (looping && new_index == src->number_of_frames) new_index = 0;
 	
 	return new_index;
 }
-
-#define U8_MAX  255
-#define S16_MIN -32768
-#define S16_MAX 32767
-#define S24_MIN -8388608
-#define S24_MAX 8388607
-#define S32_MIN -2147483648
-#define S32_MAX 2147483647
+u64 // New frame index 
+audio_source_sample_next_frames(Audio_Source *src, u64 first_frame_index, u64 number_of_frames, 
+						   void *output_buffer, bool looping) {
+	return audio_source_sample_next_frames_with_cursor(src, 0, first_frame_index, number_of_frames, output_buffer, looping);
+}
 
 void 
 mix_frames(void *dst, void *src, u64 frame_count, Audio_Format format) {
-    u64 comp_size = get_audio_bit_width_byte_size(format.bit_width);
-    u64 frame_size = comp_size * format.channels;
-    u64 output_size = frame_count * frame_size;
-    
-    for (u64 frame = 0; frame < frame_count; frame++) {
-        
-        for (u64 c = 0; c < format.channels; c++) {
-
-            void *src_sample = (u8*)src + frame*frame_size + c*comp_size;
-            void *dst_sample = (u8*)dst + frame*frame_size + c*comp_size;
-
-            switch (format.bit_width) {
-                case AUDIO_BITS_32: {
-                	*((f32*)dst_sample) += *((f32*)src_sample);
-            	}
-                case AUDIO_BITS_16: {
-                    s16 dst_int = *((s16*)dst_sample);
-                    s16 src_int = *((s16*)src_sample);
-                    *((s16*)dst_sample) = (s16)clamp((s64)(dst_int + src_int), S16_MIN, S16_MAX);
-                    break;
-                }
-            }
-        }
-    }
+	u64 number_of_samples = frame_count*format.channels;
+	switch (format.bit_width) {
+		case AUDIO_BITS_32: simd_add_float32_array((f32*)dst, (f32*)dst, (f32*)src, number_of_samples); break;
+		case AUDIO_BITS_16: simd_add_saturate_s16_array((s16*)dst, (s16*)dst, (s16*)src, number_of_samples); break;
+	}
 }
 
 void
@@ -1009,6 +1535,32 @@ resample_frames(void *dst, Audio_Format dst_format,
     
 }
 
+// Conversions which can be done on the whole buffer with the simd kernels.
+// False if it has to go frame by frame.
+bool
+convert_frames_simd(void *dst, Audio_Format dst_format, 
+                    void *src, Audio_Format src_format, u64 frame_count) {
+	u64 number_of_samples = frame_count*src_format.channels;
+	if (dst_format.channels == src_format.channels) {
+		if (dst_format.bit_width == AUDIO_BITS_32 && src_format.bit_width == AUDIO_BITS_16) {
+			simd_convert_s16_to_float32_array((f32*)dst, (s16*)src, number_of_samples);
+			return true;
+		}
+		if (dst_format.bit_width == AUDIO_BITS_16 && src_format.bit_width == AUDIO_BITS_32) {
+			simd_convert_float32_to_s16_array((s16*)dst, (f32*)src, number_of_samples);
+			return true;
+		}
+		return false;
+	}
+	// Mono to stereo is the same sample on both channels
+	if (src_format.channels == 1 && dst_format.channels == 2 
+	 && src_format.bit_width == AUDIO_BITS_32 && dst_format.bit_width == AUDIO_BITS_32) {
+		simd_interleave_float32_array((f32*)dst, (f32*)src, (f32*)src, frame_count);
+		return true;
+	}
+	return false;
+}
+
 // Assumes dst buffer is large enough
 int // Returns outputted number of frames
 convert_frames(void *dst, Audio_Format dst_format, 
@@ -1034,8 +1586,7 @@ convert_frames(void *dst, Audio_Format dst_format,
 	bool need_sample_conversion 
 		= dst_format.channels != src_format.channels 
 	   || dst_format.bit_width != src_format.bit_width;
-	// #Speed #Simd
-	if (need_sample_conversion) {
+	if (need_sample_conversion && !convert_frames_simd(dst, dst_format, src, src_format, src_frame_count)) {
 		for (u64 src_frame_index = 0; src_frame_index < src_frame_count; src_frame_index++) {
 	        void *src_frame = ((u8*)src) + src_frame_index*src_frame_size;
 	        void *dst_frame = ((u8*)dst) + src_frame_index*dst_frame_size;
@@ -1145,32 +1696,139 @@ typedef enum Audio_Player_State {
 	AUDIO_PLAYER_STATE_PLAYING
 } Audio_Player_State;
 
+// Voice limits can be set per category, see Audio_Voice_Limits
+typedef enum Audio_Voice_Category {
+	AUDIO_VOICE_CATEGORY_SFX, // Default
+	AUDIO_VOICE_CATEGORY_MUSIC,
+	AUDIO_VOICE_CATEGORY_UI,
+	
+	AUDIO_VOICE_CATEGORY_COUNT
+} Audio_Voice_Category;
+
+typedef struct Audio_Bus Audio_Bus;
+typedef struct Audio_Clip Audio_Clip;
+
 typedef struct Audio_Playback_Config {
 	Vector3 position_ndc;
 	bool enable_spacialization;
 	float32 volume;
 	float32 playback_speed;
+	Audio_Voice_Category category;
+	float32 priority; // Scales audibility when picking which voices get mixed. 0 is the same as 1.
+	Audio_Bus *bus; // 0 means the bus for the category
 } Audio_Playback_Config;
 
-typedef struct Audio_Player {
-	// You shouldn't set these directly.
-	// Set playback state with the player_xxxxx procedures
+///
+// Voice management
+// Every playing player is a voice. Each mix, voices are scored by priority*audibility and only
+// the best ones within the limits are actually decoded and mixed. The rest are virtual: their
+// timeline keeps advancing so they come back at the right spot once there's room, but they cost
+// next to nothing. So mixer CPU stays bounded no matter how many sounds are triggered.
+
+#define AUDIO_DEFAULT_MAX_VOICES 64
+#define AUDIO_DEFAULT_MIN_AUDIBILITY 0.001
+
+typedef struct Audio_Voice_Limits {
+	u32 max_voices;
+	u32 max_voices_per_category[AUDIO_VOICE_CATEGORY_COUNT]; // 0 means only max_voices applies
+	float32 min_audibility; // Voices quieter than this are always virtual
+} Audio_Voice_Limits;
+
+typedef struct Audio_Voice_Stats {
+	u64 real_voices;
+	u64 virtual_voices;
+	u64 real_voices_per_category[AUDIO_VOICE_CATEGORY_COUNT];
+} Audio_Voice_Stats;
+
+// #Global
+ogb_instance Audio_Voice_Limits audio_voice_limits; // This is safe to set whenever
+ogb_instance Audio_Voice_Stats audio_voice_stats; // From the last mix
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+Audio_Voice_Limits audio_voice_limits = {AUDIO_DEFAULT_MAX_VOICES, {0}, AUDIO_DEFAULT_MIN_AUDIBILITY};
+Audio_Voice_Stats audio_voice_stats = {0};
+#endif
+
+///
+// Clip cache
+// play_one_audio_clip(path) keeps what it plays around, so triggering the same sound again
+// doesn't touch the disk. Short clips are decoded to memory in the output format once and shared
+// by all players playing them, longer ones are streamed. Decoded clips that aren't playing are
+// evicted least recently used first when the cache goes over audio_clip_cache_budget_bytes.
+
+#define AUDIO_CLIP_CACHE_DEFAULT_BUDGET_BYTES (64*1024*1024)
+#define AUDIO_CLIP_MAX_DECODED_SECONDS 10.0 // Longer clips are streamed
+
+typedef struct Audio_Clip {
+	String_Id path_id;
+	string path; // Interned
 	Audio_Source source;
-	bool has_source;
-	bool allocated;
-	bool marked_for_release; // We release on audio thread
-	Audio_Player_State state;
-	u64 frame_index;
-	bool looping;
-	u64 fade_frames;
-	u64 fade_frames_total;
-	bool release_when_done;
-	// I think we only need to sync when audio thread samples the source, which should be
-	// fairly quick and low contention, hence a spinlock.
-	Spinlock sample_lock; 
-	
-	// #Cleanup
-	DEPRECATED(Vector3 position, "Use player->config.position_ndc instead"); // ndc space -1 to 1
+	bool loaded;    // False after the clip has been evicted, it's loaded again on the next play
+	bool loading;   // Some thread is decoding it outside of the lock, wait for it
+	bool streamed;  // Too long to decode to memory. Streamed clips are never evicted.
+	u64 bytes;      // Decoded size
+	volatile u64 refcount; // Players currently playing this clip
+	u64 last_used;
+} Audio_Clip;
+
+typedef struct Audio_Clip_Cache_Stats {
+	u64 hits;
+	u64 misses;
+	u64 evictions;
+	u64 bytes; // Decoded clips currently in memory
+	u64 clip_count;
+} Audio_Clip_Cache_Stats;
+
+// #Global
+ogb_instance u64 audio_clip_cache_budget_bytes; // This is safe to set whenever
+ogb_instance Audio_Clip_Cache_Stats audio_clip_cache_stats;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+u64 audio_clip_cache_budget_bytes = AUDIO_CLIP_CACHE_DEFAULT_BUDGET_BYTES;
+Audio_Clip_Cache_Stats audio_clip_cache_stats = {0};
+#endif
+
+// Any thread
+void
+audio_clip_add_reference(Audio_Clip *clip) {
+	u64 refcount;
+	do {
+		refcount = clip->refcount;
+	} while (!compare_and_swap_64(&clip->refcount, refcount+1, refcount));
+}
+void
+audio_clip_release_reference(Audio_Clip *clip) {
+	u64 refcount;
+	do {
+		refcount = clip->refcount;
+		assert(refcount > 0, "Audio clip refcount underflow");
+	} while (!compare_and_swap_64(&clip->refcount, refcount-1, refcount));
+}
+
+typedef struct Audio_Player {
+	// You shouldn't set these directly.
+	// Set playback state with the player_xxxxx procedures.
+	// These are owned by the audio thread, so reading them from elsewhere might give you the
+	// state from the last mix.
+	Audio_Source source;
+	bool has_source;
+	volatile bool allocated;
+	Audio_Player_State state;
+	u64 frame_index;
+	bool looping;
+	u64 fade_frames;
+	u64 fade_frames_total;
+	bool release_when_done;
+	bool is_virtual; // Playing, but not mixed in the last mix because of voice limits
+	Audio_Source_Cursor *cursor; // Swapped in by the audio thread when it applies a new source
+	Audio_Clip *clip; // Audio thread only. Holds a reference while playing a cached clip.
+	
+	// The cursor we last handed to the audio thread. Only touched by the thread controlling the
+	// player, so it knows what to retire when the source changes.
+	Audio_Source_Cursor *owned_cursor;
+	
+	// #Cleanup
+	DEPRECATED(Vector3 position, "Use player->config.position_ndc instead"); // ndc space -1 to 1
 	DEPRECATED(bool disable_spacialization, "Use player->config.enable_spacialization instead");
 	DEPRECATED(float32 volume, "Use player->config.volume instead");
 	DEPRECATED(float32 playback_speed, "Use player->config.playback_speed instead");
@@ -1186,30 +1844,303 @@ typedef struct Audio_Player_Block {
 	struct Audio_Player_Block *next;
 } Audio_Player_Block;
 
+///
+// Player commands
+// Anything that changes playback goes through a lock-free queue which the audio thread drains
+// at the start of each mix, so neither side ever waits for the other.
+// Any thread can push, only the audio thread pops.
+
+typedef enum Audio_Player_Command_Kind {
+	AUDIO_PLAYER_COMMAND_SET_STATE,
+	AUDIO_PLAYER_COMMAND_SET_TIME_STAMP,
+	AUDIO_PLAYER_COMMAND_SET_PROGRESSION_FACTOR,
+	AUDIO_PLAYER_COMMAND_SET_SOURCE,
+	AUDIO_PLAYER_COMMAND_CLEAR_SOURCE,
+	AUDIO_PLAYER_COMMAND_SET_LOOPING,
+	AUDIO_PLAYER_COMMAND_RELEASE_WHEN_DONE,
+	AUDIO_PLAYER_COMMAND_RELEASE,
+	AUDIO_PLAYER_COMMAND_FORGET_SOURCE, // Detaches all players playing source_uid, player is 0
+} Audio_Player_Command_Kind;
+
+typedef struct Audio_Player_Command {
+	// #Volatile
+	// Offset by the slot index so the zero initialized queue is valid, see audio_push_player_command()
+	volatile u64 sequence;
+	
+	Audio_Player_Command_Kind kind;
+	Audio_Player *player;
+	union {
+		Audio_Player_State state;
+		float64 time_in_seconds;
+		float64 progression_factor;
+		bool looping;
+		u64 source_uid;
+		struct {
+			Audio_Source source;
+			Audio_Source_Cursor *cursor;
+			Audio_Clip *clip; // Reference is passed on to the player
+		};
+	};
+} Audio_Player_Command;
+
+// #Volatile must be a power of two
+#define AUDIO_PLAYER_COMMAND_QUEUE_SIZE 1024
+typedef struct Audio_Player_Command_Queue {
+	Audio_Player_Command commands[AUDIO_PLAYER_COMMAND_QUEUE_SIZE];
+	volatile u64 write_pos;
+	u64 read_pos; // Audio thread only
+	
+	// When the queue is full, commands go here instead until the audio thread has drained it,
+	// so they're still applied in order. The count is read without the lock.
+	Audio_Player_Command *overflow; // Growing array
+	volatile u64 overflow_count;
+	Spinlock overflow_lock;
+} Audio_Player_Command_Queue;
+
+///
+// Deferred destruction
+// Sources and cursors which the audio thread might still be reading are retired with the
+// mix epoch at the time, and freed once a mix started after that has completed.
+// Only touched outside the audio thread, so a lock is fine here.
+
+typedef enum Audio_Retired_Kind {
+	AUDIO_RETIRED_SOURCE,
+	AUDIO_RETIRED_CURSOR,
+} Audio_Retired_Kind;
+
+typedef struct Audio_Retired {
+	Audio_Retired_Kind kind;
+	u64 epoch;
+	union {
+		Audio_Source source;
+		Audio_Source_Cursor *cursor;
+	};
+} Audio_Retired;
+
 // #Global
 ogb_instance Audio_Player_Block audio_player_block;
+ogb_instance Audio_Player_Command_Queue audio_player_command_queue;
+ogb_instance volatile u64 audio_mix_epoch_started;
+ogb_instance volatile u64 audio_mix_epoch_completed;
+ogb_instance Audio_Retired *audio_retired; // Growing array
+ogb_instance Spinlock audio_retired_lock;
+ogb_instance Audio_Source_Cursor *volatile audio_released_cursors;
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 Audio_Player_Block audio_player_block = {0};
+Audio_Player_Command_Queue audio_player_command_queue = {0};
+volatile u64 audio_mix_epoch_started = 0;
+volatile u64 audio_mix_epoch_completed = 0;
+Audio_Retired *audio_retired = 0;
+Spinlock audio_retired_lock = {0};
+Audio_Source_Cursor *volatile audio_released_cursors = 0;
 #endif
 
+void
+audio_push_player_command_overflow(Audio_Player_Command command) {
+	Audio_Player_Command_Queue *q = &audio_player_command_queue;
+	
+	spinlock_acquire_or_wait(&q->overflow_lock);
+	if (!q->overflow) {
+		growing_array_init((void**)&q->overflow, sizeof(Audio_Player_Command), get_heap_allocator());
+	}
+	growing_array_add((void**)&q->overflow, &command);
+	q->overflow_count = growing_array_get_valid_count(q->overflow);
+	spinlock_release(&q->overflow_lock);
+	
+	// #Volatile same as the locked publish in audio_push_player_command()
+	MEMORY_BARRIER;
+}
+
+// This is a bounded MPSC version of Dmitry Vyukov's MPMC queue.
+// A slot is free for writing at position pos when its sequence is pos, and ready for reading
+// when it's pos+1. We store the sequence minus the slot index so all slots start out free
+// without having to initialize the queue.
+void
+audio_push_player_command(Audio_Player_Command command) {
+	Audio_Player_Command_Queue *q = &audio_player_command_queue;
+	
+	while (true) {
+		// Anything we put in the queue now would be applied before what's waiting in the overflow
+		if (q->overflow_count > 0) {
+			audio_push_player_command_overflow(command);
+			return;
+		}
+		
+		u64 pos = q->write_pos;
+		u64 slot = pos & (AUDIO_PLAYER_COMMAND_QUEUE_SIZE-1);
+		Audio_Player_Command *c = &q->commands[slot];
+		
+		u64 sequence = c->sequence + slot;
+		
+		if (sequence == pos) {
+			if (!compare_and_swap_64(&q->write_pos, pos+1, pos)) continue;
+			
+			command.sequence = c->sequence;
+			*c = command;
+			
+			// Locked instruction so this is a full fence, the epoch read in
+			// audio_retire() can't be reordered before the command is published.
+			bool published = compare_and_swap_64(&c->sequence, pos+1-slot, pos-slot);
+			assert(published, "Internal sync error in audio command queue");
+			return;
+		} else if (sequence < pos) {
+			// Queue is full, which happens when lots of sounds are started between two mixes or
+			// nothing is mixing at all. Don't wait for the audio thread, it might never come.
+			audio_push_player_command_overflow(command);
+			return;
+		}
+		// Otherwise another thread got this slot first, try again with the new write_pos
+	}
+}
+
+bool
+audio_pop_player_command(Audio_Player_Command *result) {
+	Audio_Player_Command_Queue *q = &audio_player_command_queue;
+	
+	u64 pos = q->read_pos;
+	u64 slot = pos & (AUDIO_PLAYER_COMMAND_QUEUE_SIZE-1);
+	Audio_Player_Command *c = &q->commands[slot];
+	
+	if (c->sequence + slot != pos+1) return false;
+	
+	MEMORY_BARRIER;
+	*result = *c;
+	MEMORY_BARRIER;
+	
+	c->sequence = pos+AUDIO_PLAYER_COMMAND_QUEUE_SIZE-slot;
+	q->read_pos = pos+1;
+	
+	return true;
+}
+
+void
+audio_retire(Audio_Retired retired) {
+	// #Volatile
+	// Must be read after the commands that stop the audio thread from using this were pushed.
+	// Mix number 'epoch' might have drained the queue before that, but any later mix will
+	// drain them first, so we're good once 'epoch' has completed.
+	retired.epoch = audio_mix_epoch_started;
+	
+	spinlock_acquire_or_wait(&audio_retired_lock);
+	if (!audio_retired) {
+		growing_array_init((void**)&audio_retired, sizeof(Audio_Retired), get_heap_allocator());
+	}
+	growing_array_add((void**)&audio_retired, &retired);
+	spinlock_release(&audio_retired_lock);
+}
+void
+audio_retire_cursor(Audio_Source_Cursor *cursor) {
+	if (!cursor) return;
+	Audio_Retired retired = ZERO(Audio_Retired);
+	retired.kind = AUDIO_RETIRED_CURSOR;
+	retired.cursor = cursor;
+	audio_retire(retired);
+}
+
+// Frees whatever the audio thread is done with.
+// Called from the player procedures, so you don't need to call this yourself.
+void
+audio_collect_retired() {
+	// The audio thread is already done with these
+	Audio_Source_Cursor *released;
+	do {
+		released = audio_released_cursors;
+	} while (released && !compare_and_swap_64((volatile u64*)&audio_released_cursors, 0, (u64)released));
+	while (released) {
+		Audio_Source_Cursor *next = released->next_released;
+		audio_source_cursor_destroy(released);
+		dealloc(get_heap_allocator(), released);
+		released = next;
+	}
+	
+	if (!audio_retired) return;
+	
+	u64 completed = audio_mix_epoch_completed;
+	
+	spinlock_acquire_or_wait(&audio_retired_lock);
+	for (s64 i = (s64)growing_array_get_valid_count(audio_retired)-1; i >= 0; i--) {
+		Audio_Retired *r = &audio_retired[i];
+		if (r->epoch > completed) continue;
+		
+		switch (r->kind) {
+			case AUDIO_RETIRED_SOURCE: {
+				audio_source_free_now(&r->source);
+				break;
+			}
+			case AUDIO_RETIRED_CURSOR: {
+				audio_source_cursor_destroy(r->cursor);
+				dealloc(get_heap_allocator(), r->cursor);
+				break;
+			}
+		}
+		
+		growing_array_unordered_remove_by_index((void**)&audio_retired, (u32)i);
+	}
+	spinlock_release(&audio_retired_lock);
+}
+
+// Opens a decoder for the player on the calling thread so the audio thread doesn't have to.
+// Returns 0 for sources that don't need one.
+Audio_Source_Cursor *
+audio_make_cursor_for_source(Audio_Source *src) {
+	bool is_ogg_stream = src->kind == AUDIO_SOURCE_FILE_STREAM && src->decoder == AUDIO_DECODER_OGG;
+	if (!is_ogg_stream && src->kind != AUDIO_SOURCE_ADPCM) return 0;
+	
+	Audio_Source_Cursor *cursor = alloc(get_heap_allocator(), sizeof(Audio_Source_Cursor));
+	*cursor = ZERO(Audio_Source_Cursor);
+	if (!audio_source_cursor_prepare(cursor, src)) {
+		dealloc(get_heap_allocator(), cursor);
+		return 0;
+	}
+	
+	return cursor;
+}
+
+void 
+audio_source_destroy(Audio_Source *src) {
+	// The audio thread might be sampling this source right now, so we tell it to detach
+	// players still using it and only free it once it's done with the current mix.
+	Audio_Player_Command c = ZERO(Audio_Player_Command);
+	c.kind = AUDIO_PLAYER_COMMAND_FORGET_SOURCE;
+	c.source_uid = src->uid;
+	audio_push_player_command(c);
+	
+	Audio_Retired retired = ZERO(Audio_Retired);
+	retired.kind = AUDIO_RETIRED_SOURCE;
+	retired.source = *src;
+	audio_retire(retired);
+	
+	audio_collect_retired();
+}
+
 Audio_Player *
 audio_player_get_one() {
 
+	audio_collect_retired();
+
 	Audio_Player_Block *block = &audio_player_block;
 	Audio_Player_Block *last = 0;
 	
 	while (block) {
 		
 		for (u64 i = 0; i < AUDIO_PLAYERS_PER_BLOCK; i++) {
-			if (!block->players[i].allocated) {
+			Audio_Player *p = &block->players[i];
+			if (!p->allocated && compare_and_swap_bool(&p->allocated, true, false)) {
 			
-				memset(&block->players[i], 0, sizeof(block->players[i]));
-				block->players[i].allocated = true;
-				block->players[i].config.volume = 1.0;
-				block->players[i].config.playback_speed = 1.0;
+				// Released players shouldn't have a cursor left, but don't leak it if they do
+				audio_retire_cursor(p->owned_cursor);
+				
+				// #Volatile
+				// The audio thread ignores players without a source, which released players never
+				// have, so it's fine if it sees this half written.
+				Audio_Player fresh = ZERO(Audio_Player);
+				fresh.allocated = true;
+				fresh.config.volume = 1.0;
+				fresh.config.playback_speed = 1.0;
+				*p = fresh;
 				
-				return &block->players[i];
+				return p;
 			}
 		}
 		
@@ -1225,166 +2156,433 @@ audio_player_get_one() {
 	memset(new_block, 0, sizeof(*new_block));
 #endif
 
-	last->next = new_block;
-
 	new_block->players[0].allocated = true;
 	new_block->players[0].config.volume = 1.0;
-	block->players[0].config.playback_speed = 1.0;
+	new_block->players[0].config.playback_speed = 1.0;
+	
+	MEMORY_BARRIER;
+	
+	// #Sync
+	// Another thread might have appended a block since we looked
+	while (!compare_and_swap_64((volatile u64*)&last->next, (u64)new_block, 0)) {
+		last = last->next;
+	}
+	
 	return &new_block->players[0];
 }
 
 void 
 audio_player_release(Audio_Player *p) {
-	p->marked_for_release = true;
+	Audio_Source_Cursor *cursor = p->owned_cursor;
+	p->owned_cursor = 0;
+	
+	Audio_Player_Command c = ZERO(Audio_Player_Command);
+	c.kind = AUDIO_PLAYER_COMMAND_RELEASE;
+	c.player = p;
+	audio_push_player_command(c);
+	
+	audio_retire_cursor(cursor);
 }
 void
 audio_player_set_state(Audio_Player *p, Audio_Player_State state) {
-
-	if (p->state == state) return;
-
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
-	p->state = state;
-	
-	float64 full_duration 
-		= (float64)p->source.number_of_frames/(float64)p->source.format.sample_rate;
-	float64 progression = (float64)p->frame_index / (float64)p->source.number_of_frames;
-	float64 remaining = (1.0-progression)*full_duration;
-	
-	float64 fade_seconds = min(AUDIO_SMOOTH_TRANSITION_TIME_MS/1000.0, remaining);
-	
-	float64 fade_factor = fade_seconds/full_duration;
-	
-	p->fade_frames = (u64)round(fade_factor*(float64)p->source.number_of_frames);
-	p->fade_frames_total = p->fade_frames;
-	
-	spinlock_release(&p->sample_lock);
+	Audio_Player_Command c = ZERO(Audio_Player_Command);
+	c.kind = AUDIO_PLAYER_COMMAND_SET_STATE;
+	c.player = p;
+	c.state = state;
+	audio_push_player_command(c);
 }
 void
 audio_player_set_time_stamp(Audio_Player *p, float64 time_in_seconds) {
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
-	
-	float64 full_duration 
-		= (float64)p->source.number_of_frames/(float64)p->source.format.sample_rate;
-	time_in_seconds = clamp(time_in_seconds, 0, full_duration);
-	float64 progression = time_in_seconds/full_duration;
-	
-	p->frame_index = (u64)round((float64)p->source.number_of_frames*progression);
-	
-	spinlock_release(&p->sample_lock);
+	Audio_Player_Command c = ZERO(Audio_Player_Command);
+	c.kind = AUDIO_PLAYER_COMMAND_SET_TIME_STAMP;
+	c.player = p;
+	c.time_in_seconds = time_in_seconds;
+	audio_push_player_command(c);
 }
 
 bool 
 audio_player_at_source_end(Audio_Player *p) {
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
-	
-    bool finished = p->frame_index == p->source.number_of_frames;
-	
-	spinlock_release(&p->sample_lock);
-
-    return finished;
+    return p->frame_index >= p->source.number_of_frames;
 }
 
 void // 0 - 1
 audio_player_set_progression_factor(Audio_Player *p, float64 factor) {
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
-	
-	p->frame_index = (u64)round((float64)p->source.number_of_frames*factor);
-	
-	spinlock_release(&p->sample_lock);
+	Audio_Player_Command c = ZERO(Audio_Player_Command);
+	c.kind = AUDIO_PLAYER_COMMAND_SET_PROGRESSION_FACTOR;
+	c.player = p;
+	c.progression_factor = factor;
+	audio_push_player_command(c);
 }
 float64 // seconds
 audio_player_get_time_stamp(Audio_Player *p) {
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
+	if (!p->has_source) return 0;
 	
-	float64 full_duration 
-		= (float64)p->source.number_of_frames/(float64)p->source.format.sample_rate;
-	float64 progression = (float64)p->frame_index / (float64)p->source.number_of_frames;
+	// #Sync
+	// This might be mid-update by the audio thread, in which case we're off by a mix at worst
+	u64 frame_index = p->frame_index;
+	u64 number_of_frames = p->source.number_of_frames;
 	
-	spinlock_release(&p->sample_lock);
+	float64 full_duration 
+		= (float64)number_of_frames/(float64)p->source.format.sample_rate;
+	float64 progression = (float64)min(frame_index, number_of_frames) / (float64)number_of_frames;
 	
 	return progression*full_duration;
 }
 float64
 audio_player_get_current_progression_factor(Audio_Player *p) {
 	if (!p->has_source) return 0;
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
-	
-	float64 progression = (float64)p->frame_index / (float64)p->source.number_of_frames;
 	
-	spinlock_release(&p->sample_lock);
+	u64 frame_index = p->frame_index;
+	u64 number_of_frames = p->source.number_of_frames;
 	
-	return progression;
+	return (float64)min(frame_index, number_of_frames) / (float64)number_of_frames;
 }
 void 
-audio_player_set_source(Audio_Player *p, Audio_Source src) {
+audio_player_set_source_with_clip(Audio_Player *p, Audio_Source src, Audio_Clip *clip) {
 
-	float64 last_progression = audio_player_get_current_progression_factor(p);
-	
-	spinlock_acquire_or_wait(&p->sample_lock);
+	audio_collect_retired();
 
-	p->source = src;
-	p->has_source = true;
-	
-	p->frame_index = 0;
+	Audio_Source_Cursor *old_cursor = p->owned_cursor;
+
+	Audio_Player_Command c = ZERO(Audio_Player_Command);
+	c.kind = AUDIO_PLAYER_COMMAND_SET_SOURCE;
+	c.player = p;
+	c.source = src;
+	c.cursor = audio_make_cursor_for_source(&src);
+	c.clip = clip;
+	p->owned_cursor = c.cursor;
+	audio_push_player_command(c);
 	
-	spinlock_release(&p->sample_lock);
+	audio_retire_cursor(old_cursor);
+}
+void 
+audio_player_set_source(Audio_Player *p, Audio_Source src) {
+	audio_player_set_source_with_clip(p, src, 0);
 }
 void 
 audio_player_clear_source(Audio_Player *p) {
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
+	Audio_Source_Cursor *old_cursor = p->owned_cursor;
+	p->owned_cursor = 0;
+
+	Audio_Player_Command c = ZERO(Audio_Player_Command);
+	c.kind = AUDIO_PLAYER_COMMAND_CLEAR_SOURCE;
+	c.player = p;
+	audio_push_player_command(c);
 	
+	audio_retire_cursor(old_cursor);
+}
+void
+audio_player_set_looping(Audio_Player *p, bool looping) {
+	Audio_Player_Command c = ZERO(Audio_Player_Command);
+	c.kind = AUDIO_PLAYER_COMMAND_SET_LOOPING;
+	c.player = p;
+	c.looping = looping;
+	audio_push_player_command(c);
+}
+
+// The player is released by the audio thread once it reaches the end of its source.
+// Don't touch the player after this.
+void
+audio_player_release_when_done(Audio_Player *p) {
+	Audio_Player_Command c = ZERO(Audio_Player_Command);
+	c.kind = AUDIO_PLAYER_COMMAND_RELEASE_WHEN_DONE;
+	c.player = p;
+	audio_push_player_command(c);
+}
+
+// Audio thread only
+void
+audio_player_detach_source(Audio_Player *p) {
 	p->has_source = false;
 	p->state = AUDIO_PLAYER_STATE_PAUSED;
-	p->source = ZERO(Audio_Source);
+	p->fade_frames = 0;
+	p->cursor = 0; // The controlling thread still has it as owned_cursor and retires it
+	if (p->clip) {
+		audio_clip_release_reference(p->clip);
+		p->clip = 0;
+	}
+}
+
+// Audio thread only
+// For release_when_done players. Nobody controls the player anymore, so the cursor is handed
+// back to be freed by the next audio_collect_retired() instead of waiting for the player to be
+// reused.
+void
+audio_player_release_finished(Audio_Player *p) {
+	Audio_Source_Cursor *cursor = p->owned_cursor;
+	p->owned_cursor = 0;
+	audio_player_detach_source(p);
+	
+	if (cursor) {
+		Audio_Source_Cursor *head;
+		do {
+			head = audio_released_cursors;
+			cursor->next_released = head;
+		} while (!compare_and_swap_64((volatile u64*)&audio_released_cursors, (u64)cursor, (u64)head));
+	}
 	
-	spinlock_release(&p->sample_lock);
+	MEMORY_BARRIER;
+	p->allocated = false;
 }
+
+// Audio thread only
 void
-audio_player_set_looping(Audio_Player *p, bool looping) {
-	spinlock_acquire_or_wait(&p->sample_lock);
+audio_apply_player_command(Audio_Player_Command *c) {
+	Audio_Player *p = c->player;
 	
-	if (p->has_source && looping && !p->looping && p->frame_index == p->source.number_of_frames) {
-		p->frame_index = 0;
+	if (c->kind == AUDIO_PLAYER_COMMAND_FORGET_SOURCE) {
+		Audio_Player_Block *block = &audio_player_block;
+		while (block) {
+			for (u64 i = 0; i < AUDIO_PLAYERS_PER_BLOCK; i++) {
+				Audio_Player *other = &block->players[i];
+				if (other->allocated && other->has_source && other->source.uid == c->source_uid) {
+					audio_player_detach_source(other);
+				}
+			}
+			block = block->next;
+		}
+		return;
 	}
 	
-	p->looping = looping;
+	// Commands for a released player are stale, it might already be someone elses
+	if (!p->allocated) {
+		// The clip reference was meant for the player, so nobody else would let go of it
+		if (c->kind == AUDIO_PLAYER_COMMAND_SET_SOURCE && c->clip) audio_clip_release_reference(c->clip);
+		return;
+	}
 	
-	spinlock_release(&p->sample_lock);
+	switch (c->kind) {
+		case AUDIO_PLAYER_COMMAND_SET_STATE: {
+			if (p->state == c->state) break;
+			p->state = c->state;
+			
+			if (!p->has_source) break;
+			
+			assert(p->frame_index <= p->source.number_of_frames);
+			
+			float64 full_duration 
+				= (float64)p->source.number_of_frames/(float64)p->source.format.sample_rate;
+			float64 progression = (float64)p->frame_index / (float64)p->source.number_of_frames;
+			float64 remaining = (1.0-progression)*full_duration;
+			
+			float64 fade_seconds = min(AUDIO_SMOOTH_TRANSITION_TIME_MS/1000.0, remaining);
+			
+			float64 fade_factor = fade_seconds/full_duration;
+			
+			p->fade_frames = (u64)round(fade_factor*(float64)p->source.number_of_frames);
+			p->fade_frames_total = p->fade_frames;
+			break;
+		}
+		case AUDIO_PLAYER_COMMAND_SET_TIME_STAMP: {
+			if (!p->has_source) break;
+			float64 full_duration 
+				= (float64)p->source.number_of_frames/(float64)p->source.format.sample_rate;
+			float64 time_in_seconds = clamp(c->time_in_seconds, 0, full_duration);
+			float64 progression = time_in_seconds/full_duration;
+			
+			p->frame_index = (u64)round((float64)p->source.number_of_frames*progression);
+			break;
+		}
+		case AUDIO_PLAYER_COMMAND_SET_PROGRESSION_FACTOR: {
+			if (!p->has_source) break;
+			float64 factor = clamp(c->progression_factor, 0, 1);
+			p->frame_index = (u64)round((float64)p->source.number_of_frames*factor);
+			break;
+		}
+		case AUDIO_PLAYER_COMMAND_SET_SOURCE: {
+			if (p->clip) audio_clip_release_reference(p->clip);
+			p->clip = c->clip;
+			p->source = c->source;
+			p->cursor = c->cursor;
+			p->frame_index = 0;
+			p->has_source = true;
+			break;
+		}
+		case AUDIO_PLAYER_COMMAND_CLEAR_SOURCE: {
+			audio_player_detach_source(p);
+			p->source = ZERO(Audio_Source);
+			break;
+		}
+		case AUDIO_PLAYER_COMMAND_SET_LOOPING: {
+			if (p->has_source && c->looping && !p->looping && p->frame_index == p->source.number_of_frames) {
+				p->frame_index = 0;
+			}
+			p->looping = c->looping;
+			break;
+		}
+		case AUDIO_PLAYER_COMMAND_RELEASE_WHEN_DONE: {
+			p->release_when_done = true;
+			break;
+		}
+		case AUDIO_PLAYER_COMMAND_RELEASE: {
+			audio_player_detach_source(p);
+			MEMORY_BARRIER;
+			p->allocated = false;
+			break;
+		}
+		case AUDIO_PLAYER_COMMAND_FORGET_SOURCE: break; // Handled above
+	}
 }
 
 // #Global
-ogb_instance Hash_Table just_audio_clips;
+ogb_instance Hash_Table just_audio_clips; // String_Id of the path -> Audio_Clip*
 ogb_instance bool just_audio_clips_initted;
+ogb_instance Spinlock audio_clip_cache_lock;
+ogb_instance u64 audio_clip_cache_tick;
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 Hash_Table just_audio_clips;
 bool just_audio_clips_initted = false;
+Spinlock audio_clip_cache_lock = {0};
+u64 audio_clip_cache_tick = 0;
 #endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
 
+// Called without audio_clip_cache_lock, with clip->loading set so nobody else touches the clip.
+bool
+audio_clip_load(Audio_Clip *clip) {
+	Allocator heap = get_heap_allocator();
+	
+	// Open as a stream first, it only reads the header so we know how long the clip is
+	Audio_Source stream;
+	bool ok = audio_open_source_stream(&stream, clip->path, heap);
+	if (!ok) return false;
+	
+	f64 seconds = (f64)stream.number_of_frames / (f64)stream.format.sample_rate;
+	if (seconds > AUDIO_CLIP_MAX_DECODED_SECONDS) {
+		clip->source = stream;
+		clip->streamed = true;
+		clip->bytes = 0;
+		return true;
+	}
+	
+	// Never given to a player, so it's fine to free right away
+	audio_source_free_now(&stream);
+	
+	ok = audio_open_source_load(&clip->source, clip->path, heap);
+	if (!ok) return false;
+	
+	Audio_Format format = clip->source.format;
+	clip->bytes = clip->source.number_of_frames*format.channels*get_audio_bit_width_byte_size(format.bit_width);
+	clip->streamed = false;
+	
+	return true;
+}
+
+// Evicts decoded clips that aren't playing, least recently used first, until the cache fits in
+// budget_bytes. Call with audio_clip_cache_lock held.
+void
+audio_clip_cache_trim_locked(u64 budget_bytes) {
+	if (!just_audio_clips_initted) return;
+	
+	while (audio_clip_cache_stats.bytes > budget_bytes) {
+		Audio_Clip *oldest = 0;
+		for (u64 i = 0; i < just_audio_clips.count; i++) {
+			Audio_Clip *clip = *(Audio_Clip**)hash_table_get_nth_value(&just_audio_clips, i);
+			if (!clip->loaded || clip->streamed || clip->refcount > 0) continue;
+			if (!oldest || clip->last_used < oldest->last_used) oldest = clip;
+		}
+		
+		// Everything left is playing
+		if (!oldest) break;
+		
+		audio_source_destroy(&oldest->source);
+		oldest->loaded = false;
+		audio_clip_cache_stats.bytes -= oldest->bytes;
+		audio_clip_cache_stats.evictions += 1;
+	}
+}
+void
+audio_clip_cache_trim(u64 budget_bytes) {
+	spinlock_acquire_or_wait(&audio_clip_cache_lock);
+	audio_clip_cache_trim_locked(budget_bytes);
+	spinlock_release(&audio_clip_cache_lock);
+}
+
+// Returns the clip with a reference taken for the player which is going to play it, or 0 if
+// it could not be loaded.
+Audio_Clip *
+audio_clip_cache_acquire(string path) {
+	// Outside of the lock, this doesn't lock either once the path has been seen
+	String_Id path_id = intern_string(path);
+	
+	spinlock_acquire_or_wait(&audio_clip_cache_lock);
+	
+	if (!just_audio_clips_initted) {
+		just_audio_clips_initted = true;
+		just_audio_clips = make_hash_table(String_Id, Audio_Clip*, get_heap_allocator());
+	}
+	
+	Audio_Clip *clip = 0;
+	Audio_Clip **existing = hash_table_find(&just_audio_clips, path_id);
+	if (existing) {
+		clip = *existing;
+	} else {
+		clip = alloc(get_heap_allocator(), sizeof(Audio_Clip));
+		*clip = ZERO(Audio_Clip);
+		clip->path_id = path_id;
+		clip->path = get_interned_string(path_id);
+		hash_table_add(&just_audio_clips, path_id, clip);
+		audio_clip_cache_stats.clip_count += 1;
+	}
+	
+	// Another thread is loading this clip, decoding it twice would be worse than waiting
+	while (clip->loading) {
+		spinlock_release(&audio_clip_cache_lock);
+		os_yield_thread();
+		spinlock_acquire_or_wait(&audio_clip_cache_lock);
+	}
+	
+	if (clip->loaded) {
+		audio_clip_cache_stats.hits += 1;
+	} else {
+		audio_clip_cache_stats.misses += 1;
+		
+		// Decoding can take a while, so don't hold up everyone else playing clips meanwhile
+		clip->loading = true;
+		spinlock_release(&audio_clip_cache_lock);
+		bool ok = audio_clip_load(clip);
+		spinlock_acquire_or_wait(&audio_clip_cache_lock);
+		clip->loading = false;
+		
+		if (!ok) {
+			spinlock_release(&audio_clip_cache_lock);
+			log_error("Could not load audio to play from %s", path);
+			return 0;
+		}
+		
+		clip->loaded = true;
+		audio_clip_cache_stats.bytes += clip->bytes;
+	}
+	
+	audio_clip_cache_tick += 1;
+	clip->last_used = audio_clip_cache_tick;
+	audio_clip_add_reference(clip);
+	
+	// Might evict the clip we just loaded if it alone is over budget, but not while it's playing.
+	audio_clip_cache_trim_locked(audio_clip_cache_budget_bytes);
+	
+	spinlock_release(&audio_clip_cache_lock);
+	
+	return clip;
+}
+
 void
 DEPRECATED(play_one_audio_clip_source_at_position(Audio_Source source, Vector3 pos), "Use play_one_audio_clip_source_with_config() instead") {
 	Audio_Player *p = audio_player_get_one();
-	audio_player_set_source(p, source);
-	audio_player_set_state(p, AUDIO_PLAYER_STATE_PLAYING);
 	p->config.position_ndc = pos;
 	p->config.enable_spacialization = true;
-	p->release_when_done = true;
+	audio_player_set_source(p, source);
+	audio_player_set_state(p, AUDIO_PLAYER_STATE_PLAYING);
+	audio_player_release_when_done(p);
 }
 
 void
 play_one_audio_clip_source_with_config(Audio_Source source, Audio_Playback_Config config) {
 	Audio_Player *p = audio_player_get_one();
+	p->config = config;
 	audio_player_set_source(p, source);
 	audio_player_set_state(p, AUDIO_PLAYER_STATE_PLAYING);
-	p->config = config;
-	p->release_when_done = true;
+	audio_player_release_when_done(p);
 }
 
 void inline 
@@ -1395,47 +2593,24 @@ play_one_audio_clip_source(Audio_Source source) {
 	play_one_audio_clip_source_with_config(source, config);
 }
 void
-DEPRECATED(play_one_audio_clip_at_position(string path, Vector3 pos), "Use play_one_audio_clip_with_config() instead") {
-	if (!just_audio_clips_initted) {
-		just_audio_clips_initted = true;
-		just_audio_clips = make_hash_table(string, Audio_Source, get_heap_allocator());
-	}
-	
-	Audio_Source *src_ptr = hash_table_find(&just_audio_clips, path);
-	if (src_ptr) {
-		play_one_audio_clip_source_at_position(*src_ptr, pos);
-	} else {
-		Audio_Source new_src;
-		bool ok = audio_open_source_stream(&new_src, path, get_heap_allocator());
-		if (!ok) {
-			log_error("Could not load audio to play from %s", path);
-			return;
-		}
-		hash_table_add(&just_audio_clips, path, new_src);
-		play_one_audio_clip_source_at_position(new_src, pos);
-	}
+play_one_audio_clip_with_config(string path, Audio_Playback_Config config) {
+	Audio_Clip *clip = audio_clip_cache_acquire(path);
+	if (!clip) return;
 	
+	Audio_Player *p = audio_player_get_one();
+	p->config = config;
+	audio_player_set_source_with_clip(p, clip->source, clip);
+	audio_player_set_state(p, AUDIO_PLAYER_STATE_PLAYING);
+	audio_player_release_when_done(p);
 }
 void
-play_one_audio_clip_with_config(string path, Audio_Playback_Config config) {
-	if (!just_audio_clips_initted) {
-		just_audio_clips_initted = true;
-		just_audio_clips = make_hash_table(string, Audio_Source, get_heap_allocator());
-	}
-	
-	Audio_Source *src_ptr = hash_table_find(&just_audio_clips, path);
-	if (src_ptr) {
-		play_one_audio_clip_source_with_config(*src_ptr, config);
-	} else {
-		Audio_Source new_src;
-		bool ok = audio_open_source_stream(&new_src, path, get_heap_allocator());
-		if (!ok) {
-			log_error("Could not load audio to play from %s", path);
-			return;
-		}
-		hash_table_add(&just_audio_clips, path, new_src);
-		play_one_audio_clip_source_with_config(new_src, config);
-	}
+DEPRECATED(play_one_audio_clip_at_position(string path, Vector3 pos), "Use play_one_audio_clip_with_config() instead") {
+	Audio_Playback_Config config = {0};
+	config.volume = 1.0;
+	config.playback_speed = 1.0;
+	config.position_ndc = pos;
+	config.enable_spacialization = true;
+	play_one_audio_clip_with_config(path, config);
 }
 void inline
 play_one_audio_clip(string path) {
@@ -1625,49 +2800,968 @@ void apply_audio_spacialization(void* frames, Audio_Format format, u64 number_of
 void apply_audio_volume(void* frames, Audio_Format format, u64 number_of_frames, float32 vol) {
 	
 	// #Speed
-	// This is lazy, also it can be combined with other passes.
+	// This could be combined with other passes.
 
 	u64 comp_size  = get_audio_bit_width_byte_size(format.bit_width);
     u64 frame_size = comp_size * format.channels;
 	if (vol <= 0.0) {
 		memset(frames, 0, frame_size*number_of_frames);
+		return;
+	}
+	if (format.bit_width == AUDIO_BITS_32) {
+		simd_scale_float32_array((f32*)frames, (f32*)frames, vol, number_of_frames*format.channels);
+		return;
 	}
 	
-	for (u64 i = 0; i < number_of_frames; ++i) {
-        for (u64 c = 0; c < format.channels; ++c) {
-        	float32 sample;
-            convert_one_component(
-            	&sample, 
-            	AUDIO_BITS_32, 
-            	(u8*)frames+i*frame_size+c*comp_size, 
-            	format.bit_width
-        	);
-        	
-        	sample *= vol;
-        	
-			convert_one_component(
-            	(u8*)frames+i*frame_size+c*comp_size, 
-            	format.bit_width,
-            	&sample, 
-            	AUDIO_BITS_32
-        	);
-        }
-    }
+	// s16 goes through f32 a chunk at a time
+	f32 samples[1024];
+	s16 *pcm = (s16*)frames;
+	u64 number_of_samples = number_of_frames*format.channels;
+	for (u64 i = 0; i < number_of_samples; i += 1024) {
+		u64 count = min(number_of_samples-i, 1024);
+		simd_convert_s16_to_float32_array(samples, pcm+i, count);
+		simd_scale_float32_array(samples, samples, vol, count);
+		simd_convert_float32_to_s16_array(pcm+i, samples, count);
+	}
 }
 
-// This is supposed to be called by OS layer audio thread whenever it wants more audio samples
+// Audio thread only
+u64 // Mix epoch, pass to audio_mix_end()
+audio_mix_begin() {
+	// Locked instruction so it's a full fence against the command queue reads below.
+	// See audio_retire()
+	u64 epoch = audio_mix_epoch_started+1;
+	bool ok = compare_and_swap_64(&audio_mix_epoch_started, epoch, epoch-1);
+	assert(ok, "Only the audio thread should start mixes");
+	
+	Audio_Player_Command command;
+	while (audio_pop_player_command(&command)) {
+		audio_apply_player_command(&command);
+	}
+	
+	// The overflow goes after the queue, since it only fills up once the queue is full.
+	Audio_Player_Command_Queue *q = &audio_player_command_queue;
+	if (q->overflow_count > 0) {
+		spinlock_acquire_or_wait(&q->overflow_lock);
+		
+		// Nothing new goes in the queue while there's overflow, but it might have filled up
+		// again since we drained it.
+		while (audio_pop_player_command(&command)) {
+			audio_apply_player_command(&command);
+		}
+		
+		// If a push is still writing its slot, what's behind it has to wait for the next mix
+		if (q->read_pos == q->write_pos) {
+			u64 count = growing_array_get_valid_count(q->overflow);
+			for (u64 i = 0; i < count; i++) {
+				audio_apply_player_command(&q->overflow[i]);
+			}
+			growing_array_clear((void**)&q->overflow);
+			q->overflow_count = 0;
+		}
+		
+		spinlock_release(&q->overflow_lock);
+	}
+	
+	return epoch;
+}
+void
+audio_mix_end(u64 epoch) {
+	MEMORY_BARRIER;
+	audio_mix_epoch_completed = epoch;
+}
+
+///
+// Buses & DSP
+// Players are mixed into buses, and buses are mixed into their parent until everything ends up
+// in the master bus, which goes to the output:
+//
+//   master
+//     music  (AUDIO_VOICE_CATEGORY_MUSIC players)
+//     sfx    (AUDIO_VOICE_CATEGORY_SFX players, the default)
+//     ui     (AUDIO_VOICE_CATEGORY_UI players)
+//     ...    (audio_bus_make(), route players there with player->config.bus)
+//
+// DSP runs once per bus on the sum of everything routed to it, so a reverb on the sfx bus costs
+// the same with one or a hundred sounds playing.
+// Buses are always f32 with the channels & sample rate of the output.
+
+#define AUDIO_BUS_MAX_DSP 8
+#define AUDIO_BUS_MAX_DEPTH 32
+#define AUDIO_DSP_MAX_CHANNELS 8
+
+typedef void(*Audio_Dsp_Proc)(float32 *frames, u64 number_of_frames, Audio_Format format, void *data);
+
+typedef enum Audio_Dsp_Kind {
+	AUDIO_DSP_GAIN,
+	AUDIO_DSP_BIQUAD,
+	AUDIO_DSP_COMPRESSOR, // Also a limiter, see audio_dsp_make_limiter()
+	AUDIO_DSP_REVERB,
+	AUDIO_DSP_USER,
+} Audio_Dsp_Kind;
+
+typedef enum Audio_Biquad_Kind {
+	AUDIO_BIQUAD_LOW_PASS,
+	AUDIO_BIQUAD_HIGH_PASS,
+	AUDIO_BIQUAD_BAND_PASS,
+	AUDIO_BIQUAD_PEAK,
+} Audio_Biquad_Kind;
+
+typedef struct Audio_Biquad_Params {
+	Audio_Biquad_Kind kind;
+	float32 cutoff_hz;
+	float32 q;
+	float32 gain_db; // Only for AUDIO_BIQUAD_PEAK
+} Audio_Biquad_Params;
+
+typedef struct Audio_Biquad {
+	Audio_Biquad_Params params; // This is safe to set whenever
+	
+	// Audio thread only
+	Audio_Biquad_Params computed_params;
+	int computed_sample_rate;
+	float32 b0, b1, b2, a1, a2;
+	float32 z1[AUDIO_DSP_MAX_CHANNELS];
+	float32 z2[AUDIO_DSP_MAX_CHANNELS];
+} Audio_Biquad;
+
+typedef struct Audio_Compressor {
+	// These are safe to set whenever
+	float32 threshold_db;
+	float32 ratio;
+	float32 attack_ms;
+	float32 release_ms;
+	float32 makeup_db;
+	
+	// Audio thread only
+	float32 envelope;
+	float32 last_gain;
+} Audio_Compressor;
+
+#define AUDIO_REVERB_COMBS 4
+#define AUDIO_REVERB_ALLPASSES 2
+
+typedef struct Audio_Reverb_Line {
+	float32 *buffer;
+	u32 length;
+	u32 position;
+	float32 filter_store; // Damping state for combs
+} Audio_Reverb_Line;
+
+// Freeverb style: parallel combs into serial allpasses, left & right slightly detuned.
+// Only the first two channels get reverb.
+typedef struct Audio_Reverb {
+	// These are safe to set whenever
+	float32 room_size; // 0 - 1
+	float32 damping;   // 0 - 1
+	float32 wet;       // 0 - 1
+	
+	// Audio thread only
+	Audio_Reverb_Line combs[2][AUDIO_REVERB_COMBS];
+	Audio_Reverb_Line allpasses[2][AUDIO_REVERB_ALLPASSES];
+} Audio_Reverb;
+
+typedef struct Audio_Dsp {
+	Audio_Dsp_Kind kind;
+	bool bypass; // This is safe to set whenever
+	union {
+		float32 gain;
+		Audio_Biquad biquad;
+		Audio_Compressor compressor;
+		Audio_Reverb reverb;
+		struct {
+			Audio_Dsp_Proc proc;
+			void *data;
+		} user;
+	};
+} Audio_Dsp;
+
+typedef struct Audio_Bus {
+	Audio_Bus *parent; // 0 for the master bus
+	float32 gain;      // Linear, after the DSP chain. This is safe to set whenever.
+	bool muted;        // This is safe to set whenever
+	
+	// See audio_bus_add_dsp()
+	Audio_Dsp dsp[AUDIO_BUS_MAX_DSP];
+	volatile u64 dsp_count;
+	
+	// All buses, starting at audio_master_bus
+	Audio_Bus *volatile next;
+	
+	// Audio thread only
+	float32 *buffer;
+	u64 buffer_capacity; // In samples
+	u64 depth;
+} Audio_Bus;
+
+// #Global
+ogb_instance Audio_Bus audio_master_bus;
+ogb_instance Audio_Bus audio_music_bus;
+ogb_instance Audio_Bus audio_sfx_bus;
+ogb_instance Audio_Bus audio_ui_bus;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+Audio_Bus audio_ui_bus     = {.parent = &audio_master_bus, .gain = 1.0};
+Audio_Bus audio_sfx_bus    = {.parent = &audio_master_bus, .gain = 1.0, .next = &audio_ui_bus};
+Audio_Bus audio_music_bus  = {.parent = &audio_master_bus, .gain = 1.0, .next = &audio_sfx_bus};
+Audio_Bus audio_master_bus = {.parent = 0,                 .gain = 1.0, .next = &audio_music_bus};
+#endif
+
+Audio_Bus *
+audio_category_get_bus(Audio_Voice_Category category) {
+	switch (category) {
+		case AUDIO_VOICE_CATEGORY_MUSIC: return &audio_music_bus;
+		case AUDIO_VOICE_CATEGORY_UI:    return &audio_ui_bus;
+		default:                         return &audio_sfx_bus;
+	}
+}
+Audio_Bus *
+audio_player_get_bus(Audio_Player *p) {
+	if (p->config.bus) return p->config.bus;
+	return audio_category_get_bus(p->config.category);
+}
+
+// Buses are never destroyed, so make them once and keep them around.
+// Parent 0 means the master bus.
+Audio_Bus *
+audio_bus_make(Audio_Bus *parent) {
+	Audio_Bus *bus = alloc(get_heap_allocator(), sizeof(Audio_Bus));
+	*bus = ZERO(Audio_Bus);
+	bus->parent = parent ? parent : &audio_master_bus;
+	bus->gain = 1.0;
+	
+	// Locked instruction, so the audio thread never sees a half initialized bus
+	Audio_Bus *last = &audio_master_bus;
+	while (true) {
+		while (last->next) last = last->next;
+		if (compare_and_swap_64((u64*)&last->next, (u64)bus, 0)) break;
+	}
+	
+	return bus;
+}
+
+// Appends to the bus' DSP chain. The returned pointer stays valid so you can tweak parameters
+// later, but DSP can't be removed (set dsp->bypass instead).
+// Don't add to the same bus from multiple threads at once.
+Audio_Dsp *
+audio_bus_add_dsp(Audio_Bus *bus, Audio_Dsp dsp) {
+	u64 index = bus->dsp_count;
+	assert(index < AUDIO_BUS_MAX_DSP, "Too many DSP on one bus, max is %d", AUDIO_BUS_MAX_DSP);
+	
+	bus->dsp[index] = dsp;
+	MEMORY_BARRIER;
+	bus->dsp_count = index+1;
+	
+	return &bus->dsp[index];
+}
+
+Audio_Dsp
+audio_dsp_make_gain(float32 gain) {
+	Audio_Dsp dsp = ZERO(Audio_Dsp);
+	dsp.kind = AUDIO_DSP_GAIN;
+	dsp.gain = gain;
+	return dsp;
+}
+Audio_Dsp
+audio_dsp_make_biquad(Audio_Biquad_Kind kind, float32 cutoff_hz, float32 q) {
+	Audio_Dsp dsp = ZERO(Audio_Dsp);
+	dsp.kind = AUDIO_DSP_BIQUAD;
+	dsp.biquad.params.kind = kind;
+	dsp.biquad.params.cutoff_hz = cutoff_hz;
+	dsp.biquad.params.q = q;
+	return dsp;
+}
+Audio_Dsp
+audio_dsp_make_compressor(float32 threshold_db, float32 ratio, float32 attack_ms, float32 release_ms) {
+	Audio_Dsp dsp = ZERO(Audio_Dsp);
+	dsp.kind = AUDIO_DSP_COMPRESSOR;
+	dsp.compressor.threshold_db = threshold_db;
+	dsp.compressor.ratio = ratio;
+	dsp.compressor.attack_ms = attack_ms;
+	dsp.compressor.release_ms = release_ms;
+	dsp.compressor.last_gain = 1.0;
+	return dsp;
+}
+Audio_Dsp
+audio_dsp_make_limiter(float32 ceiling_db) {
+	return audio_dsp_make_compressor(ceiling_db, 100.0, 0.1, 50.0);
+}
+// Allocates the delay lines for the current output sample rate. They are never freed.
+Audio_Dsp
+audio_dsp_make_reverb(float32 room_size, float32 damping, float32 wet) {
+	Audio_Dsp dsp = ZERO(Audio_Dsp);
+	dsp.kind = AUDIO_DSP_REVERB;
+	dsp.reverb.room_size = room_size;
+	dsp.reverb.damping = damping;
+	dsp.reverb.wet = wet;
+	
+	// Freeverb tunings are for 44100hz
+	const u32 comb_tunings[AUDIO_REVERB_COMBS] = {1116, 1188, 1277, 1356};
+	const u32 allpass_tunings[AUDIO_REVERB_ALLPASSES] = {556, 441};
+	const u32 stereo_spread = 23;
+	
+	int sample_rate = audio_output_format.sample_rate ? audio_output_format.sample_rate : 48000;
+	f64 scale = (f64)sample_rate / 44100.0;
+	
+	for (u64 c = 0; c < 2; c++) {
+		for (u64 i = 0; i < AUDIO_REVERB_COMBS+AUDIO_REVERB_ALLPASSES; i++) {
+			Audio_Reverb_Line *line;
+			u32 tuning;
+			if (i < AUDIO_REVERB_COMBS) {
+				line = &dsp.reverb.combs[c][i];
+				tuning = comb_tunings[i];
+			} else {
+				line = &dsp.reverb.allpasses[c][i-AUDIO_REVERB_COMBS];
+				tuning = allpass_tunings[i-AUDIO_REVERB_COMBS];
+			}
+			line->length = (u32)((tuning + c*stereo_spread)*scale);
+			line->buffer = alloc(get_heap_allocator(), line->length*sizeof(float32));
+			memset(line->buffer, 0, line->length*sizeof(float32));
+		}
+	}
+	
+	return dsp;
+}
+// proc gets the interleaved f32 frames of the bus, and can change them in place.
+// It runs on the audio thread, so keep it fast and don't wait on anything.
+Audio_Dsp
+audio_dsp_make_user(Audio_Dsp_Proc proc, void *data) {
+	Audio_Dsp dsp = ZERO(Audio_Dsp);
+	dsp.kind = AUDIO_DSP_USER;
+	dsp.user.proc = proc;
+	dsp.user.data = data;
+	return dsp;
+}
+
+void
+audio_dsp_scale(float32 *samples, u64 number_of_samples, float32 gain) {
+	simd_scale_float32_array(samples, samples, gain, number_of_samples);
+}
+void
+audio_dsp_accumulate(float32 *dst, float32 *src, u64 number_of_samples) {
+	simd_add_float32_array(dst, dst, src, number_of_samples);
+}
+
+// RBJ audio EQ cookbook
+void
+audio_biquad_compute(Audio_Biquad *bq, int sample_rate) {
+	Audio_Biquad_Params params = bq->params;
+	
+	f64 cutoff = clamp(params.cutoff_hz, 10.0, sample_rate*0.49);
+	f64 q = params.q > 0 ? params.q : 0.7071;
+	f64 w0 = TAU64*cutoff/(f64)sample_rate;
+	f64 cos_w0 = cos(w0);
+	f64 alpha = sin(w0)/(2.0*q);
+	
+	f64 b0 = 1, b1 = 0, b2 = 0, a0 = 1, a1 = 0, a2 = 0;
+	switch (params.kind) {
+		case AUDIO_BIQUAD_LOW_PASS: {
+			b0 = (1.0-cos_w0)/2.0; b1 = 1.0-cos_w0;    b2 = b0;
+			a0 = 1.0+alpha;        a1 = -2.0*cos_w0;   a2 = 1.0-alpha;
+			break;
+		}
+		case AUDIO_BIQUAD_HIGH_PASS: {
+			b0 = (1.0+cos_w0)/2.0; b1 = -(1.0+cos_w0); b2 = b0;
+			a0 = 1.0+alpha;        a1 = -2.0*cos_w0;   a2 = 1.0-alpha;
+			break;
+		}
+		case AUDIO_BIQUAD_BAND_PASS: {
+			b0 = alpha;            b1 = 0;             b2 = -alpha;
+			a0 = 1.0+alpha;        a1 = -2.0*cos_w0;   a2 = 1.0-alpha;
+			break;
+		}
+		case AUDIO_BIQUAD_PEAK: {
+			f64 a = pow(10.0, params.gain_db/40.0);
+			b0 = 1.0+alpha*a;      b1 = -2.0*cos_w0;   b2 = 1.0-alpha*a;
+			a0 = 1.0+alpha/a;      a1 = -2.0*cos_w0;   a2 = 1.0-alpha/a;
+			break;
+		}
+	}
+	
+	bq->b0 = b0/a0;
+	bq->b1 = b1/a0;
+	bq->b2 = b2/a0;
+	bq->a1 = a1/a0;
+	bq->a2 = a2/a0;
+	bq->computed_params = params;
+	bq->computed_sample_rate = sample_rate;
+}
+
+void
+audio_biquad_process(Audio_Biquad *bq, float32 *frames, u64 number_of_frames, Audio_Format format) {
+	if (bq->computed_sample_rate != format.sample_rate 
+	 || !bytes_match(&bq->computed_params, &bq->params, sizeof(Audio_Biquad_Params))) {
+		audio_biquad_compute(bq, format.sample_rate);
+	}
+	
+	u64 channels = min(format.channels, AUDIO_DSP_MAX_CHANNELS);
+	
+	// Transposed direct form II. Recursive, so this goes frame by frame.
+	for (u64 c = 0; c < channels; c++) {
+		float32 z1 = bq->z1[c];
+		float32 z2 = bq->z2[c];
+		for (u64 i = 0; i < number_of_frames; i++) {
+			float32 *sample = &frames[i*format.channels+c];
+			float32 in = *sample;
+			float32 out = bq->b0*in + z1;
+			z1 = bq->b1*in - bq->a1*out + z2;
+			z2 = bq->b2*in - bq->a2*out;
+			*sample = out;
+		}
+		bq->z1[c] = z1;
+		bq->z2[c] = z2;
+	}
+}
+
+#define AUDIO_COMPRESSOR_BLOCK_FRAMES 32
+
+void
+audio_compressor_process(Audio_Compressor *comp, float32 *frames, u64 number_of_frames, Audio_Format format) {
+	f32 sample_rate = (f32)format.sample_rate;
+	f32 attack  = expf(-1.0f / (max(comp->attack_ms,  0.01f)*0.001f*sample_rate));
+	f32 release = expf(-1.0f / (max(comp->release_ms, 0.01f)*0.001f*sample_rate));
+	f32 ratio = max(comp->ratio, 1.0f);
+	f32 envelope = comp->envelope;
+	
+	for (u64 start = 0; start < number_of_frames; start += AUDIO_COMPRESSOR_BLOCK_FRAMES) {
+		u64 count = min(AUDIO_COMPRESSOR_BLOCK_FRAMES, number_of_frames-start);
+		float32 *block = frames + start*format.channels;
+		
+		// Peak envelope per frame
+		for (u64 i = 0; i < count; i++) {
+			f32 peak = 0;
+			for (u64 c = 0; c < format.channels; c++) {
+				peak = max(peak, fabsf(block[i*format.channels+c]));
+			}
+			f32 coefficient = peak > envelope ? attack : release;
+			envelope = coefficient*envelope + (1.0f-coefficient)*peak;
+		}
+		
+		// The gain is only computed once per block (log & pow are slow) and ramped to
+		// so it doesn't click
+		f32 level_db = 20.0f*log10f(max(envelope, 0.000000001f));
+		f32 over_db = level_db - comp->threshold_db;
+		f32 gain_db = (over_db > 0 ? -over_db*(1.0f-1.0f/ratio) : 0) + comp->makeup_db;
+		f32 gain = powf(10.0f, gain_db/20.0f);
+		
+		if (gain == comp->last_gain) {
+			audio_dsp_scale(block, count*format.channels, gain);
+		} else {
+			f32 step = (gain-comp->last_gain) / (f32)count;
+			for (u64 i = 0; i < count; i++) {
+				f32 frame_gain = comp->last_gain + step*(f32)(i+1);
+				for (u64 c = 0; c < format.channels; c++) {
+					block[i*format.channels+c] *= frame_gain;
+				}
+			}
+		}
+		comp->last_gain = gain;
+	}
+	
+	comp->envelope = envelope;
+}
+
+void
+audio_reverb_process(Audio_Reverb *reverb, float32 *frames, u64 number_of_frames, Audio_Format format) {
+	u64 channels = min(format.channels, 2);
+	f32 feedback = 0.7f + 0.28f*clamp(reverb->room_size, 0.0f, 1.0f);
+	f32 damp = 0.4f*clamp(reverb->damping, 0.0f, 1.0f);
+	f32 wet = clamp(reverb->wet, 0.0f, 1.0f);
+	f32 dry = 1.0f-wet;
+	
+	for (u64 i = 0; i < number_of_frames; i++) {
+		float32 *frame = &frames[i*format.channels];
+		
+		f32 input = 0;
+		for (u64 c = 0; c < channels; c++) input += frame[c];
+		input *= 0.015f;
+		
+		for (u64 c = 0; c < channels; c++) {
+			f32 out = 0;
+			for (u64 k = 0; k < AUDIO_REVERB_COMBS; k++) {
+				Audio_Reverb_Line *comb = &reverb->combs[c][k];
+				f32 delayed = comb->buffer[comb->position];
+				comb->filter_store = delayed*(1.0f-damp) + comb->filter_store*damp;
+				comb->buffer[comb->position] = input + comb->filter_store*feedback;
+				if (++comb->position >= comb->length) comb->position = 0;
+				out += delayed;
+			}
+			for (u64 k = 0; k < AUDIO_REVERB_ALLPASSES; k++) {
+				Audio_Reverb_Line *allpass = &reverb->allpasses[c][k];
+				f32 delayed = allpass->buffer[allpass->position];
+				allpass->buffer[allpass->position] = out + delayed*0.5f;
+				if (++allpass->position >= allpass->length) allpass->position = 0;
+				out = delayed - out;
+			}
+			frame[c] = frame[c]*dry + out*wet*3.0f;
+		}
+	}
+}
+
+// Audio thread only
+void
+audio_bus_process_dsp(Audio_Bus *bus, u64 number_of_frames, Audio_Format format) {
+	u64 dsp_count = bus->dsp_count;
+	MEMORY_BARRIER;
+	
+	for (u64 i = 0; i < dsp_count; i++) {
+		Audio_Dsp *dsp = &bus->dsp[i];
+		if (dsp->bypass) continue;
+		
+		switch (dsp->kind) {
+			case AUDIO_DSP_GAIN: {
+				audio_dsp_scale(bus->buffer, number_of_frames*format.channels, dsp->gain);
+				break;
+			}
+			case AUDIO_DSP_BIQUAD: {
+				audio_biquad_process(&dsp->biquad, bus->buffer, number_of_frames, format);
+				break;
+			}
+			case AUDIO_DSP_COMPRESSOR: {
+				audio_compressor_process(&dsp->compressor, bus->buffer, number_of_frames, format);
+				break;
+			}
+			case AUDIO_DSP_REVERB: {
+				audio_reverb_process(&dsp->reverb, bus->buffer, number_of_frames, format);
+				break;
+			}
+			case AUDIO_DSP_USER: {
+				if (dsp->user.proc) dsp->user.proc(bus->buffer, number_of_frames, format, dsp->user.data);
+				break;
+			}
+		}
+	}
+}
+
+// Audio thread only. Clears all bus buffers for a new mix.
+void
+audio_buses_begin_mix(u64 number_of_frames, Audio_Format bus_format) {
+	u64 number_of_samples = number_of_frames*bus_format.channels;
+	
+	for (Audio_Bus *bus = &audio_master_bus; bus; bus = bus->next) {
+		if (bus->buffer_capacity < number_of_samples) {
+			if (bus->buffer) dealloc(get_heap_allocator(), bus->buffer);
+			bus->buffer_capacity = get_next_power_of_two(number_of_samples);
+			bus->buffer = alloc(get_heap_allocator(), bus->buffer_capacity*sizeof(float32));
+		}
+		memset(bus->buffer, 0, number_of_samples*sizeof(float32));
+		
+		bus->depth = 0;
+		for (Audio_Bus *parent = bus->parent; parent && bus->depth < AUDIO_BUS_MAX_DEPTH; parent = parent->parent) {
+			bus->depth += 1;
+		}
+	}
+}
+
+int
+audio_compare_bus_depth(const void *a, const void *b) {
+	u64 depth_a = (*(Audio_Bus**)a)->depth;
+	u64 depth_b = (*(Audio_Bus**)b)->depth;
+	
+	// Deepest first
+	if (depth_a > depth_b) return -1;
+	if (depth_a < depth_b) return 1;
+	return 0;
+}
+
+// Audio thread only. Runs DSP on all buses, children before parents, and writes the master
+// bus to output.
+void
+audio_buses_end_mix(u64 number_of_frames, Audio_Format bus_format, Audio_Format out_format, void *output) {
+	u64 number_of_samples = number_of_frames*bus_format.channels;
+	
+	Audio_Bus **buses;
+	growing_array_init((void**)&buses, sizeof(Audio_Bus*), get_temporary_allocator());
+	for (Audio_Bus *bus = &audio_master_bus; bus; bus = bus->next) {
+		growing_array_add((void**)&buses, &bus);
+	}
+	u64 bus_count = growing_array_get_valid_count(buses);
+	Audio_Bus **help_buffer = talloc(bus_count*sizeof(Audio_Bus*));
+	merge_sort(buses, help_buffer, bus_count, sizeof(Audio_Bus*), audio_compare_bus_depth);
+	
+	for (u64 i = 0; i < bus_count; i++) {
+		Audio_Bus *bus = buses[i];
+		
+		if (bus->muted) {
+			memset(bus->buffer, 0, number_of_samples*sizeof(float32));
+			continue;
+		}
+		
+		audio_bus_process_dsp(bus, number_of_frames, bus_format);
+		
+		if (bus->gain != 1.0) {
+			audio_dsp_scale(bus->buffer, number_of_samples, bus->gain);
+		}
+		
+		if (bus->parent) {
+			audio_dsp_accumulate(bus->parent->buffer, bus->buffer, number_of_samples);
+		}
+	}
+	
+	float32 *master = audio_master_bus.buffer;
+	switch (out_format.bit_width) {
+		case AUDIO_BITS_32: {
+			memcpy(output, master, number_of_samples*sizeof(float32));
+			break;
+		}
+		case AUDIO_BITS_16: {
+			simd_convert_float32_to_s16_array((s16*)output, master, number_of_samples);
+			break;
+		}
+	}
+}
+
+typedef struct Audio_Voice {
+	Audio_Player *player;
+	float32 score;
+	bool is_virtual;
+} Audio_Voice;
+
+float32
+audio_player_get_priority(Audio_Player *p) {
+	return p->config.priority > 0 ? p->config.priority : 1.0;
+}
+// Roughly how loud the player is at the output, 0 - 1+
+float32
+audio_player_get_audibility(Audio_Player *p) {
+	// #Volatile the mixer skips volume when it's 0
+	float32 audibility = p->config.volume != 0.0 ? p->config.volume : 1.0;
+	
+	if (p->config.enable_spacialization) {
+		// Same attenuation as apply_audio_spacialization()
+		Vector3 pos = p->config.position_ndc;
+		float32 distance = sqrtf(pos.x * pos.x + pos.y * pos.y + pos.z * pos.z);
+		audibility *= 1.0f / (1.0f + distance);
+	}
+	
+	// We don't count fades here, or voices that just started would be virtual until faded in
+	
+	return audibility;
+}
+
+int
+audio_compare_voices(const void *a, const void *b) {
+	float32 score_a = ((const Audio_Voice*)a)->score;
+	float32 score_b = ((const Audio_Voice*)b)->score;
+	
+	// Most important first
+	if (score_a > score_b) return -1;
+	if (score_a < score_b) return 1;
+	return 0;
+}
+
+// Decides which voices get mixed (real) and which are virtual, stealing from the least
+// important voices when we're over the limits.
+void
+audio_select_voices(Audio_Voice *voices, u64 voice_count) {
+	Audio_Voice_Limits limits = audio_voice_limits;
+	
+	audio_voice_stats = ZERO(Audio_Voice_Stats);
+	
+	if (voice_count > 1) {
+		Audio_Voice *help_buffer = talloc(voice_count*sizeof(Audio_Voice));
+		merge_sort(voices, help_buffer, voice_count, sizeof(Audio_Voice), audio_compare_voices);
+	}
+	
+	for (u64 v = 0; v < voice_count; v++) {
+		Audio_Player *p = voices[v].player;
+		Audio_Voice_Category category = p->config.category;
+		if (category >= AUDIO_VOICE_CATEGORY_COUNT) category = AUDIO_VOICE_CATEGORY_SFX;
+		
+		u32 category_max = limits.max_voices_per_category[category];
+		
+		bool is_virtual = 
+			   audio_voice_stats.real_voices >= limits.max_voices
+			|| (category_max > 0 && audio_voice_stats.real_voices_per_category[category] >= category_max)
+			|| audio_player_get_audibility(p) < limits.min_audibility;
+			
+		voices[v].is_virtual = is_virtual;
+		p->is_virtual = is_virtual;
+		
+		if (is_virtual) {
+			audio_voice_stats.virtual_voices += 1;
+		} else {
+			audio_voice_stats.real_voices += 1;
+			audio_voice_stats.real_voices_per_category[category] += 1;
+		}
+	}
+}
+
+// Moves a virtual voice along as if it was mixed, without decoding anything
+void
+audio_player_advance_virtual(Audio_Player *p, u64 number_of_output_frames, Audio_Format out_format) {
+	f64 src_ratio 
+		= ((f64)p->source.format.sample_rate*p->config.playback_speed)
+		  / (f64)out_format.sample_rate;
+	u64 number_of_sample_frames = (u64)round(number_of_output_frames * src_ratio);
+	
+	p->fade_frames -= min(p->fade_frames, number_of_sample_frames);
+	
+	u64 number_of_frames = p->source.number_of_frames;
+	if (number_of_frames == 0) return;
+	
+	if (p->looping) {
+		p->frame_index = (p->frame_index + number_of_sample_frames) % number_of_frames;
+	} else {
+		p->frame_index = min(p->frame_index + number_of_sample_frames, number_of_frames);
+	}
+}
+
+///
+// Timing
+// Every mix records how long it took, how regularly mixes are asked for and how many voices
+// it mixed. The output (device or null) reports how full its buffer was and whether it ran
+// dry. Read it with audio_get_timing_stats(), it's also reported to the profiler.
+
+#define AUDIO_TIMING_HISTORY_COUNT 512 // Mixes kept for min/avg/p99
+
+typedef struct Audio_Timing_Stats {
+	u64 mix_count; // Since the last reset
+	
+	// Over the last AUDIO_TIMING_HISTORY_COUNT mixes
+	f64 mix_seconds_min;
+	f64 mix_seconds_avg;
+	f64 mix_seconds_p99;
+	f64 mix_seconds_max;
+	
+	// How far the time between two mixes was from the length of audio the first one produced.
+	// If this gets big the output asks for audio irregularly, and we're close to glitching.
+	f64 period_jitter_seconds_avg;
+	f64 period_jitter_seconds_max;
+	
+	u64 voices_mixed_last;
+	u64 voices_mixed_max;
+	f64 voices_mixed_avg;
+	f64 voice_seconds_avg; // Decode, convert & mix of one real voice
+	
+	f64 lock_wait_seconds_avg; // Per mix, time the mixing thread waited on contended locks
+	f64 lock_wait_seconds_total;
+	
+	// Reported by the output, see audio_timing_report_output()
+	u64 underruns;
+	u64 buffer_padding_frames_last;
+	u64 buffer_padding_frames_min;
+} Audio_Timing_Stats;
+
+typedef struct Audio_Timing_Sample {
+	f64 mix_seconds;
+	f64 period_jitter_seconds;
+	f64 voice_seconds;
+	f64 lock_wait_seconds;
+	u64 voices_mixed;
+} Audio_Timing_Sample;
+
+typedef struct Audio_Timing {
+	// Odd while the mixing thread is writing, readers retry if it changed under them
+	volatile u64 sequence;
+	
+	Audio_Timing_Sample history[AUDIO_TIMING_HISTORY_COUNT];
+	u64 mix_count;
+	f64 lock_wait_seconds_total;
+	u64 underruns;
+	u64 buffer_padding_frames_last;
+	u64 buffer_padding_frames_min;
+	u64 output_reports;
+	
+	// Mixing thread only
+	f64 last_mix_start;
+	f64 last_mix_audio_seconds;
+	
+	volatile bool reset_requested;
+} Audio_Timing;
+
+// #Global
+ogb_instance Audio_Timing audio_timing;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+Audio_Timing audio_timing = {0};
+#endif
+
+// Mixing thread only
+void
+audio_timing_begin_write() {
+	Audio_Timing *t = &audio_timing;
+	t->sequence += 1;
+	MEMORY_BARRIER;
+	
+	if (t->reset_requested) {
+		memset(t->history, 0, sizeof(t->history));
+		t->mix_count = 0;
+		t->lock_wait_seconds_total = 0;
+		t->underruns = 0;
+		t->buffer_padding_frames_last = 0;
+		t->buffer_padding_frames_min = 0;
+		t->output_reports = 0;
+		t->last_mix_start = 0;
+		t->last_mix_audio_seconds = 0;
+		t->reset_requested = false;
+	}
+}
+void
+audio_timing_end_write() {
+	MEMORY_BARRIER;
+	audio_timing.sequence += 1;
+}
+
+// Called by the output right before it asks for a mix, with the number of frames still
+// queued for playback. underrun is when it ran out of audio since the last mix.
+// Only call this while holding the mixer, see audio_mixer_try_acquire().
+void
+audio_timing_report_output(u64 padding_frames, bool underrun) {
+	Audio_Timing *t = &audio_timing;
+	audio_timing_begin_write();
+	
+	if (underrun) t->underruns += 1;
+	t->buffer_padding_frames_last = padding_frames;
+	if (t->output_reports == 0 || padding_frames < t->buffer_padding_frames_min) {
+		t->buffer_padding_frames_min = padding_frames;
+	}
+	t->output_reports += 1;
+	
+	audio_timing_end_write();
+	
+#if ENABLE_PROFILING
+	tm_counter("Audio buffer padding frames", padding_frames);
+	if (underrun) tm_counter("Audio underruns", t->underruns);
+#endif
+}
+
+// Mixing thread only
+void
+audio_timing_record_mix(f64 start_time, f64 end_time, u64 start_cycles, u64 end_cycles, 
+                        u64 lock_wait_cycles, u64 voices_mixed, f64 voice_seconds_total,
+                        u64 number_of_frames, Audio_Format format) {
+	Audio_Timing *t = &audio_timing;
+	audio_timing_begin_write();
+	
+	Audio_Timing_Sample sample = ZERO(Audio_Timing_Sample);
+	sample.mix_seconds = end_time-start_time;
+	sample.voices_mixed = voices_mixed;
+	sample.voice_seconds = voices_mixed > 0 ? voice_seconds_total/(f64)voices_mixed : 0;
+	
+	if (t->last_mix_start > 0) {
+		f64 period = start_time-t->last_mix_start;
+		sample.period_jitter_seconds = fabs(period-t->last_mix_audio_seconds);
+	}
+	
+	// There's no reliable cycle frequency to go by, so we measure it over the mix
+	if (lock_wait_cycles > 0 && end_cycles > start_cycles && end_time > start_time) {
+		f64 cycles_per_second = (f64)(end_cycles-start_cycles)/(end_time-start_time);
+		sample.lock_wait_seconds = (f64)lock_wait_cycles/cycles_per_second;
+	}
+	
+	t->history[t->mix_count % AUDIO_TIMING_HISTORY_COUNT] = sample;
+	t->mix_count += 1;
+	t->lock_wait_seconds_total += sample.lock_wait_seconds;
+	t->last_mix_start = start_time;
+	t->last_mix_audio_seconds = (f64)number_of_frames/(f64)format.sample_rate;
+	
+	audio_timing_end_write();
+	
+#if ENABLE_PROFILING
+	tm_counter("Audio mix microseconds", sample.mix_seconds*1000000.0);
+	tm_counter("Audio voices mixed", voices_mixed);
+	tm_counter("Audio period jitter microseconds", sample.period_jitter_seconds*1000000.0);
+#endif
+}
+
+// Stats are cleared before the next mix
+void
+audio_reset_timing_stats() {
+	audio_timing.reset_requested = true;
+}
+
+// Any thread
+Audio_Timing_Stats
+audio_get_timing_stats() {
+	Audio_Timing *t = &audio_timing;
+	
+	// The history is too big to copy to the stack every call
+	thread_local local_persist Audio_Timing_Sample history[AUDIO_TIMING_HISTORY_COUNT];
+	
+	Audio_Timing_Stats stats = ZERO(Audio_Timing_Stats);
+	
+	while (true) {
+		u64 sequence = t->sequence;
+		if (sequence & 1) {
+			os_yield_thread();
+			continue;
+		}
+		MEMORY_BARRIER;
+		
+		memcpy(history, t->history, sizeof(history));
+		stats.mix_count = t->mix_count;
+		stats.lock_wait_seconds_total = t->lock_wait_seconds_total;
+		stats.underruns = t->underruns;
+		stats.buffer_padding_frames_last = t->buffer_padding_frames_last;
+		stats.buffer_padding_frames_min = t->buffer_padding_frames_min;
+		
+		MEMORY_BARRIER;
+		if (t->sequence == sequence) break;
+	}
+	
+	u64 count = min(stats.mix_count, AUDIO_TIMING_HISTORY_COUNT);
+	if (count == 0) return stats;
+	
+	stats.voices_mixed_last = history[(stats.mix_count-1) % AUDIO_TIMING_HISTORY_COUNT].voices_mixed;
+	stats.mix_seconds_min = history[0].mix_seconds;
+	
+	f64 voice_seconds_total = 0;
+	u64 voice_seconds_count = 0;
+	
+	f64 mix_seconds[AUDIO_TIMING_HISTORY_COUNT];
+	for (u64 i = 0; i < count; i++) {
+		Audio_Timing_Sample *s = &history[i];
+		mix_seconds[i] = s->mix_seconds;
+		
+		stats.mix_seconds_min = min(stats.mix_seconds_min, s->mix_seconds);
+		stats.mix_seconds_max = max(stats.mix_seconds_max, s->mix_seconds);
+		stats.mix_seconds_avg += s->mix_seconds;
+		stats.period_jitter_seconds_max = max(stats.period_jitter_seconds_max, s->period_jitter_seconds);
+		stats.period_jitter_seconds_avg += s->period_jitter_seconds;
+		stats.voices_mixed_max = max(stats.voices_mixed_max, s->voices_mixed);
+		stats.voices_mixed_avg += (f64)s->voices_mixed;
+		stats.lock_wait_seconds_avg += s->lock_wait_seconds;
+		if (s->voices_mixed > 0) {
+			voice_seconds_total += s->voice_seconds;
+			voice_seconds_count += 1;
+		}
+	}
+	stats.mix_seconds_avg /= (f64)count;
+	stats.period_jitter_seconds_avg /= (f64)count;
+	stats.voices_mixed_avg /= (f64)count;
+	stats.lock_wait_seconds_avg /= (f64)count;
+	if (voice_seconds_count > 0) stats.voice_seconds_avg = voice_seconds_total/(f64)voice_seconds_count;
+	
+	sort_f64(mix_seconds, count);
+	stats.mix_seconds_p99 = mix_seconds[min((u64)((f64)count*0.99), count-1)];
+	
+	return stats;
+}
+
+// Mixes all players into output.
+// Whoever calls this must hold the mixer, see audio_mixer_try_acquire().
 void 
-do_program_audio_sample(u64 number_of_output_frames, Audio_Format out_format, 
-							 void *output) {
-							 
-	reset_temporary_storage();
+audio_mix_output(u64 number_of_output_frames, Audio_Format out_format, void *output) {
 							 
 	u64 out_comp_size  = get_audio_bit_width_byte_size(out_format.bit_width);
     u64 out_frame_size = out_comp_size * out_format.channels;
     u64 output_size    = number_of_output_frames * out_frame_size;
     
+	f64 mix_start_time = os_get_current_time_in_seconds();
+	u64 mix_start_cycles = rdtsc();
+	u64 lock_wait_start = get_thread_lock_wait_cycles();
+	
 	memset(output, 0, output_size);
 	
+	// Everything is mixed in f32 into the buses, and only converted to the output format at the end
+	Audio_Format bus_format = (Audio_Format){AUDIO_BITS_32, out_format.channels, out_format.sample_rate};
+	u64 bus_output_size = number_of_output_frames * sizeof(float32) * bus_format.channels;
+	
+	u64 epoch = audio_mix_begin();
+	
+	audio_buses_begin_mix(number_of_output_frames, bus_format);
+	
 	Audio_Player_Block *block = &audio_player_block;
 	
 	// #Cleanup #Memory refactor intermediate buffers
@@ -1681,24 +3775,23 @@ do_program_audio_sample(u64 number_of_output_frames, Audio_Format out_format,
 	u64 *started_this_frame;
 	growing_array_init((void**)&started_this_frame, sizeof(u64), get_temporary_allocator());
 	
+	Audio_Voice *voices;
+	growing_array_init((void**)&voices, sizeof(Audio_Voice), get_temporary_allocator());
+	
 	while (block) {
 		
 		for (u64 i = 0; i < AUDIO_PLAYERS_PER_BLOCK; i++) {
 			Audio_Player *p = &block->players[i];
-			if (p->release_when_done && (p->frame_index >= p->source.number_of_frames
-										  || !p->has_source)) {
-				p->allocated = false;
-			}
-			if (!p->allocated) {
+			if (!p->allocated || !p->has_source) {
 				continue;
 			}
-			
-			if (p->marked_for_release) {
-				p->marked_for_release = false;
-				p->allocated = false;
+			if (p->release_when_done && p->frame_index >= p->source.number_of_frames) {
+				audio_player_release_finished(p);
 				continue;
 			}
 			
+			p->is_virtual = false;
+			
 			if (p->state != AUDIO_PLAYER_STATE_PLAYING) {
 				if (p->fade_frames == 0) continue;
 			}
@@ -1708,182 +3801,512 @@ do_program_audio_sample(u64 number_of_output_frames, Audio_Format out_format,
 			
 			if (p->frame_index >= p->source.number_of_frames && !p->looping) continue;
 			
-			spinlock_acquire_or_wait(&p->sample_lock);
-			
-			Audio_Source src = p->source;
-			
-			mutex_acquire_or_wait(&src.mutex_for_destroy);
+			Audio_Voice voice = ZERO(Audio_Voice);
+			voice.player = p;
+			voice.score = audio_player_get_priority(p)*audio_player_get_audibility(p);
+			growing_array_add((void**)&voices, &voice);
+		}
+		
+		block = block->next;
+	}
+	
+	u64 voice_count = growing_array_get_valid_count(voices);
+	audio_select_voices(voices, voice_count);
+	
+	u64 voices_mixed = 0;
+	f64 voice_seconds_total = 0;
+	f64 voice_start_time = 0;
+	
+	for (u64 v = 0; v < voice_count; v++) {
+		Audio_Player *p = voices[v].player;
+		
+		if (voice_start_time > 0) {
+			// The last voice might have bailed early, so we time from one real voice to the next
+			voice_seconds_total += os_get_current_time_in_seconds()-voice_start_time;
+			voice_start_time = 0;
+		}
+		
+		if (voices[v].is_virtual) {
+			audio_player_advance_virtual(p, number_of_output_frames, bus_format);
+			continue;
+		}
+		
+		voices_mixed += 1;
+		voice_start_time = os_get_current_time_in_seconds();
+		
+		Audio_Source src = p->source;
 
-			Audio_Format sample_format = src.format;
-			sample_format.sample_rate = sample_format.sample_rate*p->config.playback_speed;
-			
-			bool need_convert = !bytes_match(
-				&out_format, 
-				&sample_format, 
-				sizeof(Audio_Format)
-			);
-			
-			u64 in_comp_size 
-				= get_audio_bit_width_byte_size(sample_format.bit_width);
-			
-			u64 in_frame_size = in_comp_size * sample_format.channels;
-			u64 input_size = number_of_output_frames * in_frame_size;
+		Audio_Format sample_format = src.format;
+		sample_format.sample_rate = sample_format.sample_rate*p->config.playback_speed;
+		
+		bool need_convert = !bytes_match(
+			&bus_format, 
+			&sample_format, 
+			sizeof(Audio_Format)
+		);
+		
+		u64 in_comp_size 
+			= get_audio_bit_width_byte_size(sample_format.bit_width);
+		
+		u64 in_frame_size = in_comp_size * sample_format.channels;
+		u64 input_size = number_of_output_frames * in_frame_size;
+		
+		// #Copypaste #Cleanup
+		u64 biggest_size = max(input_size, bus_output_size);
+		if (!mix_buffer || mix_buffer_size < biggest_size) {
+			u64 new_size = get_next_power_of_two(biggest_size);
+			if (mix_buffer) dealloc(get_heap_allocator(), mix_buffer);
+			mix_buffer = alloc(get_heap_allocator(), new_size);
+			mix_buffer_size = new_size;
+			memset(mix_buffer, 0, new_size);
+		}
+		
+		void *target_buffer = mix_buffer;
+		u64 number_of_sample_frames = number_of_output_frames;
+		
+		if (need_convert) {
+			if (sample_format.sample_rate != bus_format.sample_rate) {
+				f64 src_ratio 
+					= (f64)sample_format.sample_rate 
+					  / (f64)bus_format.sample_rate;
+					
+				number_of_sample_frames = round(number_of_output_frames * src_ratio);
+				input_size = number_of_sample_frames * in_frame_size;
+
+				// #Copypaste #Cleanup  we need to potentially grow the mix buffer again after we change input_size
+				u64 biggest_size = max(input_size, bus_output_size);
+				if (!mix_buffer || mix_buffer_size < biggest_size) {
+					u64 new_size = get_next_power_of_two(biggest_size);
+					if (mix_buffer) dealloc(get_heap_allocator(), mix_buffer);
+					mix_buffer = alloc(get_heap_allocator(), new_size);
+					mix_buffer_size = new_size;
+					memset(mix_buffer, 0, new_size);
+				}
+			}
 			
-			// #Copypaste #Cleanup
-			u64 biggest_size = max(input_size, output_size);
-			if (!mix_buffer || mix_buffer_size < biggest_size) {
+			u64 biggest_size = max(input_size, bus_output_size);
+			if (!convert_buffer || convert_buffer_size < biggest_size) {
 				u64 new_size = get_next_power_of_two(biggest_size);
-				if (mix_buffer) dealloc(get_heap_allocator(), mix_buffer);
-				mix_buffer = alloc(get_heap_allocator(), new_size);
-				mix_buffer_size = new_size;
-				memset(mix_buffer, 0, new_size);
+				if (convert_buffer) dealloc(get_heap_allocator(), convert_buffer);
+				convert_buffer = alloc(get_heap_allocator(), new_size);
+				convert_buffer_size = new_size;
+				memset(convert_buffer, 0, new_size);
 			}
+			target_buffer = convert_buffer;
 			
-			void *target_buffer = mix_buffer;
-			u64 number_of_sample_frames = number_of_output_frames;
+		}
+
+		// :PhaseCancellation
+		if (p->frame_index == 0) { // The players' source just started playing
+		
+			s64 existing_index = growing_array_find_index_from_left_by_value((void**)&started_this_frame, &src.uid);
 			
-			if (need_convert) {
-				if (sample_format.sample_rate != out_format.sample_rate) {
-					f64 src_ratio 
-						= (f64)sample_format.sample_rate 
-						  / (f64)out_format.sample_rate;
-						
-					number_of_sample_frames = round(number_of_output_frames * src_ratio);
-					input_size = number_of_sample_frames * in_frame_size;
-
-					// #Copypaste #Cleanup  we need to potentially grow the mix buffer again after we change input_size
-					u64 biggest_size = max(input_size, output_size);
-					if (!mix_buffer || mix_buffer_size < biggest_size) {
-						u64 new_size = get_next_power_of_two(biggest_size);
-						if (mix_buffer) dealloc(get_heap_allocator(), mix_buffer);
-						mix_buffer = alloc(get_heap_allocator(), new_size);
-						mix_buffer_size = new_size;
-						memset(mix_buffer, 0, new_size);
-					}
-				}
-				
-				u64 biggest_size = max(input_size, output_size);
-				if (!convert_buffer || convert_buffer_size < biggest_size) {
-					u64 new_size = get_next_power_of_two(biggest_size);
-					if (convert_buffer) dealloc(get_heap_allocator(), convert_buffer);
-					convert_buffer = alloc(get_heap_allocator(), new_size);
-					convert_buffer_size = new_size;
-					memset(convert_buffer, 0, new_size);
-				}
-				target_buffer = convert_buffer;
-				
+			if (existing_index != -1) {
+				// If this source already started playing this round from another player, then we pretend that
+				// we're already done playing by skipping to the last frame.
+				// For non-looping players, this means we don't play this instance at all.
+				// For looping players, this means we have a slight offset between the players that start
+				// playing at the exact same time. I'm not sure how else to deal with phase cancellation
+				// in looping players.
+				// #Incomplete player->is_muted_for_phase_cancellation ? 
+				p->frame_index = src.number_of_frames;
+				continue;
 			}
-	
-			// :PhaseCancellation
-			if (p->frame_index == 0) { // The players' source just started playing
+			growing_array_add((void**)&started_this_frame, &src.uid);
+		}
+
+		u64 last_frame_index = p->frame_index;
+		p->frame_index = audio_source_sample_next_frames_with_cursor(
+			&src,
+			p->cursor,
+			p->frame_index, 
+			number_of_sample_frames,
+			target_buffer,
+			p->looping
+		);
+		if (p->frame_index > last_frame_index && (p->looping || p->frame_index != src.number_of_frames)) {
+			assert(p->frame_index - last_frame_index == number_of_sample_frames);
+		}
+		
+		if (p->fade_frames > 0) {
+			u64 frames_to_fade = min(p->fade_frames, number_of_sample_frames);
 			
-				s64 existing_index = growing_array_find_index_from_left_by_value((void**)&started_this_frame, &src.uid);
-				
-				if (existing_index != -1) {
-					// If this source already started playing this round from another player, then we pretend that
-					// we're already done playing by skipping to the last frame.
-					// For non-looping players, this means we don't play this instance at all.
-					// For looping players, this means we have a slight offset between the players that start
-					// playing at the exact same time. I'm not sure how else to deal with phase cancellation
-					// in looping players.
-					// #Incomplete player->is_muted_for_phase_cancellation ? 
-					p->frame_index = src.number_of_frames;
-					continue;
-				}
-				growing_array_add((void**)&started_this_frame, &src.uid);
-			}
-	
-			u64 last_frame_index = p->frame_index;
-			p->frame_index = audio_source_sample_next_frames(
-				&src,
-				p->frame_index, 
-				number_of_sample_frames,
-				target_buffer,
-				p->looping
-			);
-			if (p->frame_index > last_frame_index && (p->looping || p->frame_index != src.number_of_frames)) {
-				assert(p->frame_index - last_frame_index == number_of_sample_frames);
-			}
+			u64 frames_faded_so_far = (p->fade_frames_total-p->fade_frames);
 			
-			if (p->fade_frames > 0) {
-				u64 frames_to_fade = min(p->fade_frames, number_of_sample_frames);
-				
-				u64 frames_faded_so_far = (p->fade_frames_total-p->fade_frames);
-				
-				switch (p->state) {
-					case AUDIO_PLAYER_STATE_PLAYING: {
-						// We need to fade in
-						float64 fade_from 
-							= (f64)frames_faded_so_far / (f64)p->fade_frames_total;
-							
-						float64 fade_to 
-							= (f64)(frames_faded_so_far + frames_to_fade) / (f64)p->fade_frames_total;
-						audio_apply_fade_in(
-							target_buffer, 
-							frames_to_fade, 
-							p->source.format, 
-							fade_from,
-							fade_to
-						);
-						break;
-					}
-					case AUDIO_PLAYER_STATE_PAUSED: {
-						// We need to fade out
-						// #Bug #Incomplete
-						// I can't get this to fade out without noise.
-						// I tried dithering but that didn't help.
-						float64 fade_from 
-							= 1.0 - (f64)frames_faded_so_far / (f64)p->fade_frames_total;
-							
-						float64 fade_to 
-							= 1.0 - (f64)(frames_faded_so_far + frames_to_fade) / (f64)p->fade_frames_total;
-						audio_apply_fade_out(
-							target_buffer, 
-							frames_to_fade, 
-							p->source.format, 
-							fade_from,
-							fade_to
-						);
-						break;
-					}
+			switch (p->state) {
+				case AUDIO_PLAYER_STATE_PLAYING: {
+					// We need to fade in
+					float64 fade_from 
+						= (f64)frames_faded_so_far / (f64)p->fade_frames_total;
+						
+					float64 fade_to 
+						= (f64)(frames_faded_so_far + frames_to_fade) / (f64)p->fade_frames_total;
+					audio_apply_fade_in(
+						target_buffer, 
+						frames_to_fade, 
+						p->source.format, 
+						fade_from,
+						fade_to
+					);
+					break;
 				}
-				
-				p->fade_frames -= frames_to_fade;
-				
-				if (frames_to_fade < number_of_sample_frames) {
-					memset(
-						(u8*)target_buffer+frames_to_fade, 
-						0, 
-						number_of_sample_frames-frames_to_fade
+				case AUDIO_PLAYER_STATE_PAUSED: {
+					// We need to fade out
+					// #Bug #Incomplete
+					// I can't get this to fade out without noise.
+					// I tried dithering but that didn't help.
+					float64 fade_from 
+						= 1.0 - (f64)frames_faded_so_far / (f64)p->fade_frames_total;
+						
+					float64 fade_to 
+						= 1.0 - (f64)(frames_faded_so_far + frames_to_fade) / (f64)p->fade_frames_total;
+					audio_apply_fade_out(
+						target_buffer, 
+						frames_to_fade, 
+						p->source.format, 
+						fade_from,
+						fade_to
 					);
+					break;
 				}
 			}
 			
-			spinlock_release(&p->sample_lock);
-						
-			if (need_convert) {
-				int converted = convert_frames(
-					mix_buffer, 
-					out_format, 
-					convert_buffer, 
-					sample_format,
-					number_of_output_frames
+			p->fade_frames -= frames_to_fade;
+			
+			if (frames_to_fade < number_of_sample_frames) {
+				memset(
+					(u8*)target_buffer+frames_to_fade, 
+					0, 
+					number_of_sample_frames-frames_to_fade
 				);
-				assert(converted == number_of_output_frames);
 			}
+		}
+		
+		if (need_convert) {
+			int converted = convert_frames(
+				mix_buffer, 
+				bus_format, 
+				convert_buffer, 
+				sample_format,
+				number_of_output_frames
+			);
+			assert(converted == number_of_output_frames);
+		}
 
-			if (p->config.enable_spacialization) {
-				apply_audio_spacialization(mix_buffer, out_format, number_of_output_frames, p->config.position_ndc);
-			}
-			if (p->config.volume != 0.0) {
-				apply_audio_volume(mix_buffer, out_format, number_of_output_frames, p->config.volume);
+		if (p->config.enable_spacialization) {
+			apply_audio_spacialization(mix_buffer, bus_format, number_of_output_frames, p->config.position_ndc);
+		}
+		if (p->config.volume != 0.0) {
+			apply_audio_volume(mix_buffer, bus_format, number_of_output_frames, p->config.volume);
+		}
+		
+		Audio_Bus *bus = audio_player_get_bus(p);
+		audio_dsp_accumulate(bus->buffer, mix_buffer, number_of_output_frames*bus_format.channels);
+	}
+	if (voice_start_time > 0) {
+		voice_seconds_total += os_get_current_time_in_seconds()-voice_start_time;
+	}
+	
+	audio_buses_end_mix(number_of_output_frames, bus_format, out_format, output);
+	
+	audio_timing_record_mix(
+		mix_start_time, 
+		os_get_current_time_in_seconds(), 
+		mix_start_cycles, 
+		rdtsc(), 
+		get_thread_lock_wait_cycles()-lock_wait_start,
+		voices_mixed,
+		voice_seconds_total,
+		number_of_output_frames,
+		out_format
+	);
+	
+	audio_mix_end(epoch);
+}
+
+// This is supposed to be called by OS layer audio thread whenever it wants more audio samples
+void 
+do_program_audio_sample(u64 number_of_output_frames, Audio_Format out_format, 
+							 void *output) {
+	reset_temporary_storage();
+	tm_scope("Audio mix") {
+		audio_mix_output(number_of_output_frames, out_format, output);
+	}
+}
+
+// For the OS layer to call instead of do_program_audio_sample() while there is no working
+// output device, so player commands and retired sources don't pile up.
+void
+audio_mix_idle() {
+	audio_mix_end(audio_mix_begin());
+}
+
+///
+///
+// Audio output
+///
+// Normally the OS layer pulls from the mixer whenever the audio device wants more frames.
+// The null output replaces the device with a thread that pulls from the mixer either as fast
+// as it can or on a simulated clock, and can record everything to a wav file. Use it for
+// benchmarking the mixer, running audio where there is no device (CI, headless) or rendering
+// audio to a file.
+// audio_render_offline() mixes on the calling thread instead, which is fully deterministic.
+
+typedef enum Audio_Output_Kind {
+	AUDIO_OUTPUT_DEVICE, // Default, OS audio device. Does nothing in headless.
+	AUDIO_OUTPUT_NULL,
+} Audio_Output_Kind;
+
+#define AUDIO_NULL_OUTPUT_DEFAULT_FRAMES_PER_MIX 512
+
+typedef struct Audio_Null_Output_Config {
+	Audio_Format format;  // Zero for audio_output_format
+	u64 frames_per_mix;   // Zero for AUDIO_NULL_OUTPUT_DEFAULT_FRAMES_PER_MIX
+	bool simulate_clock;  // Pace mixing like a device playing at format.sample_rate would. Otherwise as fast as possible.
+	u64 max_frames;       // Stop after this many frames. Zero to run until audio_output_stop_null()
+	string wav_path;      // If set, the output is recorded to this file
+} Audio_Null_Output_Config;
+
+typedef struct Audio_Null_Output {
+	Audio_Null_Output_Config config;
+	Thread thread;
+	File wav_file;
+	volatile bool running;
+	volatile bool should_stop;
+	volatile u64 frames_mixed;
+} Audio_Null_Output;
+
+// #Global
+ogb_instance volatile Audio_Output_Kind audio_output_kind;
+ogb_instance volatile bool audio_mixer_in_use;
+ogb_instance Audio_Null_Output audio_null_output;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+volatile Audio_Output_Kind audio_output_kind = AUDIO_OUTPUT_DEVICE;
+volatile bool audio_mixer_in_use = false;
+Audio_Null_Output audio_null_output = {0};
+#endif
+
+// Only one thread can mix at a time.
+// The device output only tries this when audio_output_kind is AUDIO_OUTPUT_DEVICE, and
+// outputs silence rather than waiting if it fails.
+bool
+audio_mixer_try_acquire() {
+	return compare_and_swap_bool(&audio_mixer_in_use, true, false);
+}
+void
+audio_mixer_release() {
+	MEMORY_BARRIER;
+	audio_mixer_in_use = false;
+}
+
+#ifdef OOGABOOGA_HEADLESS
+// There's no audio device in headless, so nothing would apply player commands, release finished
+// players or let retired sources be freed unless you render. The OS layer calls this from
+// os_update() instead. It doesn't mix, so release_when_done players stay around until
+// audio_render_offline() or the null output has played them to the end.
+void
+audio_update_headless() {
+	// Whoever has the mixer right now does all of this anyway
+	if (audio_mixer_try_acquire()) {
+		u64 epoch = audio_mix_begin();
+		
+		for (Audio_Player_Block *block = &audio_player_block; block; block = block->next) {
+			for (u64 i = 0; i < AUDIO_PLAYERS_PER_BLOCK; i++) {
+				Audio_Player *p = &block->players[i];
+				if (!p->allocated || !p->has_source || !p->release_when_done) continue;
+				if (p->frame_index < p->source.number_of_frames) continue;
+				audio_player_release_finished(p);
 			}
-			
-			mix_frames(output, mix_buffer, number_of_output_frames, out_format);
-			
-			mutex_release(&src.mutex_for_destroy);
 		}
 		
-		block = block->next;
+		audio_mix_end(epoch);
+		audio_mixer_release();
+	}
+	audio_collect_retired();
+}
+#endif
+
+// For when there is no audio device, i.e. headless.
+void
+audio_init_without_device() {
+	mutex_init(&audio_init_mutex);
+	audio_output_format.sample_rate = 48000;
+	audio_output_format.channels = 2;
+	audio_output_format.bit_width = AUDIO_BITS_32;
+}
+
+bool
+audio_write_wav_header(File f, Audio_Format format, u64 number_of_frames) {
+	u64 comp_size = get_audio_bit_width_byte_size(format.bit_width);
+	u32 data_size = (u32)(number_of_frames*comp_size*format.channels);
+	
+	u8 header[44];
+	memcpy(header, "RIFF", 4);
+	*(u32*)(header+4)  = 36 + data_size;
+	memcpy(header+8, "WAVEfmt ", 8);
+	*(u32*)(header+16) = 16;
+	*(u16*)(header+20) = format.bit_width == AUDIO_BITS_32 ? 0x0003 : 0x0001; // f32 or s16
+	*(u16*)(header+22) = (u16)format.channels;
+	*(u32*)(header+24) = (u32)format.sample_rate;
+	*(u32*)(header+28) = (u32)(format.sample_rate*comp_size*format.channels);
+	*(u16*)(header+32) = (u16)(comp_size*format.channels);
+	*(u16*)(header+34) = (u16)(comp_size*8);
+	memcpy(header+36, "data", 4);
+	*(u32*)(header+40) = data_size;
+	
+	return os_file_write_bytes(f, header, sizeof(header));
+}
+
+bool
+audio_write_wav_file(string path, void *frames, u64 number_of_frames, Audio_Format format) {
+	File f = os_file_open(path, O_WRITE | O_CREATE);
+	if (f == OS_INVALID_FILE) return false;
+	
+	u64 frame_size = get_audio_bit_width_byte_size(format.bit_width)*format.channels;
+	
+	bool ok = audio_write_wav_header(f, format, number_of_frames)
+	       && os_file_write_bytes(f, frames, number_of_frames*frame_size);
+	
+	os_file_close(f);
+	return ok;
+}
+
+void
+audio_null_output_thread(Thread *t) {
+	Audio_Null_Output *o = &audio_null_output;
+	Audio_Format format = o->config.format;
+	
+	u64 frame_size = get_audio_bit_width_byte_size(format.bit_width)*format.channels;
+	void *buffer = alloc(get_heap_allocator(), o->config.frames_per_mix*frame_size);
+	
+	f64 start_time = os_get_current_time_in_seconds();
+	
+	while (!o->should_stop) {
+		u64 number_of_frames = o->config.frames_per_mix;
+		if (o->config.max_frames) {
+			if (o->frames_mixed >= o->config.max_frames) break;
+			number_of_frames = min(number_of_frames, o->config.max_frames-o->frames_mixed);
+		}
+		
+		f64 due = 0;
+		if (o->config.simulate_clock) {
+			// A device asks for the next frames about when the last ones start playing
+			due = start_time + (f64)o->frames_mixed/(f64)format.sample_rate;
+			f64 now = os_get_current_time_in_seconds();
+			if (due > now) os_high_precision_sleep((due-now)*1000.0);
+		}
+		
+		while (!audio_mixer_try_acquire()) os_yield_thread();
+		if (o->config.simulate_clock) {
+			// Like a device with only one mix worth of buffer: late means it ran dry
+			f64 late = os_get_current_time_in_seconds()-due;
+			f64 period = (f64)o->config.frames_per_mix/(f64)format.sample_rate;
+			u64 padding_frames = late < 0 ? (u64)(-late*(f64)format.sample_rate) : 0;
+			bool underrun = o->frames_mixed > 0 && late > period;
+			audio_timing_report_output(padding_frames, underrun);
+		}
+		do_program_audio_sample(number_of_frames, format, buffer);
+		audio_mixer_release();
+		
+		if (o->wav_file != OS_INVALID_FILE) {
+			os_file_write_bytes(o->wav_file, buffer, number_of_frames*frame_size);
+		}
+		
+		o->frames_mixed += number_of_frames;
+	}
+	
+	dealloc(get_heap_allocator(), buffer);
+	
+	o->running = false;
+}
+
+// Takes over from the device output until audio_output_stop_null()
+bool
+audio_output_start_null(Audio_Null_Output_Config config) {
+	Audio_Null_Output *o = &audio_null_output;
+	if (o->running) {
+		log_error("Null audio output is already running");
+		return false;
 	}
+	
+	if (config.format.sample_rate == 0) {
+		mutex_acquire_or_wait(&audio_init_mutex);
+		config.format = audio_output_format;
+		mutex_release(&audio_init_mutex);
+	}
+	if (config.frames_per_mix == 0) config.frames_per_mix = AUDIO_NULL_OUTPUT_DEFAULT_FRAMES_PER_MIX;
+	
+	*o = ZERO(Audio_Null_Output);
+	o->config = config;
+	o->wav_file = OS_INVALID_FILE;
+	
+	if (config.wav_path.count > 0) {
+		o->wav_file = os_file_open(config.wav_path, O_WRITE | O_CREATE);
+		if (o->wav_file == OS_INVALID_FILE) {
+			log_error("Could not open '%s' to record null audio output", config.wav_path);
+			return false;
+		}
+		// Sizes are filled in when we stop
+		audio_write_wav_header(o->wav_file, config.format, 0);
+	}
+	
+	audio_output_kind = AUDIO_OUTPUT_NULL;
+	
+	o->running = true;
+	os_thread_init(&o->thread, audio_null_output_thread);
+	os_thread_start(&o->thread);
+	
+	return true;
+}
+
+// Stops the null output and gives the mixer back to the device output.
+// Also call this when the null output stopped by itself after max_frames, to finish the wav file.
+void
+audio_output_stop_null() {
+	Audio_Null_Output *o = &audio_null_output;
+	if (o->thread.proc == 0) return;
+	
+	o->should_stop = true;
+	os_thread_join(&o->thread);
+	
+	if (o->wav_file != OS_INVALID_FILE) {
+		os_file_set_pos(o->wav_file, 0);
+		audio_write_wav_header(o->wav_file, o->config.format, o->frames_mixed);
+		os_file_close(o->wav_file);
+	}
+	
+	u64 frames_mixed = o->frames_mixed;
+	*o = ZERO(Audio_Null_Output);
+	o->frames_mixed = frames_mixed;
+	
+	audio_output_kind = AUDIO_OUTPUT_DEVICE;
+}
+
+// Mixes number_of_frames into output on the calling thread.
+// Nothing else mixes in the meantime, so the result only depends on what you did with the
+// players before this.
+bool
+audio_render_offline(void *output, u64 number_of_frames, Audio_Format format) {
+	if (audio_null_output.running) {
+		log_error("Can't render audio offline while the null output is running");
+		return false;
+	}
+	
+	Audio_Output_Kind last_kind = audio_output_kind;
+	audio_output_kind = AUDIO_OUTPUT_NULL;
+	
+	// Waits for the device output to finish its current mix
+	while (!audio_mixer_try_acquire()) os_yield_thread();
+	
+	// We don't want to reset the callers temporary storage
+	void *temp_pointer = temporary_storage_pointer;
+	audio_mix_output(number_of_frames, format, output);
+	temporary_storage_pointer = temp_pointer;
+	
+	audio_mixer_release();
+	
+	audio_output_kind = last_kind;
+	
+	return true;
 }
@@ -1,8 +1,6 @@
 
 
 
-#define local_persist static
-
 #define forward_global extern
 
 #define alignas _Alignas
@@ -114,6 +112,12 @@ alloc_uninitialized(Allocator allocator, u64 size);
 ogb_instance void 
 dealloc(Allocator allocator, void *p);
 
+// Resizes p to new_size, in place when the allocator can manage it.
+// Allocators that don't handle ALLOCATOR_REALLOCATE (return 0) fall back to alloc + copy + dealloc,
+// which is why old_size is needed.
+ogb_instance void* 
+reallocate(Allocator allocator, void *p, u64 old_size, u64 new_size);
+
 ogb_instance void 
 push_context(Context c);
 
@@ -151,6 +155,23 @@ dealloc(Allocator allocator, void *p) {
 	allocator.proc(0, p, ALLOCATOR_DEALLOCATE, allocator.data);
 }
 
+void* 
+reallocate(Allocator allocator, void *p, u64 old_size, u64 new_size) {
+	assert(new_size > 0, "You requested a reallocation to zero bytes. Use dealloc for that.");
+	if (!p) return alloc(allocator, new_size);
+	
+	void *new = allocator.proc(new_size, p, ALLOCATOR_REALLOCATE, allocator.data);
+	if (!new) {
+		new = allocator.proc(new_size, 0, ALLOCATOR_ALLOCATE, allocator.data);
+		memcpy(new, p, min(old_size, new_size));
+		dealloc(allocator, p);
+	}
+#if DO_ZERO_INITIALIZATION
+	if (new_size > old_size) memset((u8*)new+old_size, 0, new_size-old_size);
+#endif
+	return new;
+}
+
 void 
 push_context(Context c) {
 	assert(num_contexts < CONTEXT_STACK_MAX, "Context stack overflow");
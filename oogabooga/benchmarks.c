@@ -0,0 +1,1504 @@
+
+/*
+
+	Benchmarks
+
+	build_benchmarks.c is the benchmark target, it's headless so it runs on Linux too.
+
+	A benchmark proc does its work b->iterations times and sets how many items (and bytes,
+	if it makes sense) one iteration processes:
+
+		void bench_my_thing(Benchmark_State *b) {
+			My_Data *data = make_data();
+			benchmark_reset_timer(b); // Don't count setup
+
+			for (u64 i = 0; i < b->iterations; i++) {
+				do_my_thing(data);
+			}
+
+			b->items_per_iteration = data->count;
+		}
+
+		register_benchmark("my thing", bench_my_thing, 0, 0);
+
+	Expensive setup which should happen once rather than per sample goes in the setup proc,
+	whatever it returns is passed on in b->data and to the teardown proc.
+
+	Per benchmark:
+		- Warmup & calibration: iterations double until one sample takes BENCHMARK_SAMPLE_SECONDS.
+		- Then samples are taken until BENCHMARK_SECONDS or BENCHMARK_MAX_SAMPLES.
+		- Reported per iteration: median, p10 & p90 time, plus cycles per item and throughput.
+
+	Results are written as JSON (one benchmark per line). If there's a baseline file, which is
+	just a results file from an earlier run, benchmarks are compared against it. A benchmark
+	regressed if its median is more than BENCHMARK_REGRESSION_TOLERANCE slower AND its p10 is
+	slower than the baseline p90, so noise doesn't get flagged.
+
+	Command line:
+		--filter <text>     Only run benchmarks with text in their name
+		--out <path>        Results file (default benchmark_results.json)
+		--baseline <path>   Baseline file (default benchmark_baseline.json, if it exists)
+		--draw-frame <path> Also benchmark the quad pipeline on a draw frame capture (see quad_pipeline.c)
+
+*/
+
+#ifndef BENCHMARK_SAMPLE_SECONDS
+	#define BENCHMARK_SAMPLE_SECONDS 0.005
+#endif
+#ifndef BENCHMARK_SECONDS
+	#define BENCHMARK_SECONDS 0.5
+#endif
+#ifndef BENCHMARK_REGRESSION_TOLERANCE
+	#define BENCHMARK_REGRESSION_TOLERANCE 0.05
+#endif
+#define BENCHMARK_MIN_SAMPLES 5
+#define BENCHMARK_MAX_SAMPLES 256
+#define BENCHMARK_MAX 256
+
+typedef struct Benchmark_State {
+	u64 iterations;
+	u64 items_per_iteration; // Set by the benchmark, 1 by default
+	u64 bytes_per_iteration; // Set by the benchmark for throughput in bytes, 0 by default
+	void *data; // From the setup proc
+
+	u64 start_cycles;
+	u64 end_cycles;
+	u64 paused_cycles;
+	u64 pause_start_cycles;
+} Benchmark_State;
+
+typedef void(*Benchmark_Proc)(Benchmark_State *b);
+typedef void*(*Benchmark_Setup_Proc)();
+typedef void(*Benchmark_Teardown_Proc)(void *data);
+
+typedef struct Benchmark {
+	string name;
+	Benchmark_Proc proc;
+	Benchmark_Setup_Proc setup;
+	Benchmark_Teardown_Proc teardown;
+} Benchmark;
+
+typedef struct Benchmark_Result {
+	string name;
+	u64 iterations; // Per sample
+	u64 samples;
+	u64 items_per_iteration;
+	u64 bytes_per_iteration;
+	// Per iteration
+	float64 median_ns;
+	float64 p10_ns;
+	float64 p90_ns;
+	float64 median_cycles;
+
+	float64 cycles_per_item;
+	float64 items_per_second;
+	float64 bytes_per_second;
+
+	bool has_baseline;
+	float64 baseline_median_ns;
+	float64 baseline_p90_ns;
+	float64 change; // Median vs baseline median, 0.1 is 10% slower
+	bool regressed;
+	bool improved;
+} Benchmark_Result;
+
+typedef struct Benchmark_Options {
+	string filter;
+	string out_path;
+	string baseline_path;
+} Benchmark_Options;
+
+Benchmark benchmarks[BENCHMARK_MAX];
+u64 benchmark_count = 0;
+
+// Store results here so the compiler can't optimize away the work that produced them
+volatile u64 benchmark_sink;
+volatile float32 benchmark_float_sink;
+
+void
+register_benchmark(const char *name, Benchmark_Proc proc, Benchmark_Setup_Proc setup, Benchmark_Teardown_Proc teardown) {
+	assert(benchmark_count < BENCHMARK_MAX, "Too many benchmarks (max %d)", BENCHMARK_MAX);
+	benchmarks[benchmark_count] = (Benchmark){STR(name), proc, setup, teardown};
+	benchmark_count += 1;
+}
+
+// Restarts the timer, for excluding setup in the proc
+inline void
+benchmark_reset_timer(Benchmark_State *b) {
+	b->paused_cycles = 0;
+	b->start_cycles = rdtsc();
+}
+// Stops the timer, for excluding cleanup in the proc
+inline void
+benchmark_stop_timer(Benchmark_State *b) {
+	b->end_cycles = rdtsc();
+}
+// For excluding work in between iterations, like refilling data to sort.
+// Costs an rdtsc each, so keep it out of very short iterations.
+inline void
+benchmark_pause(Benchmark_State *b) {
+	b->pause_start_cycles = rdtsc();
+}
+inline void
+benchmark_resume(Benchmark_State *b) {
+	b->paused_cycles += rdtsc()-b->pause_start_cycles;
+}
+
+// Returns cycles per iteration
+float64
+benchmark_run_sample(Benchmark *bench, void *data, u64 iterations, Benchmark_State *b) {
+	*b = ZERO(Benchmark_State);
+	b->iterations = iterations;
+	b->items_per_iteration = 1;
+	b->data = data;
+
+	b->start_cycles = rdtsc();
+	bench->proc(b);
+	if (!b->end_cycles) b->end_cycles = rdtsc();
+
+	return (float64)(b->end_cycles-b->start_cycles-b->paused_cycles)/(float64)iterations;
+}
+
+Benchmark_Result
+run_benchmark(Benchmark *bench) {
+	float64 cycles_per_second = get_tsc_frequency();
+	float64 ns_per_cycle = 1000000000.0/cycles_per_second;
+
+	void *data = bench->setup ? bench->setup() : 0;
+	Benchmark_State b;
+
+	// Calibrate, which also warms up caches, branch predictors & the heap
+	u64 iterations = 1;
+	while (true) {
+		float64 cycles = benchmark_run_sample(bench, data, iterations, &b)*(float64)iterations;
+		if (cycles/cycles_per_second >= BENCHMARK_SAMPLE_SECONDS || iterations >= (1ull << 40)) break;
+		iterations *= 2;
+	}
+
+	float64 samples[BENCHMARK_MAX_SAMPLES];
+	u64 sample_count = 0;
+	float64 start_seconds = os_get_current_time_in_seconds();
+	while (sample_count < BENCHMARK_MAX_SAMPLES) {
+		samples[sample_count] = benchmark_run_sample(bench, data, iterations, &b);
+		sample_count += 1;
+		if (sample_count >= BENCHMARK_MIN_SAMPLES && os_get_current_time_in_seconds()-start_seconds >= BENCHMARK_SECONDS) break;
+	}
+
+	if (bench->teardown) bench->teardown(data);
+
+	// Insertion sort, there are only a few hundred at most
+	for (u64 i = 1; i < sample_count; i++) {
+		float64 s = samples[i];
+		u64 j = i;
+		while (j > 0 && samples[j-1] > s) {
+			samples[j] = samples[j-1];
+			j -= 1;
+		}
+		samples[j] = s;
+	}
+
+	Benchmark_Result r = ZERO(Benchmark_Result);
+	r.name = bench->name;
+	r.iterations = iterations;
+	r.samples = sample_count;
+	r.items_per_iteration = max(b.items_per_iteration, 1);
+	r.bytes_per_iteration = b.bytes_per_iteration;
+
+	r.median_cycles = samples[sample_count/2];
+	r.median_ns = r.median_cycles*ns_per_cycle;
+	r.p10_ns = samples[(u64)((float64)(sample_count-1)*0.1+0.5)]*ns_per_cycle;
+	r.p90_ns = samples[(u64)((float64)(sample_count-1)*0.9+0.5)]*ns_per_cycle;
+
+	r.cycles_per_item = r.median_cycles/(float64)r.items_per_iteration;
+	r.items_per_second = (float64)r.items_per_iteration/(r.median_ns/1000000000.0);
+	r.bytes_per_second = (float64)r.bytes_per_iteration/(r.median_ns/1000000000.0);
+
+	return r;
+}
+
+// We only read back what benchmark_write_results() writes, so this doesn't need to be more
+// than digits with an optional sign and fraction.
+float64
+benchmark_parse_float64(string s) {
+	u64 i = 0;
+	float64 sign = 1.0;
+	if (i < s.count && s.data[i] == '-') {
+		sign = -1.0;
+		i += 1;
+	}
+	float64 value = 0;
+	while (i < s.count && s.data[i] >= '0' && s.data[i] <= '9') {
+		value = value*10.0 + (float64)(s.data[i]-'0');
+		i += 1;
+	}
+	if (i < s.count && s.data[i] == '.') {
+		i += 1;
+		float64 scale = 0.1;
+		while (i < s.count && s.data[i] >= '0' && s.data[i] <= '9') {
+			value += (float64)(s.data[i]-'0')*scale;
+			scale *= 0.1;
+			i += 1;
+		}
+	}
+	return value*sign;
+}
+
+// Finds "key": in line and parses the number after it
+bool
+benchmark_find_json_number(string line, string key, float64 *result) {
+	s64 index = string_find_from_left(line, key);
+	if (index < 0) return false;
+	*result = benchmark_parse_float64(string_view(line, index+key.count, line.count-index-key.count));
+	return true;
+}
+
+void
+benchmark_compare_with_baseline(Benchmark_Result *results, u64 result_count, string baseline) {
+	string name_key = STR("\"name\":\"");
+
+	u64 line_start = 0;
+	for (u64 i = 0; i <= baseline.count; i++) {
+		if (i < baseline.count && baseline.data[i] != '\n') continue;
+		string line = string_view(baseline, line_start, i-line_start);
+		line_start = i+1;
+
+		s64 name_index = string_find_from_left(line, name_key);
+		if (name_index < 0) continue;
+		string name = string_view(line, name_index+name_key.count, line.count-name_index-name_key.count);
+		s64 name_end = string_find_from_left(name, STR("\""));
+		if (name_end < 0) continue;
+		name.count = name_end;
+
+		for (u64 j = 0; j < result_count; j++) {
+			Benchmark_Result *r = &results[j];
+			if (!strings_match(r->name, name)) continue;
+
+			if (!benchmark_find_json_number(line, STR("\"median_ns\":"), &r->baseline_median_ns)) break;
+			if (!benchmark_find_json_number(line, STR("\"p90_ns\":"), &r->baseline_p90_ns)) break;
+			float64 baseline_p10_ns = 0;
+			if (!benchmark_find_json_number(line, STR("\"p10_ns\":"), &baseline_p10_ns)) break;
+			if (r->baseline_median_ns <= 0) break;
+
+			r->has_baseline = true;
+			r->change = r->median_ns/r->baseline_median_ns-1.0;
+			r->regressed = r->change >  BENCHMARK_REGRESSION_TOLERANCE && r->p10_ns > r->baseline_p90_ns;
+			r->improved  = r->change < -BENCHMARK_REGRESSION_TOLERANCE && r->p90_ns < baseline_p10_ns;
+			break;
+		}
+	}
+}
+
+void
+benchmark_write_results(String_Builder *builder, Benchmark_Result *results, u64 result_count) {
+	Cpu_Capabilities cpu = query_cpu_capabilities();
+	string_builder_print(builder, STR("{\n\"tsc_frequency\":%.0f,\n\"avx2\":%cs,\n\"benchmarks\":[\n"), get_tsc_frequency(), cpu.avx2 ? "true" : "false");
+	for (u64 i = 0; i < result_count; i++) {
+		Benchmark_Result r = results[i];
+		string_builder_print(builder,
+			STR("{\"name\":\"%s\",\"iterations\":%llu,\"samples\":%llu,\"items_per_iteration\":%llu,\"bytes_per_iteration\":%llu,\"median_ns\":%.3f,\"p10_ns\":%.3f,\"p90_ns\":%.3f,\"median_cycles\":%.3f,\"cycles_per_item\":%.3f,\"items_per_second\":%.3f,\"bytes_per_second\":%.3f}%cs\n"),
+			r.name, r.iterations, r.samples, r.items_per_iteration, r.bytes_per_iteration,
+			r.median_ns, r.p10_ns, r.p90_ns, r.median_cycles, r.cycles_per_item,
+			r.items_per_second, r.bytes_per_second, i+1 < result_count ? "," : "");
+	}
+	string_builder_append(builder, STR("]\n}\n"));
+}
+
+string
+benchmark_format_time(float64 ns) {
+	if (ns < 1000.0)       return tprint("%.1fns", ns);
+	if (ns < 1000000.0)    return tprint("%.2fus", ns/1000.0);
+	if (ns < 1000000000.0) return tprint("%.2fms", ns/1000000.0);
+	return tprint("%.2fs", ns/1000000000.0);
+}
+
+void
+benchmark_print_result(Benchmark_Result r) {
+	print("%s", r.name);
+	for (u64 i = r.name.count; i < 40; i++) print(" ");
+	print(" %s (p10 %s, p90 %s)  %.2f cycles/item",
+		benchmark_format_time(r.median_ns), benchmark_format_time(r.p10_ns), benchmark_format_time(r.p90_ns),
+		r.cycles_per_item);
+	if (r.bytes_per_iteration) print("  %.2f GB/s", r.bytes_per_second/1000000000.0);
+	else                       print("  %.2f M items/s", r.items_per_second/1000000.0);
+	if (r.has_baseline) {
+		print("  %+.1f%%", r.change*100.0);
+		if (r.regressed) print(" REGRESSION");
+		if (r.improved)  print(" improved");
+	}
+	print("\n");
+}
+
+// Returns number of regressions
+u64
+run_benchmarks(Benchmark_Options options) {
+	Allocator heap = get_heap_allocator();
+
+	string baseline = ZERO(string);
+	bool has_baseline = options.baseline_path.count && os_read_entire_file(options.baseline_path, &baseline, heap);
+	if (has_baseline) print("Comparing against baseline %s\n", options.baseline_path);
+
+	Benchmark_Result *results = (Benchmark_Result*)alloc(heap, sizeof(Benchmark_Result)*max(benchmark_count, 1));
+	u64 result_count = 0;
+	u64 regressions = 0;
+
+	for (u64 i = 0; i < benchmark_count; i++) {
+		Benchmark *bench = &benchmarks[i];
+		if (options.filter.count && string_find_from_left(bench->name, options.filter) < 0) continue;
+
+		reset_temporary_storage();
+
+		Benchmark_Result *r = &results[result_count];
+		*r = run_benchmark(bench);
+		result_count += 1;
+		if (has_baseline) benchmark_compare_with_baseline(r, 1, baseline);
+		if (r->regressed) regressions += 1;
+
+		benchmark_print_result(*r);
+	}
+
+	if (options.out_path.count) {
+		String_Builder json;
+		string_builder_init(&json, heap);
+		benchmark_write_results(&json, results, result_count);
+		bool ok = os_write_entire_file(options.out_path, json.result);
+		if (ok) print("Wrote benchmark results to %s\n", options.out_path);
+		else    log_error("Failed writing benchmark results to %s", options.out_path);
+		dealloc(heap, json.buffer);
+	}
+
+	if (regressions) log_error("%llu benchmarks regressed", regressions);
+
+	dealloc(heap, results);
+	if (has_baseline) dealloc_string(heap, baseline);
+
+	return regressions;
+}
+
+///
+///
+// The oogabooga benchmarks
+
+void
+bench_heap_alloc_free_64(Benchmark_State *b) {
+	Allocator heap = get_heap_allocator();
+	for (u64 i = 0; i < b->iterations; i++) {
+		dealloc(heap, alloc(heap, 64));
+	}
+}
+
+void
+bench_heap_alloc_free_mixed(Benchmark_State *b) {
+	Allocator heap = get_heap_allocator();
+	const u64 count = 64;
+	void *pointers[64];
+	u64 sizes[64];
+	u64 seed = 12345;
+	for (u64 i = 0; i < count; i++) {
+		seed = seed*6364136223846793005ull + 1442695040888963407ull;
+		sizes[i] = 16 + (seed >> 33) % 4096;
+	}
+	benchmark_reset_timer(b);
+
+	for (u64 i = 0; i < b->iterations; i++) {
+		for (u64 j = 0; j < count; j++) pointers[j] = alloc(heap, sizes[j]);
+		// Free every other first so the free list gets fragmented
+		for (u64 j = 0; j < count; j += 2) dealloc(heap, pointers[j]);
+		for (u64 j = 1; j < count; j += 2) dealloc(heap, pointers[j]);
+	}
+	b->items_per_iteration = count;
+}
+
+#define BENCH_HASH_TABLE_COUNT 10000
+
+void
+bench_hash_table_add(Benchmark_State *b) {
+	for (u64 i = 0; i < b->iterations; i++) {
+		Hash_Table table = make_hash_table(u64, u64, get_heap_allocator());
+		for (u64 key = 0; key < BENCH_HASH_TABLE_COUNT; key++) {
+			u64 value = key*2;
+			hash_table_add(&table, key, value);
+		}
+		hash_table_destroy(&table);
+	}
+	b->items_per_iteration = BENCH_HASH_TABLE_COUNT;
+}
+
+void*
+bench_hash_table_find_setup() {
+	Hash_Table *table = (Hash_Table*)alloc(get_heap_allocator(), sizeof(Hash_Table));
+	*table = make_hash_table(u64, u64, get_heap_allocator());
+	for (u64 key = 0; key < BENCH_HASH_TABLE_COUNT; key++) {
+		u64 value = key*2;
+		hash_table_add(table, key, value);
+	}
+	return table;
+}
+void
+bench_hash_table_find_teardown(void *data) {
+	hash_table_destroy((Hash_Table*)data);
+	dealloc(get_heap_allocator(), data);
+}
+void
+bench_hash_table_find(Benchmark_State *b) {
+	Hash_Table *table = (Hash_Table*)b->data;
+	u64 sum = 0;
+	for (u64 i = 0; i < b->iterations; i++) {
+		for (u64 key = 0; key < BENCH_HASH_TABLE_COUNT; key++) {
+			sum += *(u64*)hash_table_find(table, key);
+		}
+	}
+	benchmark_sink = sum;
+	b->items_per_iteration = BENCH_HASH_TABLE_COUNT;
+}
+
+void
+bench_growing_array_add(Benchmark_State *b) {
+	const u64 count = 100000;
+	for (u64 i = 0; i < b->iterations; i++) {
+		u32 *array;
+		growing_array_init((void**)&array, sizeof(u32), get_heap_allocator());
+		for (u32 j = 0; j < count; j++) growing_array_add((void**)&array, &j);
+		growing_array_deinit((void**)&array);
+	}
+	b->items_per_iteration = count;
+	b->bytes_per_iteration = count*sizeof(u32);
+}
+
+void
+bench_array_push(Benchmark_State *b) {
+	const u64 count = 100000;
+	for (u64 i = 0; i < b->iterations; i++) {
+		Array(u32) array;
+		array_init(&array, get_heap_allocator());
+		for (u32 j = 0; j < count; j++) array_push(&array, j);
+		array_deinit(&array);
+	}
+	b->items_per_iteration = count;
+	b->bytes_per_iteration = count*sizeof(u32);
+}
+
+#define BENCH_FIND_COUNT 4096
+
+// Searches for every 64th item so most of the array is scanned on average
+void
+bench_growing_array_find(Benchmark_State *b) {
+	u32 *array;
+	growing_array_init_reserve((void**)&array, sizeof(u32), BENCH_FIND_COUNT, get_heap_allocator());
+	for (u32 j = 0; j < BENCH_FIND_COUNT; j++) growing_array_add((void**)&array, &j);
+	
+	benchmark_reset_timer(b);
+	s64 sum = 0;
+	for (u64 i = 0; i < b->iterations; i++) {
+		for (u32 j = 0; j < BENCH_FIND_COUNT; j += 64) {
+			sum += growing_array_find_index_from_left_by_value((void**)&array, &j);
+		}
+	}
+	benchmark_stop_timer(b);
+	benchmark_sink = sum;
+	
+	growing_array_deinit((void**)&array);
+	b->items_per_iteration = BENCH_FIND_COUNT/64;
+	b->bytes_per_iteration = (BENCH_FIND_COUNT/64)*(BENCH_FIND_COUNT/2)*sizeof(u32);
+}
+void
+bench_array_find(Benchmark_State *b) {
+	Array(u32) array;
+	array_init_reserve(&array, BENCH_FIND_COUNT, get_heap_allocator());
+	for (u32 j = 0; j < BENCH_FIND_COUNT; j++) array_push(&array, j);
+	
+	benchmark_reset_timer(b);
+	s64 sum = 0;
+	for (u64 i = 0; i < b->iterations; i++) {
+		for (u32 j = 0; j < BENCH_FIND_COUNT; j += 64) {
+			sum += array_find(&array, &j);
+		}
+	}
+	benchmark_stop_timer(b);
+	benchmark_sink = sum;
+	
+	array_deinit(&array);
+	b->items_per_iteration = BENCH_FIND_COUNT/64;
+	b->bytes_per_iteration = (BENCH_FIND_COUNT/64)*(BENCH_FIND_COUNT/2)*sizeof(u32);
+}
+
+#define BENCH_SORT_COUNT 10000
+
+void
+bench_fill_quads_to_sort(Draw_Quad *quads, u64 count) {
+	u64 seed = 54321;
+	for (u64 i = 0; i < count; i++) {
+		seed = seed*6364136223846793005ull + 1442695040888963407ull;
+		quads[i].z = (s32)((seed >> 33) % (1 << (MAX_Z_BITS-1)));
+	}
+}
+void
+bench_radix_sort(Benchmark_State *b) {
+	Draw_Quad *quads = (Draw_Quad*)alloc(get_heap_allocator(), BENCH_SORT_COUNT*2*sizeof(Draw_Quad));
+	for (u64 i = 0; i < b->iterations; i++) {
+		benchmark_pause(b);
+		bench_fill_quads_to_sort(quads, BENCH_SORT_COUNT);
+		benchmark_resume(b);
+		radix_sort(quads, quads+BENCH_SORT_COUNT, BENCH_SORT_COUNT, sizeof(Draw_Quad), offsetof(Draw_Quad, z), MAX_Z_BITS);
+	}
+	benchmark_stop_timer(b);
+	dealloc(get_heap_allocator(), quads);
+	b->items_per_iteration = BENCH_SORT_COUNT;
+}
+int
+bench_compare_quads(const void *a, const void *b) {
+	return ((Draw_Quad*)a)->z-((Draw_Quad*)b)->z;
+}
+void
+bench_merge_sort(Benchmark_State *b) {
+	Draw_Quad *quads = (Draw_Quad*)alloc(get_heap_allocator(), BENCH_SORT_COUNT*2*sizeof(Draw_Quad));
+	for (u64 i = 0; i < b->iterations; i++) {
+		benchmark_pause(b);
+		bench_fill_quads_to_sort(quads, BENCH_SORT_COUNT);
+		benchmark_resume(b);
+		merge_sort(quads, quads+BENCH_SORT_COUNT, BENCH_SORT_COUNT, sizeof(Draw_Quad), bench_compare_quads);
+	}
+	benchmark_stop_timer(b);
+	dealloc(get_heap_allocator(), quads);
+	b->items_per_iteration = BENCH_SORT_COUNT;
+}
+#define _bench_quad_z(q) ((q).z)
+define_sort_by_key(bench_sort_quads_by_z, Draw_Quad, _bench_quad_z);
+void
+bench_sort_quads_by_key(Benchmark_State *b) {
+	Draw_Quad *quads = (Draw_Quad*)alloc(get_heap_allocator(), BENCH_SORT_COUNT*sizeof(Draw_Quad));
+	for (u64 i = 0; i < b->iterations; i++) {
+		benchmark_pause(b);
+		bench_fill_quads_to_sort(quads, BENCH_SORT_COUNT);
+		benchmark_resume(b);
+		bench_sort_quads_by_z(quads, BENCH_SORT_COUNT);
+	}
+	benchmark_stop_timer(b);
+	dealloc(get_heap_allocator(), quads);
+	b->items_per_iteration = BENCH_SORT_COUNT;
+}
+// What the quad pipeline sorts with
+void
+bench_radix_sort_quads_by_key(Benchmark_State *b) {
+	Draw_Quad *quads = (Draw_Quad*)alloc(get_heap_allocator(), BENCH_SORT_COUNT*2*sizeof(Draw_Quad));
+	for (u64 i = 0; i < b->iterations; i++) {
+		benchmark_pause(b);
+		bench_fill_quads_to_sort(quads, BENCH_SORT_COUNT);
+		benchmark_resume(b);
+		_quad_pipeline_sort_by_z(quads, quads+BENCH_SORT_COUNT, BENCH_SORT_COUNT);
+	}
+	benchmark_stop_timer(b);
+	dealloc(get_heap_allocator(), quads);
+	b->items_per_iteration = BENCH_SORT_COUNT;
+}
+
+// Random u32 below 2^31, the old radix_sort sorts 32 bit keys as signed
+typedef void(*Bench_Sort_U32_Proc)(u32 *items, u32 *buffer, u64 count);
+int
+bench_compare_u32(const void *a, const void *b) {
+	u32 x = *(const u32*)a;
+	u32 y = *(const u32*)b;
+	return (x > y) - (x < y);
+}
+void bench_sort_u32_merge(u32 *items, u32 *buffer, u64 count)     { merge_sort(items, buffer, count, sizeof(u32), bench_compare_u32); }
+void bench_sort_u32_radix_old(u32 *items, u32 *buffer, u64 count) { radix_sort(items, buffer, count, sizeof(u32), 0, 32); }
+void bench_sort_u32_pdq(u32 *items, u32 *buffer, u64 count)       { sort_u32(items, count); }
+void bench_sort_u32_radix(u32 *items, u32 *buffer, u64 count)     { radix_sort_u32(items, buffer, count); }
+void bench_sort_u32_parallel(u32 *items, u32 *buffer, u64 count)  { sort_u32_parallel(items, buffer, count); }
+void
+bench_sort_u32_with(Benchmark_State *b, u64 count, Bench_Sort_U32_Proc sort) {
+	// +1 since the old radix_sort reads 8 bytes per item
+	u32 *items = (u32*)alloc(get_heap_allocator(), (count+1)*sizeof(u32));
+	u32 *buffer = (u32*)alloc(get_heap_allocator(), count*sizeof(u32));
+	for (u64 i = 0; i < b->iterations; i++) {
+		benchmark_pause(b);
+		u64 seed = 12345;
+		for (u64 j = 0; j < count; j++) {
+			seed = seed*6364136223846793005ull + 1442695040888963407ull;
+			items[j] = (u32)(seed >> 33);
+		}
+		benchmark_resume(b);
+		sort(items, buffer, count);
+	}
+	benchmark_stop_timer(b);
+	dealloc(get_heap_allocator(), items);
+	dealloc(get_heap_allocator(), buffer);
+	b->items_per_iteration = count;
+}
+void bench_sort_1k_merge(Benchmark_State *b)       { bench_sort_u32_with(b, 1000, bench_sort_u32_merge); }
+void bench_sort_1k_radix_old(Benchmark_State *b)   { bench_sort_u32_with(b, 1000, bench_sort_u32_radix_old); }
+void bench_sort_1k_pdq(Benchmark_State *b)         { bench_sort_u32_with(b, 1000, bench_sort_u32_pdq); }
+void bench_sort_1k_radix(Benchmark_State *b)       { bench_sort_u32_with(b, 1000, bench_sort_u32_radix); }
+void bench_sort_100k_merge(Benchmark_State *b)     { bench_sort_u32_with(b, 100000, bench_sort_u32_merge); }
+void bench_sort_100k_radix_old(Benchmark_State *b) { bench_sort_u32_with(b, 100000, bench_sort_u32_radix_old); }
+void bench_sort_100k_pdq(Benchmark_State *b)       { bench_sort_u32_with(b, 100000, bench_sort_u32_pdq); }
+void bench_sort_100k_radix(Benchmark_State *b)     { bench_sort_u32_with(b, 100000, bench_sort_u32_radix); }
+void bench_sort_10m_merge(Benchmark_State *b)      { bench_sort_u32_with(b, 10000000, bench_sort_u32_merge); }
+void bench_sort_10m_radix_old(Benchmark_State *b)  { bench_sort_u32_with(b, 10000000, bench_sort_u32_radix_old); }
+void bench_sort_10m_pdq(Benchmark_State *b)        { bench_sort_u32_with(b, 10000000, bench_sort_u32_pdq); }
+void bench_sort_10m_radix(Benchmark_State *b)      { bench_sort_u32_with(b, 10000000, bench_sort_u32_radix); }
+void bench_sort_10m_parallel(Benchmark_State *b)   { bench_sort_u32_with(b, 10000000, bench_sort_u32_parallel); }
+
+#define BENCH_SIMD_COUNT 4096
+
+void
+bench_simd_add_float32_128(Benchmark_State *b) {
+	float32 *data = (float32*)alloc(get_heap_allocator(), BENCH_SIMD_COUNT*3*sizeof(float32));
+	for (u64 i = 0; i < BENCH_SIMD_COUNT*2; i++) data[i] = (float32)i;
+	float32 *a = data;
+	float32 *c = data+BENCH_SIMD_COUNT;
+	float32 *result = data+BENCH_SIMD_COUNT*2;
+	benchmark_reset_timer(b);
+
+	for (u64 i = 0; i < b->iterations; i++) {
+		for (u64 j = 0; j < BENCH_SIMD_COUNT; j += 4) simd_add_float32_128(a+j, c+j, result+j);
+	}
+
+	benchmark_stop_timer(b);
+	dealloc(get_heap_allocator(), data);
+	b->items_per_iteration = BENCH_SIMD_COUNT;
+	b->bytes_per_iteration = BENCH_SIMD_COUNT*3*sizeof(float32);
+}
+void
+bench_simd_mul_float32_256(Benchmark_State *b) {
+	float32 *data = (float32*)alloc(get_heap_allocator(), BENCH_SIMD_COUNT*3*sizeof(float32));
+	for (u64 i = 0; i < BENCH_SIMD_COUNT*2; i++) data[i] = (float32)i;
+	float32 *a = data;
+	float32 *c = data+BENCH_SIMD_COUNT;
+	float32 *result = data+BENCH_SIMD_COUNT*2;
+	benchmark_reset_timer(b);
+
+	for (u64 i = 0; i < b->iterations; i++) {
+		for (u64 j = 0; j < BENCH_SIMD_COUNT; j += 8) simd_mul_float32_256(a+j, c+j, result+j);
+	}
+
+	benchmark_stop_timer(b);
+	dealloc(get_heap_allocator(), data);
+	b->items_per_iteration = BENCH_SIMD_COUNT;
+	b->bytes_per_iteration = BENCH_SIMD_COUNT*3*sizeof(float32);
+}
+
+typedef enum Bench_Simd_Array_Kernel {
+	BENCH_SIMD_ADD_FLOAT32,
+	BENCH_SIMD_SUB_FLOAT32,
+	BENCH_SIMD_MUL_FLOAT32,
+	BENCH_SIMD_MIN_FLOAT32,
+	BENCH_SIMD_MAX_FLOAT32,
+	BENCH_SIMD_SCALE_FLOAT32,
+	BENCH_SIMD_MUL_ADD_FLOAT32,
+	BENCH_SIMD_CLAMP_FLOAT32,
+	BENCH_SIMD_SUM_FLOAT32,
+	BENCH_SIMD_DOT_FLOAT32,
+	BENCH_SIMD_PREFIX_SUM_FLOAT32,
+	BENCH_SIMD_ADD_S32,
+	BENCH_SIMD_SUB_S32,
+	BENCH_SIMD_MUL_S32,
+	BENCH_SIMD_MIN_S32,
+	BENCH_SIMD_MAX_S32,
+	BENCH_SIMD_CLAMP_S32,
+	BENCH_SIMD_SUM_S32,
+	BENCH_SIMD_PREFIX_SUM_S32,
+	BENCH_SIMD_ADD_SATURATE_S16,
+	BENCH_SIMD_S16_TO_FLOAT32,
+	BENCH_SIMD_FLOAT32_TO_S16,
+	BENCH_SIMD_U8_TO_FLOAT32,
+	BENCH_SIMD_FLOAT32_TO_U8,
+	BENCH_SIMD_INTERLEAVE_FLOAT32,
+	BENCH_SIMD_DEINTERLEAVE_FLOAT32,
+	BENCH_SIMD_TRANSFORM_POINTS_2D,
+} Bench_Simd_Array_Kernel;
+
+#define BENCH_SIMD_ARRAY_COUNT (16*1024)
+
+// One simd_*_array kernel over BENCH_SIMD_ARRAY_COUNT elements, with the dispatch forced to isa
+void
+bench_simd_array_with(Benchmark_State *b, Bench_Simd_Array_Kernel kernel, Cpu_Isa isa) {
+	Allocator heap = get_heap_allocator();
+	u64 n = BENCH_SIMD_ARRAY_COUNT;
+	float32 *fa = (float32*)alloc(heap, n*sizeof(float32));
+	float32 *fb = (float32*)alloc(heap, n*sizeof(float32));
+	float32 *fc = (float32*)alloc(heap, n*2*sizeof(float32));
+	s32 *ia = (s32*)alloc(heap, n*sizeof(s32));
+	s32 *ib = (s32*)alloc(heap, n*sizeof(s32));
+	s32 *ic = (s32*)alloc(heap, n*sizeof(s32));
+	s16 *sa = (s16*)alloc(heap, n*sizeof(s16));
+	s16 *sb = (s16*)alloc(heap, n*sizeof(s16));
+	u8 *ua = (u8*)alloc(heap, n);
+	for (u64 i = 0; i < n; i++) {
+		fa[i] = (float32)((i*37)%2001)/1000.0f - 1.0f;
+		fb[i] = (float32)((i*91)%2001)/1000.0f - 1.0f;
+		ia[i] = (s32)(i*2654435761u);
+		ib[i] = (s32)(i*40503u);
+		sa[i] = (s16)((i*37)%65536-32768);
+		sb[i] = (s16)((i*91)%65536-32768);
+		ua[i] = (u8)(i*37);
+	}
+	float32 affine[6] = {0.5f, -1.25f, 3.0f, 2.0f, 0.75f, -0.125f};
+	
+	// Bytes read + written per element
+	u64 element_bytes = 0;
+	switch (kernel) {
+		case BENCH_SIMD_ADD_FLOAT32: case BENCH_SIMD_SUB_FLOAT32: case BENCH_SIMD_MUL_FLOAT32:
+		case BENCH_SIMD_MIN_FLOAT32: case BENCH_SIMD_MAX_FLOAT32:
+		case BENCH_SIMD_ADD_S32: case BENCH_SIMD_SUB_S32: case BENCH_SIMD_MUL_S32:
+		case BENCH_SIMD_MIN_S32: case BENCH_SIMD_MAX_S32:
+			element_bytes = 12; break;
+		case BENCH_SIMD_SCALE_FLOAT32: case BENCH_SIMD_CLAMP_FLOAT32: case BENCH_SIMD_PREFIX_SUM_FLOAT32:
+		case BENCH_SIMD_CLAMP_S32: case BENCH_SIMD_PREFIX_SUM_S32: case BENCH_SIMD_TRANSFORM_POINTS_2D:
+			element_bytes = 8; break;
+		case BENCH_SIMD_MUL_ADD_FLOAT32:      element_bytes = 16; break;
+		case BENCH_SIMD_SUM_FLOAT32: case BENCH_SIMD_SUM_S32: element_bytes = 4; break;
+		case BENCH_SIMD_DOT_FLOAT32:          element_bytes = 8; break;
+		case BENCH_SIMD_ADD_SATURATE_S16:     element_bytes = 6; break;
+		case BENCH_SIMD_S16_TO_FLOAT32: case BENCH_SIMD_FLOAT32_TO_S16: element_bytes = 6; break;
+		case BENCH_SIMD_U8_TO_FLOAT32: case BENCH_SIMD_FLOAT32_TO_U8:   element_bytes = 5; break;
+		case BENCH_SIMD_INTERLEAVE_FLOAT32: case BENCH_SIMD_DEINTERLEAVE_FLOAT32: element_bytes = 16; break;
+	}
+	
+	cpu_dispatch_force_isa(isa);
+	benchmark_reset_timer(b);
+
+	for (u64 i = 0; i < b->iterations; i++) {
+		switch (kernel) {
+			case BENCH_SIMD_ADD_FLOAT32:        simd_add_float32_array(fc, fa, fb, n); break;
+			case BENCH_SIMD_SUB_FLOAT32:        simd_sub_float32_array(fc, fa, fb, n); break;
+			case BENCH_SIMD_MUL_FLOAT32:        simd_mul_float32_array(fc, fa, fb, n); break;
+			case BENCH_SIMD_MIN_FLOAT32:        simd_min_float32_array(fc, fa, fb, n); break;
+			case BENCH_SIMD_MAX_FLOAT32:        simd_max_float32_array(fc, fa, fb, n); break;
+			case BENCH_SIMD_SCALE_FLOAT32:      simd_scale_float32_array(fc, fa, 0.7f, n); break;
+			case BENCH_SIMD_MUL_ADD_FLOAT32:    simd_mul_add_float32_array(fc, fa, fb, fc, n); break;
+			case BENCH_SIMD_CLAMP_FLOAT32:      simd_clamp_float32_array(fc, fa, -0.5f, 0.5f, n); break;
+			case BENCH_SIMD_SUM_FLOAT32:        benchmark_float_sink = simd_sum_float32_array(fa, n); break;
+			case BENCH_SIMD_DOT_FLOAT32:        benchmark_float_sink = simd_dot_float32_array(fa, fb, n); break;
+			case BENCH_SIMD_PREFIX_SUM_FLOAT32: simd_prefix_sum_float32_array(fc, fa, n); break;
+			case BENCH_SIMD_ADD_S32:            simd_add_s32_array(ic, ia, ib, n); break;
+			case BENCH_SIMD_SUB_S32:            simd_sub_s32_array(ic, ia, ib, n); break;
+			case BENCH_SIMD_MUL_S32:            simd_mul_s32_array(ic, ia, ib, n); break;
+			case BENCH_SIMD_MIN_S32:            simd_min_s32_array(ic, ia, ib, n); break;
+			case BENCH_SIMD_MAX_S32:            simd_max_s32_array(ic, ia, ib, n); break;
+			case BENCH_SIMD_CLAMP_S32:          simd_clamp_s32_array(ic, ia, -1000, 1000, n); break;
+			case BENCH_SIMD_SUM_S32:            benchmark_sink = simd_sum_s32_array(ia, n); break;
+			case BENCH_SIMD_PREFIX_SUM_S32:     simd_prefix_sum_s32_array(ic, ia, n); break;
+			case BENCH_SIMD_ADD_SATURATE_S16:   simd_add_saturate_s16_array(sb, sa, sb, n); break;
+			case BENCH_SIMD_S16_TO_FLOAT32:     simd_convert_s16_to_float32_array(fc, sa, n); break;
+			case BENCH_SIMD_FLOAT32_TO_S16:     simd_convert_float32_to_s16_array(sb, fa, n); break;
+			case BENCH_SIMD_U8_TO_FLOAT32:      simd_convert_u8_to_float32_array(fc, ua, n); break;
+			case BENCH_SIMD_FLOAT32_TO_U8:      simd_convert_float32_to_u8_array(ua, fa, n); break;
+			case BENCH_SIMD_INTERLEAVE_FLOAT32: simd_interleave_float32_array(fc, fa, fb, n); break;
+			case BENCH_SIMD_DEINTERLEAVE_FLOAT32: simd_deinterleave_float32_array(fa, fb, fc, n); break;
+			case BENCH_SIMD_TRANSFORM_POINTS_2D: simd_transform_points_2d(fc, n/2, affine); break;
+		}
+	}
+
+	benchmark_stop_timer(b);
+	cpu_dispatch_init(get_cpu_capabilities());
+	dealloc(heap, fa);
+	dealloc(heap, fb);
+	dealloc(heap, fc);
+	dealloc(heap, ia);
+	dealloc(heap, ib);
+	dealloc(heap, ic);
+	dealloc(heap, sa);
+	dealloc(heap, sb);
+	dealloc(heap, ua);
+	b->items_per_iteration = n;
+	b->bytes_per_iteration = n*element_bytes;
+}
+// bench_simd_<name> at the best ISA level & bench_simd_<name>_basic
+#define BENCH_SIMD_ARRAY(name, kernel) \
+	void bench_simd_##name(Benchmark_State *b)         { bench_simd_array_with(b, kernel, get_best_cpu_isa(get_cpu_capabilities())); } \
+	void bench_simd_##name##_basic(Benchmark_State *b) { bench_simd_array_with(b, kernel, CPU_ISA_BASIC); }
+BENCH_SIMD_ARRAY(add_float32_array,        BENCH_SIMD_ADD_FLOAT32)
+BENCH_SIMD_ARRAY(sub_float32_array,        BENCH_SIMD_SUB_FLOAT32)
+BENCH_SIMD_ARRAY(mul_float32_array,        BENCH_SIMD_MUL_FLOAT32)
+BENCH_SIMD_ARRAY(min_float32_array,        BENCH_SIMD_MIN_FLOAT32)
+BENCH_SIMD_ARRAY(max_float32_array,        BENCH_SIMD_MAX_FLOAT32)
+BENCH_SIMD_ARRAY(scale_float32_array,      BENCH_SIMD_SCALE_FLOAT32)
+BENCH_SIMD_ARRAY(mul_add_float32_array,    BENCH_SIMD_MUL_ADD_FLOAT32)
+BENCH_SIMD_ARRAY(clamp_float32_array,      BENCH_SIMD_CLAMP_FLOAT32)
+BENCH_SIMD_ARRAY(sum_float32_array,        BENCH_SIMD_SUM_FLOAT32)
+BENCH_SIMD_ARRAY(dot_float32_array,        BENCH_SIMD_DOT_FLOAT32)
+BENCH_SIMD_ARRAY(prefix_sum_float32_array, BENCH_SIMD_PREFIX_SUM_FLOAT32)
+BENCH_SIMD_ARRAY(add_s32_array,            BENCH_SIMD_ADD_S32)
+BENCH_SIMD_ARRAY(sub_s32_array,            BENCH_SIMD_SUB_S32)
+BENCH_SIMD_ARRAY(mul_s32_array,            BENCH_SIMD_MUL_S32)
+BENCH_SIMD_ARRAY(min_s32_array,            BENCH_SIMD_MIN_S32)
+BENCH_SIMD_ARRAY(max_s32_array,            BENCH_SIMD_MAX_S32)
+BENCH_SIMD_ARRAY(clamp_s32_array,          BENCH_SIMD_CLAMP_S32)
+BENCH_SIMD_ARRAY(sum_s32_array,            BENCH_SIMD_SUM_S32)
+BENCH_SIMD_ARRAY(prefix_sum_s32_array,     BENCH_SIMD_PREFIX_SUM_S32)
+BENCH_SIMD_ARRAY(add_saturate_s16_array,   BENCH_SIMD_ADD_SATURATE_S16)
+BENCH_SIMD_ARRAY(s16_to_float32_array,     BENCH_SIMD_S16_TO_FLOAT32)
+BENCH_SIMD_ARRAY(float32_to_s16_array,     BENCH_SIMD_FLOAT32_TO_S16)
+BENCH_SIMD_ARRAY(u8_to_float32_array,      BENCH_SIMD_U8_TO_FLOAT32)
+BENCH_SIMD_ARRAY(float32_to_u8_array,      BENCH_SIMD_FLOAT32_TO_U8)
+BENCH_SIMD_ARRAY(interleave_float32_array, BENCH_SIMD_INTERLEAVE_FLOAT32)
+BENCH_SIMD_ARRAY(deinterleave_float32_array, BENCH_SIMD_DEINTERLEAVE_FLOAT32)
+BENCH_SIMD_ARRAY(transform_points_2d,      BENCH_SIMD_TRANSFORM_POINTS_2D)
+#undef BENCH_SIMD_ARRAY
+
+void
+bench_m4_mul(Benchmark_State *b) {
+	Matrix4 m = m4_make_translation(v3(1, 2, 3));
+	Matrix4 r = m4_make_rotation_z(0.5);
+	for (u64 i = 0; i < b->iterations; i++) {
+		m = m4_mul(m, r);
+	}
+	benchmark_float_sink = m.m[0][0];
+}
+void
+bench_m4_inverse(Benchmark_State *b) {
+	Matrix4 m = m4_mul(m4_make_translation(v3(1, 2, 3)), m4_make_rotation_z(0.5));
+	for (u64 i = 0; i < b->iterations; i++) {
+		m = m4_inverse(m);
+	}
+	benchmark_float_sink = m.m[0][0];
+}
+void
+bench_v2_rotate(Benchmark_State *b) {
+	Vector2 p = v2(1, 0);
+	for (u64 i = 0; i < b->iterations; i++) {
+		p = v2_rotate_point_around_pivot(p, v2(0.5, 0.5), 0.01);
+	}
+	benchmark_float_sink = p.x;
+}
+
+void
+bench_format_string(Benchmark_State *b) {
+	char buffer[256];
+	u64 total = 0;
+	for (u64 i = 0; i < b->iterations; i++) {
+		total += format_string_to_buffer_va(buffer, sizeof(buffer), "Player %s has %d hp at (%.2f, %.2f)", STR("Charlie"), (int)i, 12.5, -3.25);
+	}
+	b->bytes_per_iteration = total/b->iterations;
+}
+
+// Same thing through the CRT, which is what every specifier but %s used to go through
+void
+bench_format_string_crt(Benchmark_State *b) {
+	char buffer[256];
+	u64 total = 0;
+	for (u64 i = 0; i < b->iterations; i++) {
+		total += _format_crt_snprintf(buffer, sizeof(buffer), "Player %s has %d hp at (%.2f, %.2f)", "Charlie", (int)i, 12.5, -3.25);
+	}
+	b->bytes_per_iteration = total/b->iterations;
+}
+
+float64
+bench_float_value(u64 i) {
+	return (float64)((i*2654435761ull) & 0xFFFFFF) * 0.001953125 + 0.1;
+}
+
+void
+bench_format_u64(Benchmark_State *b) {
+	char buffer[32];
+	u64 total = 0;
+	for (u64 i = 0; i < b->iterations; i++) {
+		total += format_u64(i*2654435761ull, buffer);
+	}
+	b->bytes_per_iteration = total/b->iterations;
+}
+void
+bench_format_u64_crt(Benchmark_State *b) {
+	char buffer[32];
+	u64 total = 0;
+	for (u64 i = 0; i < b->iterations; i++) {
+		total += _format_crt_snprintf(buffer, sizeof(buffer), "%llu", i*2654435761ull);
+	}
+	b->bytes_per_iteration = total/b->iterations;
+}
+
+void
+bench_format_float_fixed(Benchmark_State *b) {
+	char buffer[64];
+	u64 total = 0;
+	for (u64 i = 0; i < b->iterations; i++) {
+		total += format_string_to_buffer_va(buffer, sizeof(buffer), "%.3f", bench_float_value(i));
+	}
+	b->bytes_per_iteration = total/b->iterations;
+}
+void
+bench_format_float_fixed_crt(Benchmark_State *b) {
+	char buffer[64];
+	u64 total = 0;
+	for (u64 i = 0; i < b->iterations; i++) {
+		total += _format_crt_snprintf(buffer, sizeof(buffer), "%.3f", bench_float_value(i));
+	}
+	b->bytes_per_iteration = total/b->iterations;
+}
+
+void
+bench_format_float_shortest(Benchmark_State *b) {
+	char buffer[FORMAT_FLOAT_SHORTEST_MAX];
+	u64 total = 0;
+	for (u64 i = 0; i < b->iterations; i++) {
+		total += format_float64_shortest(bench_float_value(i) * 1.1, buffer);
+	}
+	b->bytes_per_iteration = total/b->iterations;
+}
+// %.17g is what you'd need from the CRT to be sure it round trips
+void
+bench_format_float_round_trip_crt(Benchmark_State *b) {
+	char buffer[64];
+	u64 total = 0;
+	for (u64 i = 0; i < b->iterations; i++) {
+		total += _format_crt_snprintf(buffer, sizeof(buffer), "%.17g", bench_float_value(i) * 1.1);
+	}
+	b->bytes_per_iteration = total/b->iterations;
+}
+
+// Looks like the profiler's json output. The builder is reused so this is the formatting and not the heap.
+void
+bench_string_builder_print(Benchmark_State *b) {
+	const u64 count = 1000;
+	String_Builder builder;
+	string_builder_init(&builder, get_heap_allocator());
+	benchmark_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		builder.count = 0;
+		for (u64 j = 0; j < count; j++) {
+			string_builder_print(&builder, STR("{\"cat\":\"function\",\"dur\":%.3f,\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%llu,\"ts\":%.3f},"),
+				bench_float_value(j), STR("update_game"), j & 7, 1234567.0 + (float64)j * 16.667);
+		}
+	}
+	benchmark_stop_timer(b);
+	b->items_per_iteration = count;
+	b->bytes_per_iteration = builder.count;
+	dealloc(get_heap_allocator(), builder.buffer);
+}
+
+#define BENCH_TEXT_SIZE (64*1024)
+
+// Words of english-ish text. With mixed, every few words are 2 or 3 byte utf8.
+u8*
+bench_make_text(u64 count, bool mixed) {
+	const char *words[] = { "the ", "quick ", "brown ", "fox ", "jumps ", "over ", "lazy ", "dog ", "and ", "then\n" };
+	const char *mixed_words[] = { "gr\xc3\xb6\xc3\x9f" "e ", "\xe6\x97\xa5\xe6\x9c\xac ", "caf\xc3\xa9 " };
+	u8 *text = (u8*)alloc(get_heap_allocator(), count);
+	u64 n = 0;
+	u64 w = 0;
+	while (n < count) {
+		const char *word = (mixed && w%4 == 3) ? mixed_words[(w/4)%3] : words[(w*7)%10];
+		u64 len = strlen(word);
+		if (n+len > count) { memset(text+n, ' ', count-n); break; }
+		memcpy(text+n, word, len);
+		n += len;
+		w += 1;
+	}
+	return text;
+}
+
+void
+bench_string_find_with(Benchmark_State *b, String_Find_Proc find) {
+	u8 *text = bench_make_text(BENCH_TEXT_SIZE, false);
+	// Starts like a lot of the words so the first byte alone is a poor filter
+	const u8 *needle = (const u8*)"the lazy fox";
+	volatile s64 sink = 0;
+	benchmark_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		sink = find(text, BENCH_TEXT_SIZE, needle, 12);
+	}
+	benchmark_stop_timer(b);
+	assert(sink == -1, "Needle should not be in the benchmark text");
+	dealloc(get_heap_allocator(), text);
+	b->bytes_per_iteration = BENCH_TEXT_SIZE;
+}
+void
+bench_string_find(Benchmark_State *b) {
+	bench_string_find_with(b, get_string_kernels()->find_from_left);
+}
+void
+bench_string_find_basic(Benchmark_State *b) {
+	bench_string_find_with(b, _string_find_from_left_basic);
+}
+
+void
+bench_strings_match(Benchmark_State *b) {
+	const u64 count = 4096;
+	string x = {count, bench_make_text(count, true)};
+	string y = {count, bench_make_text(count, true)};
+	volatile bool sink = false;
+	benchmark_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		sink = strings_match(x, y);
+	}
+	benchmark_stop_timer(b);
+	assert(sink, "Benchmark strings should match");
+	dealloc_string(get_heap_allocator(), x);
+	dealloc_string(get_heap_allocator(), y);
+	b->bytes_per_iteration = count;
+}
+
+void
+bench_utf8_validate_with(Benchmark_State *b, Utf8_Validate_Proc validate, bool mixed) {
+	u8 *text = bench_make_text(BENCH_TEXT_SIZE, mixed);
+	volatile bool sink = false;
+	benchmark_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		sink = validate(text, BENCH_TEXT_SIZE);
+	}
+	benchmark_stop_timer(b);
+	assert(sink, "Benchmark text should be valid utf8");
+	dealloc(get_heap_allocator(), text);
+	b->bytes_per_iteration = BENCH_TEXT_SIZE;
+}
+void
+bench_utf8_validate_ascii(Benchmark_State *b) {
+	bench_utf8_validate_with(b, get_utf8_kernels()->validate, false);
+}
+void
+bench_utf8_validate_mixed(Benchmark_State *b) {
+	bench_utf8_validate_with(b, get_utf8_kernels()->validate, true);
+}
+void
+bench_utf8_validate_mixed_basic(Benchmark_State *b) {
+	bench_utf8_validate_with(b, _utf8_validate_basic, true);
+}
+
+void
+bench_utf8_decode_with(Benchmark_State *b, Utf8_Decode_Proc decode) {
+	u8 *text = bench_make_text(BENCH_TEXT_SIZE, true);
+	u32 codepoints[256];
+	u64 total = 0;
+	benchmark_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		u64 offset = 0;
+		while (offset < BENCH_TEXT_SIZE) {
+			u64 consumed = 0;
+			total += decode(text+offset, BENCH_TEXT_SIZE-offset, &consumed, codepoints, 256);
+			offset += consumed;
+		}
+	}
+	benchmark_stop_timer(b);
+	dealloc(get_heap_allocator(), text);
+	b->items_per_iteration = total/b->iterations;
+	b->bytes_per_iteration = BENCH_TEXT_SIZE;
+}
+void
+bench_utf8_decode(Benchmark_State *b) {
+	bench_utf8_decode_with(b, get_utf8_kernels()->decode);
+}
+void
+bench_utf8_decode_basic(Benchmark_State *b) {
+	bench_utf8_decode_with(b, _utf8_decode_basic);
+}
+// What walk_glyphs used to do
+void
+bench_utf8_decode_next_utf8(Benchmark_State *b) {
+	u8 *text = bench_make_text(BENCH_TEXT_SIZE, true);
+	u64 total = 0;
+	benchmark_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		string s = (string){BENCH_TEXT_SIZE, text};
+		u32 c = 0;
+		while (s.count && (c = next_utf8(&s)) != 0) {
+			benchmark_sink = c;
+			total += 1;
+		}
+	}
+	benchmark_stop_timer(b);
+	dealloc(get_heap_allocator(), text);
+	b->items_per_iteration = total/b->iterations;
+	b->bytes_per_iteration = BENCH_TEXT_SIZE;
+}
+
+void
+bench_string_replace_all(Benchmark_State *b) {
+	u8 *text = bench_make_text(BENCH_TEXT_SIZE, false);
+	string s = (string){BENCH_TEXT_SIZE, text};
+	benchmark_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		string result = string_replace_all(s, STR("lazy"), STR("energetic"), get_temporary_allocator());
+		assert(result.count > s.count, "Expected replacements in benchmark text");
+		reset_temporary_storage();
+	}
+	benchmark_stop_timer(b);
+	dealloc(get_heap_allocator(), text);
+	b->bytes_per_iteration = BENCH_TEXT_SIZE;
+}
+
+void
+bench_hash_bytes_with(Benchmark_State *b, u64 count) {
+	u8 *data = bench_make_text(max(count, 1), false);
+	u64 total = 0;
+	benchmark_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		// Depend on the previous hash so short keys measure latency and not just throughput
+		total += hash_bytes(data, count, total);
+	}
+	benchmark_stop_timer(b);
+	benchmark_sink = total;
+	dealloc(get_heap_allocator(), data);
+	b->bytes_per_iteration = count;
+}
+void bench_hash_bytes_16(Benchmark_State *b)  { bench_hash_bytes_with(b, 16); }
+void bench_hash_bytes_64(Benchmark_State *b)  { bench_hash_bytes_with(b, 64); }
+void bench_hash_bytes_1k(Benchmark_State *b)  { bench_hash_bytes_with(b, 1024); }
+void bench_hash_bytes_64k(Benchmark_State *b) { bench_hash_bytes_with(b, BENCH_TEXT_SIZE); }
+void
+bench_hash_bytes_64k_basic(Benchmark_State *b) {
+	Hash_Kernels last_kernels = *get_hash_kernels();
+	hash_kernels.accumulate = _hash_accumulate_basic;
+	hash_kernels.scramble   = _hash_scramble_basic;
+	bench_hash_bytes_with(b, BENCH_TEXT_SIZE);
+	hash_kernels = last_kernels;
+}
+// What long strings used to get
+void
+bench_djb2_64k(Benchmark_State *b) {
+	u8 *data = bench_make_text(BENCH_TEXT_SIZE, false);
+	benchmark_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		benchmark_sink = djb2_hash((string){BENCH_TEXT_SIZE, data});
+	}
+	benchmark_stop_timer(b);
+	dealloc(get_heap_allocator(), data);
+	b->bytes_per_iteration = BENCH_TEXT_SIZE;
+}
+void
+bench_hash_state_64k(Benchmark_State *b) {
+	u8 *data = bench_make_text(BENCH_TEXT_SIZE, false);
+	benchmark_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		Hash_State state;
+		hash_state_init(&state, 0);
+		// Uneven pieces, like reading a file in chunks after a header
+		hash_state_append(&state, data, 100);
+		for (u64 offset = 100; offset < BENCH_TEXT_SIZE; offset += 4000) {
+			hash_state_append(&state, data + offset, min(4000, BENCH_TEXT_SIZE - offset));
+		}
+		benchmark_sink = hash_state_get_hash(&state);
+	}
+	benchmark_stop_timer(b);
+	dealloc(get_heap_allocator(), data);
+	b->bytes_per_iteration = BENCH_TEXT_SIZE;
+}
+void
+bench_hash_many_paths(Benchmark_State *b) {
+	const u64 count = 10000;
+	Allocator heap = get_heap_allocator();
+	string *keys = (string*)alloc(heap, count*sizeof(string));
+	u64 *hashes = (u64*)alloc(heap, count*sizeof(u64));
+	u64 bytes = 0;
+	for (u64 i = 0; i < count; i++) {
+		keys[i] = sprint(heap, STR("res/sprites/enemies/skeleton_%llu/walk_%llu.png"), i/16, i%16);
+		bytes += keys[i].count;
+	}
+	benchmark_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		hash_many(keys, count, hashes, 0);
+	}
+	benchmark_stop_timer(b);
+	for (u64 i = 0; i < count; i++) dealloc_string(heap, keys[i]);
+	dealloc(heap, keys);
+	dealloc(heap, hashes);
+	b->items_per_iteration = count;
+	b->bytes_per_iteration = bytes;
+}
+
+// Looking up paths which are already interned, which is what caches keyed on ids do each frame
+void
+bench_intern_existing(Benchmark_State *b) {
+	const u64 count = 1000;
+	String_Interner interner = ZERO(String_Interner);
+	string *paths = (string*)alloc(get_heap_allocator(), count*sizeof(string));
+	for (u64 i = 0; i < count; i++) {
+		paths[i] = sprint(get_heap_allocator(), STR("res/sprites/enemies/skeleton_%llu.png"), i);
+		string_intern(&interner, paths[i]);
+	}
+	u64 total = 0;
+	benchmark_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		for (u64 j = 0; j < count; j++) total += string_intern(&interner, paths[j]);
+	}
+	benchmark_stop_timer(b);
+	benchmark_sink = total;
+	for (u64 i = 0; i < count; i++) dealloc_string(get_heap_allocator(), paths[i]);
+	dealloc(get_heap_allocator(), paths);
+	string_interner_destroy(&interner);
+	b->items_per_iteration = count;
+}
+
+void
+bench_draw_rect(Benchmark_State *b) {
+	const u64 count = 10000;
+	s32 last_width = window.width;
+	s32 last_height = window.height;
+	window.width = 1280;
+	window.height = 720;
+	reset_draw_frame(&draw_frame);
+	benchmark_reset_timer(b);
+
+	for (u64 i = 0; i < b->iterations; i++) {
+		for (u64 j = 0; j < count; j++) {
+			float32 x = (float32)(j%100)*0.01f;
+			float32 y = (float32)(j/100)*0.01f;
+			draw_rect(v2(x, y), v2(0.01, 0.01), COLOR_WHITE);
+		}
+		draw_frame.num_quads = 0;
+	}
+
+	benchmark_stop_timer(b);
+	reset_draw_frame(&draw_frame);
+	window.width = last_width;
+	window.height = last_height;
+	b->items_per_iteration = count;
+}
+
+typedef struct Bench_Draw_Frame {
+	Draw_Frame_Capture capture;
+	Quad_Pipeline pipeline;
+} Bench_Draw_Frame;
+
+string bench_draw_frame_path = {0};
+
+void*
+bench_draw_frame_setup() {
+	Bench_Draw_Frame *bench = (Bench_Draw_Frame*)alloc(get_heap_allocator(), sizeof(Bench_Draw_Frame));
+	bool ok = draw_frame_capture_load(bench_draw_frame_path, &bench->capture, get_heap_allocator());
+	assert(ok, "Failed loading draw frame capture '%s'", bench_draw_frame_path);
+	return bench;
+}
+void
+bench_draw_frame_teardown(void *data) {
+	Bench_Draw_Frame *bench = (Bench_Draw_Frame*)data;
+	draw_frame_capture_destroy(&bench->capture);
+	quad_pipeline_destroy(&bench->pipeline);
+	dealloc(get_heap_allocator(), bench);
+}
+void
+bench_draw_frame(Benchmark_State *b) {
+	Bench_Draw_Frame *bench = (Bench_Draw_Frame*)b->data;
+	for (u64 i = 0; i < b->iterations; i++) {
+		draw_frame_capture_replay(&bench->capture, &bench->pipeline);
+	}
+	b->items_per_iteration = bench->capture.frame.num_quads;
+	b->bytes_per_iteration = bench->capture.frame.num_quads*6*sizeof(Quad_Vertex);
+}
+
+#define BENCH_AUDIO_VOICES 32
+#define BENCH_AUDIO_FRAMES 1024
+
+typedef struct Bench_Audio_Mix {
+	Audio_Output_Kind last_output_kind;
+	Audio_Source source;
+	Audio_Player *players[BENCH_AUDIO_VOICES];
+	f32 *output;
+} Bench_Audio_Mix;
+
+void*
+bench_audio_mix_setup() {
+	Allocator heap = get_heap_allocator();
+	Bench_Audio_Mix *mix = (Bench_Audio_Mix*)alloc(heap, sizeof(Bench_Audio_Mix));
+
+	// Nothing else should mix while we do
+	mix->last_output_kind = audio_output_kind;
+	audio_output_kind = AUDIO_OUTPUT_NULL;
+
+	Audio_Format format = (Audio_Format){AUDIO_BITS_32, 2, 48000};
+	const u64 source_frames = 48000;
+	f32 *signal = (f32*)alloc(heap, source_frames*2*sizeof(f32));
+	for (u64 i = 0; i < source_frames*2; i++) signal[i] = (f32)(i%1000)/1000.0f - 0.5f;
+	bool ok = audio_write_wav_file(STR("benchmark_audio.wav"), signal, source_frames, format);
+	assert(ok, "Failed writing benchmark_audio.wav");
+	ok = audio_open_source_load_format(&mix->source, STR("benchmark_audio.wav"), format, heap);
+	assert(ok, "Failed loading benchmark_audio.wav");
+	os_file_delete(STR("benchmark_audio.wav"));
+	dealloc(heap, signal);
+
+	for (u64 i = 0; i < BENCH_AUDIO_VOICES; i++) {
+		Audio_Player *p = audio_player_get_one();
+		p->config.volume = 0.05;
+		audio_player_set_source(p, mix->source);
+		audio_player_set_looping(p, true);
+		audio_player_set_time_stamp(p, 0.01*(f64)i);
+		audio_player_set_state(p, AUDIO_PLAYER_STATE_PLAYING);
+		mix->players[i] = p;
+	}
+
+	mix->output = (f32*)alloc(heap, BENCH_AUDIO_FRAMES*2*sizeof(f32));
+	// Get past the fade in
+	for (u64 i = 0; i < 8; i++) audio_render_offline(mix->output, BENCH_AUDIO_FRAMES, format);
+
+	return mix;
+}
+void
+bench_audio_mix_teardown(void *data) {
+	Bench_Audio_Mix *mix = (Bench_Audio_Mix*)data;
+	for (u64 i = 0; i < BENCH_AUDIO_VOICES; i++) audio_player_release(mix->players[i]);
+	audio_source_destroy(&mix->source);
+	audio_render_offline(mix->output, BENCH_AUDIO_FRAMES, (Audio_Format){AUDIO_BITS_32, 2, 48000});
+	audio_output_kind = mix->last_output_kind;
+	dealloc(get_heap_allocator(), mix->output);
+	dealloc(get_heap_allocator(), mix);
+}
+void
+bench_audio_mix(Benchmark_State *b) {
+	Bench_Audio_Mix *mix = (Bench_Audio_Mix*)b->data;
+	Audio_Format format = (Audio_Format){AUDIO_BITS_32, 2, 48000};
+	for (u64 i = 0; i < b->iterations; i++) {
+		audio_render_offline(mix->output, BENCH_AUDIO_FRAMES, format);
+	}
+	b->items_per_iteration = BENCH_AUDIO_FRAMES;
+}
+
+void
+bench_audio_convert(Benchmark_State *b, Audio_Format src_format) {
+	Allocator heap = get_heap_allocator();
+	Audio_Format dst_format = (Audio_Format){AUDIO_BITS_32, 2, 48000};
+	// Resampling can read a frame past the end
+	s16 *src = (s16*)alloc(heap, (BENCH_AUDIO_FRAMES*2+8)*2*sizeof(s16));
+	f32 *dst = (f32*)alloc(heap, BENCH_AUDIO_FRAMES*2*sizeof(f32));
+	for (u64 i = 0; i < (BENCH_AUDIO_FRAMES*2+8)*2; i++) src[i] = (s16)((i*37)%65536-32768);
+	benchmark_reset_timer(b);
+
+	for (u64 i = 0; i < b->iterations; i++) {
+		convert_frames(dst, dst_format, src, src_format, BENCH_AUDIO_FRAMES);
+	}
+
+	benchmark_stop_timer(b);
+	dealloc(heap, src);
+	dealloc(heap, dst);
+	b->items_per_iteration = BENCH_AUDIO_FRAMES;
+	b->bytes_per_iteration = BENCH_AUDIO_FRAMES*2*sizeof(f32);
+}
+void
+bench_audio_convert_s16_to_f32(Benchmark_State *b) {
+	bench_audio_convert(b, (Audio_Format){AUDIO_BITS_16, 2, 48000});
+}
+void
+bench_audio_convert_resample(Benchmark_State *b) {
+	bench_audio_convert(b, (Audio_Format){AUDIO_BITS_16, 2, 44100});
+}
+void
+bench_audio_convert_mono_f32(Benchmark_State *b) {
+	bench_audio_convert(b, (Audio_Format){AUDIO_BITS_32, 1, 48000});
+}
+
+void
+oogabooga_register_benchmarks() {
+	register_benchmark("heap alloc+free 64B",            bench_heap_alloc_free_64, 0, 0);
+	register_benchmark("heap alloc+free 64 mixed sizes", bench_heap_alloc_free_mixed, 0, 0);
+	register_benchmark("hash table add 10k u64",         bench_hash_table_add, 0, 0);
+	register_benchmark("hash table find 10k u64",        bench_hash_table_find, bench_hash_table_find_setup, bench_hash_table_find_teardown);
+	register_benchmark("growing array add 100k u32",     bench_growing_array_add, 0, 0);
+	register_benchmark("array push 100k u32",            bench_array_push, 0, 0);
+	register_benchmark("growing array find u32 in 4k",   bench_growing_array_find, 0, 0);
+	register_benchmark("array find u32 in 4k",           bench_array_find, 0, 0);
+	register_benchmark("radix sort 10k quads",           bench_radix_sort, 0, 0);
+	register_benchmark("merge sort 10k quads",           bench_merge_sort, 0, 0);
+	register_benchmark("sort by key 10k quads",          bench_sort_quads_by_key, 0, 0);
+	register_benchmark("radix sort by key 10k quads",    bench_radix_sort_quads_by_key, 0, 0);
+	register_benchmark("merge_sort 1k u32",              bench_sort_1k_merge, 0, 0);
+	register_benchmark("radix_sort 1k u32",              bench_sort_1k_radix_old, 0, 0);
+	register_benchmark("sort_u32 1k",                    bench_sort_1k_pdq, 0, 0);
+	register_benchmark("radix_sort_u32 1k",              bench_sort_1k_radix, 0, 0);
+	register_benchmark("merge_sort 100k u32",            bench_sort_100k_merge, 0, 0);
+	register_benchmark("radix_sort 100k u32",            bench_sort_100k_radix_old, 0, 0);
+	register_benchmark("sort_u32 100k",                  bench_sort_100k_pdq, 0, 0);
+	register_benchmark("radix_sort_u32 100k",            bench_sort_100k_radix, 0, 0);
+	register_benchmark("merge_sort 10M u32",             bench_sort_10m_merge, 0, 0);
+	register_benchmark("radix_sort 10M u32",             bench_sort_10m_radix_old, 0, 0);
+	register_benchmark("sort_u32 10M",                   bench_sort_10m_pdq, 0, 0);
+	register_benchmark("radix_sort_u32 10M",             bench_sort_10m_radix, 0, 0);
+	register_benchmark("sort_u32_parallel 10M",          bench_sort_10m_parallel, 0, 0);
+	register_benchmark("simd add float32 128",           bench_simd_add_float32_128, 0, 0);
+	register_benchmark("simd mul float32 256",           bench_simd_mul_float32_256, 0, 0);
+	#define REGISTER_BENCH_SIMD_ARRAY(label, name) \
+		register_benchmark("simd " label " 16k",         bench_simd_##name, 0, 0); \
+		register_benchmark("simd " label " 16k (basic)", bench_simd_##name##_basic, 0, 0);
+	REGISTER_BENCH_SIMD_ARRAY("add float32 array", add_float32_array)
+	REGISTER_BENCH_SIMD_ARRAY("sub float32 array", sub_float32_array)
+	REGISTER_BENCH_SIMD_ARRAY("mul float32 array", mul_float32_array)
+	REGISTER_BENCH_SIMD_ARRAY("min float32 array", min_float32_array)
+	REGISTER_BENCH_SIMD_ARRAY("max float32 array", max_float32_array)
+	REGISTER_BENCH_SIMD_ARRAY("scale float32 array", scale_float32_array)
+	REGISTER_BENCH_SIMD_ARRAY("mul_add float32 array", mul_add_float32_array)
+	REGISTER_BENCH_SIMD_ARRAY("clamp float32 array", clamp_float32_array)
+	REGISTER_BENCH_SIMD_ARRAY("sum float32 array", sum_float32_array)
+	REGISTER_BENCH_SIMD_ARRAY("dot float32 array", dot_float32_array)
+	REGISTER_BENCH_SIMD_ARRAY("prefix sum float32 array", prefix_sum_float32_array)
+	REGISTER_BENCH_SIMD_ARRAY("add s32 array", add_s32_array)
+	REGISTER_BENCH_SIMD_ARRAY("sub s32 array", sub_s32_array)
+	REGISTER_BENCH_SIMD_ARRAY("mul s32 array", mul_s32_array)
+	REGISTER_BENCH_SIMD_ARRAY("min s32 array", min_s32_array)
+	REGISTER_BENCH_SIMD_ARRAY("max s32 array", max_s32_array)
+	REGISTER_BENCH_SIMD_ARRAY("clamp s32 array", clamp_s32_array)
+	REGISTER_BENCH_SIMD_ARRAY("sum s32 array", sum_s32_array)
+	REGISTER_BENCH_SIMD_ARRAY("prefix sum s32 array", prefix_sum_s32_array)
+	REGISTER_BENCH_SIMD_ARRAY("add saturate s16 array", add_saturate_s16_array)
+	REGISTER_BENCH_SIMD_ARRAY("convert s16 to float32 array", s16_to_float32_array)
+	REGISTER_BENCH_SIMD_ARRAY("convert float32 to s16 array", float32_to_s16_array)
+	REGISTER_BENCH_SIMD_ARRAY("convert u8 to float32 array", u8_to_float32_array)
+	REGISTER_BENCH_SIMD_ARRAY("convert float32 to u8 array", float32_to_u8_array)
+	REGISTER_BENCH_SIMD_ARRAY("interleave float32 array", interleave_float32_array)
+	REGISTER_BENCH_SIMD_ARRAY("deinterleave float32 array", deinterleave_float32_array)
+	REGISTER_BENCH_SIMD_ARRAY("transform points 2d", transform_points_2d)
+	#undef REGISTER_BENCH_SIMD_ARRAY
+	register_benchmark("m4_mul",                         bench_m4_mul, 0, 0);
+	register_benchmark("m4_inverse",                     bench_m4_inverse, 0, 0);
+	register_benchmark("v2_rotate_point_around_pivot",   bench_v2_rotate, 0, 0);
+	register_benchmark("format string",                  bench_format_string, 0, 0);
+	register_benchmark("format string (crt)",            bench_format_string_crt, 0, 0);
+	register_benchmark("format u64",                     bench_format_u64, 0, 0);
+	register_benchmark("format u64 (crt)",               bench_format_u64_crt, 0, 0);
+	register_benchmark("format %.3f",                    bench_format_float_fixed, 0, 0);
+	register_benchmark("format %.3f (crt)",              bench_format_float_fixed_crt, 0, 0);
+	register_benchmark("format float64 shortest",        bench_format_float_shortest, 0, 0);
+	register_benchmark("format %.17g (crt)",             bench_format_float_round_trip_crt, 0, 0);
+	register_benchmark("string builder print 1k lines",  bench_string_builder_print, 0, 0);
+	register_benchmark("string find 64KB",               bench_string_find, 0, 0);
+	register_benchmark("string find 64KB (basic)",       bench_string_find_basic, 0, 0);
+	register_benchmark("strings_match 4KB",              bench_strings_match, 0, 0);
+	register_benchmark("utf8 validate 64KB ascii",       bench_utf8_validate_ascii, 0, 0);
+	register_benchmark("utf8 validate 64KB mixed",       bench_utf8_validate_mixed, 0, 0);
+	register_benchmark("utf8 validate 64KB mixed (basic)", bench_utf8_validate_mixed_basic, 0, 0);
+	register_benchmark("utf8 decode 64KB",               bench_utf8_decode, 0, 0);
+	register_benchmark("utf8 decode 64KB (basic)",       bench_utf8_decode_basic, 0, 0);
+	register_benchmark("utf8 decode 64KB (next_utf8)",   bench_utf8_decode_next_utf8, 0, 0);
+	register_benchmark("string replace all 64KB",        bench_string_replace_all, 0, 0);
+	register_benchmark("hash_bytes 16B",                 bench_hash_bytes_16, 0, 0);
+	register_benchmark("hash_bytes 64B",                 bench_hash_bytes_64, 0, 0);
+	register_benchmark("hash_bytes 1KB",                 bench_hash_bytes_1k, 0, 0);
+	register_benchmark("hash_bytes 64KB",                bench_hash_bytes_64k, 0, 0);
+	register_benchmark("hash_bytes 64KB (basic)",        bench_hash_bytes_64k_basic, 0, 0);
+	register_benchmark("djb2 64KB",                      bench_djb2_64k, 0, 0);
+	register_benchmark("hash state 64KB in pieces",      bench_hash_state_64k, 0, 0);
+	register_benchmark("hash_many 10k asset paths",      bench_hash_many_paths, 0, 0);
+	register_benchmark("intern existing path 1k",        bench_intern_existing, 0, 0);
+	register_benchmark("draw_rect 10k quads",            bench_draw_rect, 0, 0);
+	register_benchmark("audio mix 32 voices",            bench_audio_mix, bench_audio_mix_setup, bench_audio_mix_teardown);
+	register_benchmark("audio convert s16 to f32",       bench_audio_convert_s16_to_f32, 0, 0);
+	register_benchmark("audio convert s16 44.1k to f32 48k", bench_audio_convert_resample, 0, 0);
+	register_benchmark("audio convert mono f32 to stereo f32", bench_audio_convert_mono_f32, 0, 0);
+}
+
+// Registers the oogabooga benchmarks, runs everything registered with the command line
+// options and returns the number of regressions.
+u64
+oogabooga_run_benchmarks(int argc, char **argv) {
+	oogabooga_register_benchmarks();
+
+	Benchmark_Options options = ZERO(Benchmark_Options);
+	options.out_path = STR("benchmark_results.json");
+	if (os_is_file(STR("benchmark_baseline.json"))) options.baseline_path = STR("benchmark_baseline.json");
+
+	for (int i = 1; i < argc; i++) {
+		string arg = STR(argv[i]);
+		string value = i+1 < argc ? STR(argv[i+1]) : ZERO(string);
+		if      (strings_match(arg, STR("--filter"))   && value.count) options.filter        = value;
+		else if (strings_match(arg, STR("--out"))      && value.count) options.out_path      = value;
+		else if (strings_match(arg, STR("--baseline")) && value.count) options.baseline_path = value;
+		else if (strings_match(arg, STR("--draw-frame")) && value.count) bench_draw_frame_path = value;
+		else {
+			log_warning("Unknown benchmark argument '%s'", arg);
+			continue;
+		}
+		i += 1;
+	}
+
+	if (bench_draw_frame_path.count) {
+		register_benchmark("quad pipeline on captured frame", bench_draw_frame, bench_draw_frame_setup, bench_draw_frame_teardown);
+	}
+
+	return run_benchmarks(options);
+}
@@ -31,6 +31,11 @@ spinlock_acquire_or_wait_timeout(Spinlock* l, f64 timeout_seconds);
 void ogb_instance
 spinlock_release(Spinlock* l);
 
+// Cycles the calling thread has spent waiting on contended spinlocks & mutexes.
+// Uncontended locking isn't timed, so this costs nothing when there's no contention.
+u64 ogb_instance
+get_thread_lock_wait_cycles();
+
 
 ///
 // High-level mutex primitive (short spinlock then OS mutex lock)
@@ -80,13 +85,23 @@ binary_semaphore_signal(Binary_Semaphore *sem);
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 
+thread_local u64 _thread_lock_wait_cycles = 0;
+
+u64 get_thread_lock_wait_cycles() {
+	return _thread_lock_wait_cycles;
+}
+
 void spinlock_init(Spinlock *l) {
 	memset(l, 0, sizeof(*l));
 }
 void spinlock_acquire_or_wait(Spinlock* l) {
+	if (compare_and_swap_bool(&l->locked, true, false)) return;
+	
+	u64 wait_start = rdtsc();
 	while (true) {
         bool expected = false;
         if (compare_and_swap_bool(&l->locked, true, expected)) {
+            _thread_lock_wait_cycles += rdtsc()-wait_start;
             return;
         }
         while (l->locked) {
@@ -96,15 +111,22 @@ void spinlock_acquire_or_wait(Spinlock* l) {
 }
 // Returns true on aquired, false if timeout seconds reached
 bool spinlock_acquire_or_wait_timeout(Spinlock* l, f64 timeout_seconds) {
+	if (compare_and_swap_bool(&l->locked, true, false)) return true;
+	
+	u64 wait_start = rdtsc();
     f64 start = os_get_current_time_in_seconds();
 	while (true) {
         bool expected = false;
         if (compare_and_swap_bool(&l->locked, true, expected)) {
+            _thread_lock_wait_cycles += rdtsc()-wait_start;
             return true;
         }
         while (l->locked) {
             // spinny boi
-            if ((os_get_current_time_in_seconds()-start) >= timeout_seconds) return false;
+            if ((os_get_current_time_in_seconds()-start) >= timeout_seconds) {
+            	_thread_lock_wait_cycles += rdtsc()-wait_start;
+            	return false;
+            }
         }
     }
     return true;
@@ -133,8 +155,13 @@ void mutex_acquire_or_wait(Mutex *m) {
 	if (spinlock_acquire_or_wait_timeout(&m->spinlock, m->spin_time_microseconds / 1000000.0)) {
         assert(!m->spinlock_acquired, "Internal sync error in Mutex");
     	m->spinlock_acquired = true;
+	    os_lock_mutex(m->os_handle);
+    } else {
+    	// Spun out, so someone is holding it for a while
+    	u64 wait_start = rdtsc();
+	    os_lock_mutex(m->os_handle);
+	    _thread_lock_wait_cycles += rdtsc()-wait_start;
     }
-    os_lock_mutex(m->os_handle);
     
     assert(!m->acquiring_thread, "Internal sync error in Mutex: Multiple threads acquired");
     m->acquiring_thread = context.thread_id;
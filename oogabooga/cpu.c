@@ -23,6 +23,9 @@ typedef struct Cpu_Capabilities {
 // I think this is the standard? (sse1)
 #define COMPILER_CAN_DO_SSE 1
 
+// Here rather than in base.c, cpu.c is included first
+#define local_persist static
+
 ///
 // Compiler specific stuff
 #if COMPILER_MVSC
@@ -44,11 +47,40 @@ typedef struct Cpu_Capabilities {
     rdtsc() {
         return __rdtsc();
     }
+    // Index of the highest set bit. x must not be 0.
+    inline u32 
+    bit_scan_reverse_64(u64 x) {
+        unsigned long index;
+        _BitScanReverse64(&index, x);
+        return (u32)index;
+    }
+    // Index of the lowest set bit. x must not be 0.
+    inline u32 
+    bit_scan_forward_64(u64 x) {
+        unsigned long index;
+        _BitScanForward64(&index, x);
+        return (u32)index;
+    }
+    // Low 64 bits of a*b, high 64 bits go in *hi
+    inline u64
+    mul_64x64_128(u64 a, u64 b, u64 *hi) {
+        return _umul128(a, b, hi);
+    }
     inline Cpu_Info_X86 cpuid(u32 function_id) {
     	Cpu_Info_X86 i;
-    	__cpuid((int*)&i, function_id);
+    	__cpuidex((int*)&i, function_id, 0);
     	return i;
     }
+    // Which register states the OS saves on context switches
+    inline u64 
+    xgetbv(u32 index) {
+    	return _xgetbv(index);
+    }
+    
+    // MSVC lets any function use any intrinsics
+    #define TARGET_SSE41
+    #define TARGET_AVX
+    #define TARGET_AVX2
     
     #if _M_IX86_FP >= 2
 		#define COMPILER_CAN_DO_SSE2 1
@@ -134,6 +166,24 @@ typedef struct Cpu_Capabilities {
         return ((u64)hi << 32) | lo;
     }
     
+    // Index of the highest set bit. x must not be 0.
+    inline u32 
+    bit_scan_reverse_64(u64 x) {
+        return 63 - (u32)__builtin_clzll(x);
+    }
+    // Index of the lowest set bit. x must not be 0.
+    inline u32 
+    bit_scan_forward_64(u64 x) {
+        return (u32)__builtin_ctzll(x);
+    }
+    // Low 64 bits of a*b, high 64 bits go in *hi
+    inline u64
+    mul_64x64_128(u64 a, u64 b, u64 *hi) {
+        unsigned __int128 product = (unsigned __int128)a*b;
+        *hi = (u64)(product >> 64);
+        return (u64)product;
+    }
+    
     inline 
     Cpu_Info_X86 cpuid(u32 function_id) {
     	Cpu_Info_X86 info;
@@ -143,6 +193,20 @@ typedef struct Cpu_Capabilities {
 	        : "a"(function_id), "c"(0));
 	    return info;
 	}
+	// Which register states the OS saves on context switches
+	inline u64 
+	xgetbv(u32 index) {
+		u32 eax, edx;
+		__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+		return ((u64)edx << 32) | eax;
+	}
+	
+	// Lets a single function use instructions that the rest of the program isn't compiled
+	// for. Only call it after checking get_cpu_capabilities(). Note these can't be inlined
+	// into functions without the same target.
+	#define TARGET_SSE41 __attribute__((target("sse4.1")))
+	#define TARGET_AVX   __attribute__((target("avx")))
+	#define TARGET_AVX2  __attribute__((target("avx2")))
 	
 	#ifdef __SSE2__
 		#define COMPILER_CAN_DO_SSE2 1
@@ -227,7 +291,7 @@ typedef struct Cpu_Capabilities {
 	
 	#define MEMORY_BARRIER {__asm__ __volatile__("" ::: "memory");__sync_synchronize();}
 	
-	#define thread_local __thread
+	#define thread_local _Thread_local // Unlike __thread, this can go before static
 	
 #if TARGET_OS == WINDOWS
 	#define SHARED_EXPORT __attribute__((visibility("default"))) __declspec(dllexport)
@@ -244,6 +308,22 @@ typedef struct Cpu_Capabilities {
     inline u64 
     rdtsc() { return 0; }
     inline Cpu_Info_X86 cpuid(u32 function_id) {return (Cpu_Info_X86){0};}
+    inline u64 xgetbv(u32 index) {return 0;}
+    inline u64
+    mul_64x64_128(u64 a, u64 b, u64 *hi) {
+		u64 a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+		u64 b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+		u64 p0 = a_lo*b_lo;
+		u64 p1 = a_lo*b_hi;
+		u64 p2 = a_hi*b_lo;
+		u64 p3 = a_hi*b_hi;
+		u64 middle = (p0 >> 32) + (p1 & 0xFFFFFFFF) + (p2 & 0xFFFFFFFF);
+		*hi = p3 + (p1 >> 32) + (p2 >> 32) + (middle >> 32);
+		return (middle << 32) | (p0 & 0xFFFFFFFF);
+    }
+    #define TARGET_SSE41
+    #define TARGET_AVX
+    #define TARGET_AVX2
     #define COMPILER_CAN_DO_SSE2 0
     #define COMPILER_CAN_DO_AVX 0
     #define COMPILER_CAN_DO_AVX2 0
@@ -272,13 +352,39 @@ query_cpu_capabilities() {
     result.sse42 = (info.ecx & (1 << 20)) != 0;
     result.any_sse = result.sse1 || result.sse2 || result.sse3 || result.ssse3 || result.sse41 || result.sse42;
     
-    result.avx = (info.ecx & (1 << 28)) != 0;
+    // The cpu having avx doesn't help if the OS doesn't save the ymm/zmm registers
+    bool os_saves_ymm = false;
+    bool os_saves_zmm = false;
+    if (info.ecx & (1 << 27)) { // osxsave
+    	u64 xcr0 = xgetbv(0);
+    	os_saves_ymm = (xcr0 & 0x6) == 0x6;
+    	os_saves_zmm = (xcr0 & 0xE6) == 0xE6;
+    }
+    
+    result.avx = (info.ecx & (1 << 28)) != 0 && os_saves_ymm;
 
     Cpu_Info_X86 ext_info = cpuid(7);
-    result.avx2 = (ext_info.ebx & (1 << 5)) != 0;
+    result.avx2 = (ext_info.ebx & (1 << 5)) != 0 && result.avx;
     
-    result.avx512 = (ext_info.ebx & (1 << 16)) != 0;
+    result.avx512 = (ext_info.ebx & (1 << 16)) != 0 && os_saves_zmm;
 
     return result;
 }
 
+// Cached query_cpu_capabilities(), cheap enough to call in runtime dispatch
+Cpu_Capabilities 
+get_cpu_capabilities() {
+	local_persist Cpu_Capabilities capabilities;
+	local_persist volatile bool queried = false;
+	if (!queried) {
+		// Threads racing here all write the same thing. Capabilities must be visible before
+		// the flag so nobody returns them half written.
+		capabilities = query_cpu_capabilities();
+		MEMORY_BARRIER;
+		queried = true;
+	}
+	// And not read before the flag
+	MEMORY_BARRIER;
+	return capabilities;
+}
+
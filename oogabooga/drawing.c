@@ -18,6 +18,7 @@
 	void draw_text(Gfx_Font *font, string text, u32 raster_height, Vector2 position, Vector2 scale, Vector4 color);
 	Gfx_Text_Metrics draw_text_and_measure(Gfx_Font *font, string text, u32 raster_height, Vector2 position, Vector2 scale, Vector4 color);
 	void draw_line(Vector2 p0, Vector2 p1, float line_width, Vector4 color);
+	void draw_profiler_overlay(Gfx_Font *font, u32 font_height);
 */
 
 // We use radix sort so the exact bit count is of importance
@@ -28,6 +29,7 @@
 
 typedef struct Draw_Quad {
 	// BEWARE !! These are in ndc
+	// Next to each other, draw_quad_projected() transforms them as one array
 	Vector2 bottom_left, top_left, top_right, bottom_right;
 	// r, g, b, a
 	Vector4 color;
@@ -111,10 +113,12 @@ void pop_window_scissor() {
 
 Draw_Quad _nil_quad = {0};
 Draw_Quad *draw_quad_projected(Draw_Quad quad, Matrix4 world_to_clip) {
-	quad.bottom_left  = m4_transform(world_to_clip, v4(v2_expand(quad.bottom_left), 0, 1)).xy;
-	quad.top_left     = m4_transform(world_to_clip, v4(v2_expand(quad.top_left), 0, 1)).xy;
-	quad.top_right    = m4_transform(world_to_clip, v4(v2_expand(quad.top_right), 0, 1)).xy;
-	quad.bottom_right = m4_transform(world_to_clip, v4(v2_expand(quad.bottom_right), 0, 1)).xy;
+	// Corners are 2d with z = 0 & w = 1, so only x, y and the translation of the matrix matter
+	float32 affine[6] = {
+		world_to_clip.m[0][0], world_to_clip.m[0][1], world_to_clip.m[0][3],
+		world_to_clip.m[1][0], world_to_clip.m[1][1], world_to_clip.m[1][3],
+	};
+	simd_transform_points_2d((float32*)&quad.bottom_left, 4, affine);
 	
 	bool should_cull = 
 	    (quad.bottom_left.x < -1 && quad.top_left.x < -1 && quad.top_right.x < -1 && quad.bottom_right.x < -1) ||
@@ -318,6 +322,124 @@ void draw_line(Vector2 p0, Vector2 p1, float line_width, Vector4 color) {
 	draw_rect_xform(line_xform, v2(length, line_width), color);
 }
 
+// Frame time graph, the most expensive scopes and the counters over the last
+// PROFILER_FRAME_HISTORY frames, in the top left corner of the window on top of everything.
+// Needs ENABLE_PROFILING, the stats are collected in os_update().
+void draw_profiler_overlay(Gfx_Font *font, u32 font_height) {
+	Profile_Frame_Stats frame = profiler_get_frame_stats();
+	Profile_Scope_Stats scopes[12];
+	u64 scope_count = profiler_get_top_scopes(scopes, 12);
+	Profile_Counter_Stats counters[12];
+	u64 counter_count = profiler_get_counters(counters, 12);
+	float64 frame_times[PROFILER_FRAME_HISTORY];
+	u64 frame_time_count = profiler_get_frame_times(frame_times, PROFILER_FRAME_HISTORY);
+	
+	// Draw in window pixels regardless of what the game uses
+	Matrix4 last_projection = draw_frame.projection;
+	Matrix4 last_view = draw_frame.view;
+	u64 last_scissor_count = draw_frame.scissor_count;
+	draw_frame.projection = m4_make_orthographic_projection(0, window.pixel_width, 0, window.pixel_height, -1, 10);
+	draw_frame.view = m4_scalar(1.0);
+	draw_frame.scissor_count = 0;
+	push_z_layer(MAX_Z);
+	
+	const Vector4 text_color = v4(1.0, 1.0, 1.0, 1.0);
+	const Vector4 dim_color  = v4(0.6, 0.6, 0.6, 1.0);
+	float32 line_height = (float32)font_height*1.25f;
+	float32 padding = (float32)font_height*0.5f;
+	float32 width = (float32)font_height*34;
+	float32 graph_height = (float32)font_height*5;
+	u64 line_count = 1 + 1 + max(scope_count, 1) + (counter_count ? counter_count+1 : 0);
+	float32 height = padding*3 + graph_height + line_height*line_count;
+	
+	float32 left = padding;
+	float32 top = (float32)window.pixel_height-padding;
+	draw_rect(v2(left, top-height), v2(width, height), v4(0.0, 0.0, 0.0, 0.75));
+	
+	float32 x = left+padding;
+	float32 y = top-padding;
+	
+	if (frame.frame_count == 0) {
+		draw_text(font, STR("No frame stats, is ENABLE_PROFILING on?"), font_height, v2(x, y-line_height), v2(1, 1), text_color);
+	} else {
+		y -= line_height;
+		draw_text(font, tprint("Frame %.2fms  avg %.2fms  min %.2fms  max %.2fms  (%.0f fps)",
+			frame.frame_seconds*1000.0, frame.average_frame_seconds*1000.0,
+			frame.min_frame_seconds*1000.0, frame.max_frame_seconds*1000.0,
+			frame.average_frame_seconds > 0 ? 1.0/frame.average_frame_seconds : 0.0), 
+			font_height, v2(x, y), v2(1, 1), text_color);
+	}
+	
+	///
+	// Frame time graph, scaled so the 60 fps line is always in view
+	y -= padding + graph_height;
+	float32 graph_width = width-padding*2;
+	float64 graph_max_seconds = max(frame.max_frame_seconds, 1.0/30.0);
+	draw_rect(v2(x, y), v2(graph_width, graph_height), v4(0.15, 0.15, 0.15, 0.75));
+	float32 bar_width = graph_width/(float32)PROFILER_FRAME_HISTORY;
+	for (u64 i = 0; i < frame_time_count; i++) {
+		float64 seconds = frame_times[i];
+		Vector4 color = v4(0.2, 0.8, 0.2, 1.0);
+		if (seconds > 1.0/60.0+0.0005) color = v4(0.9, 0.8, 0.2, 1.0);
+		if (seconds > 1.0/30.0+0.0005) color = v4(0.9, 0.2, 0.2, 1.0);
+		float32 bar_height = (float32)(seconds/graph_max_seconds)*graph_height;
+		draw_rect(v2(x+bar_width*(PROFILER_FRAME_HISTORY-frame_time_count+i), y), v2(max(bar_width-1, 1), bar_height), color);
+	}
+	float32 line_y = y+(float32)((1.0/60.0)/graph_max_seconds)*graph_height;
+	draw_rect(v2(x, line_y), v2(graph_width, 1), v4(1.0, 1.0, 1.0, 0.5));
+	y -= padding;
+	
+	///
+	// Scopes, averaged over the history so the numbers are readable
+	float32 self_x  = x+(float32)font_height*14;
+	float32 total_x = x+(float32)font_height*19;
+	float32 max_x   = x+(float32)font_height*24;
+	float32 calls_x = x+(float32)font_height*29;
+	
+	y -= line_height;
+	draw_text(font, STR("Scope"), font_height, v2(x, y), v2(1, 1), dim_color);
+	draw_text(font, STR("self ms"), font_height, v2(self_x, y), v2(1, 1), dim_color);
+	draw_text(font, STR("total ms"), font_height, v2(total_x, y), v2(1, 1), dim_color);
+	draw_text(font, STR("max ms"), font_height, v2(max_x, y), v2(1, 1), dim_color);
+	draw_text(font, STR("calls"), font_height, v2(calls_x, y), v2(1, 1), dim_color);
+	if (scope_count == 0) {
+		y -= line_height;
+		draw_text(font, STR("(no scopes)"), font_height, v2(x, y), v2(1, 1), dim_color);
+	}
+	for (u64 i = 0; i < scope_count; i++) {
+		Profile_Scope_Stats s = scopes[i];
+		y -= line_height;
+		draw_text(font, string_view(s.name, 0, min(s.name.count, 24)), font_height, v2(x, y), v2(1, 1), text_color);
+		draw_text(font, tprint("%.3f", s.average_self_seconds*1000.0), font_height, v2(self_x, y), v2(1, 1), text_color);
+		draw_text(font, tprint("%.3f", s.average_total_seconds*1000.0), font_height, v2(total_x, y), v2(1, 1), text_color);
+		draw_text(font, tprint("%.3f", s.max_total_seconds*1000.0), font_height, v2(max_x, y), v2(1, 1), text_color);
+		draw_text(font, tprint("%.1f", s.average_calls), font_height, v2(calls_x, y), v2(1, 1), text_color);
+	}
+	
+	///
+	// Counters
+	if (counter_count > 0) {
+		y -= line_height;
+		draw_text(font, STR("Counter"), font_height, v2(x, y), v2(1, 1), dim_color);
+		draw_text(font, STR("value"), font_height, v2(self_x, y), v2(1, 1), dim_color);
+		draw_text(font, STR("average"), font_height, v2(total_x, y), v2(1, 1), dim_color);
+		draw_text(font, STR("max"), font_height, v2(max_x, y), v2(1, 1), dim_color);
+	}
+	for (u64 i = 0; i < counter_count; i++) {
+		Profile_Counter_Stats c = counters[i];
+		y -= line_height;
+		draw_text(font, string_view(c.name, 0, min(c.name.count, 24)), font_height, v2(x, y), v2(1, 1), text_color);
+		draw_text(font, tprint("%.0f", c.value), font_height, v2(self_x, y), v2(1, 1), text_color);
+		draw_text(font, tprint("%.1f", c.average), font_height, v2(total_x, y), v2(1, 1), text_color);
+		draw_text(font, tprint("%.0f", c.max), font_height, v2(max_x, y), v2(1, 1), text_color);
+	}
+	
+	pop_z_layer();
+	draw_frame.scissor_count = last_scissor_count;
+	draw_frame.projection = last_projection;
+	draw_frame.view = last_view;
+}
+
 #define COLOR_RED   ((Vector4){1.0, 0.0, 0.0, 1.0})
 #define COLOR_GREEN ((Vector4){0.0, 1.0, 0.0, 1.0})
 #define COLOR_BLUE  ((Vector4){0.0, 0.0, 1.0, 1.0})
@@ -147,6 +147,12 @@ int entry(int argc, char **argv) {
 		
 		if (show) draw_image(atlas->image, v2(-1.6, -1), v2(4, 4), COLOR_WHITE);
 		
+		// Needs ENABLE_PROFILING
+		local_persist bool show_profiler = false;
+		if (is_key_just_pressed('P')) show_profiler = !show_profiler;
+		
+		if (show_profiler) draw_profiler_overlay(font, 16);
+		
 		if (do_enable_z_sorting) {
 			pop_window_scissor();
 		}
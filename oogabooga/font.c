@@ -290,43 +290,48 @@ void walk_glyphs(Walk_Glyphs_Spec spec, Walk_Glyphs_Callback_Proc proc) {
 	float y = 0;
 	
 	u32 last_c = 0;
-	u32 c = next_utf8(&spec.text);
-	while (c != 0) {
+	
+	// Decode a chunk at a time so ascii text goes through the simd path
+	u32 codepoints[256];
+	u64 codepoint_count;
+	while ((codepoint_count = utf8_decode(&spec.text, codepoints, 256))) {
+		for (u64 i = 0; i < codepoint_count; i++) {
+			u32 c = codepoints[i];
+			if (c == 0) return;
 		
-		render_atlas_if_not_yet_rendered(spec.font, spec.raster_height, c);
+			render_atlas_if_not_yet_rendered(spec.font, spec.raster_height, c);
 		
-		if (c == '\n') {
-			x = 0;
-			y -= (variation->metrics.latin_ascent-variation->metrics.latin_descent+variation->metrics.line_spacing)*spec.scale.y;
-			last_c = 0;
-		}
+			if (c == '\n') {
+				x = 0;
+				y -= (variation->metrics.latin_ascent-variation->metrics.latin_descent+variation->metrics.line_spacing)*spec.scale.y;
+				last_c = 0;
+			}
 		
-		if (c < 32 && spec.ignore_control_codes) {
-			c = next_utf8(&spec.text);
-			continue;
-		}
+			if (c < 32 && spec.ignore_control_codes) {
+				continue;
+			}
 		
-		u32 atlas_index = c/variation->codepoint_range_per_atlas;
+			u32 atlas_index = c/variation->codepoint_range_per_atlas;
 		
-		Gfx_Font_Atlas *atlas = (Gfx_Font_Atlas*)hash_table_find(&variation->atlases, atlas_index);
-		Gfx_Glyph glyph = atlas->glyphs[c-atlas->first_codepoint];
+			Gfx_Font_Atlas *atlas = (Gfx_Font_Atlas*)hash_table_find(&variation->atlases, atlas_index);
+			Gfx_Glyph glyph = atlas->glyphs[c-atlas->first_codepoint];
 		
-		float glyph_x = x+glyph.xoffset*spec.scale.x;
-		float glyph_y = y+(glyph.yoffset)*spec.scale.y;
-		bool should_continue = proc(glyph, atlas, glyph_x, glyph_y, spec.ud);
+			float glyph_x = x+glyph.xoffset*spec.scale.x;
+			float glyph_y = y+(glyph.yoffset)*spec.scale.y;
+			bool should_continue = proc(glyph, atlas, glyph_x, glyph_y, spec.ud);
 		
-		if (!should_continue) break;
+			if (!should_continue) return;
 		
-		// #Incomplete kerning
-		x += glyph.advance*spec.scale.x;
-		if (last_c != 0) {
-			int kerning_unscaled = stbtt_GetCodepointKernAdvance(&spec.font->stbtt_handle, last_c, c);
-			float kerning_scaled_to_font_height = kerning_unscaled * variation->scale;
-			x += kerning_scaled_to_font_height*spec.scale.x;
-		}
+			// #Incomplete kerning
+			x += glyph.advance*spec.scale.x;
+			if (last_c != 0) {
+				int kerning_unscaled = stbtt_GetCodepointKernAdvance(&spec.font->stbtt_handle, last_c, c);
+				float kerning_scaled_to_font_height = kerning_unscaled * variation->scale;
+				x += kerning_scaled_to_font_height*spec.scale.x;
+			}
 		
-		last_c = c;
-		c = next_utf8(&spec.text);
+			last_c = c;
+		}
 	}
 }
 
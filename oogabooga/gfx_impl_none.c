@@ -0,0 +1,49 @@
+// #Portability
+// Null renderer for headless builds.
+// The drawing api works like with any other renderer and gfx_update() runs the same CPU
+// pipeline (sorting, vertex expansion & batching), the vertices just don't go anywhere.
+// This way game & ui code can run in tests, benchmarks and servers without a window, and
+// frame times of headless replays include the renderer's CPU work.
+
+const Gfx_Handle GFX_INVALID_HANDLE = 0;
+
+Quad_Pipeline none_quad_pipeline = ZERO(Quad_Pipeline);
+
+void gfx_init() {
+}
+
+void gfx_update() {
+	draw_frame_capture_update();
+	
+	Quad_Pipeline *p = &none_quad_pipeline;
+	tm_scope("Quad processing") {
+		quad_pipeline_process(p, &draw_frame, quad_buffer, window.width, window.height);
+	}
+	
+	u64 draw_calls = 0;
+	u64 batch_count = growing_array_get_valid_count(p->batches);
+	for (u64 i = 0; i < batch_count; i++) {
+		if (p->batches[i].quad_count) draw_calls += 1;
+	}
+	
+	tm_counter("Quads", draw_frame.num_quads);
+	tm_counter("Draw calls", draw_calls);
+	tm_counter("Texture flushes", p->texture_flushes);
+	
+	reset_draw_frame(&draw_frame);
+}
+
+void gfx_init_image(Gfx_Image *image, void *initial_data) {
+	// Handles need to be unique per image for texture batching, so the image itself will do.
+	image->gfx_handle = image;
+}
+void gfx_set_image_data(Gfx_Image *image, u32 x, u32 y, u32 w, u32 h, void *data) {
+}
+void gfx_deinit_image(Gfx_Image *image) {
+	image->gfx_handle = GFX_INVALID_HANDLE;
+}
+
+bool 
+shader_recompile_with_extension(string ext_source, u64 cbuffer_size) {
+	return true;
+}
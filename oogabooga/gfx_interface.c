@@ -7,6 +7,8 @@
 	#include <d3dcommon.h>
 	typedef ID3D11ShaderResourceView * Gfx_Handle;
 	
+#elif GFX_RENDERER == GFX_RENDERER_NONE
+	typedef void * Gfx_Handle;
 #elif GFX_RENDERER == GFX_RENDERER_VULKAN
 	#error "We only have a D3D11 renderer at the moment"
 #elif GFX_RENDERER == GFX_RENDERER_METAL
@@ -5,6 +5,7 @@
 	
 		void growing_array_init_reserve(void **array, u64 block_size_in_bytes, u64 count_to_reserve, Allocator allocator);
 		void growing_array_init(void **array, u64 block_size_in_bytes, Allocator allocator);
+		void growing_array_init_virtual(void **array, u64 block_size_in_bytes, u64 max_count);
 		void growing_array_deinit(void **array);
 		
 		void *growing_array_add_empty(void **array);
@@ -36,6 +37,10 @@
 	    
 	    growing_array_deinit(&things);
 	    
+	    // For huge arrays: reserves address space for max_count items once and commits
+	    // pages as the array grows, so it never moves or copies.
+	    growing_array_init_virtual(&things, sizeof(Thing), 100000000);
+	    
 	    Thing new_thing;
 	    growing_array_add(&things, &new_thing); // 'thing' is copied
 	    
@@ -72,6 +77,9 @@ typedef struct Growing_Array_Header {
     u32 allocated_count;
     u32 block_size_in_bytes;
     Allocator allocator;
+    // Only set for arrays made with growing_array_init_virtual(), allocator is unused then.
+    u64 reserved_bytes;
+    u64 committed_bytes;
 } Growing_Array_Header;
 
 bool 
@@ -94,10 +102,34 @@ growing_array_init_reserve(void **array, u64 block_size_in_bytes, u64 count_to_r
     header->valid_count = 0;
     header->allocated_count = count_to_reserve;
     header->signature = GROWING_ARRAY_SIGNATURE;
+    header->reserved_bytes = 0;
+    header->committed_bytes = 0;
     
     *array = header+1;
 }
 void
+growing_array_init_virtual(void **array, u64 block_size_in_bytes, u64 max_count) {
+	assert(max_count <= UINT32_MAX, "Growing arrays can't hold more than UINT32_MAX items");
+	
+	u64 reserved_bytes = align_next(max_count*block_size_in_bytes + sizeof(Growing_Array_Header), os.page_size);
+	Growing_Array_Header *header = (Growing_Array_Header*)os_reserve_address_space(reserved_bytes);
+	assert(header, "Failed reserving address space for virtual growing array");
+	
+	u64 committed_bytes = min(align_next(sizeof(Growing_Array_Header)+8*block_size_in_bytes, os.page_size), reserved_bytes);
+	bool ok = os_commit_address_space(header, committed_bytes);
+	assert(ok, "Failed committing memory for virtual growing array");
+	
+	header->allocator = ZERO(Allocator);
+	header->block_size_in_bytes = block_size_in_bytes;
+	header->valid_count = 0;
+	header->allocated_count = (committed_bytes-sizeof(Growing_Array_Header))/block_size_in_bytes;
+	header->signature = GROWING_ARRAY_SIGNATURE;
+	header->reserved_bytes = reserved_bytes;
+	header->committed_bytes = committed_bytes;
+	
+	*array = header+1;
+}
+void
 growing_array_init(void **array, u64 block_size_in_bytes, Allocator allocator) {
     growing_array_init_reserve(array, block_size_in_bytes, 8, allocator);
 }
@@ -105,6 +137,10 @@ void
 growing_array_deinit(void **array) {
 	assert(check_growing_array_signature(array), "Not a valid growing array");
     Growing_Array_Header *header = ((Growing_Array_Header*)*array) - 1;
+    if (header->reserved_bytes) {
+    	os_release_address_space(header, header->reserved_bytes);
+    	return;
+    }
     dealloc(header->allocator, header);
 }
 
@@ -115,19 +151,28 @@ growing_array_reserve(void **array, u64 count_to_reserve) {
     
     if (header->allocated_count >= count_to_reserve) return;
     
+    if (header->reserved_bytes) {
+    	// Commit the next pages in place. Still power of two steps so we don't go to the OS on every add.
+    	u64 bytes_needed = count_to_reserve*header->block_size_in_bytes+sizeof(Growing_Array_Header);
+    	assert(bytes_needed <= header->reserved_bytes, "Virtual growing array ran out of reserved address space (%llu items)", (header->reserved_bytes-sizeof(Growing_Array_Header))/header->block_size_in_bytes);
+    	u64 bytes_to_commit = min(align_next(get_next_power_of_two(bytes_needed), os.page_size), header->reserved_bytes);
+    	bool ok = os_commit_address_space((u8*)header+header->committed_bytes, bytes_to_commit-header->committed_bytes);
+    	assert(ok, "Failed committing memory for virtual growing array");
+    	header->committed_bytes = bytes_to_commit;
+    	header->allocated_count = (bytes_to_commit-sizeof(Growing_Array_Header))/header->block_size_in_bytes;
+    	return;
+    }
+    
     u64 old_allocated_bytes = header->allocated_count*header->block_size_in_bytes+sizeof(Growing_Array_Header);
     count_to_reserve = get_next_power_of_two(count_to_reserve);
     u64 bytes_to_allocate = count_to_reserve*header->block_size_in_bytes+sizeof(Growing_Array_Header);
-    Growing_Array_Header *new_header = (Growing_Array_Header*)alloc(header->allocator, bytes_to_allocate);
-    
-    memcpy(new_header, header, old_allocated_bytes);
     
+    // Heap allocator grows in place when there's free space right after the array
+    Growing_Array_Header *new_header = (Growing_Array_Header*)reallocate(header->allocator, header, old_allocated_bytes, bytes_to_allocate);
     
     *array = new_header+1;
     
     new_header->allocated_count = count_to_reserve;
-    
-    dealloc(header->allocator, header);
 }
 
 void*
@@ -187,7 +232,8 @@ growing_array_ordered_remove_by_index(void **array, u32 index) {
     
     u64 byte_index = header->block_size_in_bytes*index;
     
-    memcpy(
+    // Source & destination overlap
+    memmove(
         (u8*)*array + byte_index, 
         (u8*)*array + byte_index + header->block_size_in_bytes,
         (header->valid_count-index-1)*header->block_size_in_bytes
@@ -18,32 +18,395 @@ static inline u64 xx_hash(u64 x) {
     return h64;
 }
 
-static inline u64 city_hash(string s) {
-    const u64 k = 0x9ddfea08eb382d69ULL;
-    u64 a = s.count;
-    u64 b = s.count * 5;
-    u64 c = 9;
-    u64 d = b;
-
-    if (s.count <= 16) {
-        memcpy(&a, s.data, sizeof(u64));
-        memcpy(&b, s.data + s.count - 8, sizeof(u64));
-    } else {
-        memcpy(&a, s.data, sizeof(u64));
-        memcpy(&b, s.data + 8, sizeof(u64));
-        memcpy(&c, s.data + s.count - 8, sizeof(u64));
-        memcpy(&d, s.data + s.count - 16, sizeof(u64));
-    }
+//
+// hash_bytes() hashes any number of bytes with a seed.
+//
+// Up to HASH_SHORT_MAX bytes it works like wyhash: a 64x64->128 bit multiply folds 16 bytes
+// at a time, with three independent lanes over 48 bytes so the multiplies overlap. The tail
+// is read with overlapping loads that never leave the key.
+//
+// Longer keys go through an XXH3 style striped accumulator. 8 lanes of 64 bits take 64 bytes
+// per stripe with 32x32->64 bit multiplies against a secret, which is exactly what SSE2 and
+// AVX2 can do. The lanes are scrambled after every block and folded together at the end.
+// The last stripe always overlaps the end of the key so there's no tail to deal with.
+//
+// Hash_State does the same incrementally and gives the same hash as hash_bytes() on all of
+// the data at once.
+//
+// None of this is cryptographic.
+//
+
+#define HASH_SHORT_MAX 256
+#define HASH_STRIPE_SIZE 64
+#define HASH_SECRET_SIZE 192
+#define HASH_STRIPES_PER_BLOCK ((HASH_SECRET_SIZE-HASH_STRIPE_SIZE)/8)
+#define HASH_BLOCK_SIZE (HASH_STRIPES_PER_BLOCK*HASH_STRIPE_SIZE)
+
+#define HASH_PRIME32_1 0x9E3779B1U
+#define HASH_PRIME32_2 0x85EBCA77U
+#define HASH_PRIME32_3 0xC2B2AE3DU
+
+#define HASH_WY_0 0x2d358dccaa6c78a5ULL
+#define HASH_WY_1 0x8bb84b93962eacc9ULL
+#define HASH_WY_2 0x4b33a62ed433d4a3ULL
+#define HASH_WY_3 0x4d5a2da51de1aa47ULL
+
+// splitmix64 output, nothing special about it other than being random
+const u8 _hash_secret[HASH_SECRET_SIZE] = {
+	0xb2, 0x10, 0x1f, 0x0a, 0x24, 0x34, 0x90, 0xa4, 0xbc, 0x07, 0xa4, 0x9d, 0x59, 0x07, 0xbc, 0x2e,
+	0xc7, 0xfa, 0x0a, 0x20, 0x87, 0x4b, 0x56, 0x1f, 0xbd, 0x4f, 0xef, 0x79, 0x5c, 0x90, 0x88, 0x4d,
+	0x97, 0x18, 0x7c, 0xc5, 0x81, 0x72, 0x8a, 0x25, 0xb3, 0xc4, 0x2d, 0x94, 0x72, 0x65, 0xeb, 0x64,
+	0xe0, 0x80, 0xae, 0x7c, 0x85, 0x46, 0xf0, 0x61, 0x96, 0x4c, 0x17, 0x02, 0x60, 0xef, 0xa9, 0x85,
+	0xc7, 0x6e, 0x17, 0xd8, 0x0a, 0xc6, 0x99, 0x61, 0xe3, 0x3f, 0xde, 0x4c, 0x57, 0x12, 0xdf, 0xc5,
+	0xfe, 0x42, 0x9c, 0xf8, 0x08, 0x7e, 0xce, 0x74, 0x10, 0x2f, 0xda, 0xb8, 0xb2, 0x04, 0x41, 0xcb,
+	0xf8, 0x17, 0xbe, 0x0a, 0x2c, 0xd9, 0x5e, 0x3c, 0x75, 0xa1, 0x24, 0x17, 0x7a, 0x2e, 0x05, 0x2b,
+	0x0a, 0xb8, 0x07, 0xfc, 0xcc, 0xb8, 0x1a, 0xc6, 0x05, 0x82, 0x46, 0x93, 0x6d, 0x77, 0x17, 0x4c,
+	0x23, 0x0f, 0x2d, 0xd6, 0x41, 0x30, 0xc4, 0x7f, 0x4b, 0x6d, 0xc3, 0x06, 0x13, 0x79, 0x6d, 0xb6,
+	0xa3, 0xe2, 0x7d, 0x12, 0x6a, 0x06, 0x4c, 0xc1, 0x11, 0x89, 0xe0, 0x22, 0x0a, 0x6c, 0xf9, 0xae,
+	0x07, 0xf9, 0x7e, 0x3d, 0x3a, 0x06, 0x42, 0xf0, 0xb5, 0x0c, 0xd0, 0xad, 0xf3, 0xfe, 0xdf, 0x99,
+	0x08, 0xf8, 0x3d, 0xd5, 0x55, 0x43, 0x33, 0x41, 0xc2, 0x9a, 0x40, 0x52, 0x69, 0x82, 0xd0, 0xfc,
+};
+
+inline u64
+_hash_read64(const u8 *p) {
+	u64 x;
+	memcpy(&x, p, sizeof(x));
+	return x;
+}
+inline u64
+_hash_read32(const u8 *p) {
+	u32 x;
+	memcpy(&x, p, sizeof(x));
+	return x;
+}
+// Both halves of the 128 bit product folded together
+inline u64
+_hash_mix(u64 a, u64 b) {
+	u64 hi;
+	u64 lo = mul_64x64_128(a, b, &hi);
+	return lo ^ hi;
+}
+
+u64
+_hash_short(const u8 *p, u64 count, u64 seed) {
+	seed ^= _hash_mix(seed ^ HASH_WY_0, HASH_WY_1);
+	u64 a, b;
+	if (count <= 16) {
+		if (count >= 4) {
+			// Two pairs of 4 byte loads from each end cover 4 to 16 bytes
+			u64 offset = (count >> 3) << 2;
+			a = (_hash_read32(p) << 32) | _hash_read32(p+offset);
+			b = (_hash_read32(p+count-4) << 32) | _hash_read32(p+count-4-offset);
+		} else if (count > 0) {
+			a = ((u64)p[0] << 16) | ((u64)p[count >> 1] << 8) | p[count-1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		u64 i = count;
+		if (i > 48) {
+			u64 seed1 = seed;
+			u64 seed2 = seed;
+			do {
+				seed  = _hash_mix(_hash_read64(p)    ^ HASH_WY_1, _hash_read64(p+8)  ^ seed);
+				seed1 = _hash_mix(_hash_read64(p+16) ^ HASH_WY_2, _hash_read64(p+24) ^ seed1);
+				seed2 = _hash_mix(_hash_read64(p+32) ^ HASH_WY_3, _hash_read64(p+40) ^ seed2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= seed1 ^ seed2;
+		}
+		while (i > 16) {
+			seed = _hash_mix(_hash_read64(p) ^ HASH_WY_1, _hash_read64(p+8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		// Last 16 bytes, overlapping what was already hashed if there's less than that left
+		a = _hash_read64(p+i-16);
+		b = _hash_read64(p+i-8);
+	}
+	a ^= HASH_WY_1;
+	b ^= seed;
+	a = mul_64x64_128(a, b, &b);
+	return _hash_mix(a ^ HASH_WY_0 ^ count, b ^ HASH_WY_1);
+}
 
-    a += b;
-    a = (a << 43) | (a >> (64 - 43));
-    a += c;
-    a = a * 5 + 0x52dce729;
-    d ^= a;
-    d = (d << 44) | (d >> (64 - 44));
-    d += b;
+// Stripe n is keyed with the secret at secret+n*8
+typedef void (*Hash_Accumulate_Proc)(u64 *acc, const u8 *data, u64 stripe_count, const u8 *secret);
+typedef void (*Hash_Scramble_Proc)(u64 *acc, const u8 *secret);
+
+typedef struct Hash_Kernels {
+	Hash_Accumulate_Proc accumulate;
+	Hash_Scramble_Proc scramble;
+} Hash_Kernels;
+Hash_Kernels hash_kernels = {0};
+
+void
+_hash_accumulate_basic(u64 *acc, const u8 *data, u64 stripe_count, const u8 *secret) {
+	for (u64 n = 0; n < stripe_count; n++) {
+		const u8 *stripe = data + n*HASH_STRIPE_SIZE;
+		const u8 *key = secret + n*8;
+		for (u64 i = 0; i < 8; i++) {
+			u64 d = _hash_read64(stripe + i*8);
+			u64 k = d ^ _hash_read64(key + i*8);
+			acc[i ^ 1] += d;
+			acc[i] += (k & 0xFFFFFFFF)*(k >> 32);
+		}
+	}
+}
+void
+_hash_scramble_basic(u64 *acc, const u8 *secret) {
+	for (u64 i = 0; i < 8; i++) {
+		u64 a = acc[i];
+		a ^= a >> 47;
+		a ^= _hash_read64(secret + i*8);
+		acc[i] = a*HASH_PRIME32_1;
+	}
+}
+
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+void
+_hash_accumulate_sse2(u64 *acc, const u8 *data, u64 stripe_count, const u8 *secret) {
+	__m128i a[4];
+	for (u64 i = 0; i < 4; i++) a[i] = _mm_loadu_si128((__m128i*)acc + i);
+	for (u64 n = 0; n < stripe_count; n++) {
+		const u8 *stripe = data + n*HASH_STRIPE_SIZE;
+		const u8 *key = secret + n*8;
+		for (u64 i = 0; i < 4; i++) {
+			__m128i d = _mm_loadu_si128((__m128i*)(stripe + i*16));
+			__m128i k = _mm_xor_si128(d, _mm_loadu_si128((__m128i*)(key + i*16)));
+			// Low 32 bits times high 32 bits of each 64 bit lane
+			__m128i product = _mm_mul_epu32(k, _mm_shuffle_epi32(k, _MM_SHUFFLE(0, 3, 0, 1)));
+			// Data goes to the other lane of the pair
+			__m128i swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+			a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, swapped));
+		}
+	}
+	for (u64 i = 0; i < 4; i++) _mm_storeu_si128((__m128i*)acc + i, a[i]);
+}
+void
+_hash_scramble_sse2(u64 *acc, const u8 *secret) {
+	__m128i prime = _mm_set1_epi32((int)HASH_PRIME32_1);
+	for (u64 i = 0; i < 4; i++) {
+		__m128i a = _mm_loadu_si128((__m128i*)acc + i);
+		a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+		a = _mm_xor_si128(a, _mm_loadu_si128((__m128i*)(secret + i*16)));
+		// No 64 bit multiply, so it's lo*prime + (hi*prime << 32)
+		__m128i lo = _mm_mul_epu32(a, prime);
+		__m128i hi = _mm_mul_epu32(_mm_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+		_mm_storeu_si128((__m128i*)acc + i, _mm_add_epi64(lo, _mm_slli_epi64(hi, 32)));
+	}
+}
+
+TARGET_AVX2 void
+_hash_accumulate_avx2(u64 *acc, const u8 *data, u64 stripe_count, const u8 *secret) {
+	__m256i a0 = _mm256_loadu_si256((__m256i*)acc);
+	__m256i a1 = _mm256_loadu_si256((__m256i*)acc + 1);
+	for (u64 n = 0; n < stripe_count; n++) {
+		const u8 *stripe = data + n*HASH_STRIPE_SIZE;
+		const u8 *key = secret + n*8;
+		__m256i d0 = _mm256_loadu_si256((__m256i*)stripe);
+		__m256i d1 = _mm256_loadu_si256((__m256i*)(stripe + 32));
+		__m256i k0 = _mm256_xor_si256(d0, _mm256_loadu_si256((__m256i*)key));
+		__m256i k1 = _mm256_xor_si256(d1, _mm256_loadu_si256((__m256i*)(key + 32)));
+		__m256i p0 = _mm256_mul_epu32(k0, _mm256_shuffle_epi32(k0, _MM_SHUFFLE(0, 3, 0, 1)));
+		__m256i p1 = _mm256_mul_epu32(k1, _mm256_shuffle_epi32(k1, _MM_SHUFFLE(0, 3, 0, 1)));
+		a0 = _mm256_add_epi64(a0, _mm256_add_epi64(p0, _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2))));
+		a1 = _mm256_add_epi64(a1, _mm256_add_epi64(p1, _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2))));
+	}
+	_mm256_storeu_si256((__m256i*)acc, a0);
+	_mm256_storeu_si256((__m256i*)acc + 1, a1);
+}
+TARGET_AVX2 void
+_hash_scramble_avx2(u64 *acc, const u8 *secret) {
+	__m256i prime = _mm256_set1_epi32((int)HASH_PRIME32_1);
+	for (u64 i = 0; i < 2; i++) {
+		__m256i a = _mm256_loadu_si256((__m256i*)acc + i);
+		a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+		a = _mm256_xor_si256(a, _mm256_loadu_si256((__m256i*)(secret + i*32)));
+		__m256i lo = _mm256_mul_epu32(a, prime);
+		__m256i hi = _mm256_mul_epu32(_mm256_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+		_mm256_storeu_si256((__m256i*)acc + i, _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32)));
+	}
+}
+
+#endif // ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+void
+hash_kernels_select(Cpu_Isa isa) {
+	Hash_Kernels k = {0};
+	switch (isa) {
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+		case CPU_ISA_AVX2:
+			k.accumulate = _hash_accumulate_avx2;
+			k.scramble   = _hash_scramble_avx2;
+			break;
+		case CPU_ISA_SSE2:
+			k.accumulate = _hash_accumulate_sse2;
+			k.scramble   = _hash_scramble_sse2;
+			break;
+#endif
+		default:
+			k.accumulate = _hash_accumulate_basic;
+			k.scramble   = _hash_scramble_basic;
+			break;
+	}
+	hash_kernels = k;
+}
+inline Hash_Kernels*
+get_hash_kernels() {
+	get_cpu_dispatch();
+	return &hash_kernels;
+}
+
+inline void
+_hash_init_accumulators(u64 *acc, u64 seed) {
+	acc[0] = HASH_PRIME32_3 + seed;
+	acc[1] = PRIME64_1      - seed;
+	acc[2] = PRIME64_2      + seed;
+	acc[3] = PRIME64_3      - seed;
+	acc[4] = PRIME64_4      + seed;
+	acc[5] = HASH_PRIME32_2 - seed;
+	acc[6] = PRIME64_5      + seed;
+	acc[7] = HASH_PRIME32_1 - seed;
+}
+
+// Feeds whole stripes, scrambling whenever a block fills up
+void
+_hash_consume_stripes(u64 *acc, u64 *stripes_in_block, const u8 *data, u64 stripe_count) {
+	Hash_Kernels *k = get_hash_kernels();
+	while (stripe_count) {
+		u64 n = min(stripe_count, HASH_STRIPES_PER_BLOCK - *stripes_in_block);
+		k->accumulate(acc, data, n, _hash_secret + *stripes_in_block*8);
+		*stripes_in_block += n;
+		data += n*HASH_STRIPE_SIZE;
+		stripe_count -= n;
+		if (*stripes_in_block == HASH_STRIPES_PER_BLOCK) {
+			k->scramble(acc, _hash_secret + HASH_SECRET_SIZE - HASH_STRIPE_SIZE);
+			*stripes_in_block = 0;
+		}
+	}
+}
+
+// last_stripe is the final 64 bytes of the data, which always go in on their own
+u64
+_hash_finish_long(u64 *acc, const u8 *last_stripe, u64 count) {
+	get_hash_kernels()->accumulate(acc, last_stripe, 1, _hash_secret + HASH_SECRET_SIZE - HASH_STRIPE_SIZE - 7);
+	u64 result = count*PRIME64_1;
+	for (u64 i = 0; i < 4; i++) {
+		result += _hash_mix(acc[2*i] ^ _hash_read64(_hash_secret + 11 + 16*i), acc[2*i+1] ^ _hash_read64(_hash_secret + 19 + 16*i));
+	}
+	result ^= result >> 37;
+	result *= 0x165667919E3779F9ULL;
+	result ^= result >> 32;
+	return result;
+}
+
+u64
+hash_bytes(const void *data, u64 count, u64 seed) {
+	const u8 *p = (const u8*)data;
+	if (count <= HASH_SHORT_MAX) return _hash_short(p, count, seed);
+
+	u64 acc[8];
+	_hash_init_accumulators(acc, seed);
+	u64 stripes_in_block = 0;
+	// Everything up to the last byte in whole stripes, the rest goes with the last stripe
+	_hash_consume_stripes(acc, &stripes_in_block, p, (count-1)/HASH_STRIPE_SIZE);
+	return _hash_finish_long(acc, p + count - HASH_STRIPE_SIZE, count);
+}
+
+//
+// Incremental hashing. Data is held back until there's more after it, since the end of the
+// data is hashed differently.
+//
+// Hash_State state;
+// hash_state_init(&state, seed);
+// hash_state_append(&state, header, sizeof(header));
+// hash_state_append(&state, pixels, pixel_bytes);
+// u64 hash = hash_state_get_hash(&state); // Same as hash_bytes() on header+pixels
+//
+
+typedef struct Hash_State {
+	u64 acc[8];
+	u64 seed;
+	u64 count;
+	u64 stripes_in_block;
+	u64 buffered;
+	u8 buffer[HASH_SHORT_MAX];
+	u8 last_stripe[HASH_STRIPE_SIZE]; // The last 64 bytes consumed before what's buffered
+} Hash_State;
+
+void
+hash_state_init(Hash_State *state, u64 seed) {
+	memset(state, 0, sizeof(Hash_State));
+	state->seed = seed;
+	_hash_init_accumulators(state->acc, seed);
+}
+
+void
+hash_state_append(Hash_State *state, const void *data, u64 count) {
+	const u8 *p = (const u8*)data;
+	state->count += count;
+	if (state->buffered + count <= HASH_SHORT_MAX) {
+		memcpy(state->buffer + state->buffered, p, count);
+		state->buffered += count;
+		return;
+	}
+	
+	// There's more data after the buffer now so all of it can go in
+	if (state->buffered) {
+		u64 fill = HASH_SHORT_MAX - state->buffered;
+		memcpy(state->buffer + state->buffered, p, fill);
+		p += fill;
+		count -= fill;
+		_hash_consume_stripes(state->acc, &state->stripes_in_block, state->buffer, HASH_SHORT_MAX/HASH_STRIPE_SIZE);
+		memcpy(state->last_stripe, state->buffer + HASH_SHORT_MAX - HASH_STRIPE_SIZE, HASH_STRIPE_SIZE);
+	}
+	if (count > HASH_SHORT_MAX) {
+		// Straight from the input, leaving 1 to 64 bytes
+		u64 consumed = ((count-1)/HASH_STRIPE_SIZE)*HASH_STRIPE_SIZE;
+		_hash_consume_stripes(state->acc, &state->stripes_in_block, p, consumed/HASH_STRIPE_SIZE);
+		memcpy(state->last_stripe, p + consumed - HASH_STRIPE_SIZE, HASH_STRIPE_SIZE);
+		p += consumed;
+		count -= consumed;
+	}
+	memcpy(state->buffer, p, count);
+	state->buffered = count;
+}
+
+// Doesn't change the state, so more can be appended after
+u64
+hash_state_get_hash(Hash_State *state) {
+	if (state->count <= HASH_SHORT_MAX) return _hash_short(state->buffer, state->count, state->seed);
+	
+	u64 acc[8];
+	memcpy(acc, state->acc, sizeof(acc));
+	u64 stripes_in_block = state->stripes_in_block;
+	_hash_consume_stripes(acc, &stripes_in_block, state->buffer, (state->buffered-1)/HASH_STRIPE_SIZE);
+	
+	u8 last_stripe[HASH_STRIPE_SIZE];
+	if (state->buffered >= HASH_STRIPE_SIZE) {
+		memcpy(last_stripe, state->buffer + state->buffered - HASH_STRIPE_SIZE, HASH_STRIPE_SIZE);
+	} else {
+		u64 from_before = HASH_STRIPE_SIZE - state->buffered;
+		memcpy(last_stripe, state->last_stripe + state->buffered, from_before);
+		memcpy(last_stripe + from_before, state->buffer, state->buffered);
+	}
+	return _hash_finish_long(acc, last_stripe, state->count);
+}
 
-    return d * k;
+// Hashes a batch of keys, for example when rebuilding a table. The key bytes a few keys
+// ahead are prefetched since they're usually scattered around the heap.
+void
+hash_many(const string *keys, u64 count, u64 *hashes, u64 seed) {
+	for (u64 i = 0; i < count; i++) {
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+		if (i + 4 < count) _mm_prefetch((const char*)keys[i+4].data, _MM_HINT_T0);
+#endif
+		hashes[i] = hash_bytes(keys[i].data, keys[i].count, seed);
+	}
 }
 
 u64 djb2_hash(string s) {
@@ -55,17 +418,20 @@ u64 djb2_hash(string s) {
 }
 
 u64 string_get_hash(string s) {
-    if (s.count > 32) return djb2_hash(s);
-    return city_hash(s);
+	return hash_bytes(s.data, s.count, 0);
 }
 u64 pointer_get_hash(void *p) {
 	return xx_hash((u64)p);
 }
 u64 float64_get_hash(float64 x) {
-	return xx_hash(*(u64*)&x);
+	u64 bits;
+	memcpy(&bits, &x, sizeof(bits));
+	return xx_hash(bits);
 }
 u64 float32_get_hash(float32 x) {
-	return float64_get_hash((float64)x);
+	u32 bits;
+	memcpy(&bits, &x, sizeof(bits));
+	return xx_hash(bits);
 }
 
 #define get_hash(x) _Generic((x), \
@@ -139,12 +139,7 @@ void hash_table_reserve(Hash_Table *t, u64 required_count) {
 	u64 new_count = get_next_power_of_two(required_count);
 	u64 new_size = new_count*entry_size;
 	
-	void *new_entries = alloc(t->allocator, new_size);
-	memcpy(new_entries, t->entries, current_size);
-	
-	dealloc(t->allocator, t->entries);
-	
-	t->entries = new_entries;
+	t->entries = reallocate(t->allocator, t->entries, current_size, new_size);
 	t->capacity_count = new_count;
 }
 
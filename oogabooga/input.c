@@ -21,6 +21,23 @@
 			case INPUT_EVENT_TEXT:   ...; break;
 		}
 	}
+	
+	Recording & replay:
+	
+	Input, window size & frame delta time can be recorded to a compact binary file and fed back
+	deterministically (also headless), for example to compare frame times of two builds over
+	the exact same session.
+	
+	bool input_record_begin(string path);
+	bool input_replay_begin(string path, string frame_times_path);
+	void input_recording_stop(); // Called on exit anyways
+	bool input_is_replaying();
+	
+	// Use this as your delta time, it's the recorded one when replaying
+	float64 get_frame_delta_time();
+	
+	File format: u32 magic, u32 version, u64 seed_for_random, then per frame:
+		u8 flags, f64 delta_t, then depending on flags window size, mouse position & events.
 */
 
 typedef enum Input_Event_Kind {
@@ -179,4 +196,397 @@ bool consume_key_just_released(Input_Key_Code code) {
 	bool result = is_key_just_released(code);
 	input_frame.key_states[code] &= ~(INPUT_STATE_JUST_RELEASED);
 	return result;
-}
\ No newline at end of file
+}
+///
+///
+// Input recording & replay
+//
+
+#define INPUT_RECORDING_MAGIC   0x52494f47 // "GOIR"
+#define INPUT_RECORDING_VERSION 1
+#define INPUT_RECORDING_FLUSH_SIZE KB(64)
+
+typedef enum Input_Recording_Mode {
+	INPUT_RECORDING_NONE,
+	INPUT_RECORDING_RECORD,
+	INPUT_RECORDING_REPLAY,
+} Input_Recording_Mode;
+
+// What follows the frame header
+typedef enum Input_Recording_Frame_Flags {
+	INPUT_RECORDING_FRAME_WINDOW_SIZE = 1<<0, // s32 width, s32 height
+	INPUT_RECORDING_FRAME_MOUSE       = 1<<1, // f32 mouse_x, f32 mouse_y
+	INPUT_RECORDING_FRAME_EVENTS      = 1<<2, // u16 count, then the events
+} Input_Recording_Frame_Flags;
+
+typedef struct Input_Recording {
+	Input_Recording_Mode mode;
+	float64 delta_t;
+	float64 last_update_time;
+	u64 frame_index;
+	
+	// Record
+	File file;
+	String_Builder buffer;
+	s32 last_width;
+	s32 last_height;
+	float32 last_mouse_x;
+	float32 last_mouse_y;
+	
+	// Replay
+	string data;
+	u64 read_pos;
+	bool read_failed; // Ran past the end of a truncated recording
+	float32 mouse_x;
+	float32 mouse_y;
+	float64 *frame_times; // growing array, real seconds per replayed frame
+	string frame_times_path;
+} Input_Recording;
+
+// #Global
+ogb_instance Input_Recording input_recording;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+Input_Recording input_recording = ZERO(Input_Recording);
+#endif
+
+// Seconds between the last two os_update() calls, or the recorded delta when replaying.
+// Use this rather than measuring time yourself if the game should replay deterministically.
+float64 
+get_frame_delta_time() {
+	return input_recording.delta_t;
+}
+
+bool 
+input_is_replaying() {
+	return input_recording.mode == INPUT_RECORDING_REPLAY;
+}
+
+void input_recording_stop();
+
+// Records input_frame events, mouse, window size & frame delta time at the end of every
+// os_update() until input_recording_stop(). Also saves seed_for_random, so begin before
+// generating anything random.
+bool 
+input_record_begin(string path) {
+	input_recording_stop();
+	
+	File file = os_file_open(path, O_CREATE | O_WRITE);
+	if (file == OS_INVALID_FILE) {
+		log_error("Could not open '%s' for input recording", path);
+		return false;
+	}
+	
+	Input_Recording *r = &input_recording;
+	*r = ZERO(Input_Recording);
+	r->mode = INPUT_RECORDING_RECORD;
+	r->file = file;
+	r->last_width = -1;
+	r->last_height = -1;
+	r->last_mouse_x = F32_MAX;
+	r->last_mouse_y = F32_MAX;
+	string_builder_init_reserve(&r->buffer, INPUT_RECORDING_FLUSH_SIZE+KB(4), get_heap_allocator());
+	
+	u32 header[2] = { INPUT_RECORDING_MAGIC, INPUT_RECORDING_VERSION };
+	string_builder_append(&r->buffer, (string){sizeof(header), (u8*)header});
+	string_builder_append(&r->buffer, (string){sizeof(u64), (u8*)&seed_for_random});
+	
+	return true;
+}
+
+// Feeds a recording back through input_frame, window size & get_frame_delta_time() and sets
+// window.should_close when it runs out. If frame_times_path is set, the real time each
+// frame took is written there (milliseconds, one frame per line) so runs of different
+// builds can be compared. A summary is logged either way.
+// Don't touch the keyboard while replaying a windowed game, OS input still reaches key states.
+bool 
+input_replay_begin(string path, string frame_times_path) {
+	input_recording_stop();
+	
+	Input_Recording *r = &input_recording;
+	*r = ZERO(Input_Recording);
+	
+	if (!os_read_entire_file(path, &r->data, get_heap_allocator())) {
+		log_error("Could not read input recording '%s'", path);
+		return false;
+	}
+	
+	u32 *header = (u32*)r->data.data;
+	if (r->data.count < sizeof(u32)*2+sizeof(u64) || header[0] != INPUT_RECORDING_MAGIC || header[1] != INPUT_RECORDING_VERSION) {
+		log_error("'%s' is not an input recording (or it's from another version)", path);
+		dealloc_string(get_heap_allocator(), r->data);
+		r->data = ZERO(string);
+		return false;
+	}
+	seed_for_random = *(u64*)(r->data.data+sizeof(u32)*2);
+	r->read_pos = sizeof(u32)*2+sizeof(u64);
+	
+	r->mode = INPUT_RECORDING_REPLAY;
+	r->frame_times_path = frame_times_path;
+	growing_array_init_reserve((void**)&r->frame_times, sizeof(float64), 1024, get_heap_allocator());
+	
+	return true;
+}
+
+void 
+input_replay_write_frame_times() {
+	Input_Recording *r = &input_recording;
+	u64 count = growing_array_get_valid_count(r->frame_times);
+	if (count == 0) return;
+	
+	if (r->frame_times_path.count) {
+		String_Builder b;
+		string_builder_init_reserve(&b, count*12, get_heap_allocator());
+		for (u64 i = 0; i < count; i++) {
+			string_builder_print(&b, STR("%.4f\n"), r->frame_times[i]*1000.0);
+		}
+		if (!os_write_entire_file(r->frame_times_path, b.result)) {
+			log_error("Could not write frame times to '%s'", r->frame_times_path);
+		}
+		dealloc(get_heap_allocator(), b.buffer);
+	}
+	
+	float64 *sorted = (float64*)alloc(get_heap_allocator(), count*sizeof(float64));
+	memcpy(sorted, r->frame_times, count*sizeof(float64));
+	sort_f64(sorted, count);
+	float64 total = 0;
+	for (u64 i = 0; i < count; i++) total += sorted[i];
+	
+	log_info("Replayed %llu frames in %.3fs. Frame ms: mean %.3f, p50 %.3f, p90 %.3f, p99 %.3f, max %.3f",
+		count, total, total/(float64)count*1000.0,
+		sorted[count/2]*1000.0, sorted[(count*9)/10]*1000.0, sorted[(count*99)/100]*1000.0, sorted[count-1]*1000.0);
+	
+	dealloc(get_heap_allocator(), sorted);
+}
+
+void
+input_recording_flush() {
+	Input_Recording *r = &input_recording;
+	if (r->buffer.count == 0) return;
+	
+	if (!os_file_write_bytes(r->file, r->buffer.buffer, r->buffer.count)) {
+		log_error("Failed writing input recording");
+	}
+	r->buffer.count = 0;
+}
+
+// Ends recording or replay. Called when the program exits so it's fine to not bother.
+void 
+input_recording_stop() {
+	Input_Recording *r = &input_recording;
+	
+	if (r->mode == INPUT_RECORDING_RECORD) {
+		input_recording_flush();
+		os_file_close(r->file);
+		dealloc(get_heap_allocator(), r->buffer.buffer);
+		log_info("Recorded %llu frames of input", r->frame_index);
+	} else if (r->mode == INPUT_RECORDING_REPLAY) {
+		input_replay_write_frame_times();
+		dealloc_string(get_heap_allocator(), r->data);
+		growing_array_deinit((void**)&r->frame_times);
+	}
+	
+	float64 delta_t = r->delta_t;
+	*r = ZERO(Input_Recording);
+	r->delta_t = delta_t;
+}
+
+#define _input_recording_write(r, value) string_builder_append(&(r)->buffer, (string){sizeof(value), (u8*)&(value)})
+
+void 
+input_recording_write_frame() {
+	Input_Recording *r = &input_recording;
+	
+	u8 flags = 0;
+	if (window.width != r->last_width || window.height != r->last_height) {
+		flags |= INPUT_RECORDING_FRAME_WINDOW_SIZE;
+	}
+	if (input_frame.mouse_x != r->last_mouse_x || input_frame.mouse_y != r->last_mouse_y) {
+		flags |= INPUT_RECORDING_FRAME_MOUSE;
+	}
+	if (input_frame.number_of_events) {
+		flags |= INPUT_RECORDING_FRAME_EVENTS;
+	}
+	
+	_input_recording_write(r, flags);
+	_input_recording_write(r, r->delta_t);
+	
+	if (flags & INPUT_RECORDING_FRAME_WINDOW_SIZE) {
+		r->last_width = window.width;
+		r->last_height = window.height;
+		_input_recording_write(r, r->last_width);
+		_input_recording_write(r, r->last_height);
+	}
+	if (flags & INPUT_RECORDING_FRAME_MOUSE) {
+		r->last_mouse_x = input_frame.mouse_x;
+		r->last_mouse_y = input_frame.mouse_y;
+		_input_recording_write(r, r->last_mouse_x);
+		_input_recording_write(r, r->last_mouse_y);
+	}
+	if (flags & INPUT_RECORDING_FRAME_EVENTS) {
+		u16 count = (u16)input_frame.number_of_events;
+		_input_recording_write(r, count);
+		for (u64 i = 0; i < count; i++) {
+			Input_Event e = input_frame.events[i];
+			u8 kind = (u8)e.kind;
+			_input_recording_write(r, kind);
+			switch (e.kind) {
+				case INPUT_EVENT_KEY: {
+					u8 key_code = (u8)e.key_code;
+					u8 key_state = (u8)e.key_state;
+					_input_recording_write(r, key_code);
+					_input_recording_write(r, key_state);
+					break;
+				}
+				case INPUT_EVENT_SCROLL: {
+					// Scroll comes in steps of 1/120, f32 is plenty
+					float32 xscroll = (float32)e.xscroll;
+					float32 yscroll = (float32)e.yscroll;
+					_input_recording_write(r, xscroll);
+					_input_recording_write(r, yscroll);
+					break;
+				}
+				case INPUT_EVENT_TEXT: {
+					_input_recording_write(r, e.utf32);
+					break;
+				}
+			}
+		}
+	}
+	
+	if (r->buffer.count >= INPUT_RECORDING_FLUSH_SIZE) input_recording_flush();
+}
+
+#define _input_replay_read(r, T) (*(T*)_input_replay_read_raw((r), sizeof(T)))
+void*
+_input_replay_read_raw(Input_Recording *r, u64 size) {
+	// Hand out zeroes past the end, input_replay_read_frame() checks read_failed and ends the replay
+	local_persist u64 zeroes = 0;
+	if (r->read_failed || r->read_pos+size > r->data.count) {
+		r->read_failed = true;
+		return &zeroes;
+	}
+	void *p = r->data.data+r->read_pos;
+	r->read_pos += size;
+	return p;
+}
+
+// Returns false when the recording is over
+bool 
+input_replay_read_frame() {
+	Input_Recording *r = &input_recording;
+	if (r->read_pos >= r->data.count) return false;
+	
+	input_frame.number_of_events = 0;
+	for (u64 i = 0; i < INPUT_KEY_CODE_COUNT; i++) {
+		input_frame.key_states[i] &= ~(INPUT_STATE_REPEAT | INPUT_STATE_JUST_PRESSED | INPUT_STATE_JUST_RELEASED);
+	}
+	
+	u8 flags = _input_replay_read(r, u8);
+	float64 delta_t = _input_replay_read(r, float64);
+	
+	s32 width  = window.width;
+	s32 height = window.height;
+	if (flags & INPUT_RECORDING_FRAME_WINDOW_SIZE) {
+		width  = _input_replay_read(r, s32);
+		height = _input_replay_read(r, s32);
+	}
+	float32 mouse_x = r->mouse_x;
+	float32 mouse_y = r->mouse_y;
+	if (flags & INPUT_RECORDING_FRAME_MOUSE) {
+		mouse_x = _input_replay_read(r, float32);
+		mouse_y = _input_replay_read(r, float32);
+	}
+	if (r->read_failed) {
+		log_error("Input recording is truncated, ending replay");
+		return false;
+	}
+	
+	r->delta_t = delta_t;
+	window.width  = width;
+	window.height = height;
+	r->mouse_x = mouse_x;
+	r->mouse_y = mouse_y;
+	input_frame.mouse_x = r->mouse_x;
+	input_frame.mouse_y = r->mouse_y;
+	
+	if (flags & INPUT_RECORDING_FRAME_EVENTS) {
+		u16 count = _input_replay_read(r, u16);
+		if (count > MAX_EVENTS_PER_FRAME) {
+			log_error("Input recording is corrupt (%d events in one frame), ending replay", count);
+			return false;
+		}
+		for (u64 i = 0; i < count; i++) {
+			Input_Event e = ZERO(Input_Event);
+			e.kind = (Input_Event_Kind)_input_replay_read(r, u8);
+			switch (e.kind) {
+				case INPUT_EVENT_KEY: {
+					e.key_code  = (Input_Key_Code)_input_replay_read(r, u8);
+					e.key_state = (Input_State_Flags)_input_replay_read(r, u8);
+					if (e.key_code >= INPUT_KEY_CODE_COUNT) {
+						log_error("Input recording is corrupt (key code %d), ending replay", e.key_code);
+						return false;
+					}
+					input_frame.key_states[e.key_code] = e.key_state;
+					break;
+				}
+				case INPUT_EVENT_SCROLL: {
+					e.xscroll = _input_replay_read(r, float32);
+					e.yscroll = _input_replay_read(r, float32);
+					break;
+				}
+				case INPUT_EVENT_TEXT: {
+					e.utf32 = _input_replay_read(r, u32);
+					break;
+				}
+				default: {
+					log_error("Input recording is corrupt (event kind %d), ending replay", e.kind);
+					return false;
+				}
+			}
+			if (r->read_failed) {
+				log_error("Input recording is truncated, ending replay");
+				return false;
+			}
+			input_frame.events[input_frame.number_of_events] = e;
+			input_frame.number_of_events += 1;
+		}
+	}
+	
+	return true;
+}
+
+// Called at the end of os_update(), after the OS has filled in input_frame
+void 
+input_recording_update() {
+	Input_Recording *r = &input_recording;
+	
+	float64 now = os_get_current_time_in_seconds();
+	float64 real_delta_t = r->last_update_time > 0 ? now-r->last_update_time : 0;
+	r->last_update_time = now;
+	
+	switch (r->mode) {
+		case INPUT_RECORDING_NONE: {
+			r->delta_t = real_delta_t;
+			break;
+		}
+		case INPUT_RECORDING_RECORD: {
+			r->delta_t = real_delta_t;
+			input_recording_write_frame();
+			break;
+		}
+		case INPUT_RECORDING_REPLAY: {
+			// Time for the frame which ended now
+			if (r->frame_index > 0) growing_array_add((void**)&r->frame_times, &real_delta_t);
+			
+			if (!input_replay_read_frame()) {
+				input_recording_stop();
+				window.should_close = true;
+				return;
+			}
+			break;
+		}
+	}
+	
+	r->frame_index += 1;
+}
@@ -49,6 +49,18 @@ Allocator get_initialization_allocator() {
 // Fragmentation is catastrophic.
 // We could fix it by merging free nodes every now and then
 // BUT: We aren't really supposed to allocate/deallocate directly on the heap too much anyways...
+//
+// Allocations larger than HEAP_LARGE_ALLOCATION_THRESHOLD don't go in the heap blocks at all.
+// They get their own pages straight from the OS which are given back as soon as they're freed,
+// so big buffers don't fragment the free lists that the small allocations live in.
+
+#ifndef HEAP_LARGE_ALLOCATION_THRESHOLD
+	#define HEAP_LARGE_ALLOCATION_THRESHOLD MB(4)
+#endif
+// See Os_Huge_Pages. Transparent by default since it costs nothing when the OS doesn't have it.
+#ifndef HEAP_LARGE_ALLOCATION_HUGE_PAGES
+	#define HEAP_LARGE_ALLOCATION_HUGE_PAGES OS_HUGE_PAGES_TRANSPARENT
+#endif
 
 #define MAX_HEAP_BLOCK_SIZE align_next(MB(500), os.page_size)
 #define DEFAULT_HEAP_BLOCK_SIZE (min(MAX_HEAP_BLOCK_SIZE, program_memory_capacity))
@@ -83,15 +95,57 @@ typedef alignat(16) struct Heap_Allocation_Metadata {
 #endif
 } Heap_Allocation_Metadata;
 
+// Sits at the start of the pages of a large allocation, followed by the usual metadata
+// (with block = 0) and then the memory we hand out.
+typedef struct Heap_Large_Allocation Heap_Large_Allocation;
+typedef alignat(16) struct Heap_Large_Allocation {
+	u64 mapped_size;
+	bool huge_pages;
+} Heap_Large_Allocation;
+
+// Large allocations are at least HEAP_LARGE_ALLOCATION_THRESHOLD each, so we run out of memory
+// long before this.
+#define HEAP_MAX_LARGE_ALLOCATIONS (1024*1024)
+
+typedef struct Heap_Stats {
+	u64 block_count;
+	u64 block_bytes; // Reserved for heap blocks, including their metadata
+	u64 free_bytes;  // In free nodes
+	u64 free_node_count;
+	u64 largest_free_node;
+	
+	u64 large_allocation_count;
+	u64 large_allocation_bytes; // Mapped from the OS, including page rounding
+	u64 large_allocation_peak_bytes;
+	u64 huge_page_allocation_count;
+	
+	// Heap blocks minus free nodes plus large allocations
+	u64 allocated_bytes;
+} Heap_Stats;
+
 // #Global
 ogb_instance Heap_Block *heap_head;
 ogb_instance bool heap_initted;
 ogb_instance Spinlock heap_lock;
+// Virtual growing array sorted by address, so pointers can be looked up with a binary search.
+// Has its own lock so that doesn't wait on the small allocations.
+ogb_instance Heap_Large_Allocation **heap_large_allocations;
+ogb_instance Spinlock heap_large_allocation_lock;
+ogb_instance u64 heap_large_allocation_count;
+ogb_instance u64 heap_large_allocation_bytes;
+ogb_instance u64 heap_large_allocation_peak_bytes;
+ogb_instance u64 heap_huge_page_allocation_count;
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 Heap_Block *heap_head;
 bool heap_initted = false;
 Spinlock heap_lock;
+Heap_Large_Allocation **heap_large_allocations = 0;
+Spinlock heap_large_allocation_lock;
+u64 heap_large_allocation_count = 0;
+u64 heap_large_allocation_bytes = 0;
+u64 heap_large_allocation_peak_bytes = 0;
+u64 heap_huge_page_allocation_count = 0;
 #endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
 	
 
@@ -113,8 +167,34 @@ bool is_pointer_in_stack(void* p) {
 bool is_pointer_in_static_memory(void* p) {
     return (uintptr_t)p >= (uintptr_t)os.static_memory_start && (uintptr_t)p < (uintptr_t)os.static_memory_end;
 }
+// Index of the first large allocation at or after p.
+// heap_large_allocation_lock must be held.
+u32 heap_find_large_allocation_index_locked(void *p) {
+	u32 low = 0;
+	u32 high = growing_array_get_valid_count(heap_large_allocations);
+	while (low < high) {
+		u32 mid = low + (high-low)/2;
+		if ((u8*)heap_large_allocations[mid] < (u8*)p) low = mid+1;
+		else high = mid;
+	}
+	return low;
+}
+bool is_pointer_in_large_allocation(void *p) {
+	if (!heap_large_allocations) return false;
+	
+	bool found = false;
+	spinlock_acquire_or_wait(&heap_large_allocation_lock);
+	u32 index = heap_find_large_allocation_index_locked((u8*)p+1);
+	if (index > 0) {
+		// Last one starting at or before p
+		Heap_Large_Allocation *large = heap_large_allocations[index-1];
+		found = (u8*)p < (u8*)large+large->mapped_size;
+	}
+	spinlock_release(&heap_large_allocation_lock);
+	return found;
+}
 bool is_pointer_valid(void *p) {
-	return is_pointer_in_program_memory(p) || is_pointer_in_stack(p) || is_pointer_in_static_memory(p);
+	return is_pointer_in_program_memory(p) || is_pointer_in_stack(p) || is_pointer_in_static_memory(p) || is_pointer_in_large_allocation(p);
 }
 
 // Meant for debug
@@ -247,26 +327,82 @@ void heap_init() {
 	heap_initted = true;
 	heap_head = make_heap_block(0, DEFAULT_HEAP_BLOCK_SIZE);
 	spinlock_init(&heap_lock);
+	spinlock_init(&heap_large_allocation_lock);
+	// Can't come from the heap, we're the heap
+	growing_array_init_virtual((void**)&heap_large_allocations, sizeof(Heap_Large_Allocation*), HEAP_MAX_LARGE_ALLOCATIONS);
+}
+
+void *heap_alloc_large(u64 size) {
+	
+	u64 header_size = sizeof(Heap_Large_Allocation)+sizeof(Heap_Allocation_Metadata);
+	
+	Os_Huge_Pages huge_pages = HEAP_LARGE_ALLOCATION_HUGE_PAGES;
+	u64 mapped_size = align_next(size+header_size, huge_pages == OS_HUGE_PAGES_EXPLICIT ? MB(2) : os.page_size);
+	
+	bool got_huge_pages = false;
+	Heap_Large_Allocation *large = (Heap_Large_Allocation*)os_allocate_pages(mapped_size, huge_pages, &got_huge_pages);
+	assert(large, "OS is not letting us allocate more memory (%llu bytes). Maybe we are out of memory?", mapped_size);
+	
+	large->mapped_size = mapped_size;
+	large->huge_pages = got_huge_pages;
+	
+	Heap_Allocation_Metadata *meta = (Heap_Allocation_Metadata*)(large+1);
+	meta->size = mapped_size-sizeof(Heap_Large_Allocation);
+	meta->block = 0;
+#if CONFIGURATION == DEBUG
+	meta->signature = HEAP_META_SIGNATURE;
+#endif
+	
+	// #Sync
+	spinlock_acquire_or_wait(&heap_large_allocation_lock);
+	u32 index = heap_find_large_allocation_index_locked(large);
+	u32 count = growing_array_get_valid_count(heap_large_allocations);
+	growing_array_add_empty((void**)&heap_large_allocations);
+	memmove(heap_large_allocations+index+1, heap_large_allocations+index, (count-index)*sizeof(Heap_Large_Allocation*));
+	heap_large_allocations[index] = large;
+	heap_large_allocation_count += 1;
+	heap_large_allocation_bytes += mapped_size;
+	heap_large_allocation_peak_bytes = max(heap_large_allocation_peak_bytes, heap_large_allocation_bytes);
+	if (got_huge_pages) heap_huge_page_allocation_count += 1;
+	spinlock_release(&heap_large_allocation_lock);
+	
+	void *p = meta+1;
+	assert((u64)p % HEAP_ALIGNMENT == 0, "Internal heap error. Result pointer is not aligned to HEAP_ALIGNMENT");
+	return p;
+}
+void heap_dealloc_large(Heap_Allocation_Metadata *meta) {
+#if CONFIGURATION == DEBUG
+	assert(meta->signature == HEAP_META_SIGNATURE, "Heap error. Either 1) You passed a bad pointer to dealloc or 2) You corrupted the heap.");
+#endif
+	assert(meta->block == 0, "Heap error. Either 1) You passed a bad pointer to dealloc or 2) You corrupted the heap.");
+	Heap_Large_Allocation *large = ((Heap_Large_Allocation*)meta)-1;
+	
+	// #Sync
+	spinlock_acquire_or_wait(&heap_large_allocation_lock);
+	u32 index = heap_find_large_allocation_index_locked(large);
+	assert(index < growing_array_get_valid_count(heap_large_allocations) && heap_large_allocations[index] == large, "Heap error. Either 1) You passed a bad pointer to dealloc or 2) You corrupted the heap.");
+	growing_array_ordered_remove_by_index((void**)&heap_large_allocations, index);
+	heap_large_allocation_count -= 1;
+	heap_large_allocation_bytes -= large->mapped_size;
+	if (large->huge_pages) heap_huge_page_allocation_count -= 1;
+	spinlock_release(&heap_large_allocation_lock);
+	
+	os_release_address_space(large, large->mapped_size);
 }
 
 void *heap_alloc(u64 size) {
 
 	if (!heap_initted) heap_init();
+	
+	if (size > HEAP_LARGE_ALLOCATION_THRESHOLD) return heap_alloc_large(size);
 
 	// #Sync #Speed oof
 	spinlock_acquire_or_wait(&heap_lock);
 	
-
-
-
-	
 	size += sizeof(Heap_Allocation_Metadata);
 	
 	size = (size+HEAP_ALIGNMENT) & ~(HEAP_ALIGNMENT-1);
 	
-	assert(size < MAX_HEAP_BLOCK_SIZE, "Past Charlie has been lazy and did not handle large allocations like this. I apologize on behalf of past Charlie. A quick fix could be to increase the heap block size for now. #Incomplete #Limitation");
-	
-	
 #if VERY_DEBUG
 	{
 		Heap_Block *block = heap_head;
@@ -396,21 +532,9 @@ void *heap_alloc(u64 size) {
 	assert((u64)p % HEAP_ALIGNMENT == 0, "Internal heap error. Result pointer is not aligned to HEAP_ALIGNMENT");
 	return p;
 }
-void heap_dealloc(void *p) {
-	// #Sync #Speed oof
-	
-	if (!heap_initted) heap_init();
-
-	spinlock_acquire_or_wait(&heap_lock);
-	
-	assert(is_pointer_in_program_memory(p), "A bad pointer was passed tp heap_dealloc: it is out of program memory bounds!"); 
-	p = (u8*)p-sizeof(Heap_Allocation_Metadata);
-	Heap_Allocation_Metadata *meta = (Heap_Allocation_Metadata*)(p);
-	check_meta(meta);
-	
-	// Yoink meta data before we start overwriting it
-	Heap_Block *block = meta->block;
-	u64 size = meta->size;
+// Gives [p, p+size) back to the block's free list, coalescing with neighbouring free nodes.
+// heap_lock must be held.
+void heap_free_range_locked(Heap_Block *block, void *p, u64 size) {
 	
 #if CONFIGURATION == DEBUG
 	memset(p, 0x69696969, size);
@@ -469,7 +593,8 @@ void heap_dealloc(void *p) {
 				// allocator slows down your program you should rethink your memory management
 				// anyways...
 				
-				if (new_node >= node) {
+				// Insert after the last node before us so the list stays sorted by address
+				if (new_node >= node && (!node->next || new_node < node->next)) {
 					u8* node_tail = (u8*)node + node->size;
 					if (cast(u8*)new_node == node_tail) {
 						
@@ -483,7 +608,8 @@ void heap_dealloc(void *p) {
 						void *next_page = (void*)align_previous(node_tail, os.page_size);
 						void *last_page_end = (void*)align_previous(free_tail, os.page_size);
 
-						if ((u8*)next_page < (u8*)node) next_page = (u8*)next_page + os.page_size;
+						// Never lock the page with the node header, also when the node starts a page
+						if ((u8*)next_page <= (u8*)node) next_page = (u8*)next_page + os.page_size;
 						
 						if ((u8*)last_page_end > (u8*)next_page) {
 							os_lock_program_memory_pages(next_page, (u64)last_page_end-(u64)next_page);
@@ -491,6 +617,12 @@ void heap_dealloc(void *p) {
 						
 						node->size += new_node_size;
 						
+						// We might have closed the gap to the next free node too
+						if (node->next && (u8*)node->next == (u8*)node + node->size) {
+							node->size += node->next->size;
+							node->next = node->next->next;
+						}
+						
 						break;
 					} else {
 						new_node->next = node->next;
@@ -527,10 +659,126 @@ void heap_dealloc(void *p) {
 #if VERY_DEBUG
 	sanity_check_block(block);
 #endif
+}
+void heap_dealloc(void *p) {
+	// #Sync #Speed oof
+	
+	if (!heap_initted) heap_init();
+	
+	if (!is_pointer_in_program_memory(p)) {
+#if CONFIGURATION == DEBUG
+		assert(is_pointer_in_large_allocation(p), "A bad pointer was passed to heap_dealloc: it is neither in program memory nor a large allocation!");
+#endif
+		heap_dealloc_large((Heap_Allocation_Metadata*)((u8*)p-sizeof(Heap_Allocation_Metadata)));
+		return;
+	}
+
+	spinlock_acquire_or_wait(&heap_lock);
+	
+	p = (u8*)p-sizeof(Heap_Allocation_Metadata);
+	Heap_Allocation_Metadata *meta = (Heap_Allocation_Metadata*)(p);
+	check_meta(meta);
+	
+	heap_free_range_locked(meta->block, meta, meta->size);
+	
 	// #Sync #Speed oof
 	spinlock_release(&heap_lock);
 }
 
+// Resizes the allocation at p without moving it. Shrinking splits the tail off into a free
+// node, growing takes from the free node right after the allocation if it's large enough.
+// Returns false if the allocation would have to move.
+bool heap_try_resize_in_place(void *p, u64 new_size) {
+
+	if (!heap_initted) heap_init();
+	
+	Heap_Allocation_Metadata *meta = (Heap_Allocation_Metadata*)((u8*)p-sizeof(Heap_Allocation_Metadata));
+	
+	if (!is_pointer_in_program_memory(p)) {
+		// Large allocation, stay in its pages as long as it fits and is still large
+		assert(meta->block == 0, "A bad pointer was passed to heap_try_resize_in_place");
+		return new_size > HEAP_LARGE_ALLOCATION_THRESHOLD && new_size+sizeof(Heap_Allocation_Metadata) <= meta->size;
+	}
+	
+	// Should move out to its own pages
+	if (new_size > HEAP_LARGE_ALLOCATION_THRESHOLD) return false;
+
+	// #Sync #Speed oof
+	spinlock_acquire_or_wait(&heap_lock);
+	
+	check_meta(meta);
+	
+	Heap_Block *block = meta->block;
+	
+	u64 size = new_size + sizeof(Heap_Allocation_Metadata);
+	size = (size+HEAP_ALIGNMENT) & ~(HEAP_ALIGNMENT-1);
+	
+	u64 old_size = meta->size;
+	bool ok = true;
+	
+	if (size < old_size) {
+		meta->size = size;
+		heap_free_range_locked(block, (u8*)meta+size, old_size-size);
+	} else if (size > old_size) {
+		u8 *tail = (u8*)meta + old_size;
+		u64 needed = size - old_size;
+		
+		// Free list is sorted by address
+		Heap_Free_Node *node = block->free_head;
+		Heap_Free_Node *previous = 0;
+		while (node && (u8*)node < tail) {
+			previous = node;
+			node = node->next;
+		}
+		
+		if (!node || (u8*)node != tail || node->size < needed) {
+			ok = false;
+		} else {
+			// Unlock the whole free node, then lock whatever remains of it, same as heap_alloc.
+			// #Copypaste
+			void *free_tail = (u8*)node + node->size;
+			void *first_page = (void*)align_previous(node, os.page_size);
+			void *last_page_end = (void*)align_previous(free_tail, os.page_size);
+			if ((u8*)last_page_end > (u8*)first_page) {
+				os_unlock_program_memory_pages(first_page, (u64)last_page_end-(u64)first_page);
+			}
+			
+			Heap_Free_Node *replacement = node->next;
+			u64 remainder = node->size - needed;
+			if (remainder) {
+				replacement = (Heap_Free_Node*)(tail+needed);
+				replacement->size = remainder;
+				replacement->next = node->next;
+				
+				// #Copypaste
+				void *free_tail = (u8*)replacement + replacement->size;
+				void *next_page = (void*)align_next(replacement, os.page_size);
+				void *last_page_end = (void*)align_previous(free_tail, os.page_size);
+				if ((u8*)last_page_end > (u8*)next_page) {
+					os_lock_program_memory_pages(next_page, (u64)last_page_end-(u64)next_page);
+				}
+			}
+			
+			if (previous) previous->next = replacement;
+			else block->free_head = replacement;
+			
+			meta->size = size;
+#if CONFIGURATION == DEBUG
+			block->total_allocated += needed;
+#endif
+		}
+	}
+
+#if VERY_DEBUG
+	sanity_check_block(block);
+#endif
+	
+	// #Sync #Speed oof
+	spinlock_release(&heap_lock);
+	
+	return ok;
+}
+
 void* heap_allocator_proc(u64 size, void *p, Allocator_Message message, void* data) {
 	switch (message) {
 		case ALLOCATOR_ALLOCATE: {
@@ -546,10 +794,15 @@ void* heap_allocator_proc(u64 size, void *p, Allocator_Message message, void* da
 				return heap_alloc(size);
 			}
 			assert(is_pointer_valid(p), "Invalid pointer passed to heap allocator reallocate");
+			
+			if (heap_try_resize_in_place(p, size)) return p;
+			
 			Heap_Allocation_Metadata *meta = (Heap_Allocation_Metadata*)(((u64)p)-sizeof(Heap_Allocation_Metadata));
-			check_meta(meta);
+			if (meta->block) check_meta(meta);
+			// meta->size includes the metadata itself
+			u64 old_size = meta->size - sizeof(Heap_Allocation_Metadata);
 			void *new = heap_alloc(size);
-			memcpy(new, p, min(size, meta->size));
+			memcpy(new, p, min(size, old_size));
 			heap_dealloc(p);
 			return new;
 		}
@@ -557,11 +810,53 @@ void* heap_allocator_proc(u64 size, void *p, Allocator_Message message, void* da
 	return 0;
 }
 
+Heap_Stats heap_get_stats() {
+	if (!heap_initted) heap_init();
+	
+	Heap_Stats stats = ZERO(Heap_Stats);
+	
+	// #Sync
+	spinlock_acquire_or_wait(&heap_lock);
+	for (Heap_Block *block = heap_head; block; block = block->next) {
+		stats.block_count += 1;
+		stats.block_bytes += block->size;
+		stats.allocated_bytes += get_heap_block_size_excluding_metadata(block);
+		for (Heap_Free_Node *node = block->free_head; node; node = node->next) {
+			stats.free_node_count += 1;
+			stats.free_bytes += node->size;
+			stats.largest_free_node = max(stats.largest_free_node, node->size);
+		}
+	}
+	stats.allocated_bytes -= stats.free_bytes;
+	spinlock_release(&heap_lock);
+	
+	spinlock_acquire_or_wait(&heap_large_allocation_lock);
+	stats.large_allocation_count = heap_large_allocation_count;
+	stats.large_allocation_bytes = heap_large_allocation_bytes;
+	stats.large_allocation_peak_bytes = heap_large_allocation_peak_bytes;
+	stats.huge_page_allocation_count = heap_huge_page_allocation_count;
+	stats.allocated_bytes += heap_large_allocation_bytes;
+	spinlock_release(&heap_large_allocation_lock);
+	
+	return stats;
+}
+
+#if ENABLE_ALLOCATION_TRACKING
+// allocation_tracking.c
+void* tracking_allocator_proc(u64 size, void *p, Allocator_Message message, void* data);
+extern struct Allocation_Tracker heap_allocation_tracker;
+#endif
+
 Allocator get_heap_allocator() {
 	Allocator heap_allocator;
 	
+#if ENABLE_ALLOCATION_TRACKING
+	heap_allocator.proc = tracking_allocator_proc;
+	heap_allocator.data = &heap_allocation_tracker;
+#else
 	heap_allocator.proc = heap_allocator_proc;
 	heap_allocator.data = 0;
+#endif
 	
 	return heap_allocator;
 }
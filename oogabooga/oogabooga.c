@@ -76,6 +76,26 @@
 				minimum requirements for example to fit the temporary storage in program 
 				memory. It's more of a rough guideline.
 			
+		- HEAP_LARGE_ALLOCATION_THRESHOLD
+			Heap allocations larger than this many bytes get their own pages from the OS
+			instead of going in the heap blocks, and are given back to the OS when freed.
+			Default is MB(4).
+			
+			Example:
+				#define HEAP_LARGE_ALLOCATION_THRESHOLD (MB(16))
+				
+		- HEAP_LARGE_ALLOCATION_HUGE_PAGES
+			Whether large heap allocations ask for huge (2MB) pages.
+			
+			OS_HUGE_PAGES_NONE:        Normal pages
+			OS_HUGE_PAGES_TRANSPARENT: Hint the OS to use huge pages (Linux only, default)
+			OS_HUGE_PAGES_EXPLICIT:    Explicit huge pages. Needs vm.nr_hugepages on Linux and the
+			                           "Lock pages in memory" privilege on Windows. Falls back
+			                           to transparent/normal pages when they're not available.
+			
+			Example:
+				#define HEAP_LARGE_ALLOCATION_HUGE_PAGES OS_HUGE_PAGES_EXPLICIT
+			
 		- RUN_TESTS
 			Run ooga booga tests.
 		
@@ -86,6 +106,10 @@
 			
 				#define RUN_TESTS 1
 				
+			Note:
+				Benchmarks are a separate target, build_benchmarks.c (build_benchmarks.bat or
+				build_benchmarks.sh). See benchmarks.c.
+				
 		- ENABLE_PROFILING
 			Enable time profiling which will be dumped to google_trace.json.
 		
@@ -97,14 +121,39 @@
 				#define ENABLE_PROFILING 1
 				
 			Note:
-				See timing macros in profile.c
+				See timing macros in profiling.c
 					tm_scope
 					tm_scope_var
 					tm_scope_accum
+					tm_counter
+				tm_scope names must be string literals.
+				Per frame stats of scopes and counters can be queried at runtime (see
+				profiler_get_frame_stats() and friends in profiling.c) or drawn with
+				draw_profiler_overlay().
 					
+		- ENABLE_ALLOCATION_TRACKING
+			Track everything allocated with get_heap_allocator() per allocation tag, report
+			it per frame (as counter tracks in google_trace.json with ENABLE_PROFILING) and
+			log leaks at exit. Cheap enough to leave on in internal release builds.
+			
+			0: Disable
+			1: Enable
+			
+			Example:
+			
+				#define ENABLE_ALLOCATION_TRACKING 1
+				
+			Note:
+				See allocation_tracking.c
+				
 		- OOGABOOGA_HEADLESS
-            Run oogabooga in headless mode, i.e. no window, no graphics, no audio.
+            Run oogabooga in headless mode, i.e. no window, no graphics and no audio device.
             Useful if you only need the oogabooga standard library for something like a game server.
+            The audio mixer is still there and can be driven with the null output (see audio.c),
+            for example to run audio tests & benchmarks in CI.
+            Drawing works too with a null renderer which drops the quads in gfx_update() (see
+            gfx_impl_none.c), so window.width & window.height need to be set yourself.
+            This is the only mode supported on Linux at the moment.
             
             0: Disable
             1: Enable
@@ -124,7 +173,9 @@
 
 #include <math.h>
 #include <immintrin.h>
+#ifdef _WIN32
 #include <intrin.h>
+#endif
 #include <stdint.h>
 
 typedef uint8_t  u8;
@@ -236,9 +287,22 @@ typedef u8 bool;
 	#define TARGET_OS WINDOWS
 	#define OS_PATHS_HAVE_BACKSLASH 1
 #elif defined(__linux__)
-	// Include whatever #Incomplete #Portability
+	// #Portability
+	// Only headless builds for now, see os_impl_linux.c
+	#ifndef OOGABOOGA_HEADLESS
+		#error "Linux is only supported for headless builds (#define OOGABOOGA_HEADLESS 1)"
+	#endif
+	#include <stddef.h>
+	#include <stdarg.h>
+	#include <string.h>
+	#include <limits.h>
+	#include <unistd.h>
+	#include <pthread.h>
+	#define __cdecl
+	// Windows.h gives us these
+	#define min(a, b) (((a) < (b)) ? (a) : (b))
+	#define max(a, b) (((a) > (b)) ? (a) : (b))
 	#define TARGET_OS LINUX
-	#error "Linux is not supported yet";
 	#define OS_PATHS_HAVE_BACKSLASH 0
 #elif defined(__APPLE__) && defined(__MACH__)
 	// Include whatever #Incomplete #Portability
@@ -268,9 +332,12 @@ typedef u8 bool;
 #define GFX_RENDERER_D3D11  0
 #define GFX_RENDERER_VULKAN 1
 #define GFX_RENDERER_METAL  2
+#define GFX_RENDERER_NONE   3
 #ifndef GFX_RENDERER
 // #Portability
-	#if TARGET_OS == WINDOWS
+	#ifdef OOGABOOGA_HEADLESS
+		#define GFX_RENDERER GFX_RENDERER_NONE
+	#elif TARGET_OS == WINDOWS
 		#define GFX_RENDERER GFX_RENDERER_D3D11
 	#elif TARGET_OS == LINUX
 		#define GFX_RENDERER GFX_RENDERER_VULKAN
@@ -289,10 +356,11 @@ typedef u8 bool;
 #include "range.c"
 #include "utility.c"
 
+#include "os_interface.c"
+
 #include "hash_table.c"
 #include "growing_array.c"
-
-#include "os_interface.c"
+#include "array.c"
 
 ///
 ///
@@ -306,23 +374,25 @@ typedef u8 bool;
 /////
 
 #include "concurrency.c"
+#include "string_interner.c"
+#include "sort.c"
 
 #include "profiling.c"
 #include "random.c"
 #include "color.c"
 #include "memory.c"
+#include "allocation_tracking.c"
 #include "input.c"
 
-#ifndef OOGABOOGA_HEADLESS
+#include "gfx_interface.c"
 
-    #include "gfx_interface.c"
+#include "font.c"
 
-    #include "font.c"
+#include "drawing.c"
 
-    #include "drawing.c"
+#include "quad_pipeline.c"
 
-    #include "audio.c"
-#endif
+#include "audio.c"
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 
@@ -336,22 +406,23 @@ typedef u8 bool;
     	#error "Current OS is not supported"
     #endif
 
-    #ifndef OOGABOOGA_HEADLESS
-        // #Portability
-        #if GFX_RENDERER == GFX_RENDERER_D3D11
-            #include "gfx_impl_d3d11.c"
-        #elif GFX_RENDERER == GFX_RENDERER_VULKAN
-            #error "We only have a D3D11 renderer at the moment"
-        #elif GFX_RENDERER == GFX_RENDERER_METAL
-            #error "We only have a D3D11 renderer at the moment"
-        #else
-            #error "Unknown renderer GFX_RENDERER defined"
-        #endif
+    // #Portability
+    #if GFX_RENDERER == GFX_RENDERER_D3D11
+        #include "gfx_impl_d3d11.c"
+    #elif GFX_RENDERER == GFX_RENDERER_NONE
+        #include "gfx_impl_none.c"
+    #elif GFX_RENDERER == GFX_RENDERER_VULKAN
+        #error "We only have a D3D11 renderer at the moment"
+    #elif GFX_RENDERER == GFX_RENDERER_METAL
+        #error "We only have a D3D11 renderer at the moment"
+    #else
+        #error "Unknown renderer GFX_RENDERER defined"
     #endif
     
 #endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
 
 #include "tests.c"
+#include "benchmarks.c"
 
 #define malloc please_use_alloc_for_memory_allocations_instead_of_malloc
 #define free please_use_dealloc_for_memory_deallocations_instead_of_free
@@ -383,14 +454,19 @@ void oogabooga_init(u64 program_memory_size) {
 	context.logger = default_logger;
 	temp_allocator = get_initialization_allocator();
 	Cpu_Capabilities features = query_cpu_capabilities();
+	cpu_dispatch_init(features);
 	os_init(program_memory_size);
 	heap_init();
 	temporary_storage_init(TEMPORARY_STORAGE_SIZE);
+#if ENABLE_PROFILING
+	profiler_init();
+#endif
 	log_info("Ooga booga version is %d.%02d.%03d", OGB_VERSION_MAJOR, OGB_VERSION_MINOR, OGB_VERSION_PATCH);
 #ifndef OOGABOOGA_HEADLESS
 	gfx_init();
 #else
     log_info("Headless mode on");
+    audio_init_without_device();
 #endif
 	log_verbose("CPU has sse1:   %cs", features.sse1 ? "true" : "false");
 	log_verbose("CPU has sse2:   %cs", features.sse2 ? "true" : "false");
@@ -401,6 +477,7 @@ void oogabooga_init(u64 program_memory_size) {
 	log_verbose("CPU has avx:    %cs", features.avx ? "true" : "false");
 	log_verbose("CPU has avx2:   %cs", features.avx2 ? "true" : "false");
 	log_verbose("CPU has avx512: %cs", features.avx512 ? "true" : "false");
+	log_verbose("Using %cs kernels", cpu_isa_names[get_cpu_dispatch()->isa]);
 }
 #endif
 
@@ -430,6 +507,12 @@ int main(int argc, char **argv) {
 	
 	int code = ENTRY_PROC(argc, argv);
 	
+	input_recording_stop();
+	
+#if ENABLE_ALLOCATION_TRACKING
+	allocation_tracking_log_leaks();
+#endif
+	
 #if ENABLE_PROFILING
 	
 	dump_profile_result();
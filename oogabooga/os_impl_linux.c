@@ -0,0 +1,984 @@
+
+// #Portability
+// Linux os layer.
+// Only headless builds for now, so no window, no graphics and no audio device. This is
+// mostly so the standard library, tests & benchmarks can run on Linux machines and in CI.
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <dlfcn.h>
+#include <dirent.h>
+#include <execinfo.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// These are GNU extensions, but we don't want _GNU_SOURCE to leak into every other header.
+int pthread_getattr_np(pthread_t thread, pthread_attr_t *attr);
+int madvise(void *addr, size_t length, int advice);
+#ifndef MAP_HUGETLB
+	#define MAP_HUGETLB 0x40000
+#endif
+#ifndef MADV_HUGEPAGE
+	#define MADV_HUGEPAGE 14
+#endif
+
+// Provided by the linker
+extern char __executable_start;
+extern char _end;
+
+// We reserve this much virtual address space up front so program memory can grow in place,
+// like how we allocate at the tail of the last region with VirtualAlloc on windows.
+#define LINUX_PROGRAM_MEMORY_RESERVE GB(64)
+
+void* heap_alloc(u64);
+void heap_dealloc(void*);
+
+u64 linux_get_thread_id() {
+	return (u64)syscall(SYS_gettid);
+}
+
+char *temp_linux_path(string path) {
+	return temp_convert_to_null_terminated_string(path);
+}
+
+void os_init(u64 program_memory_capacity) {
+
+    // #Volatile
+    // Any printing uses vsnprintf, and printing may happen in init,
+    // especially on errors, so this needs to happen first.
+	os.crt = os_load_dynamic_library(STR("libc.so.6"));
+	assert(os.crt != 0, "Could not load libc.so.6");
+	os.crt_vsnprintf = (Crt_Vsnprintf_Proc)os_dynamic_library_load_symbol(os.crt, STR("vsnprintf"));
+	assert(os.crt_vsnprintf, "Missing vsnprintf in crt");
+
+	context.thread_id = linux_get_thread_id();
+
+	os.page_size = (u64)sysconf(_SC_PAGESIZE);
+	os.granularity = os.page_size;
+
+	os.static_memory_start = &__executable_start;
+	os.static_memory_end = &_end;
+
+	program_memory_mutex = os_make_mutex();
+	os_grow_program_memory(program_memory_capacity);
+
+	heap_init();
+}
+
+void s64_to_null_terminated_string_reverse(char str[], int length)
+{
+    int start = 0;
+    int end = length - 1;
+    while (start < end) {
+        char temp = str[start];
+        str[start] = str[end];
+        str[end] = temp;
+        end--;
+        start++;
+    }
+}
+
+void s64_to_null_terminated_string(s64 num, char* str, int base)
+{
+    int i = 0;
+    bool neg = false;
+
+    if (num == 0) {
+        str[i++] = '0';
+        str[i] = '\0';
+        return;
+    }
+
+    if (num < 0 && base == 10) {
+        neg = true;
+        num = -num;
+    }
+
+    while (num != 0) {
+        int rem = num % base;
+        str[i++] = (rem > 9) ? (rem - 10) + 'a' : rem + '0';
+        num = num / base;
+    }
+
+    if (neg)
+        str[i++] = '-';
+
+    str[i] = '\0';
+    s64_to_null_terminated_string_reverse(str, i);
+}
+
+///
+///
+// Threading
+///
+
+///
+// Thread primitive
+
+void *linux_thread_invoker(void *param) {
+
+	Thread *t = (Thread*)param;
+
+	temporary_storage_init(t->temporary_storage_size);
+
+	context = t->initial_context;
+	context.thread_id = linux_get_thread_id();
+	t->id = context.thread_id;
+
+	t->proc(t);
+
+	heap_dealloc(temporary_storage);
+
+	return 0;
+}
+
+////// DEPRECATED   vvvvvvvvvvvvvvvvv
+Thread* os_make_thread(Thread_Proc proc, Allocator allocator) {
+	Thread *t = (Thread*)alloc(allocator, sizeof(Thread));
+	t->id = 0; // This is set when we start it
+	t->proc = proc;
+	t->initial_context = context;
+	t->allocator = allocator;
+	t->temporary_storage_size = KB(10);
+
+	return t;
+}
+void os_destroy_thread(Thread *t) {
+	os_thread_join(t);
+	dealloc(t->allocator, t);
+}
+void os_start_thread(Thread *t) {
+	int err = pthread_create(&t->os_handle, 0, linux_thread_invoker, t);
+	assert(err == 0, "Failed creating thread (error %d)", err);
+}
+void os_join_thread(Thread *t) {
+	pthread_join(t->os_handle, 0);
+}
+////// DEPRECATED   ^^^^^^^^^^^^^^^^
+
+void os_thread_init(Thread *t, Thread_Proc proc) {
+	memset(t, 0, sizeof(Thread));
+	t->id = 0;
+	t->proc = proc;
+	t->initial_context = context;
+	t->temporary_storage_size = KB(10);
+}
+void os_thread_destroy(Thread *t) {
+	os_thread_join(t);
+}
+void os_thread_start(Thread *t) {
+	int err = pthread_create(&t->os_handle, 0, linux_thread_invoker, t);
+	assert(err == 0, "Failed creating thread (error %d)", err);
+}
+void os_thread_join(Thread *t) {
+	pthread_join(t->os_handle, 0);
+}
+
+///
+// Mutex primitive
+
+// Mutexes need to be made before the heap exists (program_memory_mutex), so we keep our
+// own pool of them in pages straight from the OS.
+typedef union Linux_Mutex_Slot {
+	pthread_mutex_t mutex;
+	union Linux_Mutex_Slot *next_free;
+} Linux_Mutex_Slot;
+
+pthread_mutex_t linux_mutex_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+Linux_Mutex_Slot *linux_mutex_free_list = 0;
+
+Mutex_Handle os_make_mutex() {
+	pthread_mutex_lock(&linux_mutex_pool_lock);
+
+	if (!linux_mutex_free_list) {
+		u64 page_size = (u64)sysconf(_SC_PAGESIZE);
+		Linux_Mutex_Slot *slots = (Linux_Mutex_Slot*)mmap(0, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		assert(slots != MAP_FAILED, "Failed allocating memory for mutexes");
+		u64 slot_count = page_size/sizeof(Linux_Mutex_Slot);
+		for (u64 i = 0; i < slot_count; i++) {
+			slots[i].next_free = linux_mutex_free_list;
+			linux_mutex_free_list = &slots[i];
+		}
+	}
+
+	Linux_Mutex_Slot *slot = linux_mutex_free_list;
+	linux_mutex_free_list = slot->next_free;
+
+	pthread_mutex_unlock(&linux_mutex_pool_lock);
+
+	// Win32 mutexes are recursive so we keep the same behaviour here
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	int err = pthread_mutex_init(&slot->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	assert(err == 0, "Failed creating mutex (error %d)", err);
+
+	return &slot->mutex;
+}
+void os_destroy_mutex(Mutex_Handle m) {
+	pthread_mutex_destroy(m);
+
+	Linux_Mutex_Slot *slot = (Linux_Mutex_Slot*)m;
+	pthread_mutex_lock(&linux_mutex_pool_lock);
+	slot->next_free = linux_mutex_free_list;
+	linux_mutex_free_list = slot;
+	pthread_mutex_unlock(&linux_mutex_pool_lock);
+}
+void os_lock_mutex(Mutex_Handle m) {
+	int err = pthread_mutex_lock(m);
+	assert(err == 0, "Unexpected mutex lock result %d", err);
+}
+void os_unlock_mutex(Mutex_Handle m) {
+	int err = pthread_mutex_unlock(m);
+	assert(err == 0, "Unlock mutex 0x%x failed with error %d", m, err);
+}
+
+
+void os_sleep(u32 ms) {
+	struct timespec t;
+	t.tv_sec = ms/1000;
+	t.tv_nsec = (long)(ms%1000)*1000000L;
+	while (nanosleep(&t, &t) == -1 && errno == EINTR) {}
+}
+
+void os_yield_thread() {
+    sched_yield();
+}
+
+void os_high_precision_sleep(f64 ms) {
+
+	const f64 s = ms/1000.0;
+
+	f64 start = os_get_current_time_in_seconds();
+	f64 end = start + (f64)s;
+	s32 sleep_time = (s32)((end-start)*1000.0-1.0);
+
+	if (sleep_time >= 1)  os_sleep(sleep_time);
+
+	while (os_get_current_time_in_seconds() < end) {
+		os_yield_thread();
+	}
+}
+
+
+///
+///
+// Time
+///
+
+
+u64 os_get_current_cycle_count() {
+	return rdtsc();
+}
+
+float64 os_get_current_time_in_seconds() {
+	struct timespec t;
+	if (clock_gettime(CLOCK_MONOTONIC, &t) != 0) return -1.0;
+	return (float64)t.tv_sec + (float64)t.tv_nsec/1000000000.0;
+}
+
+
+///
+///
+// Dynamic Libraries
+///
+
+Dynamic_Library_Handle os_load_dynamic_library(string path) {
+	return dlopen(temp_linux_path(path), RTLD_NOW | RTLD_LOCAL);
+}
+void *os_dynamic_library_load_symbol(Dynamic_Library_Handle l, string identifier) {
+	return dlsym(l, temp_convert_to_null_terminated_string(identifier));
+}
+void os_unload_dynamic_library(Dynamic_Library_Handle l) {
+	dlclose(l);
+}
+
+///
+///
+// IO
+///
+
+const File OS_INVALID_FILE = -1;
+void os_write_string_to_stdout(string s) {
+	u64 written = 0;
+	while (written < s.count) {
+		ssize_t n = write(STDOUT_FILENO, s.data+written, s.count-written);
+		if (n <= 0) return;
+		written += (u64)n;
+	}
+}
+
+File os_file_open_s(string path, Os_Io_Open_Flags flags) {
+	int linux_flags = O_RDONLY;
+
+	if (flags & O_WRITE) {
+		linux_flags = O_RDWR;
+	}
+	if (flags & O_CREATE) {
+		linux_flags |= O_CREAT | O_TRUNC;
+	}
+
+	File f = open(temp_linux_path(path), linux_flags, 0644);
+
+	if (f != OS_INVALID_FILE && (flags & O_WRITE) && !(flags & O_CREATE)) {
+		// Append
+		lseek(f, 0, SEEK_END);
+	}
+
+	return f;
+}
+
+void os_file_close(File f) {
+	if (f != OS_INVALID_FILE) close(f);
+}
+
+bool os_file_delete_s(string path) {
+	return unlink(temp_linux_path(path)) == 0;
+}
+
+bool os_file_copy_s(string from, string to, bool replace_if_exists) {
+	File src = open(temp_linux_path(from), O_RDONLY);
+	if (src == OS_INVALID_FILE) return false;
+
+	int dst_flags = O_WRONLY | O_CREAT | O_TRUNC;
+	if (!replace_if_exists) dst_flags |= O_EXCL;
+	File dst = open(temp_linux_path(to), dst_flags, 0644);
+	if (dst == OS_INVALID_FILE) {
+		close(src);
+		return false;
+	}
+
+	u8 buffer[KB(16)];
+	bool ok = true;
+	while (true) {
+		ssize_t n = read(src, buffer, sizeof(buffer));
+		if (n == 0) break;
+		if (n < 0 || !os_file_write_bytes(dst, buffer, (u64)n)) {
+			ok = false;
+			break;
+		}
+	}
+
+	close(src);
+	close(dst);
+	return ok;
+}
+
+bool os_make_directory_s(string path, bool recursive) {
+	char *c_path = temp_linux_path(path);
+
+	for (char *p = c_path; *p; ++p) {
+		if (*p == '\\') *p = '/';
+	}
+
+	if (recursive) {
+		for (char *sep = strchr(c_path + 1, '/'); sep; sep = strchr(sep + 1, '/')) {
+			*sep = 0;
+			if (mkdir(c_path, 0755) != 0 && errno != EEXIST) {
+				return false;
+			}
+			*sep = '/';
+		}
+	}
+
+	if (mkdir(c_path, 0755) != 0 && errno != EEXIST) {
+		return false;
+	}
+
+	return true;
+}
+bool os_delete_directory_s(string path, bool recursive) {
+	char *c_path = temp_linux_path(path);
+
+	if (recursive) {
+		DIR *dir = opendir(c_path);
+		if (!dir) return false;
+
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != 0) {
+			if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+			string child_path = tprint("%s/%cs", path, entry->d_name);
+
+			bool ok;
+			if (os_is_directory_s(child_path)) ok = os_delete_directory_s(child_path, true);
+			else                                ok = os_file_delete_s(child_path);
+
+			if (!ok) {
+				closedir(dir);
+				return false;
+			}
+		}
+		closedir(dir);
+	}
+
+	return rmdir(c_path) == 0;
+}
+
+bool os_file_write_string(File f, string s) {
+	return os_file_write_bytes(f, s.data, s.count);
+}
+
+bool os_file_write_bytes(File f, void *buffer, u64 size_in_bytes) {
+	u64 written = 0;
+	while (written < size_in_bytes) {
+		ssize_t n = write(f, (u8*)buffer+written, size_in_bytes-written);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		written += (u64)n;
+	}
+	return true;
+}
+
+bool os_file_read(File f, void* buffer, u64 bytes_to_read, u64 *actual_read_bytes) {
+	u64 read_bytes = 0;
+	bool ok = true;
+	while (read_bytes < bytes_to_read) {
+		ssize_t n = read(f, (u8*)buffer+read_bytes, bytes_to_read-read_bytes);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) { ok = false; break; }
+		if (n == 0) break;
+		read_bytes += (u64)n;
+	}
+	if (actual_read_bytes) {
+		*actual_read_bytes = read_bytes;
+	}
+	return ok;
+}
+
+bool os_file_set_pos(File f, s64 pos_in_bytes) {
+	if (pos_in_bytes < 0) return false;
+	return lseek(f, (off_t)pos_in_bytes, SEEK_SET) == (off_t)pos_in_bytes;
+}
+
+s64
+os_file_get_size(File f) {
+	struct stat st;
+	if (fstat(f, &st) != 0) return -1;
+	return (s64)st.st_size;
+}
+
+s64
+os_file_get_size_from_path(string path) {
+	struct stat st;
+	if (stat(temp_linux_path(path), &st) != 0) return -1;
+	return (s64)st.st_size;
+}
+
+s64 os_file_get_pos(File f) {
+	off_t pos = lseek(f, 0, SEEK_CUR);
+	return pos < 0 ? (s64)-1 : (s64)pos;
+}
+
+bool os_write_entire_file_handle(File f, string data) {
+    return os_file_write_string(f, data);
+}
+
+bool os_write_entire_file_s(string path, string data) {
+    File file = os_file_open_s(path, O_WRITE | O_CREATE);
+    if (file == OS_INVALID_FILE) {
+        return false;
+    }
+    bool result = os_file_write_string(file, data);
+    os_file_close(file);
+    return result;
+}
+
+bool os_read_entire_file_handle(File f, string *result, Allocator allocator) {
+	s64 file_size = os_file_get_size(f);
+	if (file_size < 0) {
+		return false;
+	}
+
+	u64 actual_read = 0;
+	result->data = (u8*)alloc(allocator, file_size);
+	result->count = file_size;
+
+	bool ok = os_file_read(f, result->data, file_size, &actual_read);
+	if (!ok) {
+		dealloc(allocator, result->data);
+		result->data = 0;
+		return false;
+	}
+
+	return actual_read == (u64)file_size;
+}
+
+bool os_read_entire_file_s(string path, string *result, Allocator allocator) {
+    File file = os_file_open_s(path, O_READ);
+    if (file == OS_INVALID_FILE) {
+        return false;
+    }
+    bool res = os_read_entire_file_handle(file, result, allocator);
+    os_file_close(file);
+    return res;
+}
+
+bool os_file_map_s(string path, string *result) {
+	File file = os_file_open_s(path, O_READ);
+	if (file == OS_INVALID_FILE) {
+		return false;
+	}
+
+	s64 file_size = os_file_get_size(file);
+	if (file_size <= 0) {
+		os_file_close(file);
+		return false;
+	}
+
+	// The mapping stays valid after closing the file
+	void *view = mmap(0, (u64)file_size, PROT_READ, MAP_PRIVATE, file, 0);
+	os_file_close(file);
+	if (view == MAP_FAILED) {
+		return false;
+	}
+
+	result->data = (u8*)view;
+	result->count = (u64)file_size;
+
+	return true;
+}
+
+void os_file_unmap(string mapped) {
+	if (mapped.data) munmap(mapped.data, mapped.count);
+}
+
+bool os_is_file_s(string path) {
+	struct stat st;
+	if (stat(temp_linux_path(path), &st) != 0) return false;
+	return S_ISREG(st.st_mode);
+}
+
+bool os_is_directory_s(string path) {
+	struct stat st;
+	if (stat(temp_linux_path(path), &st) != 0) return false;
+	return S_ISDIR(st.st_mode);
+}
+
+bool os_is_path_absolute(string path) {
+	return path.count > 0 && path.data[0] == '/';
+}
+
+// Like GetFullPathNameW, this does not require the path to exist, it just resolves
+// it against the working directory and collapses . and .. segments.
+bool os_get_absolute_path(string path, string *result, Allocator allocator) {
+	string joined = path;
+	if (!os_is_path_absolute(path)) {
+		char cwd[4096];
+		if (!getcwd(cwd, sizeof(cwd))) return false;
+		joined = tprint("%cs/%s", cwd, path);
+	}
+
+	u8 *out = (u8*)alloc(allocator, joined.count+1);
+	u64 count = 0;
+
+	u64 i = 0;
+	while (i < joined.count) {
+		while (i < joined.count && (joined.data[i] == '/' || joined.data[i] == '\\')) i += 1;
+		u64 segment_start = i;
+		while (i < joined.count && joined.data[i] != '/' && joined.data[i] != '\\') i += 1;
+		string segment = string_view(joined, segment_start, i-segment_start);
+
+		if (segment.count == 0 || strings_match(segment, STR("."))) continue;
+		if (strings_match(segment, STR(".."))) {
+			while (count > 0 && out[count-1] != '/') count -= 1;
+			if (count > 0) count -= 1;
+			continue;
+		}
+
+		out[count++] = '/';
+		memcpy(out+count, segment.data, segment.count);
+		count += segment.count;
+	}
+	if (count == 0) out[count++] = '/';
+
+	result->data = out;
+	result->count = count;
+
+	return true;
+}
+
+bool os_get_relative_path(string from, string to, string *result, Allocator allocator) {
+
+	// Like PathRelativePathToW, a file is relative from its directory
+	if (os_is_file(from)) from = get_directory_of(from);
+
+	if (!os_get_absolute_path(from, &from, get_temporary_allocator())) return false;
+	if (!os_get_absolute_path(to,   &to,   get_temporary_allocator())) return false;
+
+	// Find the last shared separator
+	u64 common = 0;
+	u64 i = 0;
+	while (i < from.count && i < to.count && from.data[i] == to.data[i]) {
+		i += 1;
+		if (from.data[i-1] == '/') common = i;
+	}
+	if ((i == from.count && (i == to.count || to.data[i] == '/'))) {
+		common = i;
+	}
+
+	String_Builder sb;
+	string_builder_init(&sb, allocator);
+
+	string_builder_append(&sb, STR("."));
+	for (u64 j = common; j < from.count; j++) {
+		if (from.data[j] == '/' || j == common) {
+			if (j == common && from.data[j] == '/') continue;
+			string_builder_append(&sb, STR("/.."));
+		}
+	}
+	if (common < to.count) {
+		string rest = string_view(to, common, to.count-common);
+		if (rest.data[0] != '/') string_builder_append(&sb, STR("/"));
+		string_builder_append(&sb, rest);
+	}
+
+	*result = string_builder_get_string(sb);
+
+	return true;
+}
+
+bool os_do_paths_match(string a, string b) {
+	string full_a, full_b;
+	if (!os_get_absolute_path(a, &full_a, get_temporary_allocator())) return false;
+	if (!os_get_absolute_path(b, &full_b, get_temporary_allocator())) return false;
+	return strings_match(full_a, full_b);
+}
+
+void fprints(File f, string fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	fprint_va_list_buffered(f, fmt, args);
+	va_end(args);
+}
+void fprintf(File f, const char* fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	string s;
+	s.data = cast(u8*)fmt;
+	s.count = strlen(fmt);
+	fprint_va_list_buffered(f, s, args);
+	va_end(args);
+}
+
+///
+///
+// Queries
+///
+
+void*
+os_get_stack_base() {
+	pthread_attr_t attr;
+	void *stack_addr = 0;
+	size_t stack_size = 0;
+	if (pthread_getattr_np(pthread_self(), &attr) != 0) return 0;
+	pthread_attr_getstack(&attr, &stack_addr, &stack_size);
+	pthread_attr_destroy(&attr);
+	return (u8*)stack_addr + stack_size;
+}
+void*
+os_get_stack_limit() {
+	pthread_attr_t attr;
+	void *stack_addr = 0;
+	size_t stack_size = 0;
+	if (pthread_getattr_np(pthread_self(), &attr) != 0) return 0;
+	pthread_attr_getstack(&attr, &stack_addr, &stack_size);
+	pthread_attr_destroy(&attr);
+	return stack_addr;
+}
+
+u64
+os_get_number_of_logical_processors() {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (u64)n : 1;
+}
+
+///
+///
+// Debug
+///
+#define LINUX_MAX_STACK_FRAMES 64
+string *
+os_get_stack_trace(u64 *trace_count, Allocator allocator) {
+	void *frames[LINUX_MAX_STACK_FRAMES];
+	int count = backtrace(frames, LINUX_MAX_STACK_FRAMES);
+
+	// We don't resolve symbols here since backtrace_symbols() mallocs.
+	// Resolve the addresses with addr2line.
+	string *stack_strings = (string *)alloc(allocator, LINUX_MAX_STACK_FRAMES * sizeof(string));
+	*trace_count = 0;
+	for (int i = 0; i < count; i++) {
+		stack_strings[*trace_count].data = (u8 *)alloc(allocator, 32);
+		stack_strings[*trace_count].count = format_string_to_buffer_va((char *)stack_strings[*trace_count].data, 32, "0x%llx", (u64)frames[i]);
+		(*trace_count)++;
+	}
+	return stack_strings;
+}
+
+///
+///
+// Memory
+///
+
+bool os_grow_program_memory(u64 new_size) {
+	os_lock_mutex(program_memory_mutex); // #Sync
+	if (program_memory_capacity >= new_size) {
+		os_unlock_mutex(program_memory_mutex); // #Sync
+		return true;
+	}
+
+	bool is_first_time = program_memory == 0;
+
+	if (is_first_time) {
+		program_memory = mmap(0, LINUX_PROGRAM_MEMORY_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (program_memory == MAP_FAILED) {
+			program_memory = 0;
+			os_unlock_mutex(program_memory_mutex); // #Sync
+			return false;
+		}
+		program_memory_next = program_memory;
+	}
+
+	u64 aligned_size = align_next(new_size, os.granularity);
+	if (aligned_size > LINUX_PROGRAM_MEMORY_RESERVE) {
+		os_unlock_mutex(program_memory_mutex); // #Sync
+		return false;
+	}
+
+	// Everything is already reserved so growing is just making the next pages accessible
+	void *tail = (u8*)program_memory + program_memory_capacity;
+	u64 amount_to_allocate = aligned_size-program_memory_capacity;
+	if (mprotect(tail, amount_to_allocate, PROT_READ | PROT_WRITE) != 0) {
+		os_unlock_mutex(program_memory_mutex); // #Sync
+		return false;
+	}
+#if CONFIGURATION == DEBUG
+	memset(tail, 0xBA, amount_to_allocate);
+	mprotect(tail, amount_to_allocate, PROT_NONE);
+#endif
+	program_memory_capacity = aligned_size;
+
+	char size_str[32];
+	s64_to_null_terminated_string(program_memory_capacity/1024, size_str, 10);
+
+	os_write_string_to_stdout(STR("Program memory grew to "));
+	os_write_string_to_stdout(STR(size_str));
+	os_write_string_to_stdout(STR(" kb\n"));
+	os_unlock_mutex(program_memory_mutex); // #Sync
+	return true;
+}
+
+void*
+os_reserve_next_memory_pages(u64 size) {
+	assert(size % os.page_size == 0, "size was not aligned to page size in os_reserve_next_memory_pages");
+
+	void *p = program_memory_next;
+
+	program_memory_next = (u8*)program_memory_next + size;
+
+	void *program_tail = (u8*)program_memory + program_memory_capacity;
+
+	if ((u64)program_memory_next > (u64)program_tail) {
+		u64 minimum_size = ((u64)program_memory_next) - (u64)program_memory + 1;
+		u64 new_program_size = get_next_power_of_two(minimum_size);
+
+		const u64 ATTEMPTS = 1000;
+		for (u64 i = 0; i <= ATTEMPTS; i++) {
+			if (program_memory_capacity >= new_program_size) break; // Another thread might have resized already, causing it to fail here.
+			assert(i < ATTEMPTS, "OS is not letting us allocate more memory. Maybe we are out of memory? You sure must be using a lot of memory then.");
+			if (os_grow_program_memory(new_program_size))
+				break;
+		}
+	}
+
+	return p;
+}
+
+void
+os_unlock_program_memory_pages(void *start, u64 size) {
+#if CONFIGURATION == DEBUG
+	assert((u64)start % os.page_size == 0, "When unlocking memory pages, the start address must be the start of a page");
+	assert(size       % os.page_size == 0, "When unlocking memory pages, the size must be aligned to page_size");
+	// Unlike on windows, the whole range is one mapping so we can do it in one call.
+	int err = mprotect(start, size, PROT_READ | PROT_WRITE);
+	assert(err == 0, "mprotect failed with error %d", errno);
+#endif
+}
+
+void
+os_lock_program_memory_pages(void *start, u64 size) {
+#if CONFIGURATION == DEBUG
+	assert((u64)start % os.page_size == 0, "When unlocking memory pages, the start address must be the start of a page");
+	assert(size       % os.page_size == 0, "When unlocking memory pages, the size must be aligned to page_size");
+	int err = mprotect(start, size, PROT_NONE);
+	assert(err == 0, "mprotect failed with error %d", errno);
+#endif
+}
+
+void*
+os_reserve_address_space(u64 size) {
+	assert(size % os.page_size == 0, "size was not aligned to page size in os_reserve_address_space");
+	void *p = mmap(0, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED) return 0;
+	return p;
+}
+bool
+os_commit_address_space(void *start, u64 size) {
+	assert((u64)start % os.page_size == 0, "When committing address space, the start address must be the start of a page");
+	assert(size       % os.page_size == 0, "When committing address space, the size must be aligned to page_size");
+	// Anonymous pages are zero and only get physical memory when touched
+	return mprotect(start, size, PROT_READ | PROT_WRITE) == 0;
+}
+void
+os_release_address_space(void *start, u64 size) {
+	int err = munmap(start, size);
+	assert(err == 0, "munmap failed with error %d", errno);
+}
+
+void*
+os_allocate_pages(u64 size, Os_Huge_Pages huge_pages, bool *got_huge_pages) {
+	assert(size % os.page_size == 0, "size was not aligned to page size in os_allocate_pages");
+	if (got_huge_pages) *got_huge_pages = false;
+	
+	if (huge_pages == OS_HUGE_PAGES_EXPLICIT) {
+		assert(size % MB(2) == 0, "size must be aligned to 2MB for huge pages");
+		void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			if (got_huge_pages) *got_huge_pages = true;
+			return p;
+		}
+		// Nothing in vm.nr_hugepages, transparent huge pages is the next best thing
+		huge_pages = OS_HUGE_PAGES_TRANSPARENT;
+	}
+	
+	if (huge_pages == OS_HUGE_PAGES_TRANSPARENT && size >= MB(2)) {
+		// THP only backs 2MB aligned ranges, so map a bit extra and trim it down to an aligned start.
+		u64 padded_size = size + MB(2) - os.page_size;
+		u8 *mapped = (u8*)mmap(0, padded_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mapped == MAP_FAILED) return 0;
+		
+		u8 *p = (u8*)align_next((u64)mapped, MB(2));
+		u64 head = (u64)(p-mapped);
+		u64 tail = padded_size-head-size;
+		if (head) munmap(mapped, head);
+		if (tail) munmap(p+size, tail);
+		
+		// Fails if THP is disabled in the kernel, which is fine, we just get normal pages.
+		// Even when it succeeds the kernel decides later, so this doesn't count as got_huge_pages.
+		madvise(p, size, MADV_HUGEPAGE);
+		return p;
+	}
+	
+	void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) return 0;
+	
+	return p;
+}
+
+// One perf event group per thread so all counters are read with one read() call.
+// linux_perf_group_fd is -1 before the first read and -2 if the counters are not available.
+thread_local int linux_perf_group_fd = -1;
+thread_local s8 linux_perf_group_slots[OS_HARDWARE_COUNTER_MAX]; // Position in the group read, -1 if not in group
+
+bool
+linux_open_hardware_counters() {
+	const u64 configs[OS_HARDWARE_COUNTER_MAX] = {
+		[OS_HARDWARE_COUNTER_CYCLES]        = PERF_COUNT_HW_CPU_CYCLES,
+		[OS_HARDWARE_COUNTER_INSTRUCTIONS]  = PERF_COUNT_HW_INSTRUCTIONS,
+		[OS_HARDWARE_COUNTER_CACHE_MISSES]  = PERF_COUNT_HW_CACHE_MISSES,
+		[OS_HARDWARE_COUNTER_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+	};
+	
+	int group_fd = -1;
+	s8 slot_count = 0;
+	for (u64 i = 0; i < OS_HARDWARE_COUNTER_MAX; i++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = configs[i];
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		
+		int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+		if (fd < 0) {
+			linux_perf_group_slots[i] = -1;
+			continue;
+		}
+		if (group_fd == -1) group_fd = fd;
+		linux_perf_group_slots[i] = slot_count;
+		slot_count += 1;
+	}
+	
+	if (group_fd == -1) {
+		local_persist bool logged = false;
+		if (!logged) log_info("Hardware performance counters are not available (perf_event_open failed with errno %d)", errno);
+		logged = true;
+		return false;
+	}
+	
+	linux_perf_group_fd = group_fd;
+	return true;
+}
+
+bool
+os_read_hardware_counters(u64 counters[OS_HARDWARE_COUNTER_MAX]) {
+	memset(counters, 0, sizeof(u64)*OS_HARDWARE_COUNTER_MAX);
+	
+	if (linux_perf_group_fd == -2) return false;
+	if (linux_perf_group_fd == -1 && !linux_open_hardware_counters()) {
+		linux_perf_group_fd = -2;
+		return false;
+	}
+	
+	// PERF_FORMAT_GROUP layout
+	struct { u64 count; u64 values[OS_HARDWARE_COUNTER_MAX]; } group;
+	ssize_t read_bytes = read(linux_perf_group_fd, &group, sizeof(group));
+	if (read_bytes < (ssize_t)sizeof(u64)) return false;
+	
+	for (u64 i = 0; i < OS_HARDWARE_COUNTER_MAX; i++) {
+		s8 slot = linux_perf_group_slots[i];
+		if (slot >= 0 && (u64)slot < group.count) counters[i] = group.values[slot];
+	}
+	return true;
+}
+
+///
+///
+// Mouse pointer
+// No window in headless so these do nothing.
+
+void ogb_instance
+os_set_mouse_pointer_standard(Mouse_Pointer_Kind kind) {
+}
+void ogb_instance
+os_set_mouse_pointer_custom(Custom_Mouse_Pointer p) {
+}
+Custom_Mouse_Pointer ogb_instance
+os_make_custom_mouse_pointer(void *image, int width, int height, int hotspot_x, int hotspot_y) {
+	return 0;
+}
+Custom_Mouse_Pointer ogb_instance
+os_make_custom_mouse_pointer_from_file(string path, int hotspot_x, int hotspot_y, Allocator allocator) {
+	return 0;
+}
+
+void os_update() {
+#if ENABLE_ALLOCATION_TRACKING
+	allocation_tracking_end_frame();
+#endif
+#if ENABLE_PROFILING
+	profiler_end_frame();
+#endif
+
+	input_recording_update();
+	
+	audio_update_headless();
+}
@@ -894,6 +894,41 @@ bool os_read_entire_file_s(string path, string *result, Allocator allocator) {
     return res;
 }
 
+bool os_file_map_s(string path, string *result) {
+    File file = os_file_open_s(path, O_READ);
+    if (file == OS_INVALID_FILE) {
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        os_file_close(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingW(file, 0, PAGE_READONLY, 0, 0, 0);
+    os_file_close(file);
+    if (!mapping) {
+        return false;
+    }
+
+    // The view keeps the mapping object alive, so we don't need to hold on to any handles.
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view) {
+        return false;
+    }
+
+    result->data = (u8*)view;
+    result->count = (u64)file_size.QuadPart;
+
+    return true;
+}
+
+void os_file_unmap(string mapped) {
+    if (mapped.data) UnmapViewOfFile(mapped.data);
+}
+
 bool os_is_file_s(string path) {
 	u16 *path_wide = temp_win32_fixed_utf8_to_null_terminated_wide(path);
 	assert(path_wide, "Invalid path string");
@@ -1281,6 +1316,88 @@ os_lock_program_memory_pages(void *start, u64 size) {
 #endif
 }
 
+void*
+os_reserve_address_space(u64 size) {
+	assert(size % os.page_size == 0, "size was not aligned to page size in os_reserve_address_space");
+	return VirtualAlloc(0, size, MEM_RESERVE, PAGE_NOACCESS);
+}
+bool
+os_commit_address_space(void *start, u64 size) {
+	assert((u64)start % os.page_size == 0, "When committing address space, the start address must be the start of a page");
+	assert(size       % os.page_size == 0, "When committing address space, the size must be aligned to page_size");
+	return VirtualAlloc(start, size, MEM_COMMIT, PAGE_READWRITE) != 0;
+}
+void
+os_release_address_space(void *start, u64 size) {
+	// MEM_RELEASE wants size 0 and releases the whole reservation
+	BOOL ok = VirtualFree(start, 0, MEM_RELEASE);
+	assert(ok, "VirtualFree Failed with error %d", GetLastError());
+}
+
+// Large pages need SeLockMemoryPrivilege, which the user needs to have been granted
+// ("Lock pages in memory" policy). advapi32 is loaded at runtime so we don't need to link it.
+bool
+win32_enable_large_page_privilege() {
+	local_persist bool tried = false;
+	local_persist bool enabled = false;
+	if (tried) return enabled;
+	tried = true;
+	
+	HMODULE advapi = LoadLibraryA("advapi32.dll");
+	if (!advapi) return false;
+	
+	typedef BOOL (WINAPI *Open_Process_Token_Proc)(HANDLE, DWORD, PHANDLE);
+	typedef BOOL (WINAPI *Lookup_Privilege_Value_Proc)(LPCSTR, LPCSTR, PLUID);
+	typedef BOOL (WINAPI *Adjust_Token_Privileges_Proc)(HANDLE, BOOL, PTOKEN_PRIVILEGES, DWORD, PTOKEN_PRIVILEGES, PDWORD);
+	Open_Process_Token_Proc open_process_token = (Open_Process_Token_Proc)GetProcAddress(advapi, "OpenProcessToken");
+	Lookup_Privilege_Value_Proc lookup_privilege_value = (Lookup_Privilege_Value_Proc)GetProcAddress(advapi, "LookupPrivilegeValueA");
+	Adjust_Token_Privileges_Proc adjust_token_privileges = (Adjust_Token_Privileges_Proc)GetProcAddress(advapi, "AdjustTokenPrivileges");
+	if (!open_process_token || !lookup_privilege_value || !adjust_token_privileges) return false;
+	
+	HANDLE token;
+	if (!open_process_token(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return false;
+	
+	TOKEN_PRIVILEGES privileges = ZERO(TOKEN_PRIVILEGES);
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	if (lookup_privilege_value(0, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid)) {
+		// AdjustTokenPrivileges succeeds even if the privilege wasn't granted, so check last error
+		adjust_token_privileges(token, FALSE, &privileges, 0, 0, 0);
+		enabled = GetLastError() == ERROR_SUCCESS;
+	}
+	CloseHandle(token);
+	
+	return enabled;
+}
+
+void*
+os_allocate_pages(u64 size, Os_Huge_Pages huge_pages, bool *got_huge_pages) {
+	assert(size % os.page_size == 0, "size was not aligned to page size in os_allocate_pages");
+	if (got_huge_pages) *got_huge_pages = false;
+	
+	// Windows has no transparent huge pages, only explicit large pages.
+	if (huge_pages == OS_HUGE_PAGES_EXPLICIT && win32_enable_large_page_privilege()) {
+		SIZE_T large_page_size = GetLargePageMinimum();
+		if (large_page_size && size % large_page_size == 0) {
+			void *p = VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			if (p) {
+				if (got_huge_pages) *got_huge_pages = true;
+				return p;
+			}
+		}
+	}
+	
+	return VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+bool
+os_read_hardware_counters(u64 counters[OS_HARDWARE_COUNTER_MAX]) {
+	// #Incomplete
+	// Windows only gives user mode access to the PMU through ETW/a driver.
+	memset(counters, 0, sizeof(u64)*OS_HARDWARE_COUNTER_MAX);
+	return false;
+}
+
 ///
 ///
 // Mouse pointer
@@ -1611,6 +1728,10 @@ win32_audio_thread(Thread *t) {
     
 	while (!window.should_close) tm_scope("Audio update") {
 		if (win32_audio_deactivated) tm_scope("Retry audio device") {
+			if (audio_output_kind == AUDIO_OUTPUT_DEVICE && audio_mixer_try_acquire()) {
+				audio_mix_idle();
+				audio_mixer_release();
+			}
 			os_sleep(100);
 			mutex_acquire_or_wait(&audio_init_mutex);
 			win32_audio_init();
@@ -1635,6 +1756,9 @@ win32_audio_thread(Thread *t) {
 		}
     	u32 num_frames_to_write = buffer_frame_count - num_frames_available;
     	
+    	// If the device already played everything we gave it, we didn't keep up
+    	bool underrun = started && num_frames_available == 0;
+    	
     	if (!started) {
 	    	hr = IAudioClient_Start(win32_audio_client);
 	    	win32_check_hr(hr);
@@ -1668,7 +1792,15 @@ win32_audio_thread(Thread *t) {
 				continue;
 			}
 			
-			do_program_audio_sample(num_frames_to_write, audio_output_format, buffer);
+			// Someone else is mixing (null output or offline rendering), so we just play silence
+			if (audio_output_kind == AUDIO_OUTPUT_DEVICE && audio_mixer_try_acquire()) {
+				audio_timing_report_output(num_frames_available, underrun);
+				do_program_audio_sample(num_frames_to_write, audio_output_format, buffer);
+				audio_mixer_release();
+			} else {
+				u64 frame_size = get_audio_bit_width_byte_size(audio_output_format.bit_width)*audio_output_format.channels;
+				memset(buffer, 0, num_frames_to_write*frame_size);
+			}
 			//f32 s = 0.5;
 			//for (u32 i = 0; i < num_frames_to_write * audio_output_format.channels; ++i) {
 			//	((f32*)buffer)[i] = s;
@@ -1707,6 +1839,13 @@ win32_audio_thread(Thread *t) {
 
 void os_update() {
 
+#if ENABLE_ALLOCATION_TRACKING
+	allocation_tracking_end_frame();
+#endif
+#if ENABLE_PROFILING
+	profiler_end_frame();
+#endif
+
 #ifndef OOGABOOGA_HEADLESS
 	UINT dpi = GetDpiForWindow(window._os_handle);
     float dpi_scale_factor = dpi / 96.0f;
@@ -1823,6 +1962,12 @@ void os_update() {
 		win32_window_proc(window._os_handle, WM_CLOSE, 0, 0);
 	}
 #endif /* OOGABOOGA_HEADLESS */
+
+	input_recording_update();
+	
+#ifdef OOGABOOGA_HEADLESS
+	audio_update_headless();
+#endif
 }
 
 #ifndef OOGABOOGA_HEADLESS
@@ -8,15 +8,11 @@
 	typedef HANDLE File;
 	
 #elif defined(__linux__)
-    #ifndef OOGABOOGA_HEADLESS
-    #define "Linux is only supported for headless builds"
-    #endif
-	typedef SOMETHING Mutex_Handle;
-	typedef SOMETHING Thread_Handle;
-	typedef SOMETHING Dynamic_Library_Handle;
-	typedef SOMETHING Window_Handle;
-	typedef SOMETHING File;
-	#error "Linux is not supported yet";
+	typedef pthread_mutex_t* Mutex_Handle;
+	typedef pthread_t Thread_Handle;
+	typedef void* Dynamic_Library_Handle;
+	typedef void* Window_Handle;
+	typedef s64 File; // File descriptor
 #elif defined(__APPLE__) && defined(__MACH__)
 	typedef SOMETHING Mutex_Handle;
 	typedef SOMETHING Thread_Handle;
@@ -260,6 +256,14 @@ os_read_entire_file_handle(File f, string *result, Allocator allocator);
 bool ogb_instance
 os_read_entire_file_s(string path, string *result, Allocator allocator);
 
+// Maps the whole file read-only into virtual memory, so pages are only read from disk when touched.
+// result is only valid until os_file_unmap(). Fails on empty files.
+bool ogb_instance
+os_file_map_s(string path, string *result);
+
+void ogb_instance
+os_file_unmap(string mapped);
+
 
 bool ogb_instance
 os_is_file_s(string path);
@@ -325,6 +329,12 @@ inline bool os_read_entire_file_f(const char *path, string *result, Allocator al
                            string:  os_read_entire_file_s, \
                            default: os_read_entire_file_f \
                           )(__VA_ARGS__)
+
+inline bool os_file_map_f(const char *path, string *result) {return os_file_map_s(STR(path), result);}
+#define os_file_map(...) _Generic((FIRST_ARG(__VA_ARGS__)), \
+                           string:  os_file_map_s, \
+                           default: os_file_map_f \
+                          )(__VA_ARGS__)
                           
 inline bool os_is_file_f(const char *path) {return os_is_file_s(STR(path));}
 #define os_is_file(...) _Generic((FIRST_ARG(__VA_ARGS__)), \
@@ -442,6 +452,53 @@ os_unlock_program_memory_pages(void *start, u64 size);
 void ogb_instance
 os_lock_program_memory_pages(void *start, u64 size);
 
+// Address space outside of program memory, reserved up front and committed as it's needed.
+// Nothing is backed by physical memory until it's committed. Committed memory is zeroed.
+// - start and size must be aligned to os.page_size
+// - Returns 0 if the address space could not be reserved
+ogb_instance void*
+os_reserve_address_space(u64 size);
+bool ogb_instance
+os_commit_address_space(void *start, u64 size);
+void ogb_instance
+os_release_address_space(void *start, u64 size);
+
+typedef enum Os_Huge_Pages {
+	OS_HUGE_PAGES_NONE        = 0,
+	OS_HUGE_PAGES_TRANSPARENT = 1, // Hint the OS to back the pages with huge pages when it can (Linux THP)
+	OS_HUGE_PAGES_EXPLICIT    = 2, // Explicit 2MB pages, falls back to transparent if the system has none to give
+} Os_Huge_Pages;
+
+// Maps size bytes of zeroed read/write memory straight from the OS, outside of program memory.
+// Release it with os_release_address_space(start, size).
+// - size must be aligned to os.page_size, and to MB(2) when asking for explicit huge pages
+// - got_huge_pages (optional) is set if we got explicit huge pages. Transparent huge pages are
+//   only a hint that the OS may or may not act on later, so those are never reported.
+// - Returns 0 on fail
+ogb_instance void*
+os_allocate_pages(u64 size, Os_Huge_Pages huge_pages, bool *got_huge_pages);
+
+///
+///
+// Hardware performance counters
+
+typedef enum Os_Hardware_Counter {
+	OS_HARDWARE_COUNTER_CYCLES,
+	OS_HARDWARE_COUNTER_INSTRUCTIONS,
+	OS_HARDWARE_COUNTER_CACHE_MISSES, // Last level cache
+	OS_HARDWARE_COUNTER_BRANCH_MISSES,
+	
+	OS_HARDWARE_COUNTER_MAX,
+} Os_Hardware_Counter;
+
+// Reads the running totals of the calling thread's hardware counters, counting user mode only.
+// The counters are set up on the first call on each thread, so diff two reads.
+// Linux only (perf_event_open) for now. Returns false if the counters are not available
+// (no PMU exposed in a VM, kernel.perf_event_paranoid > 2, ...). Counters the CPU doesn't
+// have read as 0.
+ogb_instance bool
+os_read_hardware_counters(u64 counters[OS_HARDWARE_COUNTER_MAX]);
+
 ///
 ///
 // Mouse pointer
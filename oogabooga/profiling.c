@@ -1,48 +1,766 @@
 
+/*
+
+	Profiling
+
+	Each thread records binary events (name id, begin & end timestamps) into its own ring
+	buffer with plain stores, nothing is formatted or locked while profiling. The rings are
+	converted to chrome trace JSON in dump_profile_result().
+
+	rdtsc timestamps are converted to microseconds with the TSC frequency, which is
+	calibrated against os_get_current_time_in_seconds() in profiler_init() and then refined
+	over the whole run when dumping.
+
+	If a thread records more than PROFILER_EVENTS_PER_THREAD events the oldest ones are
+	overwritten.
+
+	Frame stats:
+	
+	profiler_end_frame() (called from os_update() with ENABLE_PROFILING) consumes the
+	events recorded since the last frame and aggregates them per name: total & self time
+	and call count of scopes, and the value of counters. The last PROFILER_FRAME_HISTORY
+	frames are kept so you can query averages and spikes at runtime:
+	
+		profiler_get_frame_stats()
+		profiler_get_frame_times()
+		profiler_get_scope_stats()
+		profiler_get_top_scopes()
+		profiler_get_counter_stats()
+		profiler_get_counters()
+		
+	draw_profiler_overlay() in drawing.c draws them on top of the game.
+	
+	Events count towards the frame in which they end. Self time is the time of a scope minus
+	the time of the scopes directly nested in it on the same thread.
+	If a counter is reported several times in a frame, the frame value is the highest one.
+	If it's not reported in a frame, the frame keeps the last value.
+	
+	The query procedures should be called from the same thread as profiler_end_frame().
+	
+	Hardware counters:
+	
+	tm_scope_hardware() is a tm_scope which also records the cycles, instructions, last level
+	cache misses and branch misses of the thread over the scope (os_read_hardware_counters(),
+	Linux only). They show up as args of the scope in google_trace.json and
+	dump_profile_result() logs a table of them per scope. Reading the counters is a syscall
+	on each end of the scope, so use it for selected scopes only, not in tight loops.
+
+*/
+
+#ifndef PROFILER_EVENTS_PER_THREAD
+	#define PROFILER_EVENTS_PER_THREAD (1024*256)
+#endif
+#ifndef PROFILER_FRAME_HISTORY
+	#define PROFILER_FRAME_HISTORY 120
+#endif
+#define PROFILER_NAME_MAX 4096
+#define PROFILER_NAME_CACHE_SIZE 256
+#define PROFILER_SCOPE_STACK_MAX 64
+
+typedef enum Profile_Event_Kind {
+	PROFILE_EVENT_SCOPE,
+	PROFILE_EVENT_COUNTER,
+	// Follows a scope, two of them carry the hardware counter deltas of the scope in
+	// Os_Hardware_Counter order.
+	PROFILE_EVENT_HARDWARE_COUNTERS,
+} Profile_Event_Kind;
+
+typedef struct Profile_Event {
+	u64 start; // rdtsc
+	u64 end;   // rdtsc, or the float64 bits of the value for counters
+	u32 name_id;
+	u32 kind;
+} Profile_Event;
+
+typedef struct Profile_Scope_Interval {
+	u64 start;
+	u64 end;
+} Profile_Scope_Interval;
+
+typedef struct Profile_Thread_Buffer Profile_Thread_Buffer;
+typedef struct Profile_Thread_Buffer {
+	Profile_Event *events; // PROFILER_EVENTS_PER_THREAD
+	volatile u64 write_index; // Only written by the owning thread, never wraps
+	u64 thread_id;
+	Profile_Thread_Buffer *next;
+	
+	// Only touched by profiler_end_frame()
+	u64 frame_read_index;
+	// Scopes which may still turn out to be nested in a scope that hasn't ended yet
+	Profile_Scope_Interval scope_stack[PROFILER_SCOPE_STACK_MAX];
+	u64 scope_stack_count;
+} Profile_Thread_Buffer;
+
+typedef struct Profile_Frame_Sample {
+	u64 total_cycles;
+	u64 self_cycles;
+	u64 calls;
+	float64 counter_value;
+} Profile_Frame_Sample;
+
+typedef struct Profile_Frame_Name {
+	Profile_Frame_Sample current;
+	Profile_Frame_Sample history[PROFILER_FRAME_HISTORY];
+	u64 first_frame;
+	bool is_counter;
+	bool has_counter_value; // In current frame
+} Profile_Frame_Name;
+
+typedef struct Profile_Frame_Stats {
+	u64 frame_count; // Frames ended so far
+	u64 history_count; // How many frames the averages are over
+	float64 frame_seconds; // Last frame
+	float64 average_frame_seconds;
+	float64 min_frame_seconds;
+	float64 max_frame_seconds;
+} Profile_Frame_Stats;
+
+typedef struct Profile_Scope_Stats {
+	string name;
+	// Last frame
+	float64 total_seconds;
+	float64 self_seconds;
+	u64 calls;
+	// Over the frame history
+	float64 average_total_seconds;
+	float64 average_self_seconds;
+	float64 max_total_seconds;
+	float64 average_calls;
+} Profile_Scope_Stats;
+
+typedef struct Profile_Counter_Stats {
+	string name;
+	float64 value; // Last frame
+	// Over the frame history
+	float64 average;
+	float64 min;
+	float64 max;
+} Profile_Counter_Stats;
+
+typedef struct Profile_Hardware_Scope {
+	u64 start_time;
+	u64 counters[OS_HARDWARE_COUNTER_MAX];
+	bool has_counters;
+	bool done;
+} Profile_Hardware_Scope;
+
+typedef struct Profile_Name_Cache_Entry {
+	const char *literal;
+	u32 name_id;
+} Profile_Name_Cache_Entry;
 
 // #Global
-ogb_instance String_Builder _profile_output;
 ogb_instance bool profiler_initted;
 ogb_instance Spinlock _profiler_lock;
+ogb_instance Profile_Thread_Buffer * volatile profiler_thread_buffers;
+ogb_instance String_Interner profiler_names;
+ogb_instance float64 profiler_tsc_frequency;
+ogb_instance u64 profiler_start_cycles;
+ogb_instance float64 profiler_start_seconds;
+ogb_instance Profile_Frame_Name *profiler_frame_names[PROFILER_NAME_MAX];
+ogb_instance float64 profiler_frame_seconds[PROFILER_FRAME_HISTORY];
+ogb_instance u64 profiler_frame_count;
+ogb_instance u64 profiler_last_frame_cycles;
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
-String_Builder _profile_output = {0};
 bool profiler_initted = false;
 Spinlock _profiler_lock;
+Profile_Thread_Buffer * volatile profiler_thread_buffers = 0;
+String_Interner profiler_names = {0};
+float64 profiler_tsc_frequency = 0;
+u64 profiler_start_cycles = 0;
+float64 profiler_start_seconds = 0;
+Profile_Frame_Name *profiler_frame_names[PROFILER_NAME_MAX];
+float64 profiler_frame_seconds[PROFILER_FRAME_HISTORY];
+u64 profiler_frame_count = 0;
+u64 profiler_last_frame_cycles = 0;
+
+thread_local Profile_Thread_Buffer *profiler_thread_buffer = 0;
+thread_local Profile_Name_Cache_Entry profiler_name_cache[PROFILER_NAME_CACHE_SIZE];
 #endif
 
-void dump_profile_result() {
-	File file = os_file_open("google_trace.json", O_CREATE | O_WRITE);
+ogb_instance void
+profiler_init();
+
+// Cycles per second of rdtsc()
+ogb_instance float64
+get_tsc_frequency();
+
+// Interns the name, ids are stable for the whole program.
+ogb_instance u32
+profiler_get_name_id(string name);
+ogb_instance string
+profiler_get_name(u32 name_id);
+
+ogb_instance void
+profiler_write_json(String_Builder *builder);
+
+// Aggregates the events of all threads since the last call into the frame stats
+ogb_instance void
+profiler_end_frame();
+
+ogb_instance Profile_Frame_Stats
+profiler_get_frame_stats();
+// Oldest first, returns how many were written
+ogb_instance u64
+profiler_get_frame_times(float64 *seconds, u64 max_count);
+// False if the scope didn't run in the frame history
+ogb_instance bool
+profiler_get_scope_stats(string name, Profile_Scope_Stats *stats);
+// Sorted by average self time, highest first. Returns how many were written.
+ogb_instance u64
+profiler_get_top_scopes(Profile_Scope_Stats *stats, u64 max_count);
+ogb_instance bool
+profiler_get_counter_stats(string name, Profile_Counter_Stats *stats);
+// In the order they were first reported. Returns how many were written.
+ogb_instance u64
+profiler_get_counters(Profile_Counter_Stats *stats, u64 max_count);
+
+// Per scope totals of the tm_scope_hardware scopes still in the event buffers.
+// Returns false if there are none.
+ogb_instance bool
+profiler_write_hardware_counter_table(String_Builder *builder);
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
+void
+profiler_init() {
+	if (profiler_initted) return;
+
+	// #Sync
+	spinlock_acquire_or_wait(&_profiler_lock);
+	if (!profiler_initted) {
+		// Short calibration so we have something to go on right away, dump_profile_result()
+		// measures again over the whole run.
+		float64 seconds_start = os_get_current_time_in_seconds();
+		u64 cycles_start = rdtsc();
+		float64 seconds_end = seconds_start;
+		while (seconds_end-seconds_start < 0.01) seconds_end = os_get_current_time_in_seconds();
+		u64 cycles_end = rdtsc();
+
+		profiler_tsc_frequency = (float64)(cycles_end-cycles_start)/(seconds_end-seconds_start);
+		profiler_start_cycles = cycles_start;
+		profiler_start_seconds = seconds_start;
+
+		MEMORY_BARRIER;
+		profiler_initted = true;
+	}
+	spinlock_release(&_profiler_lock);
+}
+
+float64
+get_tsc_frequency() {
+	if (!profiler_initted) profiler_init();
+	return profiler_tsc_frequency;
+}
+
+u32
+profiler_get_name_id(string name) {
+	u32 id = string_intern(&profiler_names, name);
+	assert(id < PROFILER_NAME_MAX, "Too many profiler names (max %d)", PROFILER_NAME_MAX);
+	return id;
+}
+
+// For string literals, which we can tell apart by address alone.
+inline u32
+profiler_get_name_id_literal(const char *name) {
+	Profile_Name_Cache_Entry *cached = &profiler_name_cache[((u64)name >> 3) % PROFILER_NAME_CACHE_SIZE];
+	if (cached->literal == name) return cached->name_id;
+
+	u32 id = profiler_get_name_id(STR(name));
+	cached->literal = name;
+	cached->name_id = id;
+	return id;
+}
+
+string
+profiler_get_name(u32 name_id) {
+	return string_interner_get(&profiler_names, name_id);
+}
+
+Profile_Thread_Buffer *
+profiler_make_thread_buffer() {
+	if (!profiler_initted) profiler_init();
+
+	// Straight from the OS so profiling doesn't show up in heap stats or allocation tracking
+	u64 size = align_next(sizeof(Profile_Thread_Buffer)+PROFILER_EVENTS_PER_THREAD*sizeof(Profile_Event), os.page_size);
+	Profile_Thread_Buffer *buffer = (Profile_Thread_Buffer*)os_allocate_pages(size, OS_HUGE_PAGES_NONE, 0);
+	assert(buffer, "Failed allocating profiler buffer");
+
+	buffer->events = (Profile_Event*)(buffer+1);
+	buffer->write_index = 0;
+	buffer->thread_id = get_context().thread_id;
+
+	while (true) {
+		Profile_Thread_Buffer *head = profiler_thread_buffers;
+		buffer->next = head;
+		if (compare_and_swap_64((volatile u64*)&profiler_thread_buffers, (u64)buffer, (u64)head)) break;
+	}
+
+	profiler_thread_buffer = buffer;
+	return buffer;
+}
+
+inline void
+_profiler_push_event(u32 name_id, u32 kind, u64 start, u64 end) {
+	Profile_Thread_Buffer *buffer = profiler_thread_buffer;
+	if (!buffer) buffer = profiler_make_thread_buffer();
+
+	// Volatile so the compiler keeps these stores before the write_index store, which
+	// profiler_end_frame() on another thread relies on.
+	volatile Profile_Event *e = &buffer->events[buffer->write_index % PROFILER_EVENTS_PER_THREAD];
+	e->start = start;
+	e->end = end;
+	e->name_id = name_id;
+	e->kind = kind;
+	buffer->write_index += 1;
+}
+
+inline void
+_profiler_report_scope(const char *name, u64 start, u64 end) {
+	_profiler_push_event(profiler_get_name_id_literal(name), PROFILE_EVENT_SCOPE, start, end);
+}
+void
+_profiler_report_time_cycles(string name, u64 count, u64 start) {
+	_profiler_push_event(profiler_get_name_id(name), PROFILE_EVENT_SCOPE, start, start+count);
+}
+void
+_profiler_report_counter(string name, float64 value, u64 time) {
+	u64 value_bits;
+	memcpy(&value_bits, &value, sizeof(u64));
+	_profiler_push_event(profiler_get_name_id(name), PROFILE_EVENT_COUNTER, time, value_bits);
+}
+
+inline Profile_Hardware_Scope
+_profiler_begin_hardware_scope() {
+	Profile_Hardware_Scope scope = ZERO(Profile_Hardware_Scope);
+	scope.has_counters = os_read_hardware_counters(scope.counters);
+	scope.start_time = rdtsc();
+	return scope;
+}
+void
+_profiler_end_hardware_scope(const char *name, Profile_Hardware_Scope *scope) {
+	u64 end_time = rdtsc();
+	u64 counters[OS_HARDWARE_COUNTER_MAX];
+	bool has_counters = scope->has_counters && os_read_hardware_counters(counters);
+	scope->done = true;
 	
-	os_file_write_string(file, STR("["));
-	os_file_write_string(file, _profile_output.result);
-	os_file_write_string(file, STR("{}]"));
+	u32 name_id = profiler_get_name_id_literal(name);
+	_profiler_push_event(name_id, PROFILE_EVENT_SCOPE, scope->start_time, end_time);
+	if (has_counters) {
+		for (u64 i = 0; i < OS_HARDWARE_COUNTER_MAX; i++) counters[i] -= scope->counters[i];
+		_profiler_push_event(name_id, PROFILE_EVENT_HARDWARE_COUNTERS, counters[0], counters[1]);
+		_profiler_push_event(name_id, PROFILE_EVENT_HARDWARE_COUNTERS, counters[2], counters[3]);
+	}
+}
+
+// Reads the hardware counter events following the scope event at index i, if any.
+bool
+profiler_get_event_hardware_counters(Profile_Thread_Buffer *buffer, u64 i, u64 write_index, u64 counters[OS_HARDWARE_COUNTER_MAX]) {
+	if (i+2 >= write_index) return false;
+	Profile_Event a = buffer->events[(i+1) % PROFILER_EVENTS_PER_THREAD];
+	Profile_Event b = buffer->events[(i+2) % PROFILER_EVENTS_PER_THREAD];
+	Profile_Event e = buffer->events[i % PROFILER_EVENTS_PER_THREAD];
+	if (a.kind != PROFILE_EVENT_HARDWARE_COUNTERS || a.name_id != e.name_id) return false;
+	if (b.kind != PROFILE_EVENT_HARDWARE_COUNTERS || b.name_id != e.name_id) return false;
+	counters[0] = a.start;
+	counters[1] = a.end;
+	counters[2] = b.start;
+	counters[3] = b.end;
+	return true;
+}
+
+void
+profiler_write_json(String_Builder *builder) {
+	if (!profiler_initted) profiler_init();
+
+	// Longer baseline is a more precise frequency
+	float64 seconds = os_get_current_time_in_seconds();
+	u64 cycles = rdtsc();
+	if (seconds-profiler_start_seconds > 0.1) {
+		profiler_tsc_frequency = (float64)(cycles-profiler_start_cycles)/(seconds-profiler_start_seconds);
+	}
+	float64 microseconds_per_cycle = 1000000.0/profiler_tsc_frequency;
+
+	string_builder_append(builder, STR("["));
+
+	for (Profile_Thread_Buffer *buffer = profiler_thread_buffers; buffer; buffer = buffer->next) {
+		u64 write_index = buffer->write_index;
+		u64 first = write_index > PROFILER_EVENTS_PER_THREAD ? write_index-PROFILER_EVENTS_PER_THREAD : 0;
+		if (first > 0) {
+			log_warning("Profiler dropped the %llu oldest events on thread %llu, increase PROFILER_EVENTS_PER_THREAD to keep them", first, buffer->thread_id);
+		}
+
+		for (u64 i = first; i < write_index; i++) {
+			Profile_Event e = buffer->events[i % PROFILER_EVENTS_PER_THREAD];
+			string name = profiler_get_name(e.name_id);
+			float64 ts = (float64)(s64)(e.start-profiler_start_cycles)*microseconds_per_cycle;
+
+			if (e.kind == PROFILE_EVENT_COUNTER) {
+				float64 value;
+				memcpy(&value, &e.end, sizeof(float64));
+				string_builder_print(builder, STR("{\"cat\":\"counter\",\"name\":\"%s\",\"ph\":\"C\",\"pid\":0,\"tid\":%llu,\"ts\":%.3f,\"args\":{\"value\":%.3f}},"), name, buffer->thread_id, ts, value);
+			} else if (e.kind == PROFILE_EVENT_SCOPE) {
+				float64 dur = (float64)(e.end-e.start)*microseconds_per_cycle;
+				string_builder_print(builder, STR("{\"cat\":\"function\",\"dur\":%.3f,\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%llu,\"ts\":%.3f"), dur, name, buffer->thread_id, ts);
+				
+				u64 hw[OS_HARDWARE_COUNTER_MAX];
+				if (profiler_get_event_hardware_counters(buffer, i, write_index, hw)) {
+					float64 ipc = hw[OS_HARDWARE_COUNTER_CYCLES] ? (float64)hw[OS_HARDWARE_COUNTER_INSTRUCTIONS]/(float64)hw[OS_HARDWARE_COUNTER_CYCLES] : 0;
+					string_builder_print(builder, STR(",\"args\":{\"cycles\":%llu,\"instructions\":%llu,\"ipc\":%.3f,\"cache_misses\":%llu,\"branch_misses\":%llu}"),
+						hw[OS_HARDWARE_COUNTER_CYCLES], hw[OS_HARDWARE_COUNTER_INSTRUCTIONS], ipc,
+						hw[OS_HARDWARE_COUNTER_CACHE_MISSES], hw[OS_HARDWARE_COUNTER_BRANCH_MISSES]);
+					i += 2;
+				}
+				string_builder_append(builder, STR("},"));
+			}
+		}
+	}
+
+	string_builder_append(builder, STR("{}]"));
+}
+
+Profile_Frame_Name *
+profiler_get_frame_name(u32 name_id) {
+	Profile_Frame_Name *n = profiler_frame_names[name_id];
+	if (!n) {
+		// Straight from the OS, like the event buffers
+		u64 size = align_next(sizeof(Profile_Frame_Name), os.page_size);
+		n = (Profile_Frame_Name*)os_allocate_pages(size, OS_HUGE_PAGES_NONE, 0);
+		assert(n, "Failed allocating profiler frame stats");
+		n->first_frame = profiler_frame_count;
+		profiler_frame_names[name_id] = n;
+	}
+	return n;
+}
+
+void
+profiler_aggregate_thread_buffer(Profile_Thread_Buffer *buffer) {
+	u64 write_index = buffer->write_index;
+	u64 i = buffer->frame_read_index;
+	if (write_index-i > PROFILER_EVENTS_PER_THREAD) {
+		// The thread went around the whole ring since last frame so we lost some events
+		i = write_index-PROFILER_EVENTS_PER_THREAD;
+		buffer->scope_stack_count = 0;
+	}
 	
-	os_file_close(file);
+	for (; i < write_index; i++) {
+		Profile_Event e = buffer->events[i % PROFILER_EVENTS_PER_THREAD];
+		Profile_Frame_Name *n = profiler_get_frame_name(e.name_id);
+		
+		if (e.kind == PROFILE_EVENT_COUNTER) {
+			float64 value;
+			memcpy(&value, &e.end, sizeof(float64));
+			if (!n->has_counter_value || value > n->current.counter_value) {
+				n->current.counter_value = value;
+			}
+			n->has_counter_value = true;
+			n->is_counter = true;
+			continue;
+		}
+		if (e.kind == PROFILE_EVENT_HARDWARE_COUNTERS) continue;
+		
+		// Scopes are recorded when they end, so the scopes nested in this one are the ones
+		// on top of the stack that it contains. Nested scopes of those were already popped
+		// by them.
+		u64 duration = e.end-e.start;
+		u64 nested_cycles = 0;
+		while (buffer->scope_stack_count > 0) {
+			Profile_Scope_Interval top = buffer->scope_stack[buffer->scope_stack_count-1];
+			if (top.start < e.start || top.end > e.end) break;
+			nested_cycles += top.end-top.start;
+			buffer->scope_stack_count -= 1;
+		}
+		
+		if (buffer->scope_stack_count == PROFILER_SCOPE_STACK_MAX) {
+			// Top level scopes are never popped, forget the older half of the stack.
+			const u64 keep = PROFILER_SCOPE_STACK_MAX/2;
+			memmove(buffer->scope_stack, buffer->scope_stack+PROFILER_SCOPE_STACK_MAX-keep, keep*sizeof(Profile_Scope_Interval));
+			buffer->scope_stack_count = keep;
+		}
+		buffer->scope_stack[buffer->scope_stack_count] = (Profile_Scope_Interval){e.start, e.end};
+		buffer->scope_stack_count += 1;
+		
+		n->current.total_cycles += duration;
+		n->current.self_cycles  += duration-min(nested_cycles, duration);
+		n->current.calls        += 1;
+	}
 	
-	log_verbose("Wrote profiling result to google_trace.json");
+	buffer->frame_read_index = write_index;
 }
-void _profiler_report_time_cycles(string name, u64 count, u64 start) {
-	if (!profiler_initted) {
-		spinlock_init(&_profiler_lock);
-		profiler_initted = true;
+
+void
+profiler_end_frame() {
+	if (!profiler_initted) profiler_init();
+	
+	u64 now = rdtsc();
+	
+	for (Profile_Thread_Buffer *buffer = profiler_thread_buffers; buffer; buffer = buffer->next) {
+		profiler_aggregate_thread_buffer(buffer);
+	}
+	
+	u64 slot = profiler_frame_count % PROFILER_FRAME_HISTORY;
+	u64 last_slot = (profiler_frame_count+PROFILER_FRAME_HISTORY-1) % PROFILER_FRAME_HISTORY;
+	
+	u64 last_frame_cycles = profiler_last_frame_cycles ? profiler_last_frame_cycles : profiler_start_cycles;
+	profiler_frame_seconds[slot] = (float64)(now-last_frame_cycles)/profiler_tsc_frequency;
+	
+	u64 name_count = profiler_names.count;
+	for (u64 id = 0; id < name_count; id++) {
+		Profile_Frame_Name *n = profiler_frame_names[id];
+		if (!n) continue;
 		
-		string_builder_init_reserve(&_profile_output, 1024*1000, get_heap_allocator());	
+		if (n->is_counter && !n->has_counter_value && profiler_frame_count > n->first_frame) {
+			n->current.counter_value = n->history[last_slot].counter_value;
+		}
+		n->history[slot] = n->current;
+		n->current = (Profile_Frame_Sample){0};
+		n->has_counter_value = false;
+	}
+	
+	profiler_last_frame_cycles = now;
+	profiler_frame_count += 1;
+}
+
+Profile_Frame_Stats
+profiler_get_frame_stats() {
+	Profile_Frame_Stats stats = ZERO(Profile_Frame_Stats);
+	stats.frame_count = profiler_frame_count;
+	stats.history_count = min(profiler_frame_count, PROFILER_FRAME_HISTORY);
+	if (stats.history_count == 0) return stats;
+	
+	stats.frame_seconds = profiler_frame_seconds[(profiler_frame_count-1) % PROFILER_FRAME_HISTORY];
+	stats.min_frame_seconds = stats.frame_seconds;
+	float64 sum = 0;
+	for (u64 i = 0; i < stats.history_count; i++) {
+		float64 seconds = profiler_frame_seconds[i];
+		sum += seconds;
+		stats.min_frame_seconds = min(stats.min_frame_seconds, seconds);
+		stats.max_frame_seconds = max(stats.max_frame_seconds, seconds);
+	}
+	stats.average_frame_seconds = sum/(float64)stats.history_count;
+	return stats;
+}
+
+u64
+profiler_get_frame_times(float64 *seconds, u64 max_count) {
+	u64 count = min(min(profiler_frame_count, PROFILER_FRAME_HISTORY), max_count);
+	for (u64 i = 0; i < count; i++) {
+		seconds[i] = profiler_frame_seconds[(profiler_frame_count-count+i) % PROFILER_FRAME_HISTORY];
+	}
+	return count;
+}
+
+// Frames in the history which the name was around for
+u64
+profiler_get_frame_name_history_count(Profile_Frame_Name *n) {
+	if (profiler_frame_count <= n->first_frame) return 0;
+	return min(profiler_frame_count-n->first_frame, PROFILER_FRAME_HISTORY);
+}
+
+bool
+profiler_make_scope_stats(u32 name_id, Profile_Scope_Stats *stats) {
+	Profile_Frame_Name *n = profiler_frame_names[name_id];
+	if (!n || n->is_counter) return false;
+	u64 history_count = profiler_get_frame_name_history_count(n);
+	if (history_count == 0) return false;
+	
+	float64 seconds_per_cycle = 1.0/profiler_tsc_frequency;
+	
+	*stats = ZERO(Profile_Scope_Stats);
+	stats->name = profiler_get_name(name_id);
+	
+	Profile_Frame_Sample last = n->history[(profiler_frame_count-1) % PROFILER_FRAME_HISTORY];
+	stats->total_seconds = (float64)last.total_cycles*seconds_per_cycle;
+	stats->self_seconds  = (float64)last.self_cycles*seconds_per_cycle;
+	stats->calls         = last.calls;
+	
+	u64 total_sum = 0;
+	u64 self_sum = 0;
+	u64 calls_sum = 0;
+	u64 max_total = 0;
+	for (u64 i = 0; i < history_count; i++) {
+		Profile_Frame_Sample s = n->history[(profiler_frame_count-1-i) % PROFILER_FRAME_HISTORY];
+		total_sum += s.total_cycles;
+		self_sum  += s.self_cycles;
+		calls_sum += s.calls;
+		max_total = max(max_total, s.total_cycles);
+	}
+	stats->average_total_seconds = (float64)total_sum*seconds_per_cycle/(float64)history_count;
+	stats->average_self_seconds  = (float64)self_sum*seconds_per_cycle/(float64)history_count;
+	stats->average_calls         = (float64)calls_sum/(float64)history_count;
+	stats->max_total_seconds     = (float64)max_total*seconds_per_cycle;
+	
+	return calls_sum > 0;
+}
+
+bool
+profiler_make_counter_stats(u32 name_id, Profile_Counter_Stats *stats) {
+	Profile_Frame_Name *n = profiler_frame_names[name_id];
+	if (!n || !n->is_counter) return false;
+	u64 history_count = profiler_get_frame_name_history_count(n);
+	if (history_count == 0) return false;
+	
+	*stats = ZERO(Profile_Counter_Stats);
+	stats->name  = profiler_get_name(name_id);
+	stats->value = n->history[(profiler_frame_count-1) % PROFILER_FRAME_HISTORY].counter_value;
+	stats->min   = stats->value;
+	stats->max   = stats->value;
+	
+	float64 sum = 0;
+	for (u64 i = 0; i < history_count; i++) {
+		float64 value = n->history[(profiler_frame_count-1-i) % PROFILER_FRAME_HISTORY].counter_value;
+		sum += value;
+		stats->min = min(stats->min, value);
+		stats->max = max(stats->max, value);
+	}
+	stats->average = sum/(float64)history_count;
+	
+	return true;
+}
+
+bool
+profiler_get_scope_stats(string name, Profile_Scope_Stats *stats) {
+	u32 name_id;
+	if (!string_interner_find(&profiler_names, name, &name_id)) return false;
+	return profiler_make_scope_stats(name_id, stats);
+}
+
+u64
+profiler_get_top_scopes(Profile_Scope_Stats *stats, u64 max_count) {
+	u64 count = 0;
+	u64 name_count = profiler_names.count;
+	for (u64 id = 0; id < name_count; id++) {
+		Profile_Scope_Stats s;
+		if (!profiler_make_scope_stats((u32)id, &s)) continue;
 		
+		// Insertion sort, max_count is expected to be a handful
+		u64 i = count;
+		while (i > 0 && stats[i-1].average_self_seconds < s.average_self_seconds) {
+			if (i < max_count) stats[i] = stats[i-1];
+			i -= 1;
+		}
+		if (i < max_count) stats[i] = s;
+		if (count < max_count) count += 1;
+	}
+	return count;
+}
+
+bool
+profiler_get_counter_stats(string name, Profile_Counter_Stats *stats) {
+	u32 name_id;
+	if (!string_interner_find(&profiler_names, name, &name_id)) return false;
+	return profiler_make_counter_stats(name_id, stats);
+}
+
+u64
+profiler_get_counters(Profile_Counter_Stats *stats, u64 max_count) {
+	u64 count = 0;
+	u64 name_count = profiler_names.count;
+	for (u64 id = 0; id < name_count && count < max_count; id++) {
+		if (profiler_make_counter_stats((u32)id, &stats[count])) count += 1;
 	}
+	return count;
+}
+
+bool
+profiler_write_hardware_counter_table(String_Builder *builder) {
+	if (!profiler_initted) profiler_init();
+
+	typedef struct Hardware_Totals {
+		u64 calls;
+		u64 time_cycles;
+		u64 counters[OS_HARDWARE_COUNTER_MAX];
+	} Hardware_Totals;
 	
-	spinlock_acquire_or_wait(&_profiler_lock);
+	u64 name_count = profiler_names.count;
+	Hardware_Totals *totals = (Hardware_Totals*)alloc(get_heap_allocator(), name_count*sizeof(Hardware_Totals));
+	memset(totals, 0, name_count*sizeof(Hardware_Totals));
 	
-	string fmt = STR("{\"cat\":\"function\",\"dur\":%.3f,\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%zu,\"ts\":%lld},");
-	string_builder_print(&_profile_output, fmt, (float64)count*1000, name, get_context().thread_id, start*1000);
+	bool any = false;
+	for (Profile_Thread_Buffer *buffer = profiler_thread_buffers; buffer; buffer = buffer->next) {
+		u64 write_index = buffer->write_index;
+		u64 first = write_index > PROFILER_EVENTS_PER_THREAD ? write_index-PROFILER_EVENTS_PER_THREAD : 0;
+		for (u64 i = first; i < write_index; i++) {
+			Profile_Event e = buffer->events[i % PROFILER_EVENTS_PER_THREAD];
+			u64 hw[OS_HARDWARE_COUNTER_MAX];
+			if (e.kind != PROFILE_EVENT_SCOPE || e.name_id >= name_count) continue;
+			if (!profiler_get_event_hardware_counters(buffer, i, write_index, hw)) continue;
+			
+			Hardware_Totals *t = &totals[e.name_id];
+			t->calls += 1;
+			t->time_cycles += e.end-e.start;
+			for (u64 j = 0; j < OS_HARDWARE_COUNTER_MAX; j++) t->counters[j] += hw[j];
+			any = true;
+			i += 2;
+		}
+	}
 	
-	spinlock_release(&_profiler_lock);
+	if (any) {
+		Cpu_Capabilities cpu = query_cpu_capabilities();
+		string_builder_print(builder, STR("Hardware counters per call (CPU:%cs%cs%cs%cs%cs)\n"),
+			cpu.sse2 ? " sse2" : "", cpu.sse42 ? " sse4.2" : "", cpu.avx ? " avx" : "",
+			cpu.avx2 ? " avx2" : "", cpu.avx512 ? " avx512" : "");
+		string_builder_append(builder, STR("Scope                               Calls         us       Cycles Instructions    IPC   LLC misses    Br misses\n"));
+		
+		float64 microseconds_per_cycle = 1000000.0/profiler_tsc_frequency;
+		for (u64 id = 0; id < name_count; id++) {
+			Hardware_Totals t = totals[id];
+			if (!t.calls) continue;
+			float64 calls = (float64)t.calls;
+			float64 ipc = t.counters[OS_HARDWARE_COUNTER_CYCLES] ? (float64)t.counters[OS_HARDWARE_COUNTER_INSTRUCTIONS]/(float64)t.counters[OS_HARDWARE_COUNTER_CYCLES] : 0;
+			// Our formatting doesn't pad strings
+			string name = profiler_get_name(id);
+			string_builder_append(builder, name);
+			for (u64 i = name.count; i < 32; i++) string_builder_append(builder, STR(" "));
+			string_builder_print(builder, STR(" %8llu %10.3f %12.0f %12.0f %6.2f %12.1f %12.1f\n"),
+				t.calls,
+				(float64)t.time_cycles*microseconds_per_cycle/calls,
+				(float64)t.counters[OS_HARDWARE_COUNTER_CYCLES]/calls,
+				(float64)t.counters[OS_HARDWARE_COUNTER_INSTRUCTIONS]/calls,
+				ipc,
+				(float64)t.counters[OS_HARDWARE_COUNTER_CACHE_MISSES]/calls,
+				(float64)t.counters[OS_HARDWARE_COUNTER_BRANCH_MISSES]/calls);
+		}
+	}
+	
+	dealloc(get_heap_allocator(), totals);
+	return any;
+}
+
+void dump_profile_result() {
+	String_Builder builder;
+	string_builder_init_reserve(&builder, 1024*1000, get_heap_allocator());
+
+	profiler_write_json(&builder);
+
+	File file = os_file_open("google_trace.json", O_CREATE | O_WRITE);
+	os_file_write_string(file, builder.result);
+	os_file_close(file);
+
+	dealloc(builder.allocator, builder.buffer);
+
+	log_verbose("Wrote profiling result to google_trace.json");
+	
+	String_Builder table;
+	string_builder_init(&table, get_heap_allocator());
+	if (profiler_write_hardware_counter_table(&table)) log_info("%s", table.result);
+	dealloc(table.allocator, table.buffer);
 }
+
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
+// tm_scope names must be string literals, we look up their name ids by address.
 #if ENABLE_PROFILING
+#define tm_counter(name, value) _profiler_report_counter(STR(name), (float64)(value), rdtsc())
 #define tm_scope(name) \
     for (u64 start_time = rdtsc(), end_time = start_time, elapsed_time = 0; \
          elapsed_time == 0; \
-         elapsed_time = (end_time = rdtsc()) - start_time, _profiler_report_time_cycles(STR(name), elapsed_time, start_time))
+         elapsed_time = (end_time = rdtsc()) - start_time, _profiler_report_scope(name, start_time, end_time))
+#define tm_scope_hardware(name) \
+    for (Profile_Hardware_Scope _hardware_scope = _profiler_begin_hardware_scope(); \
+         !_hardware_scope.done; \
+         _profiler_end_hardware_scope(name, &_hardware_scope))
 #define tm_scope_var(name, var) \
     for (u64 start_time = rdtsc(), end_time = start_time, elapsed_time = 0; \
          elapsed_time == 0; \
@@ -52,7 +770,9 @@ void _profiler_report_time_cycles(string name, u64 count, u64 start) {
          elapsed_time == 0; \
          elapsed_time = (end_time = rdtsc()) - start_time, var+=elapsed_time)
 #else
+	#define tm_counter(...)
 	#define tm_scope(...)
+	#define tm_scope_hardware(...)
 	#define tm_scope_var(...)
 	#define tm_scope_accum(...)
-#endif
\ No newline at end of file
+#endif
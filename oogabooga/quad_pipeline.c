@@ -0,0 +1,507 @@
+
+/*
+
+	The CPU side of rendering a draw frame, shared by the renderers:
+	z sorting, expanding quads to vertices & batching by texture.
+
+	void quad_pipeline_process(Quad_Pipeline *p, Draw_Frame *frame, Draw_Quad *quads, s32 window_width, s32 window_height);
+
+	After processing, p->vertices has 6 vertices per quad and p->batches says which textures
+	to bind for which range of quads. The renderer uploads the vertices and makes one draw
+	call per batch.
+
+	Draw frame capture:
+
+	A frame can be captured to a file and replayed through the pipeline offline, for example
+	to profile or try out batching strategies on Linux with real frames from a game.
+
+	void capture_next_draw_frame(string path); // Written on the next gfx_update()
+	bool draw_frame_capture_write(string path, Draw_Frame *frame, Draw_Quad *quads, s32 window_width, s32 window_height);
+	bool draw_frame_capture_load(string path, Draw_Frame_Capture *capture, Allocator allocator);
+	void draw_frame_capture_replay(Draw_Frame_Capture *capture, Quad_Pipeline *p);
+	void draw_frame_capture_destroy(Draw_Frame_Capture *capture);
+
+	Images are captured as their size only, there's no CPU copy of the pixels to capture and
+	the pipeline doesn't need them.
+
+	build_benchmarks.c takes --draw-frame <path> to benchmark replaying a capture.
+
+*/
+
+#define QUAD_BATCH_MAX_TEXTURES 32
+
+// We wanna pack this at some point
+// #Volatile reflected in 2D batch shader & renderer vertex layouts
+// #Cleanup #Memory why am I doing alignat(16)?
+typedef struct alignat(16) Quad_Vertex {
+
+	Vector4 color;
+	Vector4 position;
+	Vector2 uv;
+	Vector2 self_uv;
+	s8 texture_index;
+	u8 type;
+	u8 sampler;
+	u8 has_scissor;
+
+	Vector4 userdata[VERTEX_2D_USER_DATA_COUNT];
+
+	Vector4 scissor;
+
+} Quad_Vertex;
+
+typedef struct Quad_Batch {
+	u64 first_quad;
+	u64 quad_count;
+	Gfx_Handle textures[QUAD_BATCH_MAX_TEXTURES];
+	u64 texture_count;
+	bool is_texture_flush; // Started because the last batch ran out of texture slots
+} Quad_Batch;
+
+typedef struct Quad_Pipeline {
+	Quad_Vertex *vertices; // 6 per quad
+	u64 quad_count;
+	u64 quad_capacity;
+
+	Quad_Batch *batches; // growing array
+
+	Draw_Quad *sort_buffer;
+	u64 sort_buffer_count;
+
+	u64 texture_flushes;
+} Quad_Pipeline;
+
+void
+quad_pipeline_reserve(Quad_Pipeline *p, u64 quad_count) {
+	if (!p->batches) {
+		growing_array_init_reserve((void**)&p->batches, sizeof(Quad_Batch), 8, get_heap_allocator());
+	}
+	if (p->quad_capacity >= quad_count) return;
+
+	// #Memory #Heapalloc
+	if (p->vertices) dealloc(get_heap_allocator(), p->vertices);
+	p->vertices = (Quad_Vertex*)alloc(get_heap_allocator(), quad_count*6*sizeof(Quad_Vertex));
+	assert((u64)p->vertices%16 == 0);
+	p->quad_capacity = quad_count;
+}
+
+void
+quad_pipeline_destroy(Quad_Pipeline *p) {
+	if (p->vertices) dealloc(get_heap_allocator(), p->vertices);
+	if (p->sort_buffer) dealloc(get_heap_allocator(), p->sort_buffer);
+	if (p->batches) growing_array_deinit((void**)&p->batches);
+	*p = ZERO(Quad_Pipeline);
+}
+
+Quad_Batch *
+quad_pipeline_push_batch(Quad_Pipeline *p, bool is_texture_flush) {
+	Quad_Batch *batch = (Quad_Batch*)growing_array_add_empty((void**)&p->batches);
+	*batch = ZERO(Quad_Batch);
+	batch->first_quad = p->quad_count;
+	batch->is_texture_flush = is_texture_flush;
+	return batch;
+}
+
+// z is in [-MAX_Z+1, MAX_Z], offset to be unsigned the top byte is always 0 and that pass is skipped
+#define _quad_sort_key(q) ((u32)((q).z + MAX_Z))
+define_radix_sort(_quad_pipeline_sort_by_z, Draw_Quad, u32, _quad_sort_key);
+
+// Sorts & expands quads (in place, quads are modified) into p->vertices and p->batches.
+void
+quad_pipeline_process(Quad_Pipeline *p, Draw_Frame *frame, Draw_Quad *quads, s32 window_width, s32 window_height) {
+
+	quad_pipeline_reserve(p, max(frame->num_quads, allocated_quads));
+	growing_array_clear((void**)&p->batches);
+	p->quad_count = 0;
+	p->texture_flushes = 0;
+
+	if (frame->num_quads == 0) return;
+
+	if (frame->enable_z_sorting) tm_scope("Z sorting") {
+		if (p->sort_buffer_count < frame->num_quads) {
+			// #Memory #Heapalloc
+			if (p->sort_buffer) dealloc(get_heap_allocator(), p->sort_buffer);
+			p->sort_buffer_count = max(frame->num_quads, allocated_quads);
+			p->sort_buffer = (Draw_Quad*)alloc(get_heap_allocator(), p->sort_buffer_count*sizeof(Draw_Quad));
+		}
+		// Stable, so quads with the same z keep the order they were drawn in
+		_quad_pipeline_sort_by_z(quads, p->sort_buffer, frame->num_quads);
+	}
+
+	Quad_Batch *batch = quad_pipeline_push_batch(p, false);
+
+	Gfx_Handle last_texture = 0;
+	s8 last_texture_index = 0;
+
+	Quad_Vertex* pointer = p->vertices;
+
+	for (u64 i = 0; i < frame->num_quads; i++)  {
+
+		Draw_Quad *q = &quads[i];
+
+		assert(q->z <= MAX_Z, "Z is too high. Z is %d, Max is %d.", q->z, MAX_Z);
+		assert(q->z >= (-MAX_Z+1), "Z is too low. Z is %d, Min is %d.", q->z, -MAX_Z+1);
+
+		s8 texture_index = -1;
+
+		if (q->image) {
+
+			if (last_texture == q->image->gfx_handle) {
+				texture_index = last_texture_index;
+			} else {
+				// First look if texture is already bound
+				for (u64 j = 0; j < batch->texture_count; j++) {
+					if (batch->textures[j] == q->image->gfx_handle) {
+						texture_index = (s8)j;
+						break;
+					}
+				}
+				// Otherwise use a new slot
+				if (texture_index <= -1) {
+					if (batch->texture_count >= QUAD_BATCH_MAX_TEXTURES) {
+						// If max textures reached, the renderer needs to make a draw call and start over
+						batch->quad_count = p->quad_count-batch->first_quad;
+						batch = quad_pipeline_push_batch(p, true);
+						p->texture_flushes += 1;
+						texture_index = 0;
+						batch->texture_count = 1;
+					} else {
+						texture_index = (s8)batch->texture_count;
+						batch->texture_count += 1;
+					}
+				}
+			}
+			batch->textures[texture_index] = q->image->gfx_handle;
+			last_texture = q->image->gfx_handle;
+			last_texture_index = texture_index;
+		}
+
+		if (q->type == QUAD_TYPE_TEXT) {
+
+		    // This is meant to fix the annoying artifacts that shows up when sampling text from an atlas
+		    // presumably for floating point precision issues or something.
+
+		    // #Incomplete
+		    // If we want to animate text with small movements then it will look wonky.
+		    // This should be optional probably.
+		    // Also, we might want to do this on non-text if rendering with linear filtering
+		    // from a large texture atlas.
+
+			float pixel_width = 2.0/(float)window_width;
+			float pixel_height = 2.0/(float)window_height;
+
+			q->bottom_left.x  = round(q->bottom_left.x  / pixel_width)  * pixel_width;
+		    q->bottom_left.y  = round(q->bottom_left.y  / pixel_height) * pixel_height;
+		    q->top_left.x     = round(q->top_left.x     / pixel_width)  * pixel_width;
+		    q->top_left.y     = round(q->top_left.y     / pixel_height) * pixel_height;
+		    q->top_right.x    = round(q->top_right.x    / pixel_width)  * pixel_width;
+		    q->top_right.y    = round(q->top_right.y    / pixel_height) * pixel_height;
+		    q->bottom_right.x = round(q->bottom_right.x / pixel_width)  * pixel_width;
+		    q->bottom_right.y = round(q->bottom_right.y / pixel_height) * pixel_height;
+		}
+
+		// We will write to 6 vertices for the one quad (two tris)
+		 {
+
+			Quad_Vertex* BL  = pointer + 0;
+			Quad_Vertex* TL  = pointer + 1;
+			Quad_Vertex* TR  = pointer + 2;
+			Quad_Vertex* BL2 = pointer + 3;
+			Quad_Vertex* TR2 = pointer + 4;
+			Quad_Vertex* BR  = pointer + 5;
+			pointer += 6;
+
+			BL->position = v4(q->bottom_left.x,  q->bottom_left.y,  0, 1);
+			TL->position = v4(q->top_left.x,     q->top_left.y,     0, 1);
+			TR->position = v4(q->top_right.x,    q->top_right.y,    0, 1);
+			BR->position = v4(q->bottom_right.x, q->bottom_right.y, 0, 1);
+
+
+			if (q->image) {
+
+				BL->uv = v2(q->uv.x1, q->uv.y1);
+				TL->uv = v2(q->uv.x1, q->uv.y2);
+				TR->uv = v2(q->uv.x2, q->uv.y2);
+				BR->uv = v2(q->uv.x2, q->uv.y1);
+				// #Hack #Bug #Cleanup
+				// When a window dimension is uneven it slightly under/oversamples on an axis by a
+				// seemingly arbitrary amount. The 0.25 is a magic value I got from trial and error.
+				// (It undersamples by a fourth of the atlas texture?)
+				// Anything > 0.25 < will slightly over/undersample on my machine.
+				// I have no idea about #Portability here.
+				// - Charlie M 26th July 2024
+				if (window_width % 2 != 0) {
+					BL->uv.x += (2.0/(float)q->image->width)*0.25;
+					TL->uv.x += (2.0/(float)q->image->width)*0.25;
+					TR->uv.x += (2.0/(float)q->image->width)*0.25;
+					BR->uv.x += (2.0/(float)q->image->width)*0.25;
+				}
+				if (window_height % 2 != 0) {
+					BL->uv.y -= (2.0/(float)q->image->height)*0.25;
+					TL->uv.y -= (2.0/(float)q->image->height)*0.25;
+					TR->uv.y -= (2.0/(float)q->image->height)*0.25;
+					BR->uv.y -= (2.0/(float)q->image->height)*0.25;
+				}
+
+				u8 sampler = -1;
+				if (q->image_min_filter == GFX_FILTER_MODE_NEAREST
+							&& q->image_mag_filter == GFX_FILTER_MODE_NEAREST)
+						sampler = 0;
+				if (q->image_min_filter == GFX_FILTER_MODE_LINEAR
+							&& q->image_mag_filter == GFX_FILTER_MODE_LINEAR)
+						sampler = 1;
+				if (q->image_min_filter == GFX_FILTER_MODE_LINEAR
+							&& q->image_mag_filter == GFX_FILTER_MODE_NEAREST)
+						sampler = 2;
+				if (q->image_min_filter == GFX_FILTER_MODE_NEAREST
+							&& q->image_mag_filter == GFX_FILTER_MODE_LINEAR)
+						sampler = 3;
+				BL->sampler=TL->sampler=TR->sampler=BR->sampler = (u8)sampler;
+
+			}
+			BL->texture_index=TL->texture_index=TR->texture_index=BR->texture_index = texture_index;
+
+			BL->self_uv = v2(0, 0);
+			TL->self_uv = v2(0, 1);
+			TR->self_uv = v2(1, 1);
+			BR->self_uv = v2(1, 0);
+
+			// #Speed
+			memcpy(BL->userdata, q->userdata, sizeof(q->userdata));
+			memcpy(TL->userdata, q->userdata, sizeof(q->userdata));
+			memcpy(TR->userdata, q->userdata, sizeof(q->userdata));
+			memcpy(BR->userdata, q->userdata, sizeof(q->userdata));
+
+			BL->color = TL->color = TR->color = BR->color = q->color;
+
+			BL->type=TL->type=TR->type=BR->type = (u8)q->type;
+
+			float t = q->scissor.y1;
+			q->scissor.y1 = q->scissor.y2;
+			q->scissor.y2 = t;
+
+			q->scissor.y1 = window_height - q->scissor.y1;
+			q->scissor.y2 = window_height - q->scissor.y2;
+
+			BL->has_scissor=TL->has_scissor=TR->has_scissor=BR->has_scissor = q->has_scissor;
+			BL->scissor=TL->scissor=TR->scissor=BR->scissor = q->scissor;
+
+			*BL2 = *BL;
+			*TR2 = *TR;
+
+			p->quad_count += 1;
+		}
+	}
+
+	batch->quad_count = p->quad_count-batch->first_quad;
+}
+
+///
+///
+// Draw frame capture
+//
+
+#define DRAW_FRAME_CAPTURE_MAGIC   0x46444f47 // "GODF"
+#define DRAW_FRAME_CAPTURE_VERSION 1
+
+typedef struct Draw_Frame_Capture_Header {
+	u32 magic;
+	u32 version;
+	u32 quad_size; // sizeof(Draw_Quad), which depends on VERTEX_2D_USER_DATA_COUNT
+	s32 window_width;
+	s32 window_height;
+	u32 enable_z_sorting;
+	u64 quad_count;
+	u64 image_count;
+	Matrix4 projection;
+	Matrix4 view;
+	// Followed by image_count * Draw_Frame_Capture_Image, then quad_count * Draw_Quad with
+	// Draw_Quad.image replaced by image index+1 (or 0)
+} Draw_Frame_Capture_Header;
+
+typedef struct Draw_Frame_Capture_Image {
+	u32 width, height, channels;
+} Draw_Frame_Capture_Image;
+
+typedef struct Draw_Frame_Capture {
+	s32 window_width;
+	s32 window_height;
+	Draw_Frame frame;
+	Draw_Quad *quads; // Image pointers point into images
+	Gfx_Image *images;
+	u64 image_count;
+
+	Draw_Quad *scratch_quads; // Replays work on a copy since the pipeline modifies the quads
+	Allocator allocator;
+} Draw_Frame_Capture;
+
+// #Global
+ogb_instance string draw_frame_capture_next_path;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+string draw_frame_capture_next_path = {0};
+#endif
+
+bool
+draw_frame_capture_write(string path, Draw_Frame *frame, Draw_Quad *quads, s32 window_width, s32 window_height) {
+	Allocator heap = get_heap_allocator();
+
+	Hash_Table image_indices = make_hash_table(Gfx_Image*, u64, heap);
+	Gfx_Image **images;
+	growing_array_init((void**)&images, sizeof(Gfx_Image*), heap);
+
+	Draw_Quad *out_quads = (Draw_Quad*)alloc(heap, max(frame->num_quads, 1)*sizeof(Draw_Quad));
+	for (u64 i = 0; i < frame->num_quads; i++) {
+		Draw_Quad q = quads[i];
+		if (q.image) {
+			u64 *found = (u64*)hash_table_find(&image_indices, q.image);
+			u64 index;
+			if (found) {
+				index = *found;
+			} else {
+				index = growing_array_get_valid_count(images);
+				growing_array_add((void**)&images, &q.image);
+				hash_table_add(&image_indices, q.image, index);
+			}
+			q.image = (Gfx_Image*)(index+1);
+		}
+		out_quads[i] = q;
+	}
+
+	Draw_Frame_Capture_Header header = ZERO(Draw_Frame_Capture_Header);
+	header.magic = DRAW_FRAME_CAPTURE_MAGIC;
+	header.version = DRAW_FRAME_CAPTURE_VERSION;
+	header.quad_size = sizeof(Draw_Quad);
+	header.window_width = window_width;
+	header.window_height = window_height;
+	header.enable_z_sorting = frame->enable_z_sorting;
+	header.quad_count = frame->num_quads;
+	header.image_count = growing_array_get_valid_count(images);
+	header.projection = frame->projection;
+	header.view = frame->view;
+
+	bool ok = false;
+	File file = os_file_open(path, O_CREATE | O_WRITE);
+	if (file != OS_INVALID_FILE) {
+		ok = os_file_write_bytes(file, &header, sizeof(header));
+		for (u64 i = 0; ok && i < header.image_count; i++) {
+			Draw_Frame_Capture_Image image = {images[i]->width, images[i]->height, images[i]->channels};
+			ok = os_file_write_bytes(file, &image, sizeof(image));
+		}
+		if (ok) ok = os_file_write_bytes(file, out_quads, header.quad_count*sizeof(Draw_Quad));
+		os_file_close(file);
+	}
+
+	if (ok) {
+		log_info("Captured draw frame with %llu quads & %llu images to '%s'", header.quad_count, header.image_count, path);
+	} else {
+		log_error("Failed writing draw frame capture to '%s'", path);
+	}
+
+	dealloc(heap, out_quads);
+	growing_array_deinit((void**)&images);
+	hash_table_destroy(&image_indices);
+
+	return ok;
+}
+
+// The frame is written when the renderer processes the next draw frame
+void
+capture_next_draw_frame(string path) {
+	draw_frame_capture_next_path = path;
+}
+
+// Called by renderers at the start of gfx_update()
+void
+draw_frame_capture_update() {
+	if (!draw_frame_capture_next_path.count) return;
+	draw_frame_capture_write(draw_frame_capture_next_path, &draw_frame, quad_buffer, window.width, window.height);
+	draw_frame_capture_next_path = ZERO(string);
+}
+
+void
+draw_frame_capture_destroy(Draw_Frame_Capture *capture) {
+	if (capture->images)        dealloc(capture->allocator, capture->images);
+	if (capture->quads)         dealloc(capture->allocator, capture->quads);
+	if (capture->scratch_quads) dealloc(capture->allocator, capture->scratch_quads);
+	*capture = ZERO(Draw_Frame_Capture);
+}
+
+bool
+draw_frame_capture_load(string path, Draw_Frame_Capture *capture, Allocator allocator) {
+	*capture = ZERO(Draw_Frame_Capture);
+
+	string data;
+	if (!os_read_entire_file(path, &data, allocator)) {
+		log_error("Could not read draw frame capture '%s'", path);
+		return false;
+	}
+
+	Draw_Frame_Capture_Header *header = (Draw_Frame_Capture_Header*)data.data;
+	if (data.count < sizeof(Draw_Frame_Capture_Header)
+			|| header->magic != DRAW_FRAME_CAPTURE_MAGIC
+			|| header->version != DRAW_FRAME_CAPTURE_VERSION) {
+		log_error("'%s' is not a draw frame capture (or it's from another version)", path);
+		dealloc_string(allocator, data);
+		return false;
+	}
+	if (header->quad_size != sizeof(Draw_Quad)) {
+		log_error("Draw frame capture '%s' has quads of %u bytes but ours are %llu. Is VERTEX_2D_USER_DATA_COUNT the same?", path, header->quad_size, sizeof(Draw_Quad));
+		dealloc_string(allocator, data);
+		return false;
+	}
+	u64 expected_size = sizeof(Draw_Frame_Capture_Header)
+		+ header->image_count*sizeof(Draw_Frame_Capture_Image)
+		+ header->quad_count*sizeof(Draw_Quad);
+	if (data.count != expected_size) {
+		log_error("Draw frame capture '%s' is truncated or corrupt", path);
+		dealloc_string(allocator, data);
+		return false;
+	}
+
+	capture->allocator = allocator;
+	capture->window_width = header->window_width;
+	capture->window_height = header->window_height;
+	capture->frame.num_quads = header->quad_count;
+	capture->frame.enable_z_sorting = header->enable_z_sorting != 0;
+	capture->frame.projection = header->projection;
+	capture->frame.view = header->view;
+
+	// Images don't need to be real gfx images, the pipeline only needs a unique handle & size
+	capture->image_count = header->image_count;
+	capture->images = (Gfx_Image*)alloc(allocator, max(header->image_count, 1)*sizeof(Gfx_Image));
+	Draw_Frame_Capture_Image *images = (Draw_Frame_Capture_Image*)(header+1);
+	for (u64 i = 0; i < header->image_count; i++) {
+		Gfx_Image *image = &capture->images[i];
+		image->width = images[i].width;
+		image->height = images[i].height;
+		image->channels = images[i].channels;
+		image->gfx_handle = (Gfx_Handle)image;
+		image->allocator = allocator;
+	}
+
+	capture->quads = (Draw_Quad*)alloc(allocator, max(header->quad_count, 1)*sizeof(Draw_Quad));
+	capture->scratch_quads = (Draw_Quad*)alloc(allocator, max(header->quad_count, 1)*sizeof(Draw_Quad));
+	memcpy(capture->quads, images+header->image_count, header->quad_count*sizeof(Draw_Quad));
+	for (u64 i = 0; i < header->quad_count; i++) {
+		u64 index = (u64)capture->quads[i].image;
+		if (index > header->image_count) {
+			log_error("Draw frame capture '%s' has a quad with an invalid image", path);
+			dealloc_string(allocator, data);
+			draw_frame_capture_destroy(capture);
+			return false;
+		}
+		capture->quads[i].image = index ? &capture->images[index-1] : 0;
+	}
+
+	dealloc_string(allocator, data);
+
+	return true;
+}
+
+// Runs the captured frame through the pipeline like a renderer would
+void
+draw_frame_capture_replay(Draw_Frame_Capture *capture, Quad_Pipeline *p) {
+	memcpy(capture->scratch_quads, capture->quads, capture->frame.num_quads*sizeof(Draw_Quad));
+	quad_pipeline_process(p, &capture->frame, capture->scratch_quads, capture->window_width, capture->window_height);
+}
@@ -50,7 +50,9 @@ inline void basic_rsqrt_float32_512(float *a, float *result);
 #endif
 
 #include <immintrin.h>
+#if TARGET_OS == WINDOWS
 #include <intrin.h>
+#endif
 
 
 // SSE
@@ -627,8 +629,12 @@ inline void simd_rsqrt_float32_512_aligned(float *a, float *result) {
 
 #endif
 
+#if TARGET_OS == WINDOWS
 double __cdecl sqrt(_In_ double _X);
 double __cdecl rsqrt(_In_ double _X);
+#else
+double rsqrt(double _X);
+#endif
 
 inline void basic_add_float32_64 (float32 *a, float32 *b, float32* result) {
 	result[0] = a[0] + b[0];
@@ -800,3 +806,1094 @@ inline void basic_rsqrt_float32_512(float *a, float *result) {
     basic_rsqrt_float32_256(a+8, result+8);
 }
 
+
+///
+///
+// Runtime dispatch
+///
+//
+// The simd_* procs above are picked at compile time, so anything past SSE2 is only used if
+// the whole program is built for it. Kernels that run over whole arrays are compiled for every
+// ISA level instead, with TARGET_AVX2 & co on the procs, and called through tables of function
+// pointers filled from the cpu capabilities at init.
+//
+// Every table is filled before the dispatch is published, so a thread that can see the
+// dispatch can never see an empty table. cpu_dispatch_force_isa() refills all of them at once,
+// tests use that to check that every level gets the same results.
+//
+
+// Each level includes everything below it
+typedef enum Cpu_Isa {
+	CPU_ISA_BASIC, // Plain C
+	CPU_ISA_SSE2,
+	CPU_ISA_AVX2,
+	
+	CPU_ISA_COUNT,
+} Cpu_Isa;
+
+const char *cpu_isa_names[CPU_ISA_COUNT] = {"basic", "sse2", "avx2"};
+
+typedef struct Cpu_Dispatch {
+	Cpu_Isa isa;
+	u64 generation; // 0 until initialized, bumped every time isa changes
+} Cpu_Dispatch;
+Cpu_Dispatch cpu_dispatch = {0};
+
+void simd_kernels_select(Cpu_Isa isa);
+void string_kernels_select(Cpu_Isa isa);
+void utf8_kernels_select(Cpu_Isa isa);
+void hash_kernels_select(Cpu_Isa isa);
+
+// Best level this build can run on a cpu with these features
+Cpu_Isa
+get_best_cpu_isa(Cpu_Capabilities features) {
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+	if (SIMD_ENABLE_AVX2 || features.avx2) return CPU_ISA_AVX2;
+	return CPU_ISA_SSE2;
+#else
+	return CPU_ISA_BASIC;
+#endif
+}
+bool
+cpu_isa_supported(Cpu_Isa isa) {
+	return isa <= get_best_cpu_isa(get_cpu_capabilities());
+}
+
+// Tables first and the generation last. Two threads racing here (before oogabooga_init) fill
+// the same pointers and store the same generation, so either one winning is fine.
+void
+cpu_dispatch_set_isa(Cpu_Isa isa) {
+	u64 generation = cpu_dispatch.generation+1;
+	simd_kernels_select(isa);
+	string_kernels_select(isa);
+	utf8_kernels_select(isa);
+	hash_kernels_select(isa);
+	cpu_dispatch.isa = isa;
+	MEMORY_BARRIER;
+	cpu_dispatch.generation = generation;
+}
+void
+cpu_dispatch_init(Cpu_Capabilities features) {
+	cpu_dispatch_set_isa(get_best_cpu_isa(features));
+}
+// For tests & benchmarks. Kernels already running on other threads finish on the old level.
+void
+cpu_dispatch_force_isa(Cpu_Isa isa) {
+	assert(cpu_isa_supported(isa), "Can't force ISA '%cs', this cpu or build doesn't support it", cpu_isa_names[isa]);
+	cpu_dispatch_set_isa(isa);
+}
+inline Cpu_Dispatch*
+get_cpu_dispatch() {
+	// Something may need a kernel before oogabooga_init
+	if (!cpu_dispatch.generation) cpu_dispatch_init(get_cpu_capabilities());
+	return &cpu_dispatch;
+}
+
+///
+// Array kernels
+//
+// simd_*_array procs take any count and any alignment. Single elements are done until dst is
+// aligned to the vector size, then whole vectors (unaligned loads, the sources may not line up
+// with dst) and the tail is single elements again. dst may be the same array as a source
+// unless noted otherwise, but arrays must not partially overlap.
+//
+// Every level gives the same bits, tails use the same scalar helpers as the basic procs. The
+// exception is float sums, dots and prefix sums, which add in a different order per level.
+//
+
+typedef void    (*Simd_Float32_Binary_Proc)(float32 *dst, const float32 *a, const float32 *b, u64 count);
+typedef void    (*Simd_S32_Binary_Proc)(s32 *dst, const s32 *a, const s32 *b, u64 count);
+typedef void    (*Simd_S16_Binary_Proc)(s16 *dst, const s16 *a, const s16 *b, u64 count);
+typedef void    (*Simd_Scale_Float32_Proc)(float32 *dst, const float32 *src, float32 scale, u64 count);
+typedef void    (*Simd_Mul_Add_Float32_Proc)(float32 *dst, const float32 *a, const float32 *b, const float32 *c, u64 count);
+typedef void    (*Simd_Clamp_Float32_Proc)(float32 *dst, const float32 *src, float32 lo, float32 hi, u64 count);
+typedef void    (*Simd_Clamp_S32_Proc)(s32 *dst, const s32 *src, s32 lo, s32 hi, u64 count);
+typedef float32 (*Simd_Sum_Float32_Proc)(const float32 *src, u64 count);
+typedef s64     (*Simd_Sum_S32_Proc)(const s32 *src, u64 count);
+typedef float32 (*Simd_Dot_Float32_Proc)(const float32 *a, const float32 *b, u64 count);
+typedef void    (*Simd_Prefix_Sum_Float32_Proc)(float32 *dst, const float32 *src, u64 count);
+typedef void    (*Simd_Prefix_Sum_S32_Proc)(s32 *dst, const s32 *src, u64 count);
+typedef void    (*Simd_S16_To_Float32_Proc)(float32 *dst, const s16 *src, u64 count);
+typedef void    (*Simd_Float32_To_S16_Proc)(s16 *dst, const float32 *src, u64 count);
+typedef void    (*Simd_U8_To_Float32_Proc)(float32 *dst, const u8 *src, u64 count);
+typedef void    (*Simd_Float32_To_U8_Proc)(u8 *dst, const float32 *src, u64 count);
+typedef void    (*Simd_Interleave_Float32_Proc)(float32 *dst, const float32 *left, const float32 *right, u64 frame_count);
+typedef void    (*Simd_Deinterleave_Float32_Proc)(float32 *left, float32 *right, const float32 *src, u64 frame_count);
+typedef void    (*Simd_Transform_Points_2d_Proc)(float32 *xy, u64 point_count, const float32 *affine);
+
+typedef struct Simd_Kernels {
+	Simd_Float32_Binary_Proc add_float32;
+	Simd_Float32_Binary_Proc sub_float32;
+	Simd_Float32_Binary_Proc mul_float32;
+	Simd_Float32_Binary_Proc min_float32;
+	Simd_Float32_Binary_Proc max_float32;
+	Simd_Scale_Float32_Proc scale_float32;
+	Simd_Mul_Add_Float32_Proc mul_add_float32;
+	Simd_Clamp_Float32_Proc clamp_float32;
+	Simd_Sum_Float32_Proc sum_float32;
+	Simd_Dot_Float32_Proc dot_float32;
+	Simd_Prefix_Sum_Float32_Proc prefix_sum_float32;
+
+	Simd_S32_Binary_Proc add_s32;
+	Simd_S32_Binary_Proc sub_s32;
+	Simd_S32_Binary_Proc mul_s32;
+	Simd_S32_Binary_Proc min_s32;
+	Simd_S32_Binary_Proc max_s32;
+	Simd_Clamp_S32_Proc clamp_s32;
+	Simd_Sum_S32_Proc sum_s32;
+	Simd_Prefix_Sum_S32_Proc prefix_sum_s32;
+
+	Simd_S16_Binary_Proc add_saturate_s16;
+
+	Simd_S16_To_Float32_Proc s16_to_float32;
+	Simd_Float32_To_S16_Proc float32_to_s16;
+	Simd_U8_To_Float32_Proc u8_to_float32;
+	Simd_Float32_To_U8_Proc float32_to_u8;
+	Simd_Interleave_Float32_Proc interleave_float32;
+	Simd_Deinterleave_Float32_Proc deinterleave_float32;
+
+	Simd_Transform_Points_2d_Proc transform_points_2d;
+} Simd_Kernels;
+Simd_Kernels simd_kernels = {0};
+
+#define SIMD_S16_TO_FLOAT32_SCALE (1.0f/32768.0f)
+
+// Single elements until p is aligned to vector_size. 0 if p isn't even aligned to its
+// elements, then it never will be and the vector loop just runs unaligned.
+inline u64
+_simd_head_count(const void *p, u64 element_size, u64 vector_size, u64 count) {
+	u64 misalignment = (u64)p & (vector_size-1);
+	if (!misalignment || misalignment % element_size) return 0;
+	return min((vector_size-misalignment)/element_size, count);
+}
+
+// SCALAR and VECTOR are statements using the element index i. SCALAR does element i,
+// VECTOR does STEP elements starting at i.
+#define _SIMD_ARRAY_LOOP(dst, count, VECTOR_SIZE, STEP, VECTOR, SCALAR) { \
+	u64 i = 0; \
+	u64 _head = _simd_head_count((dst), sizeof(*(dst)), (VECTOR_SIZE), (count)); \
+	for (; i < _head; i++) { SCALAR; } \
+	for (; i+(STEP) <= (count); i += (STEP)) { VECTOR; } \
+	for (; i < (count); i++) { SCALAR; } \
+}
+
+// Scalar versions of what the vector instructions do, so every level rounds and handles NaN
+// the same way. min/max are minps/maxps: b if either is NaN.
+inline float32 _simd_min_float32(float32 a, float32 b) { return a < b ? a : b; }
+inline float32 _simd_max_float32(float32 a, float32 b) { return a > b ? a : b; }
+inline s32 _simd_min_s32(s32 a, s32 b) { return a < b ? a : b; }
+inline s32 _simd_max_s32(s32 a, s32 b) { return a > b ? a : b; }
+// Integer math wraps
+inline s32 _simd_add_s32(s32 a, s32 b) { return (s32)((u32)a + (u32)b); }
+inline s32 _simd_sub_s32(s32 a, s32 b) { return (s32)((u32)a - (u32)b); }
+inline s32 _simd_mul_s32(s32 a, s32 b) { return (s32)((u32)a * (u32)b); }
+inline s16
+_simd_add_saturate_s16(s16 a, s16 b) {
+	s32 sum = (s32)a + (s32)b;
+	return (s16)(sum < -32768 ? -32768 : (sum > 32767 ? 32767 : sum));
+}
+// Truncates like the plain (s16) cast did, NaN becomes 32767
+inline s16
+_simd_float32_to_s16(float32 x) {
+	float32 y = _simd_max_float32(_simd_min_float32(x*32768.0f, 32767.0f), -32768.0f);
+	return (s16)(s32)y;
+}
+// Rounds to nearest, NaN becomes 255
+inline u8
+_simd_float32_to_u8(float32 x) {
+	float32 y = _simd_max_float32(_simd_min_float32(x*255.0f + 0.5f, 255.0f), 0.0f);
+	return (u8)(s32)y;
+}
+
+void
+_simd_add_float32_basic(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = a[i] + b[i];
+}
+void
+_simd_sub_float32_basic(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = a[i] - b[i];
+}
+void
+_simd_mul_float32_basic(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = a[i] * b[i];
+}
+void
+_simd_min_float32_basic(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = _simd_min_float32(a[i], b[i]);
+}
+void
+_simd_max_float32_basic(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = _simd_max_float32(a[i], b[i]);
+}
+void
+_simd_scale_float32_basic(float32 *dst, const float32 *src, float32 scale, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = src[i] * scale;
+}
+void
+_simd_mul_add_float32_basic(float32 *dst, const float32 *a, const float32 *b, const float32 *c, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = a[i]*b[i] + c[i];
+}
+void
+_simd_clamp_float32_basic(float32 *dst, const float32 *src, float32 lo, float32 hi, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = _simd_min_float32(_simd_max_float32(src[i], lo), hi);
+}
+float32
+_simd_sum_float32_basic(const float32 *src, u64 count) {
+	float32 sum = 0;
+	for (u64 i = 0; i < count; i++) sum += src[i];
+	return sum;
+}
+float32
+_simd_dot_float32_basic(const float32 *a, const float32 *b, u64 count) {
+	float32 sum = 0;
+	for (u64 i = 0; i < count; i++) sum += a[i]*b[i];
+	return sum;
+}
+void
+_simd_prefix_sum_float32_basic(float32 *dst, const float32 *src, u64 count) {
+	float32 sum = 0;
+	for (u64 i = 0; i < count; i++) dst[i] = sum += src[i];
+}
+void
+_simd_add_s32_basic(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = _simd_add_s32(a[i], b[i]);
+}
+void
+_simd_sub_s32_basic(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = _simd_sub_s32(a[i], b[i]);
+}
+void
+_simd_mul_s32_basic(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = _simd_mul_s32(a[i], b[i]);
+}
+void
+_simd_min_s32_basic(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = _simd_min_s32(a[i], b[i]);
+}
+void
+_simd_max_s32_basic(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = _simd_max_s32(a[i], b[i]);
+}
+void
+_simd_clamp_s32_basic(s32 *dst, const s32 *src, s32 lo, s32 hi, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = _simd_min_s32(_simd_max_s32(src[i], lo), hi);
+}
+s64
+_simd_sum_s32_basic(const s32 *src, u64 count) {
+	s64 sum = 0;
+	for (u64 i = 0; i < count; i++) sum += src[i];
+	return sum;
+}
+void
+_simd_prefix_sum_s32_basic(s32 *dst, const s32 *src, u64 count) {
+	s32 sum = 0;
+	for (u64 i = 0; i < count; i++) dst[i] = sum = _simd_add_s32(sum, src[i]);
+}
+void
+_simd_add_saturate_s16_basic(s16 *dst, const s16 *a, const s16 *b, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = _simd_add_saturate_s16(a[i], b[i]);
+}
+void
+_simd_s16_to_float32_basic(float32 *dst, const s16 *src, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = (float32)src[i] * SIMD_S16_TO_FLOAT32_SCALE;
+}
+void
+_simd_float32_to_s16_basic(s16 *dst, const float32 *src, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = _simd_float32_to_s16(src[i]);
+}
+void
+_simd_u8_to_float32_basic(float32 *dst, const u8 *src, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = (float32)src[i] / 255.0f;
+}
+void
+_simd_float32_to_u8_basic(u8 *dst, const float32 *src, u64 count) {
+	for (u64 i = 0; i < count; i++) dst[i] = _simd_float32_to_u8(src[i]);
+}
+void
+_simd_interleave_float32_basic(float32 *dst, const float32 *left, const float32 *right, u64 frame_count) {
+	for (u64 i = 0; i < frame_count; i++) {
+		dst[i*2+0] = left[i];
+		dst[i*2+1] = right[i];
+	}
+}
+void
+_simd_deinterleave_float32_basic(float32 *left, float32 *right, const float32 *src, u64 frame_count) {
+	for (u64 i = 0; i < frame_count; i++) {
+		left[i]  = src[i*2+0];
+		right[i] = src[i*2+1];
+	}
+}
+// affine is {a, b, c, d, e, f}: x' = a*x + b*y + c, y' = d*x + e*y + f
+void
+_simd_transform_points_2d_basic(float32 *xy, u64 point_count, const float32 *affine) {
+	for (u64 i = 0; i < point_count; i++) {
+		float32 x = xy[i*2+0];
+		float32 y = xy[i*2+1];
+		xy[i*2+0] = affine[0]*x + affine[1]*y + affine[2];
+		xy[i*2+1] = affine[3]*x + affine[4]*y + affine[5];
+	}
+}
+
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+// SSE2 has no 32 bit min, max or low multiply, those came with SSE4.1
+inline __m128i
+_simd_min_epi32_sse2(__m128i a, __m128i b) {
+	__m128i gt = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+}
+inline __m128i
+_simd_max_epi32_sse2(__m128i a, __m128i b) {
+	__m128i gt = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+inline __m128i
+_simd_mullo_epi32_sse2(__m128i a, __m128i b) {
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+inline __m128i
+_simd_load_s32_sse2(const s32 *p) { return _mm_loadu_si128((const __m128i*)p); }
+inline void
+_simd_store_s32_sse2(s32 *p, __m128i v) { _mm_storeu_si128((__m128i*)p, v); }
+
+void
+_simd_add_float32_sse2(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 16, 4,
+		_mm_storeu_ps(dst+i, _mm_add_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i))),
+		dst[i] = a[i] + b[i]);
+}
+void
+_simd_sub_float32_sse2(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 16, 4,
+		_mm_storeu_ps(dst+i, _mm_sub_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i))),
+		dst[i] = a[i] - b[i]);
+}
+void
+_simd_mul_float32_sse2(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 16, 4,
+		_mm_storeu_ps(dst+i, _mm_mul_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i))),
+		dst[i] = a[i] * b[i]);
+}
+void
+_simd_min_float32_sse2(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 16, 4,
+		_mm_storeu_ps(dst+i, _mm_min_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i))),
+		dst[i] = _simd_min_float32(a[i], b[i]));
+}
+void
+_simd_max_float32_sse2(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 16, 4,
+		_mm_storeu_ps(dst+i, _mm_max_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i))),
+		dst[i] = _simd_max_float32(a[i], b[i]));
+}
+void
+_simd_scale_float32_sse2(float32 *dst, const float32 *src, float32 scale, u64 count) {
+	__m128 s = _mm_set1_ps(scale);
+	_SIMD_ARRAY_LOOP(dst, count, 16, 4,
+		_mm_storeu_ps(dst+i, _mm_mul_ps(_mm_loadu_ps(src+i), s)),
+		dst[i] = src[i] * scale);
+}
+void
+_simd_mul_add_float32_sse2(float32 *dst, const float32 *a, const float32 *b, const float32 *c, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 16, 4,
+		_mm_storeu_ps(dst+i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i)), _mm_loadu_ps(c+i))),
+		dst[i] = a[i]*b[i] + c[i]);
+}
+void
+_simd_clamp_float32_sse2(float32 *dst, const float32 *src, float32 lo, float32 hi, u64 count) {
+	__m128 vlo = _mm_set1_ps(lo);
+	__m128 vhi = _mm_set1_ps(hi);
+	_SIMD_ARRAY_LOOP(dst, count, 16, 4,
+		_mm_storeu_ps(dst+i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src+i), vlo), vhi)),
+		dst[i] = _simd_min_float32(_simd_max_float32(src[i], lo), hi));
+}
+inline float32
+_simd_horizontal_add_sse2(__m128 v) {
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_add_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_cvtss_f32(v);
+}
+// Two accumulators so the adds don't wait on each other
+float32
+_simd_sum_float32_sse2(const float32 *src, u64 count) {
+	__m128 sum0 = _mm_setzero_ps();
+	__m128 sum1 = _mm_setzero_ps();
+	u64 i = 0;
+	for (; i+8 <= count; i += 8) {
+		sum0 = _mm_add_ps(sum0, _mm_loadu_ps(src+i));
+		sum1 = _mm_add_ps(sum1, _mm_loadu_ps(src+i+4));
+	}
+	float32 sum = _simd_horizontal_add_sse2(_mm_add_ps(sum0, sum1));
+	for (; i < count; i++) sum += src[i];
+	return sum;
+}
+float32
+_simd_dot_float32_sse2(const float32 *a, const float32 *b, u64 count) {
+	__m128 sum0 = _mm_setzero_ps();
+	__m128 sum1 = _mm_setzero_ps();
+	u64 i = 0;
+	for (; i+8 <= count; i += 8) {
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a+i),   _mm_loadu_ps(b+i)));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a+i+4), _mm_loadu_ps(b+i+4)));
+	}
+	float32 sum = _simd_horizontal_add_sse2(_mm_add_ps(sum0, sum1));
+	for (; i < count; i++) sum += a[i]*b[i];
+	return sum;
+}
+// Log-step scan within the vector, then add the running total carried from the last one
+void
+_simd_prefix_sum_float32_sse2(float32 *dst, const float32 *src, u64 count) {
+	__m128 carry = _mm_setzero_ps();
+	u64 i = 0;
+	for (; i+4 <= count; i += 4) {
+		__m128 x = _mm_loadu_ps(src+i);
+		x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)));
+		x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8)));
+		x = _mm_add_ps(x, carry);
+		_mm_storeu_ps(dst+i, x);
+		carry = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+	float32 sum = _mm_cvtss_f32(carry);
+	for (; i < count; i++) dst[i] = sum += src[i];
+}
+void
+_simd_add_s32_sse2(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 16, 4,
+		_simd_store_s32_sse2(dst+i, _mm_add_epi32(_simd_load_s32_sse2(a+i), _simd_load_s32_sse2(b+i))),
+		dst[i] = _simd_add_s32(a[i], b[i]));
+}
+void
+_simd_sub_s32_sse2(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 16, 4,
+		_simd_store_s32_sse2(dst+i, _mm_sub_epi32(_simd_load_s32_sse2(a+i), _simd_load_s32_sse2(b+i))),
+		dst[i] = _simd_sub_s32(a[i], b[i]));
+}
+void
+_simd_mul_s32_sse2(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 16, 4,
+		_simd_store_s32_sse2(dst+i, _simd_mullo_epi32_sse2(_simd_load_s32_sse2(a+i), _simd_load_s32_sse2(b+i))),
+		dst[i] = _simd_mul_s32(a[i], b[i]));
+}
+void
+_simd_min_s32_sse2(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 16, 4,
+		_simd_store_s32_sse2(dst+i, _simd_min_epi32_sse2(_simd_load_s32_sse2(a+i), _simd_load_s32_sse2(b+i))),
+		dst[i] = _simd_min_s32(a[i], b[i]));
+}
+void
+_simd_max_s32_sse2(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 16, 4,
+		_simd_store_s32_sse2(dst+i, _simd_max_epi32_sse2(_simd_load_s32_sse2(a+i), _simd_load_s32_sse2(b+i))),
+		dst[i] = _simd_max_s32(a[i], b[i]));
+}
+void
+_simd_clamp_s32_sse2(s32 *dst, const s32 *src, s32 lo, s32 hi, u64 count) {
+	__m128i vlo = _mm_set1_epi32(lo);
+	__m128i vhi = _mm_set1_epi32(hi);
+	_SIMD_ARRAY_LOOP(dst, count, 16, 4,
+		_simd_store_s32_sse2(dst+i, _simd_min_epi32_sse2(_simd_max_epi32_sse2(_simd_load_s32_sse2(src+i), vlo), vhi)),
+		dst[i] = _simd_min_s32(_simd_max_s32(src[i], lo), hi));
+}
+// Sign extends to 64 bit lanes so the sum can't overflow
+s64
+_simd_sum_s32_sse2(const s32 *src, u64 count) {
+	__m128i sum0 = _mm_setzero_si128();
+	__m128i sum1 = _mm_setzero_si128();
+	u64 i = 0;
+	for (; i+4 <= count; i += 4) {
+		__m128i x = _simd_load_s32_sse2(src+i);
+		__m128i sign = _mm_srai_epi32(x, 31);
+		sum0 = _mm_add_epi64(sum0, _mm_unpacklo_epi32(x, sign));
+		sum1 = _mm_add_epi64(sum1, _mm_unpackhi_epi32(x, sign));
+	}
+	s64 lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(sum0, sum1));
+	s64 sum = lanes[0] + lanes[1];
+	for (; i < count; i++) sum += src[i];
+	return sum;
+}
+void
+_simd_prefix_sum_s32_sse2(s32 *dst, const s32 *src, u64 count) {
+	__m128i carry = _mm_setzero_si128();
+	u64 i = 0;
+	for (; i+4 <= count; i += 4) {
+		__m128i x = _simd_load_s32_sse2(src+i);
+		x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+		x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+		x = _mm_add_epi32(x, carry);
+		_simd_store_s32_sse2(dst+i, x);
+		carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+	s32 sum = _mm_cvtsi128_si32(carry);
+	for (; i < count; i++) dst[i] = sum = _simd_add_s32(sum, src[i]);
+}
+void
+_simd_add_saturate_s16_sse2(s16 *dst, const s16 *a, const s16 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 16, 8,
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_adds_epi16(_mm_loadu_si128((const __m128i*)(a+i)), _mm_loadu_si128((const __m128i*)(b+i)))),
+		dst[i] = _simd_add_saturate_s16(a[i], b[i]));
+}
+void
+_simd_s16_to_float32_sse2(float32 *dst, const s16 *src, u64 count) {
+	__m128 scale = _mm_set1_ps(SIMD_S16_TO_FLOAT32_SCALE);
+	_SIMD_ARRAY_LOOP(dst, count, 16, 8,
+		__m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+		// Sign extend by putting the s16 in the top half and shifting back down
+		__m128i low  = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+		__m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+		_mm_storeu_ps(dst+i,   _mm_mul_ps(_mm_cvtepi32_ps(low),  scale));
+		_mm_storeu_ps(dst+i+4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale)),
+		dst[i] = (float32)src[i] * SIMD_S16_TO_FLOAT32_SCALE);
+}
+void
+_simd_float32_to_s16_sse2(s16 *dst, const float32 *src, u64 count) {
+	__m128 scale = _mm_set1_ps(32768.0f);
+	__m128 lo = _mm_set1_ps(-32768.0f);
+	__m128 hi = _mm_set1_ps(32767.0f);
+	_SIMD_ARRAY_LOOP(dst, count, 16, 8,
+		__m128 x0 = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(src+i),   scale), hi), lo);
+		__m128 x1 = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(src+i+4), scale), hi), lo);
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_packs_epi32(_mm_cvttps_epi32(x0), _mm_cvttps_epi32(x1))),
+		dst[i] = _simd_float32_to_s16(src[i]));
+}
+void
+_simd_u8_to_float32_sse2(float32 *dst, const u8 *src, u64 count) {
+	__m128 scale = _mm_set1_ps(255.0f);
+	__m128i zero = _mm_setzero_si128();
+	_SIMD_ARRAY_LOOP(dst, count, 16, 16,
+		__m128i x = _mm_loadu_si128((const __m128i*)(src+i));
+		__m128i low  = _mm_unpacklo_epi8(x, zero);
+		__m128i high = _mm_unpackhi_epi8(x, zero);
+		_mm_storeu_ps(dst+i,    _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(low,  zero)), scale));
+		_mm_storeu_ps(dst+i+4,  _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(low,  zero)), scale));
+		_mm_storeu_ps(dst+i+8,  _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)), scale));
+		_mm_storeu_ps(dst+i+12, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)), scale)),
+		dst[i] = (float32)src[i] / 255.0f);
+}
+void
+_simd_float32_to_u8_sse2(u8 *dst, const float32 *src, u64 count) {
+	__m128 scale = _mm_set1_ps(255.0f);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 lo = _mm_setzero_ps();
+	__m128 hi = _mm_set1_ps(255.0f);
+	#define _SIMD_F32_TO_U8_SSE2(p) _mm_cvttps_epi32(_mm_max_ps(_mm_min_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p), scale), half), hi), lo))
+	_SIMD_ARRAY_LOOP(dst, count, 16, 16,
+		__m128i low  = _mm_packs_epi32(_SIMD_F32_TO_U8_SSE2(src+i),   _SIMD_F32_TO_U8_SSE2(src+i+4));
+		__m128i high = _mm_packs_epi32(_SIMD_F32_TO_U8_SSE2(src+i+8), _SIMD_F32_TO_U8_SSE2(src+i+12));
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_packus_epi16(low, high)),
+		dst[i] = _simd_float32_to_u8(src[i]));
+	#undef _SIMD_F32_TO_U8_SSE2
+}
+void
+_simd_interleave_float32_sse2(float32 *dst, const float32 *left, const float32 *right, u64 frame_count) {
+	u64 i = 0;
+	for (; i+4 <= frame_count; i += 4) {
+		__m128 l = _mm_loadu_ps(left+i);
+		__m128 r = _mm_loadu_ps(right+i);
+		_mm_storeu_ps(dst+i*2,   _mm_unpacklo_ps(l, r));
+		_mm_storeu_ps(dst+i*2+4, _mm_unpackhi_ps(l, r));
+	}
+	_simd_interleave_float32_basic(dst+i*2, left+i, right+i, frame_count-i);
+}
+void
+_simd_deinterleave_float32_sse2(float32 *left, float32 *right, const float32 *src, u64 frame_count) {
+	u64 i = 0;
+	for (; i+4 <= frame_count; i += 4) {
+		__m128 a = _mm_loadu_ps(src+i*2);
+		__m128 b = _mm_loadu_ps(src+i*2+4);
+		_mm_storeu_ps(left+i,  _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(right+i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+	_simd_deinterleave_float32_basic(left+i, right+i, src+i*2, frame_count-i);
+}
+// Two points per vector, x and y broadcast to both of their lanes
+void
+_simd_transform_points_2d_sse2(float32 *xy, u64 point_count, const float32 *affine) {
+	__m128 xs = _mm_setr_ps(affine[0], affine[3], affine[0], affine[3]);
+	__m128 ys = _mm_setr_ps(affine[1], affine[4], affine[1], affine[4]);
+	__m128 t  = _mm_setr_ps(affine[2], affine[5], affine[2], affine[5]);
+	u64 i = 0;
+	for (; i+2 <= point_count; i += 2) {
+		__m128 p = _mm_loadu_ps(xy+i*2);
+		__m128 x = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 0, 0));
+		__m128 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 1, 1));
+		_mm_storeu_ps(xy+i*2, _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, xs), _mm_mul_ps(y, ys)), t));
+	}
+	_simd_transform_points_2d_basic(xy+i*2, point_count-i, affine);
+}
+
+// Tails stay in these procs. Calling non AVX code with the upper halves of the ymm registers
+// dirty can cost hundreds of cycles, and the compiler doesn't always clear them before a tail call.
+
+TARGET_AVX2 inline __m256i
+_simd_load_s32_avx2(const s32 *p) { return _mm256_loadu_si256((const __m256i*)p); }
+TARGET_AVX2 inline void
+_simd_store_s32_avx2(s32 *p, __m256i v) { _mm256_storeu_si256((__m256i*)p, v); }
+
+TARGET_AVX2 void
+_simd_add_float32_avx2(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 32, 8,
+		_mm256_storeu_ps(dst+i, _mm256_add_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i))),
+		dst[i] = a[i] + b[i]);
+}
+TARGET_AVX2 void
+_simd_sub_float32_avx2(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 32, 8,
+		_mm256_storeu_ps(dst+i, _mm256_sub_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i))),
+		dst[i] = a[i] - b[i]);
+}
+TARGET_AVX2 void
+_simd_mul_float32_avx2(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 32, 8,
+		_mm256_storeu_ps(dst+i, _mm256_mul_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i))),
+		dst[i] = a[i] * b[i]);
+}
+TARGET_AVX2 void
+_simd_min_float32_avx2(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 32, 8,
+		_mm256_storeu_ps(dst+i, _mm256_min_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i))),
+		dst[i] = _simd_min_float32(a[i], b[i]));
+}
+TARGET_AVX2 void
+_simd_max_float32_avx2(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 32, 8,
+		_mm256_storeu_ps(dst+i, _mm256_max_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i))),
+		dst[i] = _simd_max_float32(a[i], b[i]));
+}
+TARGET_AVX2 void
+_simd_scale_float32_avx2(float32 *dst, const float32 *src, float32 scale, u64 count) {
+	__m256 s = _mm256_set1_ps(scale);
+	_SIMD_ARRAY_LOOP(dst, count, 32, 8,
+		_mm256_storeu_ps(dst+i, _mm256_mul_ps(_mm256_loadu_ps(src+i), s)),
+		dst[i] = src[i] * scale);
+}
+// Not fused, FMA is a separate cpu feature and would round differently from the other levels
+TARGET_AVX2 void
+_simd_mul_add_float32_avx2(float32 *dst, const float32 *a, const float32 *b, const float32 *c, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 32, 8,
+		_mm256_storeu_ps(dst+i, _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i)), _mm256_loadu_ps(c+i))),
+		dst[i] = a[i]*b[i] + c[i]);
+}
+TARGET_AVX2 void
+_simd_clamp_float32_avx2(float32 *dst, const float32 *src, float32 lo, float32 hi, u64 count) {
+	__m256 vlo = _mm256_set1_ps(lo);
+	__m256 vhi = _mm256_set1_ps(hi);
+	_SIMD_ARRAY_LOOP(dst, count, 32, 8,
+		_mm256_storeu_ps(dst+i, _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src+i), vlo), vhi)),
+		dst[i] = _simd_min_float32(_simd_max_float32(src[i], lo), hi));
+}
+TARGET_AVX2 inline float32
+_simd_horizontal_add_avx2(__m256 v) {
+	__m128 x = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+	x = _mm_add_ss(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_cvtss_f32(x);
+}
+TARGET_AVX2 float32
+_simd_sum_float32_avx2(const float32 *src, u64 count) {
+	__m256 sum0 = _mm256_setzero_ps();
+	__m256 sum1 = _mm256_setzero_ps();
+	u64 i = 0;
+	for (; i+16 <= count; i += 16) {
+		sum0 = _mm256_add_ps(sum0, _mm256_loadu_ps(src+i));
+		sum1 = _mm256_add_ps(sum1, _mm256_loadu_ps(src+i+8));
+	}
+	float32 sum = _simd_horizontal_add_avx2(_mm256_add_ps(sum0, sum1));
+	for (; i < count; i++) sum += src[i];
+	return sum;
+}
+TARGET_AVX2 float32
+_simd_dot_float32_avx2(const float32 *a, const float32 *b, u64 count) {
+	__m256 sum0 = _mm256_setzero_ps();
+	__m256 sum1 = _mm256_setzero_ps();
+	u64 i = 0;
+	for (; i+16 <= count; i += 16) {
+		sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(a+i),   _mm256_loadu_ps(b+i)));
+		sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(a+i+8), _mm256_loadu_ps(b+i+8)));
+	}
+	float32 sum = _simd_horizontal_add_avx2(_mm256_add_ps(sum0, sum1));
+	for (; i < count; i++) sum += a[i]*b[i];
+	return sum;
+}
+// Scans each 128 bit half, then adds the low half's total to the high half
+TARGET_AVX2 void
+_simd_prefix_sum_float32_avx2(float32 *dst, const float32 *src, u64 count) {
+	__m256 carry = _mm256_setzero_ps();
+	__m256i last = _mm256_set1_epi32(7);
+	u64 i = 0;
+	for (; i+8 <= count; i += 8) {
+		__m256 x = _mm256_loadu_ps(src+i);
+		x = _mm256_add_ps(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 4)));
+		x = _mm256_add_ps(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 8)));
+		__m256 low_total = _mm256_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+		x = _mm256_add_ps(x, _mm256_permute2f128_ps(low_total, low_total, 0x08));
+		x = _mm256_add_ps(x, carry);
+		_mm256_storeu_ps(dst+i, x);
+		carry = _mm256_permutevar8x32_ps(x, last);
+	}
+	float32 sum = _mm_cvtss_f32(_mm256_castps256_ps128(carry));
+	for (; i < count; i++) dst[i] = sum += src[i];
+}
+TARGET_AVX2 void
+_simd_add_s32_avx2(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 32, 8,
+		_simd_store_s32_avx2(dst+i, _mm256_add_epi32(_simd_load_s32_avx2(a+i), _simd_load_s32_avx2(b+i))),
+		dst[i] = _simd_add_s32(a[i], b[i]));
+}
+TARGET_AVX2 void
+_simd_sub_s32_avx2(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 32, 8,
+		_simd_store_s32_avx2(dst+i, _mm256_sub_epi32(_simd_load_s32_avx2(a+i), _simd_load_s32_avx2(b+i))),
+		dst[i] = _simd_sub_s32(a[i], b[i]));
+}
+TARGET_AVX2 void
+_simd_mul_s32_avx2(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 32, 8,
+		_simd_store_s32_avx2(dst+i, _mm256_mullo_epi32(_simd_load_s32_avx2(a+i), _simd_load_s32_avx2(b+i))),
+		dst[i] = _simd_mul_s32(a[i], b[i]));
+}
+TARGET_AVX2 void
+_simd_min_s32_avx2(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 32, 8,
+		_simd_store_s32_avx2(dst+i, _mm256_min_epi32(_simd_load_s32_avx2(a+i), _simd_load_s32_avx2(b+i))),
+		dst[i] = _simd_min_s32(a[i], b[i]));
+}
+TARGET_AVX2 void
+_simd_max_s32_avx2(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 32, 8,
+		_simd_store_s32_avx2(dst+i, _mm256_max_epi32(_simd_load_s32_avx2(a+i), _simd_load_s32_avx2(b+i))),
+		dst[i] = _simd_max_s32(a[i], b[i]));
+}
+TARGET_AVX2 void
+_simd_clamp_s32_avx2(s32 *dst, const s32 *src, s32 lo, s32 hi, u64 count) {
+	__m256i vlo = _mm256_set1_epi32(lo);
+	__m256i vhi = _mm256_set1_epi32(hi);
+	_SIMD_ARRAY_LOOP(dst, count, 32, 8,
+		_simd_store_s32_avx2(dst+i, _mm256_min_epi32(_mm256_max_epi32(_simd_load_s32_avx2(src+i), vlo), vhi)),
+		dst[i] = _simd_min_s32(_simd_max_s32(src[i], lo), hi));
+}
+TARGET_AVX2 s64
+_simd_sum_s32_avx2(const s32 *src, u64 count) {
+	__m256i sum0 = _mm256_setzero_si256();
+	__m256i sum1 = _mm256_setzero_si256();
+	u64 i = 0;
+	for (; i+8 <= count; i += 8) {
+		sum0 = _mm256_add_epi64(sum0, _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(src+i))));
+		sum1 = _mm256_add_epi64(sum1, _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(src+i+4))));
+	}
+	s64 lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(sum0, sum1));
+	s64 sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	for (; i < count; i++) sum += src[i];
+	return sum;
+}
+TARGET_AVX2 void
+_simd_prefix_sum_s32_avx2(s32 *dst, const s32 *src, u64 count) {
+	__m256i carry = _mm256_setzero_si256();
+	__m256i last = _mm256_set1_epi32(7);
+	u64 i = 0;
+	for (; i+8 <= count; i += 8) {
+		__m256i x = _simd_load_s32_avx2(src+i);
+		x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+		x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+		__m256i low_total = _mm256_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+		x = _mm256_add_epi32(x, _mm256_permute2x128_si256(low_total, low_total, 0x08));
+		x = _mm256_add_epi32(x, carry);
+		_simd_store_s32_avx2(dst+i, x);
+		carry = _mm256_permutevar8x32_epi32(x, last);
+	}
+	s32 sum = _mm_cvtsi128_si32(_mm256_castsi256_si128(carry));
+	for (; i < count; i++) dst[i] = sum = _simd_add_s32(sum, src[i]);
+}
+TARGET_AVX2 void
+_simd_add_saturate_s16_avx2(s16 *dst, const s16 *a, const s16 *b, u64 count) {
+	_SIMD_ARRAY_LOOP(dst, count, 32, 16,
+		_mm256_storeu_si256((__m256i*)(dst+i), _mm256_adds_epi16(_mm256_loadu_si256((const __m256i*)(a+i)), _mm256_loadu_si256((const __m256i*)(b+i)))),
+		dst[i] = _simd_add_saturate_s16(a[i], b[i]));
+}
+TARGET_AVX2 void
+_simd_s16_to_float32_avx2(float32 *dst, const s16 *src, u64 count) {
+	__m256 scale = _mm256_set1_ps(SIMD_S16_TO_FLOAT32_SCALE);
+	_SIMD_ARRAY_LOOP(dst, count, 32, 16,
+		__m256i low  = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src+i)));
+		__m256i high = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src+i+8)));
+		_mm256_storeu_ps(dst+i,   _mm256_mul_ps(_mm256_cvtepi32_ps(low),  scale));
+		_mm256_storeu_ps(dst+i+8, _mm256_mul_ps(_mm256_cvtepi32_ps(high), scale)),
+		dst[i] = (float32)src[i] * SIMD_S16_TO_FLOAT32_SCALE);
+}
+// The packs work per 128 bit half, the permute puts the 64 bit pieces back in order
+TARGET_AVX2 void
+_simd_float32_to_s16_avx2(s16 *dst, const float32 *src, u64 count) {
+	__m256 scale = _mm256_set1_ps(32768.0f);
+	__m256 lo = _mm256_set1_ps(-32768.0f);
+	__m256 hi = _mm256_set1_ps(32767.0f);
+	_SIMD_ARRAY_LOOP(dst, count, 32, 16,
+		__m256 x0 = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(src+i),   scale), hi), lo);
+		__m256 x1 = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(src+i+8), scale), hi), lo);
+		__m256i packed = _mm256_packs_epi32(_mm256_cvttps_epi32(x0), _mm256_cvttps_epi32(x1));
+		_mm256_storeu_si256((__m256i*)(dst+i), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0))),
+		dst[i] = _simd_float32_to_s16(src[i]));
+}
+TARGET_AVX2 void
+_simd_u8_to_float32_avx2(float32 *dst, const u8 *src, u64 count) {
+	__m256 scale = _mm256_set1_ps(255.0f);
+	_SIMD_ARRAY_LOOP(dst, count, 32, 16,
+		__m256i low  = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src+i)));
+		__m256i high = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src+i+8)));
+		_mm256_storeu_ps(dst+i,   _mm256_div_ps(_mm256_cvtepi32_ps(low),  scale));
+		_mm256_storeu_ps(dst+i+8, _mm256_div_ps(_mm256_cvtepi32_ps(high), scale)),
+		dst[i] = (float32)src[i] / 255.0f);
+}
+TARGET_AVX2 void
+_simd_float32_to_u8_avx2(u8 *dst, const float32 *src, u64 count) {
+	__m256 scale = _mm256_set1_ps(255.0f);
+	__m256 half = _mm256_set1_ps(0.5f);
+	__m256 lo = _mm256_setzero_ps();
+	__m256 hi = _mm256_set1_ps(255.0f);
+	__m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	#define _SIMD_F32_TO_U8_AVX2(p) _mm256_cvttps_epi32(_mm256_max_ps(_mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(p), scale), half), hi), lo))
+	_SIMD_ARRAY_LOOP(dst, count, 32, 32,
+		__m256i low  = _mm256_packs_epi32(_SIMD_F32_TO_U8_AVX2(src+i),    _SIMD_F32_TO_U8_AVX2(src+i+8));
+		__m256i high = _mm256_packs_epi32(_SIMD_F32_TO_U8_AVX2(src+i+16), _SIMD_F32_TO_U8_AVX2(src+i+24));
+		_mm256_storeu_si256((__m256i*)(dst+i), _mm256_permutevar8x32_epi32(_mm256_packus_epi16(low, high), order)),
+		dst[i] = _simd_float32_to_u8(src[i]));
+	#undef _SIMD_F32_TO_U8_AVX2
+}
+TARGET_AVX2 void
+_simd_interleave_float32_avx2(float32 *dst, const float32 *left, const float32 *right, u64 frame_count) {
+	u64 i = 0;
+	for (; i+8 <= frame_count; i += 8) {
+		__m256 l = _mm256_loadu_ps(left+i);
+		__m256 r = _mm256_loadu_ps(right+i);
+		__m256 low  = _mm256_unpacklo_ps(l, r);
+		__m256 high = _mm256_unpackhi_ps(l, r);
+		_mm256_storeu_ps(dst+i*2,   _mm256_permute2f128_ps(low, high, 0x20));
+		_mm256_storeu_ps(dst+i*2+8, _mm256_permute2f128_ps(low, high, 0x31));
+	}
+	for (; i < frame_count; i++) {
+		dst[i*2+0] = left[i];
+		dst[i*2+1] = right[i];
+	}
+}
+TARGET_AVX2 void
+_simd_deinterleave_float32_avx2(float32 *left, float32 *right, const float32 *src, u64 frame_count) {
+	u64 i = 0;
+	for (; i+8 <= frame_count; i += 8) {
+		__m256 a = _mm256_loadu_ps(src+i*2);
+		__m256 b = _mm256_loadu_ps(src+i*2+8);
+		__m256 l = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		__m256 r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		_mm256_storeu_ps(left+i,  _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(l), _MM_SHUFFLE(3, 1, 2, 0))));
+		_mm256_storeu_ps(right+i, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r), _MM_SHUFFLE(3, 1, 2, 0))));
+	}
+	for (; i < frame_count; i++) {
+		left[i]  = src[i*2+0];
+		right[i] = src[i*2+1];
+	}
+}
+TARGET_AVX2 void
+_simd_transform_points_2d_avx2(float32 *xy, u64 point_count, const float32 *affine) {
+	__m256 xs = _mm256_setr_ps(affine[0], affine[3], affine[0], affine[3], affine[0], affine[3], affine[0], affine[3]);
+	__m256 ys = _mm256_setr_ps(affine[1], affine[4], affine[1], affine[4], affine[1], affine[4], affine[1], affine[4]);
+	__m256 t  = _mm256_setr_ps(affine[2], affine[5], affine[2], affine[5], affine[2], affine[5], affine[2], affine[5]);
+	u64 i = 0;
+	for (; i+4 <= point_count; i += 4) {
+		__m256 p = _mm256_loadu_ps(xy+i*2);
+		__m256 x = _mm256_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 0, 0));
+		__m256 y = _mm256_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 1, 1));
+		_mm256_storeu_ps(xy+i*2, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, xs), _mm256_mul_ps(y, ys)), t));
+	}
+	for (; i < point_count; i++) {
+		float32 x = xy[i*2+0];
+		float32 y = xy[i*2+1];
+		xy[i*2+0] = affine[0]*x + affine[1]*y + affine[2];
+		xy[i*2+1] = affine[3]*x + affine[4]*y + affine[5];
+	}
+}
+
+#endif // ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+#define _SIMD_KERNELS_FILL(k, ISA) \
+	(k).add_float32          = _simd_add_float32_##ISA; \
+	(k).sub_float32          = _simd_sub_float32_##ISA; \
+	(k).mul_float32          = _simd_mul_float32_##ISA; \
+	(k).min_float32          = _simd_min_float32_##ISA; \
+	(k).max_float32          = _simd_max_float32_##ISA; \
+	(k).scale_float32        = _simd_scale_float32_##ISA; \
+	(k).mul_add_float32      = _simd_mul_add_float32_##ISA; \
+	(k).clamp_float32        = _simd_clamp_float32_##ISA; \
+	(k).sum_float32          = _simd_sum_float32_##ISA; \
+	(k).dot_float32          = _simd_dot_float32_##ISA; \
+	(k).prefix_sum_float32   = _simd_prefix_sum_float32_##ISA; \
+	(k).add_s32              = _simd_add_s32_##ISA; \
+	(k).sub_s32              = _simd_sub_s32_##ISA; \
+	(k).mul_s32              = _simd_mul_s32_##ISA; \
+	(k).min_s32              = _simd_min_s32_##ISA; \
+	(k).max_s32              = _simd_max_s32_##ISA; \
+	(k).clamp_s32            = _simd_clamp_s32_##ISA; \
+	(k).sum_s32              = _simd_sum_s32_##ISA; \
+	(k).prefix_sum_s32       = _simd_prefix_sum_s32_##ISA; \
+	(k).add_saturate_s16     = _simd_add_saturate_s16_##ISA; \
+	(k).s16_to_float32       = _simd_s16_to_float32_##ISA; \
+	(k).float32_to_s16       = _simd_float32_to_s16_##ISA; \
+	(k).u8_to_float32        = _simd_u8_to_float32_##ISA; \
+	(k).float32_to_u8        = _simd_float32_to_u8_##ISA; \
+	(k).interleave_float32   = _simd_interleave_float32_##ISA; \
+	(k).deinterleave_float32 = _simd_deinterleave_float32_##ISA; \
+	(k).transform_points_2d  = _simd_transform_points_2d_##ISA;
+
+void
+simd_kernels_select(Cpu_Isa isa) {
+	Simd_Kernels k = {0};
+	switch (isa) {
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+		case CPU_ISA_AVX2: _SIMD_KERNELS_FILL(k, avx2);  break;
+		case CPU_ISA_SSE2: _SIMD_KERNELS_FILL(k, sse2);  break;
+#endif
+		default:           _SIMD_KERNELS_FILL(k, basic); break;
+	}
+	simd_kernels = k;
+}
+inline Simd_Kernels*
+get_simd_kernels() {
+	get_cpu_dispatch(); // Fills the tables if nobody has yet
+	return &simd_kernels;
+}
+
+// dst[i] = a[i] + b[i]
+inline void
+simd_add_float32_array(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	get_simd_kernels()->add_float32(dst, a, b, count);
+}
+// dst[i] = a[i] - b[i]
+inline void
+simd_sub_float32_array(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	get_simd_kernels()->sub_float32(dst, a, b, count);
+}
+// dst[i] = a[i] * b[i]
+inline void
+simd_mul_float32_array(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	get_simd_kernels()->mul_float32(dst, a, b, count);
+}
+// dst[i] = min(a[i], b[i]), b[i] if either is NaN
+inline void
+simd_min_float32_array(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	get_simd_kernels()->min_float32(dst, a, b, count);
+}
+// dst[i] = max(a[i], b[i]), b[i] if either is NaN
+inline void
+simd_max_float32_array(float32 *dst, const float32 *a, const float32 *b, u64 count) {
+	get_simd_kernels()->max_float32(dst, a, b, count);
+}
+// dst[i] = src[i] * scale
+inline void
+simd_scale_float32_array(float32 *dst, const float32 *src, float32 scale, u64 count) {
+	get_simd_kernels()->scale_float32(dst, src, scale, count);
+}
+// dst[i] = a[i]*b[i] + c[i], rounded twice like the plain C expression
+inline void
+simd_mul_add_float32_array(float32 *dst, const float32 *a, const float32 *b, const float32 *c, u64 count) {
+	get_simd_kernels()->mul_add_float32(dst, a, b, c, count);
+}
+// dst[i] = clamp(src[i], lo, hi), NaN becomes lo
+inline void
+simd_clamp_float32_array(float32 *dst, const float32 *src, float32 lo, float32 hi, u64 count) {
+	get_simd_kernels()->clamp_float32(dst, src, lo, hi, count);
+}
+inline float32
+simd_sum_float32_array(const float32 *src, u64 count) {
+	return get_simd_kernels()->sum_float32(src, count);
+}
+inline float32
+simd_dot_float32_array(const float32 *a, const float32 *b, u64 count) {
+	return get_simd_kernels()->dot_float32(a, b, count);
+}
+// dst[i] = src[0] + ... + src[i]
+inline void
+simd_prefix_sum_float32_array(float32 *dst, const float32 *src, u64 count) {
+	get_simd_kernels()->prefix_sum_float32(dst, src, count);
+}
+
+// s32 math wraps around like unsigned math would
+inline void
+simd_add_s32_array(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	get_simd_kernels()->add_s32(dst, a, b, count);
+}
+inline void
+simd_sub_s32_array(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	get_simd_kernels()->sub_s32(dst, a, b, count);
+}
+// Low 32 bits of the product
+inline void
+simd_mul_s32_array(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	get_simd_kernels()->mul_s32(dst, a, b, count);
+}
+inline void
+simd_min_s32_array(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	get_simd_kernels()->min_s32(dst, a, b, count);
+}
+inline void
+simd_max_s32_array(s32 *dst, const s32 *a, const s32 *b, u64 count) {
+	get_simd_kernels()->max_s32(dst, a, b, count);
+}
+inline void
+simd_clamp_s32_array(s32 *dst, const s32 *src, s32 lo, s32 hi, u64 count) {
+	get_simd_kernels()->clamp_s32(dst, src, lo, hi, count);
+}
+// Summed as s64 so it doesn't overflow
+inline s64
+simd_sum_s32_array(const s32 *src, u64 count) {
+	return get_simd_kernels()->sum_s32(src, count);
+}
+inline void
+simd_prefix_sum_s32_array(s32 *dst, const s32 *src, u64 count) {
+	get_simd_kernels()->prefix_sum_s32(dst, src, count);
+}
+
+// dst[i] = a[i] + b[i], clamped to the s16 range
+inline void
+simd_add_saturate_s16_array(s16 *dst, const s16 *a, const s16 *b, u64 count) {
+	get_simd_kernels()->add_saturate_s16(dst, a, b, count);
+}
+
+// dst[i] = src[i]/32768
+inline void
+simd_convert_s16_to_float32_array(float32 *dst, const s16 *src, u64 count) {
+	get_simd_kernels()->s16_to_float32(dst, src, count);
+}
+// dst[i] = src[i]*32768, truncated and clamped to the s16 range
+inline void
+simd_convert_float32_to_s16_array(s16 *dst, const float32 *src, u64 count) {
+	get_simd_kernels()->float32_to_s16(dst, src, count);
+}
+// dst[i] = src[i]/255
+inline void
+simd_convert_u8_to_float32_array(float32 *dst, const u8 *src, u64 count) {
+	get_simd_kernels()->u8_to_float32(dst, src, count);
+}
+// dst[i] = src[i]*255, rounded and clamped to 0..255
+inline void
+simd_convert_float32_to_u8_array(u8 *dst, const float32 *src, u64 count) {
+	get_simd_kernels()->float32_to_u8(dst, src, count);
+}
+// Two channels into frames: dst = {left[0], right[0], left[1], right[1], ...}
+// left and right may be the same array, dst can't be either of them.
+inline void
+simd_interleave_float32_array(float32 *dst, const float32 *left, const float32 *right, u64 frame_count) {
+	get_simd_kernels()->interleave_float32(dst, left, right, frame_count);
+}
+// Inverse of simd_interleave_float32_array
+inline void
+simd_deinterleave_float32_array(float32 *left, float32 *right, const float32 *src, u64 frame_count) {
+	get_simd_kernels()->deinterleave_float32(left, right, src, frame_count);
+}
+
+// Transforms interleaved x, y points in place, affine is {a, b, c, d, e, f}:
+// x' = a*x + b*y + c
+// y' = d*x + e*y + f
+inline void
+simd_transform_points_2d(float32 *xy, u64 point_count, const float32 *affine) {
+	get_simd_kernels()->transform_points_2d(xy, point_count, affine);
+}
@@ -0,0 +1,476 @@
+/*
+
+	Type specialized sorts.
+
+	The sorts in utility.c take an item size and a compare callback, so every compare is an
+	indirect call and every move is a memcpy of unknown size. These are generated per type
+	instead so compares inline and items move as plain assignments.
+
+	// Once per type at file scope
+	define_sort(sort_entities_by_depth, Entity, entity_depth_less); // LESS(a, b) gets two Entity values
+	define_sort_by_key(sort_quads_by_z, Draw_Quad, quad_z);         // KEY(x) gets an item, compared with <
+	define_radix_sort(radix_sort_quads_by_z, Draw_Quad, s32, quad_z); // Key type u32, s32, f32, u64, s64 or f64
+
+	#define entity_depth_less(a, b) ((a).depth < (b).depth)
+	#define quad_z(q) ((q).z)
+
+	sort_entities_by_depth(entities, count);
+
+	// Needs a buffer of count items. Spreads over worker threads when count is large enough.
+	sort_entities_by_depth_parallel(entities, buffer, count);
+	sort_entities_by_depth_parallel_threads(entities, buffer, count, 4); // Force a thread count
+
+	radix_sort_quads_by_z(quads, buffer, count); // Stable, needs a buffer of count items
+
+	Base types are predefined: sort_u32(items, count), sort_f64_parallel(items, buffer, count),
+	radix_sort_s64(items, buffer, count) and so on for u32, s32, u64, s64, f32 and f64.
+
+	Which one:
+		define_sort is pattern defeating quicksort. It's in place, not stable, O(n log n) worst
+		case (falls back to heapsort) and close to O(n) on sorted, reversed or mostly sorted
+		input. Good default, and the fastest for small arrays.
+
+		define_radix_sort is an LSD radix sort on 8 bit digits. It's stable and O(n) per digit,
+		digits where all keys are equal are skipped. Beats pdqsort from a few thousand items on
+		random keys, especially 32 bit ones.
+
+		_parallel merges the sorted chunks of each thread with merge path splits so every thread
+		does the same amount of work in every round. Threads are started per call, so it only
+		kicks in from SORT_PARALLEL_MIN_ITEMS_PER_THREAD items per thread. Not stable.
+
+	Floats:
+		define_sort compares with <, so -0.0 and 0.0 are equal and NaNs end up anywhere.
+		define_radix_sort sorts by IEEE total order: -NaN < -inf < ... < -0.0 < 0.0 < ... < inf < NaN.
+
+	Note:
+		LESS and KEY may be macros and get evaluated many times, so keep them cheap and without
+		side effects. A function sort_x(items, count) is generated along with some helpers
+		prefixed sort_x_, so the name has to be unique.
+*/
+
+#define SORT_INSERTION_THRESHOLD 24
+#define SORT_NINTHER_THRESHOLD 128
+#define SORT_PARTIAL_INSERTION_LIMIT 8
+#define SORT_RADIX_INSERTION_THRESHOLD 32
+#define SORT_MAX_THREADS 16
+#define SORT_PARALLEL_MIN_ITEMS_PER_THREAD (64*1024)
+
+#define _sort_identity(x) (x)
+#define _sort_less_than(a, b) ((a) < (b))
+#define _sort_swap(T, a, b) do { T _sort_tmp = *(a); *(a) = *(b); *(b) = _sort_tmp; } while (0)
+
+///
+// Parallel merge sort jobs, shared by all generated sorts
+
+typedef struct _Sort_Parallel_Job _Sort_Parallel_Job;
+typedef struct _Sort_Parallel_Task {
+	_Sort_Parallel_Job *job;
+	u64 index;
+} _Sort_Parallel_Task;
+
+typedef struct _Sort_Parallel_Job {
+	void *src;
+	void *dst;
+	u64 bounds[SORT_MAX_THREADS+1]; // Chunk i is [bounds[i], bounds[i+1])
+	u64 thread_count; // Power of two
+	u64 round; // 0 sorts the chunks, round r merges runs of 2^(r-1) chunks
+	void (*proc)(_Sort_Parallel_Task*);
+} _Sort_Parallel_Job;
+
+// Largest power of two thread count that still gives every thread enough items
+u64
+_sort_parallel_thread_count(u64 count) {
+	u64 max_threads = min(os_get_number_of_logical_processors(), SORT_MAX_THREADS);
+	u64 n = 1;
+	while (n*2 <= max_threads && count/(n*2) >= SORT_PARALLEL_MIN_ITEMS_PER_THREAD) n *= 2;
+	return n;
+}
+
+void
+_sort_parallel_thread(Thread *t) {
+	_Sort_Parallel_Task *task = (_Sort_Parallel_Task*)t->data;
+	task->job->proc(task);
+}
+
+// Runs job->proc for every task, task 0 on the calling thread
+void
+_sort_run_parallel(_Sort_Parallel_Job *job) {
+	Thread threads[SORT_MAX_THREADS];
+	_Sort_Parallel_Task tasks[SORT_MAX_THREADS];
+	for (u64 i = 0; i < job->thread_count; i++) {
+		tasks[i].job = job;
+		tasks[i].index = i;
+	}
+	for (u64 i = 1; i < job->thread_count; i++) {
+		os_thread_init(&threads[i], _sort_parallel_thread);
+		threads[i].data = &tasks[i];
+		os_thread_start(&threads[i]);
+	}
+	job->proc(&tasks[0]);
+	for (u64 i = 1; i < job->thread_count; i++) {
+		os_thread_destroy(&threads[i]); // Joins
+	}
+}
+
+///
+// Comparison sort (pdqsort)
+
+#define define_sort(NAME, T, LESS) _define_sort_impl(NAME, T, LESS, _sort_identity)
+#define define_sort_by_key(NAME, T, KEY) _define_sort_impl(NAME, T, _sort_less_than, KEY)
+
+#define _define_sort_impl(NAME, T, LESS, KEY) \
+	/* Unguarded expects an item before begin which is <= all items in [begin, end) */ \
+	void \
+	NAME##_insertion(T *begin, T *end, bool guarded) { \
+		if (begin == end) return; \
+		for (T *current = begin+1; current != end; current++) { \
+			T *sift = current; \
+			T *sift_1 = current-1; \
+			if (LESS(KEY(*sift), KEY(*sift_1))) { \
+				T value = *sift; \
+				do { *sift-- = *sift_1; } while ((!guarded || sift != begin) && LESS(KEY(value), KEY(*--sift_1))); \
+				*sift = value; \
+			} \
+		} \
+	} \
+	/* Gives up if it has to move too many items, so it's cheap to try on maybe sorted input */ \
+	bool \
+	NAME##_partial_insertion(T *begin, T *end) { \
+		if (begin == end) return true; \
+		u64 moved = 0; \
+		for (T *current = begin+1; current != end; current++) { \
+			T *sift = current; \
+			T *sift_1 = current-1; \
+			if (LESS(KEY(*sift), KEY(*sift_1))) { \
+				T value = *sift; \
+				do { *sift-- = *sift_1; } while (sift != begin && LESS(KEY(value), KEY(*--sift_1))); \
+				*sift = value; \
+				moved += (u64)(current-sift); \
+			} \
+			if (moved > SORT_PARTIAL_INSERTION_LIMIT) return false; \
+		} \
+		return true; \
+	} \
+	inline void \
+	NAME##_sort2(T *a, T *b) { \
+		if (LESS(KEY(*b), KEY(*a))) _sort_swap(T, a, b); \
+	} \
+	inline void \
+	NAME##_sort3(T *a, T *b, T *c) { \
+		NAME##_sort2(a, b); \
+		NAME##_sort2(b, c); \
+		NAME##_sort2(a, b); \
+	} \
+	/* Pivot is *begin. Items equal to the pivot go right. */ \
+	T* \
+	NAME##_partition_right(T *begin, T *end, bool *already_partitioned) { \
+		T pivot = *begin; \
+		T *first = begin; \
+		T *last = end; \
+		/* The median of 3 leaves an item >= pivot at the end, so this stops */ \
+		while (LESS(KEY(*++first), KEY(pivot))); \
+		if (first-1 == begin) while (first < last && !LESS(KEY(*--last), KEY(pivot))); \
+		else                  while (!LESS(KEY(*--last), KEY(pivot))); \
+		*already_partitioned = first >= last; \
+		while (first < last) { \
+			_sort_swap(T, first, last); \
+			while (LESS(KEY(*++first), KEY(pivot))); \
+			while (!LESS(KEY(*--last), KEY(pivot))); \
+		} \
+		T *pivot_position = first-1; \
+		*begin = *pivot_position; \
+		*pivot_position = pivot; \
+		return pivot_position; \
+	} \
+	/* Items equal to the pivot go left. Used when the pivot equals the item before the range, */ \
+	/* then they're all done and many duplicates take linear time. */ \
+	T* \
+	NAME##_partition_left(T *begin, T *end) { \
+		T pivot = *begin; \
+		T *first = begin; \
+		T *last = end; \
+		while (LESS(KEY(pivot), KEY(*--last))); \
+		if (last+1 == end) while (first < last && !LESS(KEY(pivot), KEY(*++first))); \
+		else               while (!LESS(KEY(pivot), KEY(*++first))); \
+		while (first < last) { \
+			_sort_swap(T, first, last); \
+			while (LESS(KEY(pivot), KEY(*--last))); \
+			while (!LESS(KEY(pivot), KEY(*++first))); \
+		} \
+		*begin = *last; \
+		*last = pivot; \
+		return last; \
+	} \
+	void \
+	NAME##_sift_down(T *items, u64 root, u64 count) { \
+		T value = items[root]; \
+		while (root*2+1 < count) { \
+			u64 child = root*2+1; \
+			if (child+1 < count && LESS(KEY(items[child]), KEY(items[child+1]))) child += 1; \
+			if (!LESS(KEY(value), KEY(items[child]))) break; \
+			items[root] = items[child]; \
+			root = child; \
+		} \
+		items[root] = value; \
+	} \
+	void \
+	NAME##_heapsort(T *items, u64 count) { \
+		for (u64 i = count/2; i-- > 0;) NAME##_sift_down(items, i, count); \
+		for (u64 i = count; i-- > 1;) { \
+			_sort_swap(T, &items[0], &items[i]); \
+			NAME##_sift_down(items, 0, i); \
+		} \
+	} \
+	void \
+	NAME##_pdqsort_loop(T *begin, T *end, u64 bad_allowed, bool leftmost) { \
+		while (true) { \
+			u64 size = (u64)(end-begin); \
+			if (size < SORT_INSERTION_THRESHOLD) { \
+				NAME##_insertion(begin, end, leftmost); \
+				return; \
+			} \
+			/* Median of 3, or pseudomedian of 9 for large ranges, moved to begin */ \
+			u64 half = size/2; \
+			if (size > SORT_NINTHER_THRESHOLD) { \
+				NAME##_sort3(begin, begin+half, end-1); \
+				NAME##_sort3(begin+1, begin+half-1, end-2); \
+				NAME##_sort3(begin+2, begin+half+1, end-3); \
+				NAME##_sort3(begin+half-1, begin+half, begin+half+1); \
+				_sort_swap(T, begin, begin+half); \
+			} else { \
+				NAME##_sort3(begin+half, begin, end-1); \
+			} \
+			if (!leftmost && !LESS(KEY(*(begin-1)), KEY(*begin))) { \
+				begin = NAME##_partition_left(begin, end)+1; \
+				continue; \
+			} \
+			bool already_partitioned; \
+			T *pivot = NAME##_partition_right(begin, end, &already_partitioned); \
+			u64 left_size = (u64)(pivot-begin); \
+			u64 right_size = (u64)(end-(pivot+1)); \
+			if (left_size < size/8 || right_size < size/8) { \
+				/* Bad split. Too many of those and we switch to heapsort to stay O(n log n), */ \
+				/* otherwise swap some items around to break up patterns. */ \
+				if (--bad_allowed == 0) { \
+					NAME##_heapsort(begin, size); \
+					return; \
+				} \
+				if (left_size >= SORT_INSERTION_THRESHOLD) { \
+					_sort_swap(T, begin, begin+left_size/4); \
+					_sort_swap(T, pivot-1, pivot-left_size/4); \
+					if (left_size > SORT_NINTHER_THRESHOLD) { \
+						_sort_swap(T, begin+1, begin+left_size/4+1); \
+						_sort_swap(T, begin+2, begin+left_size/4+2); \
+						_sort_swap(T, pivot-2, pivot-left_size/4-1); \
+						_sort_swap(T, pivot-3, pivot-left_size/4-2); \
+					} \
+				} \
+				if (right_size >= SORT_INSERTION_THRESHOLD) { \
+					_sort_swap(T, pivot+1, pivot+1+right_size/4); \
+					_sort_swap(T, end-1, end-right_size/4); \
+					if (right_size > SORT_NINTHER_THRESHOLD) { \
+						_sort_swap(T, pivot+2, pivot+2+right_size/4); \
+						_sort_swap(T, pivot+3, pivot+3+right_size/4); \
+						_sort_swap(T, end-2, end-1-right_size/4); \
+						_sort_swap(T, end-3, end-2-right_size/4); \
+					} \
+				} \
+			} else if (already_partitioned \
+			        && NAME##_partial_insertion(begin, pivot) \
+			        && NAME##_partial_insertion(pivot+1, end)) { \
+				/* Looked sorted and was */ \
+				return; \
+			} \
+			NAME##_pdqsort_loop(begin, pivot, bad_allowed, leftmost); \
+			begin = pivot+1; \
+			leftmost = false; \
+		} \
+	} \
+	void \
+	NAME(T *items, u64 count) { \
+		if (count < 2) return; \
+		NAME##_pdqsort_loop(items, items+count, bit_scan_reverse_64(count)+1, true); \
+	} \
+	/* How many items of the merged output come from left, found with a binary search along */ \
+	/* the diagonal. Equal items take left first. */ \
+	u64 \
+	NAME##_merge_split(T *left, u64 left_count, T *right, u64 right_count, u64 diagonal) { \
+		u64 low = diagonal > right_count ? diagonal-right_count : 0; \
+		u64 high = min(diagonal, left_count); \
+		while (low < high) { \
+			u64 i = low + (high-low)/2; \
+			if (LESS(KEY(right[diagonal-i-1]), KEY(left[i]))) high = i; \
+			else low = i+1; \
+		} \
+		return low; \
+	} \
+	void \
+	NAME##_parallel_task(_Sort_Parallel_Task *task) { \
+		_Sort_Parallel_Job *job = task->job; \
+		T *src = (T*)job->src; \
+		T *dst = (T*)job->dst; \
+		u64 t = task->index; \
+		if (job->round == 0) { \
+			u64 begin = job->bounds[t]; \
+			u64 count = job->bounds[t+1]-begin; \
+			if (dst != src) memcpy(dst+begin, src+begin, count*sizeof(T)); \
+			NAME(dst+begin, count); \
+			return; \
+		} \
+		/* This thread does part j of merge m, split so each part outputs the same count */ \
+		u64 width = 1ULL << job->round; \
+		u64 m = t >> job->round; \
+		u64 j = t & (width-1); \
+		u64 left_begin = job->bounds[m*width]; \
+		u64 right_begin = job->bounds[m*width + width/2]; \
+		u64 right_end = job->bounds[m*width + width]; \
+		T *left = src+left_begin; \
+		T *right = src+right_begin; \
+		u64 left_count = right_begin-left_begin; \
+		u64 right_count = right_end-right_begin; \
+		u64 total = left_count+right_count; \
+		u64 out_begin = total*j/width; \
+		u64 out_end = total*(j+1)/width; \
+		u64 li = NAME##_merge_split(left, left_count, right, right_count, out_begin); \
+		u64 ri = out_begin-li; \
+		u64 li_end = NAME##_merge_split(left, left_count, right, right_count, out_end); \
+		u64 ri_end = out_end-li_end; \
+		T *out = dst+left_begin+out_begin; \
+		while (li < li_end && ri < ri_end) { \
+			if (LESS(KEY(right[ri]), KEY(left[li]))) *out++ = right[ri++]; \
+			else                                     *out++ = left[li++]; \
+		} \
+		while (li < li_end) *out++ = left[li++]; \
+		while (ri < ri_end) *out++ = right[ri++]; \
+	} \
+	/* thread_count is rounded down to a power of two, buffer needs room for count items */ \
+	void \
+	NAME##_parallel_threads(T *items, T *buffer, u64 count, u64 thread_count) { \
+		thread_count = clamp(thread_count, 1, SORT_MAX_THREADS); \
+		thread_count = 1ULL << bit_scan_reverse_64(thread_count); \
+		if (thread_count == 1 || count < thread_count*SORT_INSERTION_THRESHOLD) { \
+			NAME(items, count); \
+			return; \
+		} \
+		u64 rounds = bit_scan_reverse_64(thread_count); \
+		_Sort_Parallel_Job job = ZERO(_Sort_Parallel_Job); \
+		job.thread_count = thread_count; \
+		job.proc = NAME##_parallel_task; \
+		for (u64 i = 0; i <= thread_count; i++) job.bounds[i] = count*i/thread_count; \
+		/* Every merge round flips between the two arrays, so start in the buffer if that */ \
+		/* makes us end up in items */ \
+		T *src = items; \
+		T *dst = (rounds % 2) ? buffer : items; \
+		for (u64 round = 0; round <= rounds; round++) { \
+			job.round = round; \
+			job.src = src; \
+			job.dst = dst; \
+			_sort_run_parallel(&job); \
+			src = dst; \
+			dst = (dst == items) ? buffer : items; \
+		} \
+		assert(src == items, "Parallel sort ended up in the wrong buffer"); \
+	} \
+	void \
+	NAME##_parallel(T *items, T *buffer, u64 count) { \
+		NAME##_parallel_threads(items, buffer, count, _sort_parallel_thread_count(count)); \
+	}
+
+///
+// Radix sort
+
+// Keys are mapped to unsigned integers which sort in the same order
+typedef u32 _Radix_Unsigned_u32;
+typedef u32 _Radix_Unsigned_s32;
+typedef u32 _Radix_Unsigned_f32;
+typedef u64 _Radix_Unsigned_u64;
+typedef u64 _Radix_Unsigned_s64;
+typedef u64 _Radix_Unsigned_f64;
+
+inline u32 _radix_key_u32(u32 x) { return x; }
+inline u64 _radix_key_u64(u64 x) { return x; }
+inline u32 _radix_key_s32(s32 x) { return (u32)x ^ 0x80000000u; }
+inline u64 _radix_key_s64(s64 x) { return (u64)x ^ 0x8000000000000000ULL; }
+// Negative floats sort reversed, so flip all their bits. Positive ones just go above them.
+inline u32
+_radix_key_f32(f32 x) {
+	u32 bits;
+	memcpy(&bits, &x, sizeof(bits));
+	return bits ^ ((u32)-(s32)(bits >> 31) | 0x80000000u);
+}
+inline u64
+_radix_key_f64(f64 x) {
+	u64 bits;
+	memcpy(&bits, &x, sizeof(bits));
+	return bits ^ ((u64)-(s64)(bits >> 63) | 0x8000000000000000ULL);
+}
+
+#define define_radix_sort(NAME, T, Key_Type, KEY) \
+	/* Stable, for small counts */ \
+	void \
+	NAME##_insertion(T *items, u64 count) { \
+		for (u64 i = 1; i < count; i++) { \
+			T value = items[i]; \
+			_Radix_Unsigned_##Key_Type key = _radix_key_##Key_Type(KEY(value)); \
+			u64 j = i; \
+			while (j > 0 && key < _radix_key_##Key_Type(KEY(items[j-1]))) { \
+				items[j] = items[j-1]; \
+				j -= 1; \
+			} \
+			items[j] = value; \
+		} \
+	} \
+	void \
+	NAME(T *items, T *buffer, u64 count) { \
+		if (count <= SORT_RADIX_INSERTION_THRESHOLD) { \
+			NAME##_insertion(items, count); \
+			return; \
+		} \
+		const u64 digit_count = sizeof(_Radix_Unsigned_##Key_Type); \
+		/* Histograms of all digits in one pass over the items */ \
+		u64 counts[sizeof(_Radix_Unsigned_##Key_Type)][256]; \
+		memset(counts, 0, sizeof(counts)); \
+		for (u64 i = 0; i < count; i++) { \
+			_Radix_Unsigned_##Key_Type key = _radix_key_##Key_Type(KEY(items[i])); \
+			for (u64 d = 0; d < digit_count; d++) counts[d][(key >> (d*8)) & 0xFF] += 1; \
+		} \
+		_Radix_Unsigned_##Key_Type first_key = _radix_key_##Key_Type(KEY(items[0])); \
+		T *src = items; \
+		T *dst = buffer; \
+		for (u64 d = 0; d < digit_count; d++) { \
+			u64 shift = d*8; \
+			/* All keys have the same digit here, nothing would move */ \
+			if (counts[d][(first_key >> shift) & 0xFF] == count) continue; \
+			u64 offsets[256]; \
+			u64 sum = 0; \
+			for (u64 b = 0; b < 256; b++) { \
+				offsets[b] = sum; \
+				sum += counts[d][b]; \
+			} \
+			for (u64 i = 0; i < count; i++) { \
+				_Radix_Unsigned_##Key_Type key = _radix_key_##Key_Type(KEY(src[i])); \
+				dst[offsets[(key >> shift) & 0xFF]++] = src[i]; \
+			} \
+			T *tmp = src; \
+			src = dst; \
+			dst = tmp; \
+		} \
+		if (src != items) memcpy(items, src, count*sizeof(T)); \
+	}
+
+///
+// Base types
+
+define_sort(sort_u32, u32, _sort_less_than);
+define_sort(sort_s32, s32, _sort_less_than);
+define_sort(sort_u64, u64, _sort_less_than);
+define_sort(sort_s64, s64, _sort_less_than);
+define_sort(sort_f32, f32, _sort_less_than);
+define_sort(sort_f64, f64, _sort_less_than);
+
+define_radix_sort(radix_sort_u32, u32, u32, _sort_identity);
+define_radix_sort(radix_sort_s32, s32, s32, _sort_identity);
+define_radix_sort(radix_sort_u64, u64, u64, _sort_identity);
+define_radix_sort(radix_sort_s64, s64, s64, _sort_identity);
+define_radix_sort(radix_sort_f32, f32, f32, _sort_identity);
+define_radix_sort(radix_sort_f64, f64, f64, _sort_identity);
@@ -72,13 +72,206 @@ temp_convert_to_null_terminated_string(const string s) {
 	char *c = convert_to_null_terminated_string(s, get_temporary_allocator());
 	return c;
 }
+///
+// Search & compare kernels
+//
+// Substring search is the "SIMD-friendly" algorithm from Wojciech Muła: compare a block of
+// positions against both the first and the last byte of sub at once, and only look closer
+// where both match. That rejects nearly every position in one compare, even when the first
+// byte alone is common (spaces, 'e').
+//
+// SSE2 is always there on x64. The AVX2 versions are picked at runtime if the cpu has it,
+// unless the program is compiled with AVX2 in the first place. See Cpu_Dispatch in simd.c.
+//
+
+typedef s64 (*String_Find_Proc)(const u8 *s, u64 count, const u8 *sub, u64 sub_count);
+
+typedef struct String_Kernels {
+	String_Find_Proc find_from_left;
+	String_Find_Proc find_from_right;
+} String_Kernels;
+String_Kernels string_kernels = {0};
+
+// Equality of up to 16 bytes with two overlapping loads instead of a loop
+inline bool
+_bytes_equal_small(const u8 *a, const u8 *b, u64 count) {
+	if (count >= 8) {
+		u64 a0, b0, a1, b1;
+		memcpy(&a0, a, 8); memcpy(&a1, a+count-8, 8);
+		memcpy(&b0, b, 8); memcpy(&b1, b+count-8, 8);
+		return ((a0 ^ b0) | (a1 ^ b1)) == 0;
+	}
+	if (count >= 4) {
+		u32 a0, b0, a1, b1;
+		memcpy(&a0, a, 4); memcpy(&a1, a+count-4, 4);
+		memcpy(&b0, b, 4); memcpy(&b1, b+count-4, 4);
+		return ((a0 ^ b0) | (a1 ^ b1)) == 0;
+	}
+	if (count == 0) return true;
+	// 1-3 bytes: first, middle and last covers all of them
+	return a[0] == b[0] && a[count/2] == b[count/2] && a[count-1] == b[count-1];
+}
+
+s64
+_string_find_from_left_basic(const u8 *s, u64 count, const u8 *sub, u64 sub_count) {
+	for (u64 i = 0; i + sub_count <= count; i++) {
+		if (s[i] == sub[0] && memcmp(s+i, sub, sub_count) == 0) return (s64)i;
+	}
+	return -1;
+}
+s64
+_string_find_from_right_basic(const u8 *s, u64 count, const u8 *sub, u64 sub_count) {
+	for (s64 i = (s64)(count-sub_count); i >= 0; i--) {
+		if (s[i] == sub[0] && memcmp(s+i, sub, sub_count) == 0) return i;
+	}
+	return -1;
+}
+
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+// The candidate positions in mask are checked in order. The first and last byte already matched.
+#define _STRING_FIND_CHECK_FORWARD(block_start) \
+	while (mask) { \
+		u64 position = (block_start) + bit_scan_forward_64(mask); \
+		if (sub_count <= 2 || memcmp(s+position+1, sub+1, sub_count-2) == 0) return (s64)position; \
+		mask &= mask-1; \
+	}
+#define _STRING_FIND_CHECK_BACKWARD(block_start) \
+	while (mask) { \
+		u32 bit = bit_scan_reverse_64(mask); \
+		u64 position = (block_start) + bit; \
+		if (sub_count <= 2 || memcmp(s+position+1, sub+1, sub_count-2) == 0) return (s64)position; \
+		mask &= ~(1ull << bit); \
+	}
+
+s64
+_string_find_from_left_sse2(const u8 *s, u64 count, const u8 *sub, u64 sub_count) {
+	u64 positions = count - sub_count + 1;
+	if (positions < 16) return _string_find_from_left_basic(s, count, sub, sub_count);
+	
+	u64 last = sub_count-1;
+	__m128i first_byte = _mm_set1_epi8((char)sub[0]);
+	__m128i last_byte  = _mm_set1_epi8((char)sub[last]);
+	
+	u64 i = 0;
+	while (true) {
+		__m128i a = _mm_loadu_si128((__m128i*)(s+i));
+		__m128i b = _mm_loadu_si128((__m128i*)(s+i+last));
+		u64 mask = (u32)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first_byte), _mm_cmpeq_epi8(b, last_byte)));
+		_STRING_FIND_CHECK_FORWARD(i);
+		
+		if (i + 16 == positions) break;
+		i += 16;
+		// Last block overlaps the one before, which is fine since nothing matched there
+		if (i + 16 > positions) i = positions - 16;
+	}
+	return -1;
+}
+s64
+_string_find_from_right_sse2(const u8 *s, u64 count, const u8 *sub, u64 sub_count) {
+	u64 positions = count - sub_count + 1;
+	if (positions < 16) return _string_find_from_right_basic(s, count, sub, sub_count);
+	
+	u64 last = sub_count-1;
+	__m128i first_byte = _mm_set1_epi8((char)sub[0]);
+	__m128i last_byte  = _mm_set1_epi8((char)sub[last]);
+	
+	u64 i = positions - 16;
+	while (true) {
+		__m128i a = _mm_loadu_si128((__m128i*)(s+i));
+		__m128i b = _mm_loadu_si128((__m128i*)(s+i+last));
+		u64 mask = (u32)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first_byte), _mm_cmpeq_epi8(b, last_byte)));
+		_STRING_FIND_CHECK_BACKWARD(i);
+		
+		if (i == 0) break;
+		i = i >= 16 ? i - 16 : 0;
+	}
+	return -1;
+}
+
+TARGET_AVX2 s64
+_string_find_from_left_avx2(const u8 *s, u64 count, const u8 *sub, u64 sub_count) {
+	u64 positions = count - sub_count + 1;
+	if (positions < 32) return _string_find_from_left_sse2(s, count, sub, sub_count);
+	
+	u64 last = sub_count-1;
+	__m256i first_byte = _mm256_set1_epi8((char)sub[0]);
+	__m256i last_byte  = _mm256_set1_epi8((char)sub[last]);
+	
+	u64 i = 0;
+	while (true) {
+		__m256i a = _mm256_loadu_si256((__m256i*)(s+i));
+		__m256i b = _mm256_loadu_si256((__m256i*)(s+i+last));
+		u64 mask = (u32)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first_byte), _mm256_cmpeq_epi8(b, last_byte)));
+		_STRING_FIND_CHECK_FORWARD(i);
+		
+		if (i + 32 == positions) break;
+		i += 32;
+		if (i + 32 > positions) i = positions - 32;
+	}
+	return -1;
+}
+TARGET_AVX2 s64
+_string_find_from_right_avx2(const u8 *s, u64 count, const u8 *sub, u64 sub_count) {
+	u64 positions = count - sub_count + 1;
+	if (positions < 32) return _string_find_from_right_sse2(s, count, sub, sub_count);
+	
+	u64 last = sub_count-1;
+	__m256i first_byte = _mm256_set1_epi8((char)sub[0]);
+	__m256i last_byte  = _mm256_set1_epi8((char)sub[last]);
+	
+	u64 i = positions - 32;
+	while (true) {
+		__m256i a = _mm256_loadu_si256((__m256i*)(s+i));
+		__m256i b = _mm256_loadu_si256((__m256i*)(s+i+last));
+		u64 mask = (u32)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first_byte), _mm256_cmpeq_epi8(b, last_byte)));
+		_STRING_FIND_CHECK_BACKWARD(i);
+		
+		if (i == 0) break;
+		i = i >= 32 ? i - 32 : 0;
+	}
+	return -1;
+}
+
+#endif // ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+void
+string_kernels_select(Cpu_Isa isa) {
+	String_Kernels k = {0};
+	switch (isa) {
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+		case CPU_ISA_AVX2:
+			k.find_from_left  = _string_find_from_left_avx2;
+			k.find_from_right = _string_find_from_right_avx2;
+			break;
+		case CPU_ISA_SSE2:
+			k.find_from_left  = _string_find_from_left_sse2;
+			k.find_from_right = _string_find_from_right_sse2;
+			break;
+#endif
+		default:
+			k.find_from_left  = _string_find_from_left_basic;
+			k.find_from_right = _string_find_from_right_basic;
+			break;
+	}
+	string_kernels = k;
+}
+inline String_Kernels*
+get_string_kernels() {
+	get_cpu_dispatch();
+	return &string_kernels;
+}
+
 bool 
 strings_match(string a, string b) {
 	if (a.count != b.count) return false;
 	
 	// Count match, pointer match: they are the same
 	if (a.data == b.data) return true;
+	
+	if (a.count <= 16) return _bytes_equal_small(a.data, b.data, a.count);
 
+	// Measured against 4x unrolled SSE2 & AVX2 compares, the crt memcmp was as fast or faster at every size
 	return memcmp(a.data, b.data, a.count) == 0;
 }
 
@@ -98,25 +291,19 @@ string_view(string s, u64 start_index, u64 count) {
 // Returns first index from left where "sub" matches in "s". Returns -1 if no match is found.
 s64 
 string_find_from_left(string s, string sub) {
-	for (s64 i = 0; i <= s.count-sub.count; i++) {
-		if (strings_match(string_view(s, i, sub.count), sub)) {
-			return i;
-		}
-	}
+	if (s.count < sub.count) return -1;
+	if (sub.count == 0) return 0;
 	
-	return -1;
+	return get_string_kernels()->find_from_left(s.data, s.count, sub.data, sub.count);
 }
 
 // Returns first index from right where "sub" matches in "s" Returns -1 if no match is found.
 s64 
 string_find_from_right(string s, string sub) {
-	for (s64 i = s.count-sub.count; i >= 0 ; i--) {
-		if (strings_match(string_view(s, i, sub.count), sub)) {
-			return i;
-		}
-	}
+	if (s.count < sub.count) return -1;
+	if (sub.count == 0) return (s64)s.count;
 	
-	return -1;
+	return get_string_kernels()->find_from_right(s.data, s.count, sub.data, sub.count);
 }
 
 bool 
@@ -151,12 +338,7 @@ string_builder_reserve(String_Builder *b, u64 required_capacity) {
 	if (b->buffer_capacity >= required_capacity) return;
 	
 	u64 new_capacity = max(b->buffer_capacity*2, (u64)(required_capacity*1.5));
-	u8 *new_buffer = alloc(b->allocator, new_capacity);
-	if (b->buffer) {
-		memcpy(new_buffer, b->buffer, b->count);
-		dealloc(b->allocator, b->buffer);
-	}
-	b->buffer = new_buffer;
+	b->buffer = reallocate(b->allocator, b->buffer, b->count, new_capacity);
 	b->buffer_capacity = new_capacity;
 }
 void 
@@ -165,8 +347,8 @@ string_builder_init_reserve(String_Builder *b, u64 reserved_capacity, Allocator
 	b->allocator = allocator;
 	b->buffer_capacity = 0;
 	b->buffer = 0;
+	b->count = 0; // Before reserving, it's how much reallocate() copies
 	string_builder_reserve(b, reserved_capacity);
-	b->count = 0;
 }
 void 
 string_builder_init(String_Builder *b, Allocator allocator) {
@@ -190,20 +372,22 @@ string
 string_replace_all(string s, string old, string new, Allocator allocator) {
 
 	if (!s.data || !s.count) return string_copy(null_string, allocator);
+	if (old.count == 0) return string_copy(s, allocator);
 
 	String_Builder builder;
 	string_builder_init_reserve(&builder, s.count, allocator);
 	
+	// Append everything between matches at once
 	while (s.count > 0) {
-		if (s.count >= old.count && strings_match(string_view(s, 0, old.count), old)) {
-			if (new.count != 0) string_builder_append(&builder, new);
-			s.data += old.count;
-			s.count -= old.count;
-		} else {
-			string_builder_append(&builder, string_view(s, 0, 1));
-			s.data += 1;
-			s.count -= 1;
+		s64 index = string_find_from_left(s, old);
+		if (index == -1) {
+			string_builder_append(&builder, s);
+			break;
 		}
+		string_builder_append(&builder, (string){(u64)index, s.data});
+		if (new.count != 0) string_builder_append(&builder, new);
+		s.data += index + old.count;
+		s.count -= index + old.count;
 	}
 	
 	return string_builder_get_string(builder);
@@ -4,84 +4,882 @@ inline int crt_sprintf(char *str, const char *format, ...);
 int vsnprintf(char* buffer, size_t n, const char* fmt, va_list args);
 bool is_pointer_valid(void *p);
 
+///
+// Number formatting
+//
+// Integers are written backwards two digits at a time from a table, which halves the
+// number of divisions.
+//
+// %f/%F with a precision up to 17 is formatted natively and exactly (rounded half to even
+// on the exact binary value, like the CRT), as long as value*10^precision fits in 64 bits.
+// That covers pretty much all the %.2f & %.3f we print. Everything else (%e, %g, %a, huge
+// values, inf/nan) goes to the CRT vsnprintf.
+//
+// %r is our own: the shortest decimal which parses back to the same float64, formatted
+// like JavaScript numbers do (0.1, 1e+21, 1.5e-7). Float32 arguments are promoted to
+// float64 by varargs so format them with format_float32_shortest() to get "0.1" rather
+// than "0.10000000149011612".
+//
+// Shortest is Grisu2 (Florian Loitsch, "Printing Floating-Point Numbers Quickly and
+// Accurately with Integers"). It always round trips, and very rarely gives one more
+// digit than strictly needed.
+//
+
+#define FORMAT_FLOAT_SHORTEST_MAX 32
+
+const char _format_digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+const u64 _format_powers_of_ten[20] = {
+	1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull,
+	1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull,
+	100000000000000ull, 1000000000000000ull, 10000000000000000ull, 100000000000000000ull,
+	1000000000000000000ull, 10000000000000000000ull,
+};
+
+// Writes the digits of x so they end right before end. Returns the number of digits.
+inline u64
+format_u64_decimal_backwards(u64 x, char *end) {
+	char *p = end;
+	while (x >= 100) {
+		u64 q = x / 100;
+		u64 r = x - q*100;
+		p -= 2;
+		memcpy(p, &_format_digit_pairs[r*2], 2);
+		x = q;
+	}
+	if (x < 10) {
+		*--p = (char)('0' + x);
+	} else {
+		p -= 2;
+		memcpy(p, &_format_digit_pairs[x*2], 2);
+	}
+	return (u64)(end - p);
+}
+inline u64
+format_u64_hex_backwards(u64 x, char *end, bool upper) {
+	const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	char *p = end;
+	do {
+		*--p = digits[x & 0xF];
+		x >>= 4;
+	} while (x);
+	return (u64)(end - p);
+}
+inline u64
+format_u64_octal_backwards(u64 x, char *end) {
+	char *p = end;
+	do {
+		*--p = (char)('0' + (x & 7));
+		x >>= 3;
+	} while (x);
+	return (u64)(end - p);
+}
+
+// Buffer needs room for 20 characters. Returns number of characters written.
+u64
+format_u64(u64 x, char *buffer) {
+	char temp[20];
+	u64 n = format_u64_decimal_backwards(x, temp+sizeof(temp));
+	memcpy(buffer, temp+sizeof(temp)-n, n);
+	return n;
+}
+// Buffer needs room for 20 characters. Returns number of characters written.
+u64
+format_s64(s64 x, char *buffer) {
+	if (x >= 0) return format_u64((u64)x, buffer);
+	*buffer = '-';
+	return 1 + format_u64(0ull - (u64)x, buffer+1);
+}
+
+inline u64
+_format_float64_bits(float64 x) {
+	u64 bits;
+	memcpy(&bits, &x, sizeof(bits));
+	return bits;
+}
+
+// Formats x with precision digits after the point into buffer (at least 40 characters), without sign.
+// Returns false if it can't be done exactly in 64 bits, in which case the caller needs the CRT.
+bool
+_format_float64_fixed(float64 x, u64 precision, char *buffer, u64 *count) {
+	u64 bits = _format_float64_bits(x);
+	u64 biased_exponent = (bits >> 52) & 0x7FF;
+	u64 mantissa = bits & ((1ull << 52) - 1);
+	
+	if (biased_exponent == 0x7FF || precision > 17) return false;
+	
+	float64 magnitude = x < 0 ? -x : x;
+	if (magnitude * (float64)_format_powers_of_ten[precision] >= 1e19) return false;
+	
+	s64 exponent;
+	if (biased_exponent == 0) {
+		exponent = -1074;
+	} else {
+		mantissa |= 1ull << 52;
+		exponent = (s64)biased_exponent - 1075;
+	}
+	
+	// value * 10^precision = mantissa * 10^precision * 2^exponent, rounded half to even
+	u64 hi;
+	u64 lo = mul_64x64_128(mantissa, _format_powers_of_ten[precision], &hi);
+	u64 rounded;
+	if (exponent >= 0) {
+		// Fits because of the magnitude check
+		rounded = lo << exponent;
+	} else {
+		u64 shift = (u64)(-exponent);
+		if (shift >= 128) {
+			// The product is below 2^110 so this is way under a half
+			rounded = 0;
+		} else {
+			u64 rest_hi, rest_lo, half_hi, half_lo;
+			if (shift >= 64) {
+				u64 s = shift - 64;
+				rounded = s ? hi >> s : hi;
+				rest_hi = s ? hi & ((1ull << s) - 1) : 0;
+				rest_lo = lo;
+				half_hi = s ? 1ull << (s-1) : 0;
+				half_lo = s ? 0 : 1ull << 63;
+			} else {
+				rounded = (lo >> shift) | (hi << (64-shift));
+				rest_hi = 0;
+				rest_lo = lo & ((1ull << shift) - 1);
+				half_hi = 0;
+				half_lo = 1ull << (shift-1);
+			}
+			bool above_half = rest_hi > half_hi || (rest_hi == half_hi && rest_lo > half_lo);
+			bool exactly_half = rest_hi == half_hi && rest_lo == half_lo;
+			if (above_half || (exactly_half && (rounded & 1))) rounded += 1;
+		}
+	}
+	
+	u64 scale = _format_powers_of_ten[precision];
+	u64 integer_part = rounded / scale;
+	u64 fraction_part = rounded - integer_part*scale;
+	
+	u64 n = format_u64(integer_part, buffer);
+	if (precision > 0) {
+		buffer[n++] = '.';
+		char *end = buffer + n + precision;
+		u64 digits = fraction_part ? format_u64_decimal_backwards(fraction_part, end) : 0;
+		memset(buffer + n, '0', precision - digits);
+		n += precision;
+	}
+	*count = n;
+	return true;
+}
+
+// Grisu2
+
+typedef struct _Diy_Fp {
+	u64 f;
+	s32 e;
+} _Diy_Fp;
+
+typedef struct _Cached_Power {
+	u64 f;
+	s32 e;
+	s32 k;
+} _Cached_Power;
+
+// Normalized 10^k for every 8th k, so that for any binary exponent one of these brings
+// the product into [-60, -32]
+const _Cached_Power _format_cached_powers[79] = {
+	{0xAB70FE17C79AC6CAULL, -1060, -300},
+	{0xFF77B1FCBEBCDC4FULL, -1034, -292},
+	{0xBE5691EF416BD60CULL, -1007, -284},
+	{0x8DD01FAD907FFC3CULL,  -980, -276},
+	{0xD3515C2831559A83ULL,  -954, -268},
+	{0x9D71AC8FADA6C9B5ULL,  -927, -260},
+	{0xEA9C227723EE8BCBULL,  -901, -252},
+	{0xAECC49914078536DULL,  -874, -244},
+	{0x823C12795DB6CE57ULL,  -847, -236},
+	{0xC21094364DFB5637ULL,  -821, -228},
+	{0x9096EA6F3848984FULL,  -794, -220},
+	{0xD77485CB25823AC7ULL,  -768, -212},
+	{0xA086CFCD97BF97F4ULL,  -741, -204},
+	{0xEF340A98172AACE5ULL,  -715, -196},
+	{0xB23867FB2A35B28EULL,  -688, -188},
+	{0x84C8D4DFD2C63F3BULL,  -661, -180},
+	{0xC5DD44271AD3CDBAULL,  -635, -172},
+	{0x936B9FCEBB25C996ULL,  -608, -164},
+	{0xDBAC6C247D62A584ULL,  -582, -156},
+	{0xA3AB66580D5FDAF6ULL,  -555, -148},
+	{0xF3E2F893DEC3F126ULL,  -529, -140},
+	{0xB5B5ADA8AAFF80B8ULL,  -502, -132},
+	{0x87625F056C7C4A8BULL,  -475, -124},
+	{0xC9BCFF6034C13053ULL,  -449, -116},
+	{0x964E858C91BA2655ULL,  -422, -108},
+	{0xDFF9772470297EBDULL,  -396, -100},
+	{0xA6DFBD9FB8E5B88FULL,  -369,  -92},
+	{0xF8A95FCF88747D94ULL,  -343,  -84},
+	{0xB94470938FA89BCFULL,  -316,  -76},
+	{0x8A08F0F8BF0F156BULL,  -289,  -68},
+	{0xCDB02555653131B6ULL,  -263,  -60},
+	{0x993FE2C6D07B7FACULL,  -236,  -52},
+	{0xE45C10C42A2B3B06ULL,  -210,  -44},
+	{0xAA242499697392D3ULL,  -183,  -36},
+	{0xFD87B5F28300CA0EULL,  -157,  -28},
+	{0xBCE5086492111AEBULL,  -130,  -20},
+	{0x8CBCCC096F5088CCULL,  -103,  -12},
+	{0xD1B71758E219652CULL,   -77,   -4},
+	{0x9C40000000000000ULL,   -50,    4},
+	{0xE8D4A51000000000ULL,   -24,   12},
+	{0xAD78EBC5AC620000ULL,     3,   20},
+	{0x813F3978F8940984ULL,    30,   28},
+	{0xC097CE7BC90715B3ULL,    56,   36},
+	{0x8F7E32CE7BEA5C70ULL,    83,   44},
+	{0xD5D238A4ABE98068ULL,   109,   52},
+	{0x9F4F2726179A2245ULL,   136,   60},
+	{0xED63A231D4C4FB27ULL,   162,   68},
+	{0xB0DE65388CC8ADA8ULL,   189,   76},
+	{0x83C7088E1AAB65DBULL,   216,   84},
+	{0xC45D1DF942711D9AULL,   242,   92},
+	{0x924D692CA61BE758ULL,   269,  100},
+	{0xDA01EE641A708DEAULL,   295,  108},
+	{0xA26DA3999AEF774AULL,   322,  116},
+	{0xF209787BB47D6B85ULL,   348,  124},
+	{0xB454E4A179DD1877ULL,   375,  132},
+	{0x865B86925B9BC5C2ULL,   402,  140},
+	{0xC83553C5C8965D3DULL,   428,  148},
+	{0x952AB45CFA97A0B3ULL,   455,  156},
+	{0xDE469FBD99A05FE3ULL,   481,  164},
+	{0xA59BC234DB398C25ULL,   508,  172},
+	{0xF6C69A72A3989F5CULL,   534,  180},
+	{0xB7DCBF5354E9BECEULL,   561,  188},
+	{0x88FCF317F22241E2ULL,   588,  196},
+	{0xCC20CE9BD35C78A5ULL,   614,  204},
+	{0x98165AF37B2153DFULL,   641,  212},
+	{0xE2A0B5DC971F303AULL,   667,  220},
+	{0xA8D9D1535CE3B396ULL,   694,  228},
+	{0xFB9B7CD9A4A7443CULL,   720,  236},
+	{0xBB764C4CA7A44410ULL,   747,  244},
+	{0x8BAB8EEFB6409C1AULL,   774,  252},
+	{0xD01FEF10A657842CULL,   800,  260},
+	{0x9B10A4E5E9913129ULL,   827,  268},
+	{0xE7109BFBA19C0C9DULL,   853,  276},
+	{0xAC2820D9623BF429ULL,   880,  284},
+	{0x80444B5E7AA7CF85ULL,   907,  292},
+	{0xBF21E44003ACDD2DULL,   933,  300},
+	{0x8E679C2F5E44FF8FULL,   960,  308},
+	{0xD433179D9C8CB841ULL,   986,  316},
+	{0x9E19DB92B4E31BA9ULL,  1013,  324},
+};
+
+inline _Diy_Fp
+_diy_fp_mul(_Diy_Fp x, _Diy_Fp y) {
+	u64 hi;
+	u64 lo = mul_64x64_128(x.f, y.f, &hi);
+	// Round
+	hi += lo >> 63;
+	return (_Diy_Fp){hi, x.e + y.e + 64};
+}
+
+inline _Diy_Fp
+_diy_fp_normalize(_Diy_Fp x) {
+	u32 shift = 63 - bit_scan_reverse_64(x.f);
+	return (_Diy_Fp){x.f << shift, x.e - (s32)shift};
+}
+
+// Round the last digit towards w while we stay inside the interval
+inline void
+_grisu2_round(char *buffer, u64 count, u64 distance, u64 delta, u64 rest, u64 ten_k) {
+	while (rest < distance && delta - rest >= ten_k
+	    && (rest + ten_k < distance || distance - rest > rest + ten_k - distance)) {
+		buffer[count-1] -= 1;
+		rest += ten_k;
+	}
+}
+
+// Generates the shortest digits in [low, high] closest to w. Returns digit count.
+u64
+_grisu2_digits(char *buffer, s32 *decimal_exponent, _Diy_Fp low, _Diy_Fp w, _Diy_Fp high) {
+	u64 delta = high.f - low.f;
+	u64 distance = high.f - w.f;
+	
+	u32 one_shift = (u32)(-high.e);
+	u64 one = 1ull << one_shift;
+	u32 integral = (u32)(high.f >> one_shift);
+	u64 fraction = high.f & (one - 1);
+	
+	u32 digits = 1;
+	u32 divisor = 1;
+	while (digits < 10 && integral >= divisor*10) {
+		divisor *= 10;
+		digits += 1;
+	}
+	
+	u64 count = 0;
+	while (digits > 0) {
+		u32 d = integral / divisor;
+		integral -= d*divisor;
+		buffer[count++] = (char)('0' + d);
+		digits -= 1;
+		
+		u64 rest = ((u64)integral << one_shift) + fraction;
+		if (rest <= delta) {
+			*decimal_exponent += (s32)digits;
+			_grisu2_round(buffer, count, distance, delta, rest, (u64)divisor << one_shift);
+			return count;
+		}
+		divisor /= 10;
+	}
+	
+	s32 fraction_digits = 0;
+	while (true) {
+		fraction *= 10;
+		buffer[count++] = (char)('0' + (fraction >> one_shift));
+		fraction &= one - 1;
+		delta *= 10;
+		distance *= 10;
+		fraction_digits += 1;
+		if (fraction <= delta) break;
+	}
+	*decimal_exponent -= fraction_digits;
+	_grisu2_round(buffer, count, distance, delta, fraction, one);
+	return count;
+}
+
+// Value is mantissa*2^exponent, with mantissa_bits bits including the hidden one.
+// Returns digit count, value is digits*10^decimal_exponent.
+u64
+_grisu2(u64 mantissa, s32 exponent, bool lower_boundary_is_closer, char *buffer, s32 *decimal_exponent) {
+	_Diy_Fp v = {mantissa, exponent};
+	
+	// Boundaries are halfway to the neighbouring floats
+	_Diy_Fp high = _diy_fp_normalize((_Diy_Fp){v.f*2 + 1, v.e - 1});
+	_Diy_Fp low = lower_boundary_is_closer ? (_Diy_Fp){v.f*4 - 1, v.e - 2} : (_Diy_Fp){v.f*2 - 1, v.e - 1};
+	low.f <<= low.e - high.e;
+	low.e = high.e;
+	v = _diy_fp_normalize(v);
+	
+	// Pick 10^-k so the scaled exponent lands in [-60, -32]
+	s32 f = -60 - high.e - 1;
+	s32 k = (f * 78913) / (1 << 18) + (f > 0);
+	s32 index = (300 + k + 7) / 8;
+	_Cached_Power cached = _format_cached_powers[index];
+	_Diy_Fp c = {cached.f, cached.e};
+	
+	_Diy_Fp w = _diy_fp_mul(v, c);
+	_Diy_Fp w_low = _diy_fp_mul(low, c);
+	_Diy_Fp w_high = _diy_fp_mul(high, c);
+	
+	// Shrink the interval by one unit to account for the rounding error in the multiplies
+	w_low.f += 1;
+	w_high.f -= 1;
+	
+	*decimal_exponent = -cached.k;
+	return _grisu2_digits(buffer, decimal_exponent, w_low, w, w_high);
+}
+
+// digits*10^decimal_exponent in plain notation when the point lands within 21 digits of
+// the first one, like JavaScript does, and scientific otherwise.
+u64
+_format_shortest_digits(char *out, char *digits, u64 digit_count, s32 decimal_exponent) {
+	s32 k = (s32)digit_count;
+	s32 n = k + decimal_exponent; // Position of the decimal point
+	
+	if (k <= n && n <= 21) {
+		// 1234e2 -> 123400
+		memcpy(out, digits, k);
+		memset(out + k, '0', n - k);
+		return n;
+	}
+	if (0 < n && n <= 21) {
+		// 1234e-2 -> 12.34
+		memcpy(out, digits, n);
+		out[n] = '.';
+		memcpy(out + n + 1, digits + n, k - n);
+		return k + 1;
+	}
+	if (-6 < n && n <= 0) {
+		// 1234e-6 -> 0.001234
+		out[0] = '0';
+		out[1] = '.';
+		memset(out + 2, '0', -n);
+		memcpy(out + 2 - n, digits, k);
+		return 2 - n + k;
+	}
+	
+	// 1234e30 -> 1.234e+33
+	u64 count = 0;
+	out[count++] = digits[0];
+	if (k > 1) {
+		out[count++] = '.';
+		memcpy(out + count, digits + 1, k - 1);
+		count += k - 1;
+	}
+	out[count++] = 'e';
+	s32 e = n - 1;
+	out[count++] = e < 0 ? '-' : '+';
+	count += format_u64((u64)(e < 0 ? -e : e), out + count);
+	return count;
+}
+
+// Shortest decimal that parses back to exactly x. Buffer needs FORMAT_FLOAT_SHORTEST_MAX characters.
+u64
+format_float64_shortest(float64 x, char *buffer) {
+	u64 bits = _format_float64_bits(x);
+	u64 biased_exponent = (bits >> 52) & 0x7FF;
+	u64 mantissa = bits & ((1ull << 52) - 1);
+	
+	u64 count = 0;
+	if (bits >> 63) buffer[count++] = '-';
+	
+	if (biased_exponent == 0x7FF) {
+		if (mantissa) {
+			memcpy(buffer, "nan", 3);
+			return 3;
+		}
+		memcpy(buffer + count, "inf", 3);
+		return count + 3;
+	}
+	if (biased_exponent == 0 && mantissa == 0) {
+		buffer[count++] = '0';
+		return count;
+	}
+	
+	s32 exponent;
+	if (biased_exponent == 0) {
+		exponent = -1074;
+	} else {
+		mantissa |= 1ull << 52;
+		exponent = (s32)biased_exponent - 1075;
+	}
+	
+	char digits[20];
+	s32 decimal_exponent;
+	bool lower_boundary_is_closer = (bits & ((1ull << 52) - 1)) == 0 && biased_exponent > 1;
+	u64 digit_count = _grisu2(mantissa, exponent, lower_boundary_is_closer, digits, &decimal_exponent);
+	
+	return count + _format_shortest_digits(buffer + count, digits, digit_count, decimal_exponent);
+}
+// Shortest decimal that parses back to exactly x as a float32. Buffer needs FORMAT_FLOAT_SHORTEST_MAX characters.
+u64
+format_float32_shortest(float32 x, char *buffer) {
+	u32 bits;
+	memcpy(&bits, &x, sizeof(bits));
+	u32 biased_exponent = (bits >> 23) & 0xFF;
+	u32 mantissa = bits & ((1u << 23) - 1);
+	
+	if (biased_exponent == 0xFF || (biased_exponent == 0 && mantissa == 0)) {
+		return format_float64_shortest((float64)x, buffer);
+	}
+	
+	u64 count = 0;
+	if (bits >> 31) buffer[count++] = '-';
+	
+	s32 exponent;
+	if (biased_exponent == 0) {
+		exponent = -149;
+	} else {
+		mantissa |= 1u << 23;
+		exponent = (s32)biased_exponent - 150;
+	}
+	
+	char digits[20];
+	s32 decimal_exponent;
+	bool lower_boundary_is_closer = (bits & ((1u << 23) - 1)) == 0 && biased_exponent > 1;
+	u64 digit_count = _grisu2(mantissa, exponent, lower_boundary_is_closer, digits, &decimal_exponent);
+	
+	return count + _format_shortest_digits(buffer + count, digits, digit_count, decimal_exponent);
+}
+
+///
+// Format output
+//
+// Either a fixed buffer which gets truncated (or no buffer, to just count), or a
+// String_Builder which grows as we go so we only format once.
+//
+
+typedef struct Format_Output {
+	char *buffer;
+	u64 count; // Everything formatted, including what didn't fit
+	u64 capacity;
+	String_Builder *builder;
+	// Arguments might point into the builder, so the buffer it had when we started is only
+	// freed once we're done formatting.
+	u8 *builder_original_buffer;
+} Format_Output;
+
+void
+_format_output_grow(Format_Output *o, u64 required) {
+	String_Builder *b = o->builder;
+	b->count = o->count;
+	// +1 so there's always room for a null terminator
+	if (b->buffer && b->buffer == o->builder_original_buffer && b->buffer_capacity < required+1) {
+		// Same as string_builder_reserve(), but copy rather than reallocate so the old buffer stays
+		u64 new_capacity = max(b->buffer_capacity*2, (u64)((required+1)*1.5));
+		u8 *new_buffer = (u8*)alloc(b->allocator, new_capacity);
+		memcpy(new_buffer, b->buffer, b->count);
+		b->buffer = new_buffer;
+		b->buffer_capacity = new_capacity;
+	} else {
+		string_builder_reserve(b, required+1);
+	}
+	o->buffer = (char*)b->buffer;
+	o->capacity = b->buffer_capacity-1;
+}
+
+inline void
+_format_write(Format_Output *o, const void *data, u64 n) {
+	if (o->count+n > o->capacity) {
+		if (o->builder) _format_output_grow(o, o->count+n);
+		else {
+			u64 fits = o->count < o->capacity ? o->capacity-o->count : 0;
+			if (o->buffer) memcpy(o->buffer+o->count, data, fits);
+			o->count += n;
+			return;
+		}
+	}
+	if (o->buffer) memcpy(o->buffer+o->count, data, n);
+	o->count += n;
+}
+inline void
+_format_write_repeat(Format_Output *o, char c, u64 n) {
+	if (o->count+n > o->capacity) {
+		if (o->builder) _format_output_grow(o, o->count+n);
+		else {
+			u64 fits = o->count < o->capacity ? o->capacity-o->count : 0;
+			if (o->buffer) memset(o->buffer+o->count, c, fits);
+			o->count += n;
+			return;
+		}
+	}
+	if (o->buffer) memset(o->buffer+o->count, c, n);
+	o->count += n;
+}
+
+#define FORMAT_FLAG_LEFT    (1 << 0)
+#define FORMAT_FLAG_PLUS    (1 << 1)
+#define FORMAT_FLAG_SPACE   (1 << 2)
+#define FORMAT_FLAG_ALT     (1 << 3)
+#define FORMAT_FLAG_ZERO    (1 << 4)
+
+// Prefix (sign, 0x), then zeros, then body, padded out to width
+void
+_format_write_padded(Format_Output *o, u32 flags, s64 width, const char *prefix, u64 prefix_count, u64 zeros, const char *body, u64 body_count) {
+	u64 total = prefix_count + zeros + body_count;
+	u64 padding = width > 0 && (u64)width > total ? (u64)width - total : 0;
+	
+	if (flags & FORMAT_FLAG_LEFT) {
+		_format_write(o, prefix, prefix_count);
+		_format_write_repeat(o, '0', zeros);
+		_format_write(o, body, body_count);
+		_format_write_repeat(o, ' ', padding);
+	} else if (flags & FORMAT_FLAG_ZERO) {
+		_format_write(o, prefix, prefix_count);
+		_format_write_repeat(o, '0', zeros + padding);
+		_format_write(o, body, body_count);
+	} else {
+		_format_write_repeat(o, ' ', padding);
+		_format_write(o, prefix, prefix_count);
+		_format_write_repeat(o, '0', zeros);
+		_format_write(o, body, body_count);
+	}
+}
+
+u64
+_format_sign(char *prefix, bool negative, u32 flags) {
+	if (negative)                  { prefix[0] = '-'; return 1; }
+	if (flags & FORMAT_FLAG_PLUS)  { prefix[0] = '+'; return 1; }
+	if (flags & FORMAT_FLAG_SPACE) { prefix[0] = ' '; return 1; }
+	return 0;
+}
+
+void
+_format_integer(Format_Output *o, u64 value, bool negative, char conversion, u32 flags, s64 width, s64 precision) {
+	char digits[24];
+	char *end = digits + sizeof(digits);
+	u64 digit_count;
+	char prefix[2];
+	u64 prefix_count = 0;
+	
+	switch (conversion) {
+		case 'x': case 'X':
+			digit_count = format_u64_hex_backwards(value, end, conversion == 'X');
+			if ((flags & FORMAT_FLAG_ALT) && value) {
+				prefix[0] = '0';
+				prefix[1] = conversion;
+				prefix_count = 2;
+			}
+			break;
+		case 'o':
+			digit_count = format_u64_octal_backwards(value, end);
+			break;
+		case 'p':
+			digit_count = format_u64_hex_backwards(value, end, false);
+			prefix[0] = '0';
+			prefix[1] = 'x';
+			prefix_count = 2;
+			break;
+		case 'd': case 'i':
+			prefix_count = _format_sign(prefix, negative, flags);
+			digit_count = format_u64_decimal_backwards(value, end);
+			break;
+		default:
+			digit_count = format_u64_decimal_backwards(value, end);
+			break;
+	}
+	
+	// Precision is the minimum digit count, and 0 with 0 precision prints nothing
+	u64 zeros = 0;
+	if (precision >= 0) {
+		flags &= ~FORMAT_FLAG_ZERO;
+		if (precision == 0 && value == 0) digit_count = 0;
+		if ((u64)precision > digit_count) zeros = (u64)precision - digit_count;
+	}
+	if (conversion == 'o' && (flags & FORMAT_FLAG_ALT) && zeros == 0 && (digit_count == 0 || *(end-digit_count) != '0')) {
+		zeros = 1;
+	}
+	
+	_format_write_padded(o, flags, width, prefix, prefix_count, zeros, end-digit_count, digit_count);
+}
+
+int _format_crt_snprintf(char *buffer, u64 count, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	int r = vsnprintf(buffer, count, fmt, args);
+	va_end(args);
+	return r;
+}
+
+// Formats fmt into o. This is the one place formatting happens, everything else wraps it.
+void
+_format_string(Format_Output *o, const char *fmt, va_list args) {
+	const char *p = fmt;
+	while (*p != '\0') {
+		
+		// Copy everything up to the next % at once
+		const char *literal = p;
+		while (*p != '\0' && *p != '%') p += 1;
+		if (p != literal) _format_write(o, literal, (u64)(p-literal));
+		if (*p == '\0') break;
+		
+		const char *spec_start = p;
+		p += 1;
+		
+		// Fast path for plain %s which is by far the most common
+		if (*p == 's') {
+			// We replace %s formatting with our fixed length string
+			p += 1;
+			string s = va_arg(args, string);
+			assert(s.count < (1024ULL*1024ULL*1024ULL*256ULL), "Ypu passed something else than a fixed-length 'string' to %%s. Maybe you passed a char* and should do %%cs instead?");
+			_format_write(o, s.data, s.count);
+			continue;
+		}
+		
+		u32 flags = 0;
+		while (true) {
+			if      (*p == '-') flags |= FORMAT_FLAG_LEFT;
+			else if (*p == '+') flags |= FORMAT_FLAG_PLUS;
+			else if (*p == ' ') flags |= FORMAT_FLAG_SPACE;
+			else if (*p == '#') flags |= FORMAT_FLAG_ALT;
+			else if (*p == '0') flags |= FORMAT_FLAG_ZERO;
+			else break;
+			p += 1;
+		}
+		
+		s64 width = -1;
+		if (*p == '*') {
+			width = va_arg(args, int);
+			if (width < 0) {
+				flags |= FORMAT_FLAG_LEFT;
+				width = -width;
+			}
+			p += 1;
+		} else if (*p >= '0' && *p <= '9') {
+			width = 0;
+			while (*p >= '0' && *p <= '9') width = width*10 + (*p++ - '0');
+		}
+		
+		s64 precision = -1;
+		if (*p == '.') {
+			p += 1;
+			if (*p == '*') {
+				precision = va_arg(args, int);
+				if (precision < 0) precision = -1;
+				p += 1;
+			} else {
+				precision = 0;
+				while (*p >= '0' && *p <= '9') precision = precision*10 + (*p++ - '0');
+			}
+		}
+		
+		// Size of the argument in bytes, 0 for int
+		u32 size = 0;
+		bool long_double = false;
+		switch (*p) {
+			case 'h': p += 1; if (*p == 'h') { size = 1; p += 1; } else size = 2; break;
+			case 'l': p += 1; if (*p == 'l') { size = 8; p += 1; } else size = sizeof(long); break;
+			case 'z': case 'j': case 't': p += 1; size = 8; break;
+			case 'L': p += 1; long_double = true; break;
+			default: break;
+		}
+		
+		if (flags & FORMAT_FLAG_LEFT) flags &= ~FORMAT_FLAG_ZERO;
+		
+		char conversion = *p;
+		if (conversion != '\0') p += 1;
+		
+		switch (conversion) {
+			case 'd': case 'i': {
+				s64 value;
+				if      (size == 8) value = va_arg(args, long long);
+				else if (size == 4) value = va_arg(args, long);
+				else                value = va_arg(args, int);
+				if (size == 1) value = (s8)value;
+				if (size == 2) value = (s16)value;
+				u64 magnitude = value < 0 ? 0ull - (u64)value : (u64)value;
+				_format_integer(o, magnitude, value < 0, conversion, flags, width, precision);
+				break;
+			}
+			case 'u': case 'x': case 'X': case 'o': {
+				u64 value;
+				if      (size == 8) value = va_arg(args, unsigned long long);
+				else if (size == 4) value = va_arg(args, unsigned long);
+				else                value = va_arg(args, unsigned int);
+				if (size == 1) value = (u8)value;
+				if (size == 2) value = (u16)value;
+				_format_integer(o, value, false, conversion, flags, width, precision);
+				break;
+			}
+			case 'p': {
+				void *value = va_arg(args, void*);
+				_format_integer(o, (u64)value, false, conversion, flags & ~FORMAT_FLAG_ZERO, width, -1);
+				break;
+			}
+			case 'c': {
+				if (*p == 's') {
+					// We extend the standard formatting and add %cs so we can format c strings if we need to
+					p += 1;
+					char* s = va_arg(args, char*);
+					u64 len = 0;
+					while (s[len] != '\0' && (precision < 0 || len < (u64)precision)) {
+						len += 1;
+						assert(len < (1024ULL*1024ULL*1024ULL*1ULL), "The argument passed to %%cs is either way too big, missing null-termination or simply not a char*.");
+					}
+					_format_write_padded(o, flags & ~FORMAT_FLAG_ZERO, width, 0, 0, 0, s, len);
+				} else {
+					char c = (char)va_arg(args, int);
+					_format_write_padded(o, flags & ~FORMAT_FLAG_ZERO, width, 0, 0, 0, &c, 1);
+				}
+				break;
+			}
+			case 's': {
+				string s = va_arg(args, string);
+				assert(s.count < (1024ULL*1024ULL*1024ULL*256ULL), "Ypu passed something else than a fixed-length 'string' to %%s. Maybe you passed a char* and should do %%cs instead?");
+				u64 len = precision >= 0 && (u64)precision < s.count ? (u64)precision : s.count;
+				_format_write_padded(o, flags & ~FORMAT_FLAG_ZERO, width, 0, 0, 0, (char*)s.data, len);
+				break;
+			}
+			case 'r': {
+				float64 value = va_arg(args, float64);
+				char body[FORMAT_FLOAT_SHORTEST_MAX];
+				u64 count = format_float64_shortest(value, body);
+				char *digits = body;
+				char prefix[1];
+				u64 prefix_count;
+				if (body[0] == '-') {
+					prefix[0] = '-';
+					prefix_count = 1;
+					digits += 1;
+					count -= 1;
+				} else {
+					prefix_count = _format_sign(prefix, false, flags);
+				}
+				if (digits[0] == 'n' || digits[0] == 'i') flags &= ~FORMAT_FLAG_ZERO;
+				_format_write_padded(o, flags, width, prefix, prefix_count, 0, digits, count);
+				break;
+			}
+			case 'n': {
+				int *out = va_arg(args, int*);
+				*out = (int)o->count;
+				break;
+			}
+			case '%': {
+				_format_write(o, "%", 1);
+				break;
+			}
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+				long double long_value = 0;
+				float64 value = 0;
+				if (long_double) long_value = va_arg(args, long double);
+				else             value = va_arg(args, float64);
+				
+				if (!long_double && (conversion == 'f' || conversion == 'F')) {
+					char body[48];
+					u64 count;
+					if (_format_float64_fixed(value, precision < 0 ? 6 : (u64)precision, body, &count)) {
+						if (precision == 0 && (flags & FORMAT_FLAG_ALT)) body[count++] = '.';
+						char prefix[1];
+						u64 prefix_count = _format_sign(prefix, (_format_float64_bits(value) >> 63) != 0, flags);
+						_format_write_padded(o, flags, width, prefix, prefix_count, 0, body, count);
+						break;
+					}
+				}
+				
+				// Fallback to the CRT. The specifier is rebuilt because * width/precision were already consumed.
+				char specifier[64];
+				u64 n = 0;
+				specifier[n++] = '%';
+				if (flags & FORMAT_FLAG_LEFT)  specifier[n++] = '-';
+				if (flags & FORMAT_FLAG_PLUS)  specifier[n++] = '+';
+				if (flags & FORMAT_FLAG_SPACE) specifier[n++] = ' ';
+				if (flags & FORMAT_FLAG_ALT)   specifier[n++] = '#';
+				if (flags & FORMAT_FLAG_ZERO)  specifier[n++] = '0';
+				if (width >= 0) n += format_u64((u64)width, specifier+n);
+				if (precision >= 0) {
+					specifier[n++] = '.';
+					n += format_u64((u64)precision, specifier+n);
+				}
+				if (long_double) specifier[n++] = 'L';
+				specifier[n++] = conversion;
+				specifier[n] = '\0';
+				
+				char temp_buffer[512];
+				int temp_len = long_double
+				             ? _format_crt_snprintf(temp_buffer, sizeof(temp_buffer), specifier, long_value)
+				             : _format_crt_snprintf(temp_buffer, sizeof(temp_buffer), specifier, value);
+				if (temp_len > 0) _format_write(o, temp_buffer, min((u64)temp_len, sizeof(temp_buffer)-1));
+				break;
+			}
+			default: {
+				// Not a specifier we know, print it as is
+				_format_write(o, spec_start, (u64)(p-spec_start));
+				break;
+			}
+		}
+	}
+}
+
 u64 format_string_to_buffer(char* buffer, u64 count, const char* fmt, va_list args) {
-	if (!buffer) count = UINT64_MAX;
-    const char* p = fmt;
-    char* bufp = buffer;
-    while (*p != '\0' && (bufp - buffer) < count - 1) {
-        if (*p == '%') {
-            p += 1;
-            if (*p == 's') {
-            	// We replace %s formatting with our fixed length string
-                p += 1;
-                string s = va_arg(args, string);
-                assert(s.count < (1024ULL*1024ULL*1024ULL*256ULL), "Ypu passed something else than a fixed-length 'string' to %%s. Maybe you passed a char* and should do %%cs instead?");
-                for (u64 i = 0; i < s.count && (bufp - buffer) < count - 1; i++) {
-                	if (buffer) *bufp = s.data[i];
-                    bufp += 1;
-                }
-            } else if (*p == 'c' && *(p+1) == 's') {
-            	// We extend the standard formatting and add %cs so we can format c strings if we need to
-                p += 2;
-                char* s = va_arg(args, char*);
-                u64 len = 0;
-                while (*s != '\0' && (bufp - buffer) < count - 1) {
-                	assert(len < (1024ULL*1024ULL*1024ULL*1ULL), "The argument passed to %%cs is either way too big, missing null-termination or simply not a char*.");
-                	if (buffer) {
-                		*bufp = *s;
-                	}
-                	s += 1;
-                    bufp += 1;
-                    len += 1;
-                    assert(len < (1024ULL*1024ULL*1024ULL*1ULL), "The argument passed to %%cs is either way too big, missing null-termination or simply not a char*.");
-                }
-            } else {
-                // Fallback to standard vsnprintf
-                char temp_buffer[512];
-                char format_specifier[64];
-                int specifier_len = 0;
-                format_specifier[specifier_len++] = '%';
-
-                while (*p != '\0' && strchr("diuoxXfFeEgGaAcCpn%", *p) == NULL) {
-                    format_specifier[specifier_len++] = *p++;
-                }
-                if (*p != '\0') {
-                    format_specifier[specifier_len++] = *p++;
-                }
-                format_specifier[specifier_len] = '\0';
-
-                int temp_len = vsnprintf(temp_buffer, sizeof(temp_buffer), format_specifier, args);
-                switch (format_specifier[specifier_len - 1]) {
-                    case 'd': case 'i': va_arg(args, int); break;
-                    case 'u': case 'x': case 'X': case 'o': va_arg(args, unsigned int); break;
-                    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': va_arg(args, double); break;
-                    case 'c': va_arg(args, int); break;
-                    case 's': va_arg(args, char*); break;
-                    case 'p': va_arg(args, void*); break;
-                    case 'n': va_arg(args, int*); break;
-                    default: break;
-                }
-
-                if (temp_len < 0) {
-                    return -1; // Error in formatting
-                }
-
-                for (int i = 0; i < temp_len && (bufp - buffer) < count - 1; i++) {
-                    if (buffer) *bufp = temp_buffer[i];
-                    bufp += 1;
-                }
-            }
-        } else {
-            if (buffer) {
-                *bufp = *p;
-            }
-            bufp += 1;
-            p += 1;
-        }
-    }
-    if (buffer)  *bufp = '\0';
-    
-    return bufp - buffer;
+	Format_Output o = ZERO(Format_Output);
+	o.buffer = buffer;
+	if (buffer) {
+		if (count == 0) return 0;
+		o.capacity = count-1;
+	} else {
+		o.capacity = UINT64_MAX;
+	}
+	
+	_format_string(&o, fmt, args);
+	
+	if (!buffer) return o.count;
+	
+	u64 written = min(o.count, o.capacity);
+	buffer[written] = '\0';
+	return written;
 }
 u64 format_string_to_buffer_va(char* buffer, u64 count, const char* fmt, ...) {
 	va_list args;
@@ -110,21 +908,43 @@ string sprint_va_list_to_buffer(const string fmt, va_list args, void* buffer, u6
 	return sprint_null_terminated_string_va_list_to_buffer(fmt_cstring, args, buffer, buffer_size);
 }
 
+// Most strings fit on the stack, so we format once and copy into an exact allocation.
+// Only longer strings are formatted a second time.
+string sprint_null_terminated_string_va_list(Allocator allocator, const char *fmt, va_list args) {
+	char stack_buffer[1024];
+	
+	va_list args_copy;
+	va_copy(args_copy, args);
+	Format_Output o = ZERO(Format_Output);
+	o.buffer = stack_buffer;
+	o.capacity = sizeof(stack_buffer);
+	_format_string(&o, fmt, args_copy);
+	va_end(args_copy);
+	
+	string result;
+	result.count = o.count;
+	result.data = (u8*)alloc(allocator, o.count+1);
+	
+	if (o.count <= o.capacity) {
+		memcpy(result.data, stack_buffer, o.count);
+	} else {
+		Format_Output exact = ZERO(Format_Output);
+		exact.buffer = (char*)result.data;
+		exact.capacity = o.count;
+		_format_string(&exact, fmt, args);
+	}
+	result.data[result.count] = '\0';
+	
+	return result;
+}
 string sprint_va_list(Allocator allocator, const string fmt, va_list args) {
-
-    char* fmt_cstring = temp_convert_to_null_terminated_string(fmt);
-    u64 count = format_string_to_buffer(NULL, 0, fmt_cstring, args) + 1; 
-
-    char* buffer = NULL;
-
-    buffer = (char*)alloc(allocator, count);
-
-    return sprint_null_terminated_string_va_list_to_buffer(fmt_cstring, args, buffer, count);
+	char* fmt_cstring = temp_convert_to_null_terminated_string(fmt);
+	return sprint_null_terminated_string_va_list(allocator, fmt_cstring, args);
 }
 
 
 string sprints(Allocator allocator, const string fmt, ...) {
-	va_list args = 0;
+	va_list args;
 	va_start(args, fmt);
 	string s = sprint_va_list(allocator, fmt, args);
 	va_end(args);
@@ -133,7 +953,7 @@ string sprints(Allocator allocator, const string fmt, ...) {
 
 // temp allocator
 string tprints(const string fmt, ...) {
-	va_list args = 0;
+	va_list args;
 	va_start(args, fmt);
 	string s = sprint_va_list(get_temporary_allocator(), fmt, args);
 	va_end(args);
@@ -142,26 +962,18 @@ string tprints(const string fmt, ...) {
 
 
 string sprintf(Allocator allocator, const char *fmt, ...) {
-	string sfmt;
-	sfmt.data = cast(u8*)fmt;
-	sfmt.count = strlen(fmt);
-	
 	va_list args;
 	va_start(args, fmt);
-	string s = sprint_va_list(allocator, sfmt, args);
+	string s = sprint_null_terminated_string_va_list(allocator, fmt, args);
 	va_end(args);
 	
 	return s;
 }
 // temp allocator
 string tprintf(const char *fmt, ...) {
-	string sfmt;
-	sfmt.data = cast(u8*)fmt;
-	sfmt.count = strlen(fmt);
-	
 	va_list args;
 	va_start(args, fmt);
-	string s = sprint_va_list(get_temporary_allocator(), sfmt, args);
+	string s = sprint_null_terminated_string_va_list(get_temporary_allocator(), fmt, args);
 	va_end(args);
 	
 	return s;
@@ -233,43 +1045,39 @@ typedef void(*Logger_Proc)(Log_Level level, string s);
 
 
 
-void string_builder_prints(String_Builder *b, string fmt, ...) {
+// Formats straight into the builder, growing it as needed.
+// It's fine to pass strings pointing into the builder itself, like its result so far.
+void string_builder_print_va_list(String_Builder *b, const char *fmt, va_list args) {
 	assert(b->allocator.proc, "String_Builder is missing allocator");
 	
-	va_list args1 = 0;
-	va_start(args1, fmt);
-	va_list args2 = 0;
-	va_copy(args2, args1);
-	
-	u64 formatted_count = format_string_to_buffer(0, 0, temp_convert_to_null_terminated_string(fmt), args1);
+	Format_Output o = ZERO(Format_Output);
+	o.buffer = (char*)b->buffer;
+	o.count = b->count;
+	o.capacity = b->buffer_capacity ? b->buffer_capacity-1 : 0;
+	o.builder = b;
+	o.builder_original_buffer = b->buffer;
 	
-	va_end(args1);
+	_format_string(&o, fmt, args);
 	
-	string_builder_reserve(b, b->count+formatted_count+1);
+	if (o.count+1 > b->buffer_capacity) _format_output_grow(&o, o.count);
+	b->count = o.count;
+	b->buffer[b->count] = '\0';
 	
-	format_string_to_buffer((char*)b->buffer+b->count, b->count+formatted_count+1, temp_convert_to_null_terminated_string(fmt), args2);
-	b->count += formatted_count;
-	
-	va_end(args2);
+	if (o.builder_original_buffer && b->buffer != o.builder_original_buffer) {
+		dealloc(b->allocator, o.builder_original_buffer);
+	}
+}
+void string_builder_prints(String_Builder *b, string fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	string_builder_print_va_list(b, temp_convert_to_null_terminated_string(fmt), args);
+	va_end(args);
 }
 void string_builder_printf(String_Builder *b, const char *fmt, ...) {
-	assert(b->allocator.proc, "String_Builder is missing allocator");
-	
-	va_list args1 = 0;
-	va_start(args1, fmt);
-	va_list args2 = 0;
-	va_copy(args2, args1);
-	
-	u64 formatted_count = format_string_to_buffer(0, 0, fmt, args1);
-	
-	va_end(args1);
-	
-	string_builder_reserve(b, b->count+formatted_count+1);
-	
-	format_string_to_buffer((char*)b->buffer+b->count, b->buffer_capacity-b->count+1, fmt, args2);
-	b->count += formatted_count;
-	
-	va_end(args2);
+	va_list args;
+	va_start(args, fmt);
+	string_builder_print_va_list(b, fmt, args);
+	va_end(args);
 }
 
 #define string_builder_print(...) _Generic((SECOND_ARG(__VA_ARGS__)), \
@@ -0,0 +1,252 @@
+/*
+
+	String interning
+
+	Maps strings to dense u32 ids (0, 1, 2, ...) in the order they are first interned. The
+	bytes are copied once into storage which never moves, so an interned string stays valid
+	until the interner is destroyed, and two interned strings are equal if their ids are.
+	Ids hash with the plain integer hash so they make cheap hash table keys.
+
+	Looking up a string that's already interned doesn't lock. The table is open addressing
+	with one u64 per slot (high 32 bits of the hash | id+1), written with a single store after
+	the entry it refers to is in place. Growing fills a new table before publishing it, and
+	old tables stay readable until the interner is destroyed. A lookup that misses takes the
+	lock and looks again before adding.
+
+	A zeroed String_Interner is ready to use.
+
+	intern_string() and get_interned_string() use one global interner. Make your own
+	String_Interner when ids should stay dense for one system, like the profiler does for
+	its scope names.
+
+		String_Id id = intern_string(path);
+		string same = get_interned_string(id); // Same bytes, no copy
+
+		String_Id other;
+		if (find_interned_string(STR("player.png"), &other) && other == id) ...
+
+*/
+
+typedef u32 String_Id;
+
+#define STRING_INTERNER_CHUNK_SIZE 4096
+#define STRING_INTERNER_MAX_CHUNKS 1024
+#define STRING_INTERNER_MAX_COUNT (STRING_INTERNER_CHUNK_SIZE*STRING_INTERNER_MAX_CHUNKS)
+
+typedef struct String_Interner_Entry {
+	string s;
+	u64 hash;
+} String_Interner_Entry;
+
+typedef struct String_Interner_Table String_Interner_Table;
+typedef struct String_Interner_Table {
+	u64 capacity; // Power of two
+	String_Interner_Table *previous;
+	// u64 slots[capacity] follow
+} String_Interner_Table;
+
+typedef struct String_Interner_Storage String_Interner_Storage;
+typedef struct String_Interner_Storage {
+	String_Interner_Storage *previous;
+	u64 size;
+	// Bytes follow
+} String_Interner_Storage;
+
+typedef struct String_Interner {
+	Spinlock lock; // Only taken to add
+	String_Interner_Table * volatile table;
+	String_Interner_Entry * volatile chunks[STRING_INTERNER_MAX_CHUNKS];
+	volatile u64 count;
+
+	String_Interner_Storage *storage;
+	u64 storage_used;
+} String_Interner;
+
+// Returns the id of s, adding it if it's not interned yet. Safe from any thread.
+ogb_instance String_Id
+string_intern(String_Interner *interner, string s);
+
+// False if s isn't interned. Never adds or locks.
+ogb_instance bool
+string_interner_find(String_Interner *interner, string s, String_Id *id);
+
+ogb_instance string
+string_interner_get(String_Interner *interner, String_Id id);
+
+// Frees everything. No other thread may be using the interner.
+ogb_instance void
+string_interner_destroy(String_Interner *interner);
+
+// #Global
+ogb_instance String_Interner global_string_interner;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+String_Interner global_string_interner = {0};
+#endif
+
+inline String_Id
+intern_string(string s) {
+	return string_intern(&global_string_interner, s);
+}
+inline bool
+find_interned_string(string s, String_Id *id) {
+	return string_interner_find(&global_string_interner, s, id);
+}
+inline string
+get_interned_string(String_Id id) {
+	return string_interner_get(&global_string_interner, id);
+}
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
+#define _STRING_INTERNER_TAG_MASK 0xFFFFFFFF00000000ULL
+
+inline String_Interner_Entry*
+_string_interner_entry(String_Interner *interner, String_Id id) {
+	return &interner->chunks[id/STRING_INTERNER_CHUNK_SIZE][id%STRING_INTERNER_CHUNK_SIZE];
+}
+
+bool
+_string_interner_find_in_table(String_Interner *interner, String_Interner_Table *table, string s, u64 hash, String_Id *id) {
+	if (!table) return false;
+	volatile u64 *slots = (volatile u64*)(table+1);
+	u64 mask = table->capacity-1;
+	u64 tag = hash & _STRING_INTERNER_TAG_MASK;
+	// Never more than half full so this always hits an empty slot
+	for (u64 i = hash & mask;; i = (i+1) & mask) {
+		u64 slot = slots[i];
+		if (!slot) return false;
+		if ((slot & _STRING_INTERNER_TAG_MASK) != tag) continue;
+
+		String_Id candidate = (String_Id)(slot & 0xFFFFFFFF) - 1;
+		String_Interner_Entry *e = _string_interner_entry(interner, candidate);
+		if (e->hash == hash && strings_match(e->s, s)) {
+			*id = candidate;
+			return true;
+		}
+	}
+}
+
+void
+_string_interner_insert_slot(String_Interner_Table *table, u64 hash, String_Id id) {
+	volatile u64 *slots = (volatile u64*)(table+1);
+	u64 mask = table->capacity-1;
+	u64 i = hash & mask;
+	while (slots[i]) i = (i+1) & mask;
+	slots[i] = (hash & _STRING_INTERNER_TAG_MASK) | ((u64)id+1);
+}
+
+void
+_string_interner_grow_locked(String_Interner *interner) {
+	String_Interner_Table *old = interner->table;
+	u64 capacity = old ? old->capacity*2 : 256;
+
+	// Straight from the OS so interned strings don't show up as heap leaks
+	u64 size = align_next(sizeof(String_Interner_Table) + capacity*sizeof(u64), os.page_size);
+	String_Interner_Table *table = (String_Interner_Table*)os_allocate_pages(size, OS_HUGE_PAGES_NONE, 0);
+	assert(table, "Failed allocating string interner table");
+	table->capacity = capacity;
+	table->previous = old;
+	for (u64 id = 0; id < interner->count; id++) {
+		_string_interner_insert_slot(table, _string_interner_entry(interner, (String_Id)id)->hash, (String_Id)id);
+	}
+
+	// Readers may still be probing the old table, it's freed in string_interner_destroy()
+	MEMORY_BARRIER;
+	interner->table = table;
+}
+
+string
+_string_interner_copy_locked(String_Interner *interner, string s) {
+	String_Interner_Storage *storage = interner->storage;
+	if (!storage || interner->storage_used + s.count > storage->size) {
+		u64 size = align_next(sizeof(String_Interner_Storage) + max(s.count, 64*1024), os.page_size);
+		String_Interner_Storage *next = (String_Interner_Storage*)os_allocate_pages(size, OS_HUGE_PAGES_NONE, 0);
+		assert(next, "Failed allocating string interner storage");
+		next->previous = storage;
+		next->size = size - sizeof(String_Interner_Storage);
+		interner->storage = storage = next;
+		interner->storage_used = 0;
+	}
+	string copy;
+	copy.count = s.count;
+	copy.data = (u8*)(storage+1) + interner->storage_used;
+	memcpy(copy.data, s.data, s.count);
+	interner->storage_used += s.count;
+	return copy;
+}
+
+String_Id
+string_intern(String_Interner *interner, string s) {
+	u64 hash = hash_bytes(s.data, s.count, 0);
+	String_Id id;
+	if (_string_interner_find_in_table(interner, interner->table, s, hash, &id)) return id;
+
+	// #Sync
+	spinlock_acquire_or_wait(&interner->lock);
+
+	// It may have been added while we were waiting
+	if (_string_interner_find_in_table(interner, interner->table, s, hash, &id)) {
+		spinlock_release(&interner->lock);
+		return id;
+	}
+
+	assert(interner->count < STRING_INTERNER_MAX_COUNT, "Too many interned strings (max %d)", STRING_INTERNER_MAX_COUNT);
+	id = (String_Id)interner->count;
+
+	u64 chunk = id/STRING_INTERNER_CHUNK_SIZE;
+	if (!interner->chunks[chunk]) {
+		u64 size = align_next(STRING_INTERNER_CHUNK_SIZE*sizeof(String_Interner_Entry), os.page_size);
+		String_Interner_Entry *entries = (String_Interner_Entry*)os_allocate_pages(size, OS_HUGE_PAGES_NONE, 0);
+		assert(entries, "Failed allocating string interner entries");
+		interner->chunks[chunk] = entries;
+	}
+	String_Interner_Entry *e = _string_interner_entry(interner, id);
+	e->s = _string_interner_copy_locked(interner, s);
+	e->hash = hash;
+
+	if (!interner->table || (interner->count+1)*2 > interner->table->capacity) {
+		_string_interner_grow_locked(interner);
+	}
+
+	// The entry has to be visible before the slot pointing at it
+	MEMORY_BARRIER;
+	interner->count += 1;
+	_string_interner_insert_slot(interner->table, hash, id);
+
+	spinlock_release(&interner->lock);
+	return id;
+}
+
+bool
+string_interner_find(String_Interner *interner, string s, String_Id *id) {
+	return _string_interner_find_in_table(interner, interner->table, s, hash_bytes(s.data, s.count, 0), id);
+}
+
+string
+string_interner_get(String_Interner *interner, String_Id id) {
+	assert(id < interner->count, "Invalid string id %u", id);
+	return _string_interner_entry(interner, id)->s;
+}
+
+void
+string_interner_destroy(String_Interner *interner) {
+	String_Interner_Table *table = interner->table;
+	while (table) {
+		String_Interner_Table *previous = table->previous;
+		os_release_address_space(table, align_next(sizeof(String_Interner_Table) + table->capacity*sizeof(u64), os.page_size));
+		table = previous;
+	}
+	String_Interner_Storage *storage = interner->storage;
+	while (storage) {
+		String_Interner_Storage *previous = storage->previous;
+		os_release_address_space(storage, storage->size + sizeof(String_Interner_Storage));
+		storage = previous;
+	}
+	for (u64 i = 0; i < STRING_INTERNER_MAX_CHUNKS && interner->chunks[i]; i++) {
+		os_release_address_space(interner->chunks[i], align_next(STRING_INTERNER_CHUNK_SIZE*sizeof(String_Interner_Entry), os.page_size));
+	}
+	memset(interner, 0, sizeof(String_Interner));
+}
+
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
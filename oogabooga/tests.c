@@ -31,7 +31,15 @@ void log_heap() {
 		
 		block = block->next;
 	}
+	
 	spinlock_release(&heap_lock);
+	
+	spinlock_acquire_or_wait(&heap_large_allocation_lock);
+	for (u32 i = 0; i < growing_array_get_valid_count(heap_large_allocations); i++) {
+		Heap_Large_Allocation *large = heap_large_allocations[i];
+		print("\tLARGE ALLOCATION @ 0x%I64x, %llu bytes%s\n", (u64)large, large->mapped_size, large->huge_pages ? " (huge pages)" : "");
+	}
+	spinlock_release(&heap_large_allocation_lock);
 }
 
 void test_allocator(bool do_log_heap) {
@@ -192,11 +200,288 @@ void test_allocator(bool do_log_heap) {
         dealloc(heap, blocks[i]);
     }
     
+    // Reallocate
+    u8 *r = (u8*)alloc(heap, 4096);
+    for (u64 i = 0; i < 4096; i++) r[i] = (u8)i;
+    
+    // Shrinking always happens in place, and then the tail we gave back is free right after
+    // the allocation so growing back into it must not move it either.
+    u8 *r_shrunk = (u8*)reallocate(heap, r, 4096, 1024);
+    assert(r_shrunk == r, "Shrinking reallocate moved the allocation");
+    u8 *r_grown = (u8*)reallocate(heap, r, 1024, 3000);
+    assert(r_grown == r, "Growing reallocate into free space moved the allocation");
+    for (u64 i = 0; i < 1024; i++) assert(r[i] == (u8)i, "Reallocate corrupted memory");
+    
+    // Might move, contents must survive either way
+    void *r_blocker = alloc(heap, 64);
+    r = (u8*)reallocate(heap, r, 3000, 1024*1024);
+    for (u64 i = 0; i < 1024; i++) assert(r[i] == (u8)i, "Reallocate corrupted memory");
+    dealloc(heap, r_blocker);
+    dealloc(heap, r);
+    
+    // Temp allocator doesn't reallocate so this takes the copying fallback
+    int *temp_ints = (int*)alloc(get_temporary_allocator(), sizeof(int)*4);
+    for (int i = 0; i < 4; i++) temp_ints[i] = i*3;
+    temp_ints = (int*)reallocate(get_temporary_allocator(), temp_ints, sizeof(int)*4, sizeof(int)*64);
+    for (int i = 0; i < 4; i++) assert(temp_ints[i] == i*3, "Reallocate fallback corrupted memory");
+    
+    // Large allocations get their own pages and go back to the OS on free
+    Heap_Stats stats_before = heap_get_stats();
+    u8 *large = (u8*)alloc(heap, MB(600));
+    large[0] = 69;
+    large[MB(600)-1] = 42;
+    Heap_Stats stats = heap_get_stats();
+    assert(!is_pointer_in_program_memory(large), "Large allocation was put in a heap block");
+    assert(is_pointer_valid(large+MB(300)), "Large allocation is not a valid pointer");
+    assert(stats.large_allocation_count == stats_before.large_allocation_count+1, "Large allocation was not counted");
+    assert(stats.large_allocation_bytes >= stats_before.large_allocation_bytes+MB(600), "Large allocation was not counted");
+    assert(stats.block_bytes == stats_before.block_bytes, "Large allocation grew the heap blocks");
+    
+    // Staying large stays in the same pages, shrinking down to small moves into the heap blocks
+    u8 *large_resized = (u8*)reallocate(heap, large, MB(600), MB(500));
+    assert(large_resized == large, "Shrinking a large allocation moved it");
+    u8 *small = (u8*)reallocate(heap, large, MB(500), 1024);
+    assert(is_pointer_in_program_memory(small) && small[0] == 69, "Shrinking a large allocation to small failed");
+    stats = heap_get_stats();
+    assert(stats.large_allocation_count == stats_before.large_allocation_count, "Large allocation was not released");
+    assert(stats.large_allocation_bytes == stats_before.large_allocation_bytes, "Large allocation was not released");
+    
+    // And growing past the threshold moves out of the heap blocks
+    large = (u8*)reallocate(heap, small, 1024, HEAP_LARGE_ALLOCATION_THRESHOLD+1);
+    assert(!is_pointer_in_program_memory(large) && large[0] == 69, "Growing a small allocation to large failed");
+    dealloc(heap, large);
+    assert(heap_get_stats().large_allocation_count == stats_before.large_allocation_count, "Large allocation was not released");
+    
+    // Looked up by address, so freeing in any order keeps the rest findable
+    u8 *larges[5];
+    for (u64 i = 0; i < 5; i++) larges[i] = (u8*)alloc(heap, HEAP_LARGE_ALLOCATION_THRESHOLD+1);
+    dealloc(heap, larges[2]);
+    for (u64 i = 0; i < 5; i++) {
+    	if (i == 2) continue;
+    	assert(is_pointer_in_large_allocation(larges[i]), "Large allocation lookup failed");
+    	assert(is_pointer_in_large_allocation(larges[i]+HEAP_LARGE_ALLOCATION_THRESHOLD), "Large allocation lookup failed at the end");
+    }
+    assert(!is_pointer_in_large_allocation(check_bytes), "Small allocation found as large allocation");
+    for (u64 i = 0; i < 5; i++) if (i != 2) dealloc(heap, larges[i]);
+    assert(heap_get_stats().large_allocation_count == stats_before.large_allocation_count, "Large allocations were not released");
+    
+    // Transparent huge pages don't need 2MB sizes, and are only a hint so they're never reported as huge pages
+    bool got_huge_pages = true;
+    u64 thp_size = MB(4)+os.page_size;
+    u8 *thp = (u8*)os_allocate_pages(thp_size, OS_HUGE_PAGES_TRANSPARENT, &got_huge_pages);
+    assert(thp && !got_huge_pages, "Transparent huge pages should not be reported as huge pages");
+#if TARGET_OS == LINUX
+    assert((u64)thp % MB(2) == 0, "Transparent huge page allocation was not 2MB aligned");
+#endif
+    thp[0] = 1;
+    thp[thp_size-1] = 2;
+    os_release_address_space(thp, thp_size);
+    
     assert(bytes_match(check_bytes, check_bytes_copy, 1024), "Memory corrupt");
     
     if (do_log_heap) log_heap();
 }
 
+Allocator test_tracked_allocator;
+void *test_tracked_from_thread[16];
+void test_allocation_tracking_thread(Thread *t) {
+	for (int i = 0; i < 16; i++) test_tracked_from_thread[i] = alloc(test_tracked_allocator, 1000);
+}
+
+void test_allocation_tracking() {
+	Allocator tracked = make_tracking_allocator(get_heap_allocator(), STR("Test tracking"));
+	u32 tag = get_allocation_tag(STR("Test tracking"));
+	assert(get_allocation_tag(STR("Test tracking")) == tag, "Same tag name gave different tags");
+	
+	allocation_tracking_end_frame();
+	
+	void *small[10];
+	for (int i = 0; i < 10; i++) small[i] = alloc(tracked, 100);
+	void *big = alloc(tracked, 5000);
+	
+	Allocation_Tag_Stats stats = get_allocation_tag_stats(tag);
+	assert(strings_match(stats.name, STR("Test tracking")), "Bad tag name");
+	assert(stats.live_count == 11 && stats.live_bytes == 6000, "Bad live stats: %llu, %llu", stats.live_count, stats.live_bytes);
+	assert(stats.size_histogram[7] == 10, "100 bytes should be in the (64, 128] bucket");
+	assert(stats.size_histogram[13] == 1, "5000 bytes should be in the (4096, 8192] bucket");
+	
+	small[0] = reallocate(tracked, small[0], 100, 300);
+	stats = get_allocation_tag_stats(tag);
+	assert(stats.live_count == 11 && stats.live_bytes == 6200, "Reallocate was not tracked");
+	
+	allocation_tracking_end_frame();
+	stats = get_allocation_tag_stats(tag);
+	assert(stats.allocations_last_frame == 12 && stats.bytes_allocated_last_frame == 6300, "Bad frame stats: %llu, %llu", stats.allocations_last_frame, stats.bytes_allocated_last_frame);
+	
+	for (int i = 0; i < 10; i++) dealloc(tracked, small[i]);
+	dealloc(tracked, big);
+	
+	// Allocated on another thread, freed on this one
+	test_tracked_allocator = tracked;
+	Thread t;
+	os_thread_init(&t, test_allocation_tracking_thread);
+	os_thread_start(&t);
+	os_thread_join(&t);
+	stats = get_allocation_tag_stats(tag);
+	assert(stats.live_count == 16 && stats.live_bytes == 16000, "Allocations from other thread not tracked");
+	for (int i = 0; i < 16; i++) dealloc(tracked, test_tracked_from_thread[i]);
+	
+	stats = get_allocation_tag_stats(tag);
+	assert(stats.live_count == 0 && stats.live_bytes == 0, "Deallocations not tracked");
+	assert(stats.peak_live_bytes == 16000, "Bad peak: %llu", stats.peak_live_bytes);
+	assert(stats.total_allocations == stats.total_deallocations, "Allocation counts don't add up");
+	
+	// Thread tags, which the heap allocator counts into with ENABLE_ALLOCATION_TRACKING
+	Allocator heap_tracked = (Allocator){tracking_allocator_proc, &heap_allocation_tracker};
+	push_allocation_tag(STR("Test thread tag"));
+	void *p = alloc(heap_tracked, 64);
+	pop_allocation_tag();
+	stats = get_allocation_tag_stats(get_allocation_tag(STR("Test thread tag")));
+	assert(stats.live_count == 1 && stats.live_bytes == 64, "Thread tag not used");
+	
+	assert(allocation_tracking_log_leaks() >= 1, "Leak not reported");
+	dealloc(heap_tracked, p);
+	
+	// Overhead. Compare against the same size on the heap as the tracking header makes it
+	// since heap alloc time depends a lot on size.
+	const u64 iterations = 100000;
+	Allocator heap = get_heap_allocator();
+	u64 start = rdtsc();
+	for (u64 i = 0; i < iterations; i++) dealloc(heap, alloc(heap, 64+sizeof(Allocation_Tracking_Header)));
+	u64 heap_cycles = rdtsc()-start;
+	start = rdtsc();
+	for (u64 i = 0; i < iterations; i++) dealloc(tracked, alloc(tracked, 64));
+	u64 tracked_cycles = rdtsc()-start;
+	print("alloc+dealloc took %llu cycles, %llu cycles tracked... ", heap_cycles/iterations, tracked_cycles/iterations);
+}
+
+void test_profiler() {
+	u32 id = profiler_get_name_id(STR("Test profiler scope"));
+	assert(profiler_get_name_id(STR("Test profiler scope")) == id, "Profiler name id not stable");
+	assert(profiler_get_name_id_literal("Test profiler scope") == id, "Literal profiler name id doesn't match");
+	assert(strings_match(profiler_get_name(id), STR("Test profiler scope")), "Bad profiler name");
+	
+	u64 start = rdtsc();
+	_profiler_report_scope("Test profiler scope", start, start+1000);
+	_profiler_report_counter(STR("Test profiler counter"), 42.0, start);
+	
+	String_Builder json;
+	string_builder_init(&json, get_heap_allocator());
+	profiler_write_json(&json);
+	assert(string_find_from_left(json.result, STR("\"name\":\"Test profiler scope\",\"ph\":\"X\"")) >= 0, "Scope missing from profiler json");
+	assert(string_find_from_left(json.result, STR("\"name\":\"Test profiler counter\",\"ph\":\"C\"")) >= 0, "Counter missing from profiler json");
+	assert(string_find_from_left(json.result, STR("\"value\":42.000")) >= 0, "Counter value missing from profiler json");
+	dealloc(json.allocator, json.buffer);
+	
+	float64 frequency = get_tsc_frequency();
+	assert(frequency > 1000000.0, "TSC frequency calibration failed (%f)", frequency);
+	
+	// Frame stats
+	profiler_end_frame(); // Whatever was recorded before goes into its own frame
+	u64 frame_count = profiler_get_frame_stats().frame_count;
+	start = rdtsc();
+	_profiler_report_scope("Test frame child", start+100, start+300);
+	_profiler_report_scope("Test frame child", start+400, start+500);
+	_profiler_report_scope("Test frame parent", start, start+1000);
+	_profiler_report_counter(STR("Test frame counter"), 5.0, start);
+	_profiler_report_counter(STR("Test frame counter"), 7.0, start);
+	profiler_end_frame();
+	
+	Profile_Frame_Stats frame = profiler_get_frame_stats();
+	assert(frame.frame_count == frame_count+1, "Frame not counted");
+	assert(frame.frame_seconds > 0 && frame.max_frame_seconds >= frame.frame_seconds, "Bad frame time");
+	
+	float64 seconds_per_cycle = 1.0/frequency;
+	Profile_Scope_Stats scope;
+	assert(profiler_get_scope_stats(STR("Test frame parent"), &scope), "Missing frame scope");
+	assert(scope.calls == 1, "Bad call count %llu", scope.calls);
+	assert(fabs(scope.total_seconds-(1000*seconds_per_cycle)) < 1e-12, "Bad total time");
+	assert(fabs(scope.self_seconds-(700*seconds_per_cycle)) < 1e-12, "Bad self time");
+	assert(profiler_get_scope_stats(STR("Test frame child"), &scope), "Missing frame scope");
+	assert(scope.calls == 2, "Bad call count %llu", scope.calls);
+	assert(fabs(scope.self_seconds-(300*seconds_per_cycle)) < 1e-12, "Bad self time");
+	u64 name_count = profiler_names.count;
+	assert(!profiler_get_scope_stats(STR("Test frame nothing"), &scope), "Stats for scope that never ran");
+	assert(profiler_names.count == name_count, "Querying stats should not add a profiler name");
+	
+	Profile_Counter_Stats counter;
+	assert(profiler_get_counter_stats(STR("Test frame counter"), &counter), "Missing frame counter");
+	assert(counter.value == 7.0, "Counter frame value should be the max, got %f", counter.value);
+	
+	// Nothing reported: scope averages fall, counter keeps its value
+	profiler_end_frame();
+	assert(profiler_get_scope_stats(STR("Test frame parent"), &scope), "Missing frame scope");
+	assert(scope.calls == 0 && fabs(scope.average_calls-0.5) < 1e-9, "Bad scope history");
+	assert(fabs(scope.max_total_seconds-(1000*seconds_per_cycle)) < 1e-12, "Bad scope max");
+	assert(profiler_get_counter_stats(STR("Test frame counter"), &counter), "Missing frame counter");
+	assert(counter.value == 7.0 && counter.average == 7.0, "Counter value not kept");
+	
+	Profile_Scope_Stats top[64];
+	u64 top_count = profiler_get_top_scopes(top, 64);
+	for (u64 i = 1; i < top_count; i++) {
+		assert(top[i-1].average_self_seconds >= top[i].average_self_seconds, "Top scopes not sorted");
+	}
+	float64 frame_times[PROFILER_FRAME_HISTORY];
+	assert(profiler_get_frame_times(frame_times, 2) == 2 && frame_times[1] == profiler_get_frame_stats().frame_seconds, "Bad frame times");
+	
+	// Hardware counters. Injected, so the output is tested on machines without a PMU too (VMs).
+	// Taken out again after so they don't end up in the real profile.
+	Profile_Thread_Buffer *buffer = profiler_thread_buffer;
+	u64 write_index = buffer->write_index;
+	start = rdtsc();
+	u32 hardware_id = profiler_get_name_id_literal("Test hardware scope");
+	_profiler_push_event(hardware_id, PROFILE_EVENT_SCOPE, start, start+5000);
+	_profiler_push_event(hardware_id, PROFILE_EVENT_HARDWARE_COUNTERS, 4000, 8000);
+	_profiler_push_event(hardware_id, PROFILE_EVENT_HARDWARE_COUNTERS, 12, 34);
+	string_builder_init(&json, get_heap_allocator());
+	profiler_write_json(&json);
+	assert(string_find_from_left(json.result, STR("\"args\":{\"cycles\":4000,\"instructions\":8000,\"ipc\":2.000,\"cache_misses\":12,\"branch_misses\":34}")) >= 0, "Hardware counters missing from profiler json");
+	dealloc(json.allocator, json.buffer);
+	string_builder_init(&json, get_heap_allocator());
+	assert(profiler_write_hardware_counter_table(&json), "No hardware counter table");
+	assert(string_find_from_left(json.result, STR("Test hardware scope")) >= 0, "Scope missing from hardware counter table");
+	dealloc(json.allocator, json.buffer);
+	profiler_end_frame();
+	assert(profiler_get_scope_stats(STR("Test hardware scope"), &scope) && scope.calls == 1, "Hardware counters counted as scopes");
+	buffer->write_index = write_index;
+	buffer->frame_read_index = write_index;
+	string_builder_init(&json, get_heap_allocator());
+	profiler_write_hardware_counter_table(&json);
+	assert(string_find_from_left(json.result, STR("Test hardware scope")) < 0, "Injected hardware counters left in the profile");
+	dealloc(json.allocator, json.buffer);
+	
+	u64 counters_before[OS_HARDWARE_COUNTER_MAX];
+	u64 counters_after[OS_HARDWARE_COUNTER_MAX];
+	if (os_read_hardware_counters(counters_before)) {
+		volatile u64 sink = 0;
+		for (u64 i = 0; i < 100000; i++) sink += i;
+		assert(os_read_hardware_counters(counters_after), "Hardware counters stopped working");
+		u64 instructions = counters_after[OS_HARDWARE_COUNTER_INSTRUCTIONS]-counters_before[OS_HARDWARE_COUNTER_INSTRUCTIONS];
+		assert(instructions >= 100000, "Counted %llu instructions for 100000 iterations", instructions);
+		print("%llu instructions in 100000 iterations... ", instructions);
+	} else {
+		print("no hardware counters here... ");
+	}
+	
+	// Overhead of a tm_scope
+	const u64 iterations = 100000;
+	start = rdtsc();
+	for (u64 i = 0; i < iterations; i++) {
+		u64 scope_start = rdtsc();
+		_profiler_report_scope("Test profiler overhead", scope_start, rdtsc());
+	}
+	u64 cycles = rdtsc()-start;
+	// The two rdtsc calls are part of any scope, but it's good to know how much they are of it
+	start = rdtsc();
+	u64 sink = 0;
+	for (u64 i = 0; i < iterations; i++) {
+		u64 scope_start = rdtsc();
+		sink += rdtsc()-scope_start;
+	}
+	u64 rdtsc_cycles = rdtsc()-start;
+	print("scope overhead is %llu cycles (%.1f ns), %llu of which is rdtsc... ", cycles/iterations, (float64)cycles/(float64)iterations/frequency*1000000000.0, rdtsc_cycles/iterations);
+}
+
 void test_thread_proc1(Thread* t) {
 	os_sleep(5);
 	print("Hello from thread %llu\n", t->id);
@@ -452,6 +737,337 @@ void test_strings() {
     assert(strings_match(hello_balls, STR("Greetings, Balls!")), "Failed: string_replace");
 }
 
+u64
+test_utf8_encode(u32 c, u8 *out) {
+	if (c < 0x80)    { out[0] = (u8)c; return 1; }
+	if (c < 0x800)   { out[0] = (u8)(0xC0 | (c >> 6));  out[1] = (u8)(0x80 | (c & 0x3F)); return 2; }
+	if (c < 0x10000) { out[0] = (u8)(0xE0 | (c >> 12)); out[1] = (u8)(0x80 | ((c >> 6) & 0x3F));  out[2] = (u8)(0x80 | (c & 0x3F)); return 3; }
+	out[0] = (u8)(0xF0 | (c >> 18)); out[1] = (u8)(0x80 | ((c >> 12) & 0x3F)); out[2] = (u8)(0x80 | ((c >> 6) & 0x3F)); out[3] = (u8)(0x80 | (c & 0x3F));
+	return 4;
+}
+
+// Every kernel variant the cpu can run against the basic ones
+void test_string_kernels() {
+	Allocator heap = get_heap_allocator();
+	
+	// Every ISA level this cpu can run, through the same tables everything else uses
+	String_Find_Proc find_left[CPU_ISA_COUNT];
+	String_Find_Proc find_right[CPU_ISA_COUNT];
+	Utf8_Validate_Proc validate[CPU_ISA_COUNT];
+	Utf8_Decode_Proc decode[CPU_ISA_COUNT];
+	Ascii_Prefix_Proc ascii[CPU_ISA_COUNT];
+	u64 kernel_count = 0;
+	for (Cpu_Isa isa = 0; isa < CPU_ISA_COUNT; isa++) {
+		if (!cpu_isa_supported(isa)) continue;
+		cpu_dispatch_force_isa(isa);
+		find_left[kernel_count]  = get_string_kernels()->find_from_left;
+		find_right[kernel_count] = get_string_kernels()->find_from_right;
+		validate[kernel_count]   = get_utf8_kernels()->validate;
+		decode[kernel_count]     = get_utf8_kernels()->decode;
+		ascii[kernel_count]      = get_utf8_kernels()->ascii_prefix;
+		kernel_count += 1;
+	}
+	cpu_dispatch_init(get_cpu_capabilities());
+	assert(find_left[0] == _string_find_from_left_basic && validate[0] == _utf8_validate_basic, "Failed: basic kernels");
+	
+	u8 *haystack = (u8*)alloc(heap, 1024);
+	u8 needle[64];
+	u64 seed = 777;
+	#define TEST_NEXT_RANDOM() (seed = seed*6364136223846793005ull + 1442695040888963407ull, seed >> 33)
+	
+	// Small alphabet so there are plenty of partial matches
+	for (u64 round = 0; round < 3000; round++) {
+		u64 count = TEST_NEXT_RANDOM() % 300;
+		for (u64 i = 0; i < count; i++) haystack[i] = (u8)('a' + TEST_NEXT_RANDOM() % 3);
+		u64 needle_count = 1 + TEST_NEXT_RANDOM() % 12;
+		if (count >= needle_count && (round & 1)) {
+			memcpy(needle, haystack + TEST_NEXT_RANDOM() % (count - needle_count + 1), needle_count);
+		} else {
+			for (u64 i = 0; i < needle_count; i++) needle[i] = (u8)('a' + TEST_NEXT_RANDOM() % 3);
+		}
+		if (count < needle_count) continue;
+		
+		s64 expected_left  = find_left[0](haystack, count, needle, needle_count);
+		s64 expected_right = find_right[0](haystack, count, needle, needle_count);
+		for (u64 k = 1; k < kernel_count; k++) {
+			assert(find_left[k](haystack, count, needle, needle_count) == expected_left, "Failed: find from left kernel %llu (count %llu, sub %llu)", k, count, needle_count);
+			assert(find_right[k](haystack, count, needle, needle_count) == expected_right, "Failed: find from right kernel %llu (count %llu, sub %llu)", k, count, needle_count);
+		}
+	}
+	string hay = STR("The quick brown fox jumps over the lazy dog, then the quick brown fox sleeps.");
+	assert(string_find_from_left(hay, STR("quick brown")) == 4, "Failed: string_find_from_left");
+	assert(string_find_from_right(hay, STR("quick brown")) == 54, "Failed: string_find_from_right");
+	assert(string_find_from_left(hay, STR("cat")) == -1, "Failed: string_find_from_left");
+	assert(string_find_from_right(hay, STR(".")) == (s64)hay.count-1, "Failed: string_find_from_right");
+	assert(string_find_from_left(hay, STR("T")) == 0, "Failed: string_find_from_left");
+	
+	// Compare with a difference at every position
+	u8 *other = (u8*)alloc(heap, 1024);
+	for (u64 count = 0; count < 300; count++) {
+		for (u64 i = 0; i < count; i++) haystack[i] = (u8)TEST_NEXT_RANDOM();
+		memcpy(other, haystack, count);
+		assert(strings_match((string){count, haystack}, (string){count, other}), "Failed: strings_match");
+		for (u64 i = 0; i < count; i++) {
+			other[i] ^= 0x10;
+			assert(!strings_match((string){count, haystack}, (string){count, other}), "Failed: strings_match (diff at %llu of %llu)", i, count);
+			other[i] ^= 0x10;
+		}
+	}
+	
+	// Known good & bad utf8
+	const char *valid[] = {
+		"", "hello", "\xC2\x80", "\xDF\xBF", "\xE0\xA0\x80", "\xED\x9F\xBF", "\xEE\x80\x80", "\xEF\xBF\xBF",
+		"\xF0\x90\x80\x80", "\xF4\x8F\xBF\xBF", "h\xC3\xA9llo w\xC3\xB6rld \xE2\x82\xAC \xF0\x9F\x98\x80",
+	};
+	const char *invalid[] = {
+		"\x80", "\xBF", "\xC0\x80", "\xC1\xBF", "\xC2", "\xC2\x41", "\xE0\x80\x80", "\xE0\x9F\xBF", "\xED\xA0\x80",
+		"\xE2\x82", "\xF0\x80\x80\x80", "\xF0\x8F\xBF\xBF", "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xFF",
+		"\xC2\x80\x80", "\xE2\x82\xAC\xAC", "abc\xE2\x82",
+	};
+	for (u64 i = 0; i < sizeof(valid)/sizeof(valid[0]); i++) {
+		// At different offsets so they cross the vector boundaries
+		for (u64 offset = 0; offset < 40; offset += 3) {
+			memset(haystack, 'x', offset);
+			u64 count = strlen(valid[i]);
+			memcpy(haystack+offset, valid[i], count);
+			for (u64 k = 0; k < kernel_count; k++) {
+				assert(validate[k](haystack, offset+count), "Failed: utf8 validate kernel %llu on valid #%llu at %llu", k, i, offset);
+			}
+		}
+	}
+	for (u64 i = 0; i < sizeof(invalid)/sizeof(invalid[0]); i++) {
+		for (u64 offset = 0; offset < 40; offset += 3) {
+			memset(haystack, 'x', offset);
+			u64 count = strlen(invalid[i]);
+			memcpy(haystack+offset, invalid[i], count);
+			for (u64 k = 0; k < kernel_count; k++) {
+				assert(!validate[k](haystack, offset+count), "Failed: utf8 validate kernel %llu on invalid #%llu at %llu", k, i, offset);
+				// Followed by more text
+				memset(haystack+offset+count, 'y', 40);
+				assert(!validate[k](haystack, offset+count+40), "Failed: utf8 validate kernel %llu on invalid #%llu at %llu", k, i, offset);
+			}
+		}
+	}
+	
+	// Random text, mostly ascii with some of every length, then broken in random ways
+	u32 *codepoints = (u32*)alloc(heap, 1024*sizeof(u32));
+	u32 *decoded = (u32*)alloc(heap, 1024*sizeof(u32));
+	for (u64 round = 0; round < 2000; round++) {
+		u64 count = 0;
+		u64 codepoint_count = 0;
+		u64 target = TEST_NEXT_RANDOM() % 200;
+		while (count < target) {
+			u32 c;
+			u64 r = TEST_NEXT_RANDOM() % 10;
+			if      (r < 6) c = 32 + TEST_NEXT_RANDOM() % 95;
+			else if (r < 7) c = 0x80 + TEST_NEXT_RANDOM() % (0x800-0x80);
+			else if (r < 8) c = 0x800 + TEST_NEXT_RANDOM() % (0xD800-0x800);
+			else if (r < 9) c = 0xE000 + TEST_NEXT_RANDOM() % (0x10000-0xE000);
+			else            c = 0x10000 + TEST_NEXT_RANDOM() % (0x110000-0x10000);
+			codepoints[codepoint_count++] = c;
+			count += test_utf8_encode(c, haystack+count);
+		}
+		
+		for (u64 k = 0; k < kernel_count; k++) {
+			assert(validate[k](haystack, count), "Failed: utf8 validate kernel %llu on random valid text", k);
+			u64 consumed;
+			u64 n = decode[k](haystack, count, &consumed, decoded, 1024);
+			assert(n == codepoint_count && consumed == count, "Failed: utf8 decode kernel %llu count", k);
+			assert(memcmp(decoded, codepoints, n*sizeof(u32)) == 0, "Failed: utf8 decode kernel %llu", k);
+			assert(ascii[k](haystack, count) == ascii[0](haystack, count), "Failed: ascii prefix kernel %llu", k);
+		}
+		
+		// Decoding in small chunks doesn't split sequences
+		string text = {count, haystack};
+		u64 n = 0;
+		u64 chunk;
+		while ((chunk = utf8_decode(&text, decoded+n, 1 + round % 40))) n += chunk;
+		assert(n == codepoint_count && memcmp(decoded, codepoints, n*sizeof(u32)) == 0, "Failed: utf8_decode in chunks");
+		
+		if (count == 0) continue;
+		u64 broken_at = TEST_NEXT_RANDOM() % count;
+		u64 how = TEST_NEXT_RANDOM() % 3;
+		if (how == 0) haystack[broken_at] = (u8)TEST_NEXT_RANDOM();
+		else if (how == 1) haystack[broken_at] ^= 0x40;
+		else count = broken_at;
+		
+		bool expected = validate[0](haystack, count);
+		u64 expected_consumed;
+		u64 expected_n = decode[0](haystack, count, &expected_consumed, codepoints, 1024);
+		for (u64 k = 1; k < kernel_count; k++) {
+			assert(validate[k](haystack, count) == expected, "Failed: utf8 validate kernel %llu on broken text", k);
+			u64 consumed;
+			u64 n = decode[k](haystack, count, &consumed, decoded, 1024);
+			assert(n == expected_n && consumed == expected_consumed && memcmp(decoded, codepoints, n*sizeof(u32)) == 0, "Failed: utf8 decode kernel %llu on broken text", k);
+		}
+	}
+	#undef TEST_NEXT_RANDOM
+	
+	assert(string_is_ascii(STR("Just ascii, nothing to see here. Just ascii, nothing to see here.")), "Failed: string_is_ascii");
+	assert(!string_is_ascii(STR("Just ascii, nothing to see here. Just ascii, nothing to see h\xC3\xA9re.")), "Failed: string_is_ascii");
+	assert(utf8_validate(STR("h\xC3\xA9llo")) && !utf8_validate(STR("h\xC3llo")), "Failed: utf8_validate");
+	
+	string replaced = string_replace_all(STR("a--b--c----d"), STR("--"), STR("+"), heap);
+	assert(strings_match(replaced, STR("a+b+c++d")), "Failed: string_replace_all");
+	dealloc_string(heap, replaced);
+	
+	dealloc(heap, haystack);
+	dealloc(heap, other);
+	dealloc(heap, codepoints);
+	dealloc(heap, decoded);
+}
+
+typedef float64(*Test_Strtod_Proc)(const char *s, char **end);
+typedef float32(*Test_Strtof_Proc)(const char *s, char **end);
+
+#define TEST_FORMAT_MATCHES_CRT(fmt, ...) { \
+	char ours[256]; \
+	char crt[256]; \
+	u64 n = format_string_to_buffer_va(ours, sizeof(ours), fmt, __VA_ARGS__); \
+	_format_crt_snprintf(crt, sizeof(crt), fmt, __VA_ARGS__); \
+	assert(strcmp(ours, crt) == 0 && n == strlen(crt), "Failed: format '%cs' gave '%cs', CRT gave '%cs'", fmt, ours, crt); \
+}
+
+#define TEST_FORMAT_EQUALS(expected, fmt, ...) { \
+	string s = tprint(fmt, __VA_ARGS__); \
+	assert(strings_match(s, STR(expected)), "Failed: format '%cs' gave '%s', expected '%cs'", fmt, s, expected); \
+}
+
+void test_string_format() {
+	Allocator heap = get_heap_allocator();
+
+	TEST_FORMAT_MATCHES_CRT("%d %i %u", 0, -1, 4000000000u);
+	TEST_FORMAT_MATCHES_CRT("%d %d", 2147483647, (int)0x80000000);
+	TEST_FORMAT_MATCHES_CRT("%lld %llu", (long long)-9223372036854775807ll-1, 18446744073709551615ull);
+	TEST_FORMAT_MATCHES_CRT("%hhd %hd %hhu %hu", 300, 70000, 300, 70000);
+	TEST_FORMAT_MATCHES_CRT("%5d|%-5d|%05d|%+d|% d|%+5d", 42, 42, -42, 42, 42, -42);
+	TEST_FORMAT_MATCHES_CRT("%.3d|%8.3d|%-8.3d|%.0d|%08.3d", 7, -7, 7, 0, 7);
+	TEST_FORMAT_MATCHES_CRT("%x %X %#x %#X %o %#o %#o", 255u, 255u, 255u, 0u, 8u, 8u, 0u);
+	TEST_FORMAT_MATCHES_CRT("%llx %016llx %#18llx", 0xDEADBEEFCAFEBABEull, 0x1234ull, 0xABCull);
+	TEST_FORMAT_MATCHES_CRT("%*d|%-*d|%.*d|%*.*d", 6, 1, 6, 1, 3, 1, -6, 4, 1);
+	TEST_FORMAT_MATCHES_CRT("%c|%3c|%-3c|%%|%5%%d", 'a', 'b', 'c', 9);
+	TEST_FORMAT_MATCHES_CRT("%f %f %f %f", 0.0, -0.0, 1.0, 0.1);
+	TEST_FORMAT_MATCHES_CRT("%.2f %.3f %.0f %.0f %.0f %.0f", 3.14159, -2.0005, 0.5, 1.5, 2.5, -0.5);
+	TEST_FORMAT_MATCHES_CRT("%10.3f|%-10.3f|%010.3f|%+.1f|% .1f|%#.0f", 3.14159, 3.14159, -3.14159, 2.25, 2.25, 3.0);
+	TEST_FORMAT_MATCHES_CRT("%.17f %.10f %f", 0.1, 1e-300, 5e-324);
+	TEST_FORMAT_MATCHES_CRT("%f %.3f %f", 1e300, 123456789012345678.0, 9007199254740993.0);
+	TEST_FORMAT_MATCHES_CRT("%e %g %.3e %G", 12345.678, 0.0001234, -1e100, 1e-10);
+	
+	// Random values at every precision, including the ones that go past what fits in 64 bits
+	u64 seed = 1234;
+	for (u64 i = 0; i < 2000; i++) {
+		seed = seed*6364136223846793005ull + 1442695040888963407ull;
+		float64 value = (float64)(seed >> 11) / (float64)(1ull << 53);
+		value *= _format_powers_of_ten[i % 20];
+		if (i & 1) value = -value;
+		int precision = (int)(i % 19);
+		TEST_FORMAT_MATCHES_CRT("%.*f", precision, value);
+		// Exact halves
+		TEST_FORMAT_MATCHES_CRT("%.*f", precision%4, (float64)(s64)(seed >> 40) / 8.0);
+	}
+	
+	// Our own specifiers
+	TEST_FORMAT_EQUALS("[hello]", "[%s]", STR("hello"));
+	TEST_FORMAT_EQUALS("[hello   ][   hello][hel]", "[%-8s][%8s][%.3s]", STR("hello"), STR("hello"), STR("hello"));
+	TEST_FORMAT_EQUALS("[hello][ hi][he]", "[%cs][%3cs][%.2cs]", "hello", "hi", "hello");
+	TEST_FORMAT_EQUALS("0x1f", "%p", (void*)0x1f);
+	
+	// Shortest round trip
+	TEST_FORMAT_EQUALS("0.1 0.3333333333333333 1 -2.5 0 -0", "%r %r %r %r %r %r", 0.1, 1.0/3.0, 1.0, -2.5, 0.0, -0.0);
+	TEST_FORMAT_EQUALS("5e-324 1.7976931348623157e+308 2.2250738585072014e-308", "%r %r %r", 5e-324, 1.7976931348623157e308, 2.2250738585072014e-308);
+	TEST_FORMAT_EQUALS("100000000000000000000 1e+21 0.000001 1e-7", "%r %r %r %r", 1e20, 1e21, 0.000001, 1e-7);
+	TEST_FORMAT_EQUALS("9007199254740992 123456.789 1.5e+300", "%r %r %r", 9007199254740992.0, 123456.789, 1.5e300);
+	TEST_FORMAT_EQUALS("[  1.5][+1.5  ][-001.5]", "[%5r][%-+6r][%06r]", 1.5, 1.5, -1.5);
+	
+	char buffer[FORMAT_FLOAT_SHORTEST_MAX];
+	u64 n = format_float32_shortest(0.1f, buffer);
+	assert(strings_match((string){n, (u8*)buffer}, STR("0.1")), "Failed: format_float32_shortest");
+	n = format_float32_shortest(3.4028235e38f, buffer);
+	assert(strings_match((string){n, (u8*)buffer}, STR("3.4028235e+38")), "Failed: format_float32_shortest");
+	n = format_float32_shortest(16777216.0f, buffer);
+	assert(strings_match((string){n, (u8*)buffer}, STR("16777216")), "Failed: format_float32_shortest");
+	n = format_s64(-1234567890123ll, buffer);
+	assert(strings_match((string){n, (u8*)buffer}, STR("-1234567890123")), "Failed: format_s64");
+	
+	Test_Strtod_Proc crt_strtod = (Test_Strtod_Proc)os_dynamic_library_load_symbol(os.crt, STR("strtod"));
+	Test_Strtof_Proc crt_strtof = (Test_Strtof_Proc)os_dynamic_library_load_symbol(os.crt, STR("strtof"));
+	assert(crt_strtod && crt_strtof, "Missing strtod in crt");
+	
+	seed = 4321;
+	for (u64 i = 0; i < 20000; i++) {
+		seed = seed*6364136223846793005ull + 1442695040888963407ull;
+		
+		// Any bit pattern that isn't inf/nan
+		u64 bits = seed;
+		if (((bits >> 52) & 0x7FF) == 0x7FF) bits ^= 1ull << 62;
+		float64 value;
+		memcpy(&value, &bits, sizeof(value));
+		
+		char s[FORMAT_FLOAT_SHORTEST_MAX+1];
+		n = format_float64_shortest(value, s);
+		s[n] = 0;
+		float64 back = crt_strtod(s, 0);
+		assert(bytes_match(&back, &value, sizeof(value)), "Failed: %cs does not round trip", s);
+		
+		u32 bits32 = (u32)(seed >> 32);
+		if (((bits32 >> 23) & 0xFF) == 0xFF) bits32 ^= 1u << 30;
+		float32 value32;
+		memcpy(&value32, &bits32, sizeof(value32));
+		n = format_float32_shortest(value32, s);
+		s[n] = 0;
+		float32 back32 = crt_strtof(s, 0);
+		assert(bytes_match(&back32, &value32, sizeof(value32)), "Failed: %cs does not round trip as float32", s);
+	}
+	
+	// Truncation
+	char small[8];
+	n = format_string_to_buffer_va(small, sizeof(small), "%d and %s", 123456, STR("more"));
+	assert(n == 7 && strcmp(small, "123456 ") == 0, "Failed: truncated format");
+	n = format_string_to_buffer_va(0, 0, "%d and %s", 123456, STR("more"));
+	assert(n == 15, "Failed: format count");
+	
+	// Longer than the stack buffer in sprint
+	string long_string = alloc_string(heap, 3000);
+	memset(long_string.data, 'x', long_string.count);
+	string formatted = sprint(heap, STR("<%s|%d>"), long_string, 5);
+	assert(formatted.count == 3004 && formatted.data[3003] == '>' && formatted.data[3004] == 0, "Failed: long sprint");
+	dealloc_string(heap, formatted);
+	
+	// Builders grow while formatting
+	String_Builder builder;
+	string_builder_init_reserve(&builder, 16, heap);
+	for (u64 i = 0; i < 1000; i++) {
+		string_builder_print(&builder, "%llu,%.3f;", i, (float64)i/8.0);
+	}
+	string_builder_print(&builder, STR("%s"), long_string);
+	assert(builder.buffer[builder.count] == 0, "Failed: string builder null termination");
+	string built = string_builder_get_string(builder);
+	assert(string_starts_with(built, STR("0,0.000;1,0.125;2,0.250;")), "Failed: string_builder_print");
+	assert(string_find_from_left(built, STR("999,124.875;x")) != -1, "Failed: string_builder_print");
+	dealloc(heap, builder.buffer);
+	
+	// Printing the builder into itself, while it grows
+	string_builder_init_reserve(&builder, 128, heap);
+	string_builder_append(&builder, STR("ab"));
+	for (u64 i = 0; i < 12; i++) {
+		string_builder_print(&builder, STR("%s"), builder.result);
+	}
+	assert(builder.count == 2*4096 && builder.buffer[builder.count] == 0, "Failed: string builder printed into itself");
+	for (u64 i = 0; i < builder.count; i++) assert(builder.buffer[i] == (i % 2 ? 'b' : 'a'), "Failed: string builder printed into itself");
+	dealloc(heap, builder.buffer);
+	
+	// Builder filled up to exactly its capacity
+	string_builder_init_reserve(&builder, 128, heap);
+	string fill = alloc_string(heap, builder.buffer_capacity);
+	memset(fill.data, 'y', fill.count);
+	string_builder_append(&builder, fill);
+	string_builder_print(&builder, "");
+	assert(builder.count == fill.count && builder.buffer[builder.count] == 0, "Failed: string builder at capacity");
+	dealloc(heap, builder.buffer);
+	dealloc_string(heap, fill);
+	dealloc_string(heap, long_string);
+}
+
 void test_file_io() {
 
 #if TARGET_OS == WINDOWS && !OOGABOOGA_LINK_EXTERNAL_INSTANCE
@@ -489,7 +1105,7 @@ void test_file_io() {
     assert(file != OS_INVALID_FILE, "Failed: os_file_open (read)");
     string hello_world_read = talloc_string(hello_world_write.count);
     bool read_result = os_file_read(file, hello_world_read.data, hello_world_read.count, &hello_world_read.count);
-    assert(read_result, "Failed: os_file_read %d", GetLastError());
+    assert(read_result, "Failed: os_file_read");
     assert(strings_match(hello_world_read, hello_world_write), "Failed: os_file_read write/read mismatch");
     os_file_close(file);
 
@@ -541,6 +1157,15 @@ void test_file_io() {
     u64 *new_integers = (u64*)integers_data.data;
     assert(integers_read.count == integers_data.count, "Failed: big file read/write mismatch. Read was %d and written was %d", integers_read.count, integers_data.count);
     assert(strings_match(integers_data, integers_read), "Failed: big file read/write mismatch");
+    
+    string integers_mapped;
+    ok = os_file_map("integers", &integers_mapped);
+    assert(ok, "Failed: os_file_map");
+    assert(strings_match(integers_data, integers_mapped), "Failed: os_file_map content mismatch");
+    os_file_unmap(integers_mapped);
+    
+    string missing_mapped;
+    assert(!os_file_map("this_file_does_not_exist", &missing_mapped), "Failed: os_file_map should fail for missing file");
 
 	assert(os_is_file("test.txt"), "Failed: test.txt not recognized as file");
 	assert(os_is_file("test_bytes.txt"), "Failed: test_bytes.txt not recognized as file");
@@ -841,6 +1466,231 @@ void test_simd() {
 } 
 
 // Indirect testing of some simd stuff
+u8*
+test_cpu_dispatch_out(u8 *at, u8 *end, const void *p, u64 size) {
+	assert(at+size <= end, "Test output too small");
+	memcpy(at, p, size);
+	return at+size;
+}
+// Runs everything that goes through the dispatch tables at one ISA level, results end up in out.
+// Returns the number of bytes written.
+u64
+test_cpu_dispatch_run(u8 *out, u64 out_size, const u8 *input, u64 count) {
+	u8 *at = out;
+	#define TEST_OUT(p, size) at = test_cpu_dispatch_out(at, out+out_size, (p), (size))
+	#define TEST_ARRAY(T, n, offset) ((T*)alloc(get_temporary_allocator(), ((n)+3)*sizeof(T)) + (offset))
+	
+	// Odd offsets and counts so the vector loops have heads and tails
+	for (u64 offset = 0; offset < 3; offset++) {
+		u64 n = count-offset*5;
+		float32 *a = TEST_ARRAY(float32, n, offset);
+		float32 *b = TEST_ARRAY(float32, n, offset);
+		float32 *c = TEST_ARRAY(float32, n, offset);
+		float32 *d = TEST_ARRAY(float32, n, 0);
+		s16 *s = TEST_ARRAY(s16, n, offset);
+		s16 *t = TEST_ARRAY(s16, n, offset);
+		s32 *x = TEST_ARRAY(s32, n, offset);
+		s32 *y = TEST_ARRAY(s32, n, 0);
+		s32 *z = TEST_ARRAY(s32, n, offset);
+		u8 *u = TEST_ARRAY(u8, n, offset);
+		memcpy(s, input+offset, n*sizeof(s16));
+		memcpy(t, input+offset*3+1, n*sizeof(s16));
+		memcpy(x, input+offset, n*sizeof(s32));
+		memcpy(y, input+count*4-n*sizeof(s32), n*sizeof(s32));
+		
+		simd_convert_s16_to_float32_array(a, s, n);
+		simd_convert_s16_to_float32_array(b, t, n);
+		// Past -1..1 so the conversions back saturate
+		simd_scale_float32_array(a, a, 1.7f, n);
+		TEST_OUT(a, n*sizeof(float32));
+		simd_add_float32_array(c, a, b, n);
+		TEST_OUT(c, n*sizeof(float32));
+		simd_sub_float32_array(c, a, b, n);
+		TEST_OUT(c, n*sizeof(float32));
+		simd_mul_float32_array(c, a, b, n);
+		TEST_OUT(c, n*sizeof(float32));
+		simd_mul_add_float32_array(c, a, b, c, n);
+		TEST_OUT(c, n*sizeof(float32));
+		simd_min_float32_array(c, a, b, n);
+		TEST_OUT(c, n*sizeof(float32));
+		simd_max_float32_array(c, a, b, n);
+		TEST_OUT(c, n*sizeof(float32));
+		simd_clamp_float32_array(c, a, -0.5f, 0.25f, n);
+		TEST_OUT(c, n*sizeof(float32));
+		
+		simd_convert_float32_to_s16_array(t, a, n);
+		TEST_OUT(t, n*sizeof(s16));
+		simd_convert_float32_to_u8_array(u, a, n);
+		TEST_OUT(u, n);
+		simd_convert_u8_to_float32_array(c, input+offset*7, n);
+		TEST_OUT(c, n*sizeof(float32));
+		simd_add_saturate_s16_array(s, s, t, n);
+		TEST_OUT(s, n*sizeof(s16));
+		
+		simd_interleave_float32_array(d, a, b, n/2);
+		TEST_OUT(d, (n/2)*2*sizeof(float32));
+		simd_deinterleave_float32_array(a, b, c, n/2);
+		TEST_OUT(a, (n/2)*sizeof(float32));
+		TEST_OUT(b, (n/2)*sizeof(float32));
+		
+		float32 affine[6] = {0.5f, -1.25f, 3.0f, 2.0f, 0.75f, -0.125f};
+		simd_transform_points_2d(c, n/2, affine);
+		TEST_OUT(c, n*sizeof(float32));
+		
+		simd_add_s32_array(z, x, y, n);
+		TEST_OUT(z, n*sizeof(s32));
+		simd_sub_s32_array(z, x, y, n);
+		TEST_OUT(z, n*sizeof(s32));
+		simd_mul_s32_array(z, x, y, n);
+		TEST_OUT(z, n*sizeof(s32));
+		simd_min_s32_array(z, x, y, n);
+		TEST_OUT(z, n*sizeof(s32));
+		simd_max_s32_array(z, x, y, n);
+		TEST_OUT(z, n*sizeof(s32));
+		simd_clamp_s32_array(z, x, -1000000000, 5, n);
+		TEST_OUT(z, n*sizeof(s32));
+		s64 sum = simd_sum_s32_array(x, n);
+		TEST_OUT(&sum, sizeof(sum));
+		simd_prefix_sum_s32_array(x, x, n);
+		TEST_OUT(x, n*sizeof(s32));
+	}
+	
+	// Kernels in other modules follow along
+	string text = {count, (u8*)input};
+	string needle = {7, (u8*)input+count-9};
+	s64 found = string_find_from_left(text, needle);
+	TEST_OUT(&found, sizeof(found));
+	u64 hash = hash_bytes(input, count, 1234);
+	TEST_OUT(&hash, sizeof(hash));
+	bool valid = utf8_validate((string){count, (u8*)input});
+	TEST_OUT(&valid, sizeof(valid));
+	
+	#undef TEST_OUT
+	#undef TEST_ARRAY
+	return at-out;
+}
+void test_cpu_dispatch() {
+	Allocator heap = get_heap_allocator();
+	u64 seed = 31337;
+	#define TEST_NEXT_RANDOM() (seed = seed*6364136223846793005ull + 1442695040888963407ull, seed >> 33)
+	
+	u64 count = 1000+13;
+	u8 *input = (u8*)alloc(heap, count*4);
+	for (u64 i = 0; i < count*4; i++) input[i] = (u8)TEST_NEXT_RANDOM();
+	// Some full scale samples so the saturating add saturates
+	for (u64 i = 0; i < count*4; i += 16) input[i+1] = 0x7F;
+	
+	u64 out_size = count*256;
+	u8 *expected = (u8*)alloc(heap, out_size);
+	u8 *result = (u8*)alloc(heap, out_size);
+	
+	// Float sums add in a different order per level, so those are checked against f64 instead
+	u64 float_count = 1000+7;
+	float32 *f = (float32*)alloc(heap, float_count*sizeof(float32));
+	float32 *g = (float32*)alloc(heap, float_count*sizeof(float32));
+	float32 *prefix = (float32*)alloc(heap, float_count*sizeof(float32));
+	for (u64 i = 0; i < float_count; i++) {
+		f[i] = (float32)((s64)(TEST_NEXT_RANDOM() % 2001) - 1000) / 1000.0f;
+		g[i] = (float32)((s64)(TEST_NEXT_RANDOM() % 2001) - 1000) / 1000.0f;
+	}
+	
+	Cpu_Isa best = get_best_cpu_isa(get_cpu_capabilities());
+	assert(get_cpu_dispatch()->isa == best, "Failed: dispatch should start at the best ISA");
+	assert(cpu_isa_supported(CPU_ISA_BASIC), "Failed: basic is always supported");
+	
+	cpu_dispatch_force_isa(CPU_ISA_BASIC);
+	assert(get_simd_kernels()->add_float32 == _simd_add_float32_basic, "Failed: forcing basic");
+	assert(get_string_kernels()->find_from_left == _string_find_from_left_basic, "Failed: forcing basic");
+	u64 expected_size = test_cpu_dispatch_run(expected, out_size, input, count);
+	
+	for (Cpu_Isa isa = CPU_ISA_BASIC; isa < CPU_ISA_COUNT; isa++) {
+		if (!cpu_isa_supported(isa)) continue;
+		cpu_dispatch_force_isa(isa);
+		assert(get_cpu_dispatch()->isa == isa, "Failed: cpu_dispatch_force_isa");
+		
+		if (isa != CPU_ISA_BASIC) {
+			// Every level gives the same bits
+			assert(get_simd_kernels()->add_float32 != _simd_add_float32_basic, "Failed: forcing %cs", cpu_isa_names[isa]);
+			memset(result, 0, out_size);
+			u64 size = test_cpu_dispatch_run(result, out_size, input, count);
+			assert(size == expected_size, "Failed: %cs kernels wrote %llu bytes, basic wrote %llu", cpu_isa_names[isa], size, expected_size);
+			for (u64 i = 0; i < size; i++) {
+				assert(result[i] == expected[i], "Failed: %cs kernels differ from basic at byte %llu", cpu_isa_names[isa], i);
+			}
+		}
+		
+		for (u64 n = 0; n <= float_count; n += (n < 40 ? 1 : 193)) {
+			f64 sum = 0;
+			f64 dot = 0;
+			simd_prefix_sum_float32_array(prefix, f, n);
+			for (u64 i = 0; i < n; i++) {
+				sum += f[i];
+				dot += (f64)f[i]*(f64)g[i];
+				assert(fabs(prefix[i]-sum) < 0.001, "Failed: %cs simd_prefix_sum_float32_array", cpu_isa_names[isa]);
+			}
+			assert(fabs(simd_sum_float32_array(f, n)-sum) < 0.001, "Failed: %cs simd_sum_float32_array", cpu_isa_names[isa]);
+			assert(fabs(simd_dot_float32_array(f, g, n)-dot) < 0.001, "Failed: %cs simd_dot_float32_array", cpu_isa_names[isa]);
+		}
+	}
+	
+	cpu_dispatch_init(get_cpu_capabilities());
+	assert(get_cpu_dispatch()->isa == best, "Failed: cpu_dispatch_init");
+	
+	// Spot check against plain math
+	float32 a[5] = {1, 2, 3, 4, 5};
+	float32 b[5] = {10, 20, 30, 40, 50};
+	simd_add_float32_array(a, a, b, 5);
+	simd_scale_float32_array(a, a, 2.0f, 5);
+	assert(a[0] == 22 && a[4] == 110, "Failed: simd_add_float32_array/simd_scale_float32_array");
+	simd_clamp_float32_array(a, a, 30, 100, 5);
+	assert(a[0] == 30 && a[2] == 66 && a[4] == 100, "Failed: simd_clamp_float32_array");
+	s16 x[3] = {32000, -32000, 5};
+	s16 y[3] = {1000, -1000, -10};
+	simd_add_saturate_s16_array(x, x, y, 3);
+	assert(x[0] == 32767 && x[1] == -32768 && x[2] == -5, "Failed: simd_add_saturate_s16_array");
+	float32 points[4] = {1, 2, -1, 0};
+	float32 affine[6] = {2, 0, 1, 0, 3, -1};
+	simd_transform_points_2d(points, 2, affine);
+	assert(points[0] == 3 && points[1] == 5 && points[2] == -1 && points[3] == -1, "Failed: simd_transform_points_2d");
+	
+	float32 samples[7] = {1.0f, -1.0f, 2.0f, -2.0f, 0.5f, -0.5f, 0};
+	s16 pcm[7];
+	simd_convert_float32_to_s16_array(pcm, samples, 7);
+	assert(pcm[0] == 32767 && pcm[1] == -32768 && pcm[2] == 32767 && pcm[3] == -32768, "Failed: simd_convert_float32_to_s16_array should saturate");
+	assert(pcm[4] == 16384 && pcm[5] == -16384 && pcm[6] == 0, "Failed: simd_convert_float32_to_s16_array");
+	u8 pixels[7];
+	simd_convert_float32_to_u8_array(pixels, samples, 7);
+	assert(pixels[0] == 255 && pixels[1] == 0 && pixels[2] == 255 && pixels[3] == 0 && pixels[4] == 128 && pixels[6] == 0, "Failed: simd_convert_float32_to_u8_array");
+	u8 bytes[3] = {0, 255, 51};
+	float32 unit[3];
+	simd_convert_u8_to_float32_array(unit, bytes, 3);
+	assert(unit[0] == 0 && unit[1] == 1 && unit[2] == 0.2f, "Failed: simd_convert_u8_to_float32_array");
+	
+	float32 frames[4];
+	float32 left[2] = {1, 2};
+	float32 right[2] = {3, 4};
+	simd_interleave_float32_array(frames, left, right, 2);
+	assert(frames[0] == 1 && frames[1] == 3 && frames[2] == 2 && frames[3] == 4, "Failed: simd_interleave_float32_array");
+	simd_deinterleave_float32_array(right, left, frames, 2);
+	assert(right[0] == 1 && right[1] == 2 && left[0] == 3 && left[1] == 4, "Failed: simd_deinterleave_float32_array");
+	
+	s32 ints[5] = {1, 2, 3, 4, 5};
+	s32 big[2] = {S32_MAX, S32_MAX};
+	simd_prefix_sum_s32_array(ints, ints, 5);
+	assert(ints[0] == 1 && ints[2] == 6 && ints[4] == 15, "Failed: simd_prefix_sum_s32_array");
+	assert(simd_sum_s32_array(big, 2) == (s64)S32_MAX*2, "Failed: simd_sum_s32_array shouldn't overflow");
+	simd_mul_s32_array(big, big, big, 2);
+	assert(big[0] == 1, "Failed: simd_mul_s32_array should wrap");
+	
+	#undef TEST_NEXT_RANDOM
+	dealloc(heap, input);
+	dealloc(heap, expected);
+	dealloc(heap, result);
+	dealloc(heap, f);
+	dealloc(heap, g);
+	dealloc(heap, prefix);
+}
+
 void test_linmath() {
 
     // Test vector creation and access
@@ -1105,6 +1955,230 @@ void test_intmath() {
     assert(v4i_result.x == 1 && v4i_result.y == 2 && v4i_result.z == 3 && v4i_result.w == 4, "v4i_divi incorrect");
 }
 
+void test_hash() {
+	Allocator heap = get_heap_allocator();
+	u64 seed = 4242;
+	#define TEST_NEXT_RANDOM() (seed = seed*6364136223846793005ull + 1442695040888963407ull, seed >> 33)
+	
+	// Every kernel accumulates and scrambles exactly like the basic one
+	Hash_Accumulate_Proc accumulate[CPU_ISA_COUNT];
+	Hash_Scramble_Proc scramble[CPU_ISA_COUNT];
+	u64 kernel_count = 0;
+	for (Cpu_Isa isa = 0; isa < CPU_ISA_COUNT; isa++) {
+		if (!cpu_isa_supported(isa)) continue;
+		cpu_dispatch_force_isa(isa);
+		accumulate[kernel_count] = get_hash_kernels()->accumulate;
+		scramble[kernel_count]   = get_hash_kernels()->scramble;
+		kernel_count += 1;
+	}
+	cpu_dispatch_init(get_cpu_capabilities());
+	assert(accumulate[0] == _hash_accumulate_basic, "Failed: basic kernels");
+	u64 data_size = 8*1024;
+	u8 *data = (u8*)alloc(heap, data_size);
+	for (u64 i = 0; i < data_size; i++) data[i] = (u8)TEST_NEXT_RANDOM();
+	for (u64 stripes = 0; stripes <= HASH_STRIPES_PER_BLOCK; stripes++) {
+		u64 expected[8];
+		_hash_init_accumulators(expected, stripes);
+		accumulate[0](expected, data + stripes, stripes, _hash_secret);
+		scramble[0](expected, _hash_secret + HASH_SECRET_SIZE - HASH_STRIPE_SIZE);
+		for (u64 k = 1; k < kernel_count; k++) {
+			u64 acc[8];
+			_hash_init_accumulators(acc, stripes);
+			accumulate[k](acc, data + stripes, stripes, _hash_secret);
+			scramble[k](acc, _hash_secret + HASH_SECRET_SIZE - HASH_STRIPE_SIZE);
+			assert(bytes_match(acc, expected, sizeof(acc)), "Failed: hash kernel %llu (%llu stripes)", k, stripes);
+		}
+	}
+	
+	// Appending in random pieces gives the same hash as all at once, and bytes around the
+	// key never matter.
+	u8 *copy = (u8*)alloc(heap, data_size + 2);
+	for (u64 count = 0; count < 3000; count += (count < 600 ? 1 : 1 + TEST_NEXT_RANDOM() % 50)) {
+		u64 key_seed = count*31;
+		u64 expected = hash_bytes(data, count, key_seed);
+		
+		memset(copy, 0xAA, data_size + 2);
+		memcpy(copy + 1, data, count);
+		assert(hash_bytes(copy + 1, count, key_seed) == expected, "Failed: hash_bytes depends on where the key is (count %llu)", count);
+		memset(copy, 0x55, data_size + 2);
+		memcpy(copy + 1, data, count);
+		assert(hash_bytes(copy + 1, count, key_seed) == expected, "Failed: hash_bytes reads outside the key (count %llu)", count);
+		
+		Hash_State state;
+		hash_state_init(&state, key_seed);
+		u64 appended = 0;
+		while (appended < count) {
+			u64 max_piece = TEST_NEXT_RANDOM() & 1 ? 20 : 700;
+			u64 piece = TEST_NEXT_RANDOM() % max_piece;
+			piece = min(piece, count - appended);
+			hash_state_append(&state, data + appended, piece);
+			appended += piece;
+		}
+		assert(hash_state_get_hash(&state) == expected, "Failed: incremental hash differs from hash_bytes (count %llu)", count);
+		
+		if (count) {
+			assert(hash_bytes(data, count, key_seed+1) != expected, "Failed: seed doesn't change the hash (count %llu)", count);
+			assert(hash_bytes(data, count-1, key_seed) != expected, "Failed: length doesn't change the hash (count %llu)", count);
+		}
+	}
+	
+	// Avalanche: flipping any input bit should flip each output bit about half of the time
+	u64 lengths[] = {1, 3, 4, 8, 13, 16, 17, 24, 40, 49, 100, 256, 257, 300, 1025, 5000};
+	u8 *flipped = (u8*)alloc(heap, data_size);
+	for (u64 l = 0; l < sizeof(lengths)/sizeof(lengths[0]); l++) {
+		u64 count = lengths[l];
+		u64 flip_counts[64] = {0};
+		u64 trials = 0;
+		// One byte keys only have 256 values so do all of them
+		u64 samples = count == 1 ? 256 : 300;
+		for (u64 sample = 0; sample < samples; sample++) {
+			for (u64 i = 0; i < count; i++) data[i] = count == 1 ? (u8)sample : (u8)TEST_NEXT_RANDOM();
+			u64 h = hash_bytes(data, count, 0);
+			u64 bit_count = min(count*8, 64);
+			for (u64 b = 0; b < bit_count; b++) {
+				u64 bit = count*8 <= 64 ? b : TEST_NEXT_RANDOM() % (count*8);
+				memcpy(flipped, data, count);
+				flipped[bit/8] ^= (u8)(1 << (bit%8));
+				u64 diff = h ^ hash_bytes(flipped, count, 0);
+				for (u64 o = 0; o < 64; o++) flip_counts[o] += (diff >> o) & 1;
+				trials += 1;
+			}
+		}
+		// Within 5 standard deviations of a fair coin
+		float64 tolerance = 5.0*0.5/sqrt((float64)trials);
+		for (u64 o = 0; o < 64; o++) {
+			float64 p = (float64)flip_counts[o]/(float64)trials;
+			assert(p > 0.5-tolerance && p < 0.5+tolerance, "Failed: hash avalanche, output bit %llu flips %.3f of the time (length %llu)", o, p, count);
+		}
+	}
+	
+	// No collisions on a lot of asset paths that look alike
+	const char *folders[] = {"res/sprites", "res/sounds", "res/fonts", "oogabooga/examples", "assets/levels/forest"};
+	const char *names[] = {"skeleton.png", "player.png", "bone.png", "scroll.png", "circle.png", "berry_bush.png", "hammer.png", "block.wav", "bruh.wav", "song.ogg"};
+	u64 path_count = 5*10*1000;
+	u64 *hashes = (u64*)alloc(heap, path_count*sizeof(u64));
+	u64 *help = (u64*)alloc(heap, path_count*sizeof(u64));
+	u64 n = 0;
+	char path[256];
+	for (u64 f = 0; f < 5; f++) {
+		for (u64 name = 0; name < 10; name++) {
+			for (u64 v = 0; v < 1000; v++) {
+				u64 length = format_string_to_buffer_va(path, sizeof(path), "%cs/%llu/%cs", folders[f], v, names[name]);
+				hashes[n++] = hash_bytes(path, length, 0);
+			}
+		}
+	}
+	radix_sort(hashes, help, path_count, sizeof(u64), 0, 64);
+	u64 low_collisions = 0;
+	for (u64 i = 1; i < path_count; i++) {
+		assert(hashes[i] != hashes[i-1], "Failed: hash collision between asset paths");
+	}
+	// Same for just the low 32 bits, which is what a table would index with. About 0.3 expected.
+	for (u64 i = 0; i < path_count; i++) hashes[i] &= 0xFFFFFFFF;
+	radix_sort(hashes, help, path_count, sizeof(u64), 0, 32);
+	for (u64 i = 1; i < path_count; i++) {
+		if (hashes[i] == hashes[i-1]) low_collisions += 1;
+	}
+	assert(low_collisions <= 4, "Failed: %llu collisions in the low 32 bits of asset path hashes", low_collisions);
+	
+	// hash_many is hash_bytes on each key
+	string keys[] = {STR(""), STR("a"), STR("res/sprites/player.png"), (string){3000, data}};
+	u64 many[4];
+	hash_many(keys, 4, many, 7);
+	for (u64 i = 0; i < 4; i++) {
+		assert(many[i] == hash_bytes(keys[i].data, keys[i].count, 7), "Failed: hash_many key %llu", i);
+	}
+	assert(get_hash(keys[2]) == hash_bytes(keys[2].data, keys[2].count, 0), "Failed: string get_hash");
+	
+	float32 f32_a = 1.0f;
+	float32 f32_b = 1.0f + 1e-7f;
+	assert(float32_get_hash(f32_a) != float32_get_hash(f32_b), "Failed: float32 hash");
+	
+	#undef TEST_NEXT_RANDOM
+	dealloc(heap, data);
+	dealloc(heap, copy);
+	dealloc(heap, flipped);
+	dealloc(heap, hashes);
+	dealloc(heap, help);
+}
+#define TEST_INTERNER_STRINGS 3000
+typedef struct Test_Interner_Thread {
+	String_Interner *interner;
+	u64 start;
+	String_Id ids[TEST_INTERNER_STRINGS];
+} Test_Interner_Thread;
+void test_string_interner_thread(Thread *t) {
+	Test_Interner_Thread *data = (Test_Interner_Thread*)t->data;
+	char buffer[64];
+	// Every thread interns the same strings starting at a different one
+	for (u64 n = 0; n < TEST_INTERNER_STRINGS; n++) {
+		u64 i = (data->start + n) % TEST_INTERNER_STRINGS;
+		u64 length = format_string_to_buffer_va(buffer, sizeof(buffer), "res/sprites/thing_%llu.png", i);
+		data->ids[i] = string_intern(data->interner, (string){length, (u8*)buffer});
+	}
+}
+void test_string_interner() {
+	String_Interner interner = ZERO(String_Interner);
+	String_Id missing;
+	assert(!string_interner_find(&interner, STR("nothing"), &missing), "Failed: find in empty interner");
+	
+	// Ids are dense and in order, and the same string always gets the same id
+	String_Id empty = string_intern(&interner, STR(""));
+	String_Id player = string_intern(&interner, STR("player.png"));
+	assert(empty == 0 && player == 1, "Failed: interned ids should be dense");
+	assert(string_intern(&interner, STR("player.png")) == player, "Failed: interning twice");
+	assert(string_interner_get(&interner, empty).count == 0, "Failed: interned empty string");
+	
+	// Interned strings don't move as the interner grows
+	string player_string = string_interner_get(&interner, player);
+	char buffer[64];
+	for (u64 i = 0; i < 20000; i++) {
+		u64 length = format_string_to_buffer_va(buffer, sizeof(buffer), "string number %llu", i);
+		String_Id id = string_intern(&interner, (string){length, (u8*)buffer});
+		assert(id == i+2, "Failed: interned id, expected %llu got %u", i+2, id);
+	}
+	assert(interner.count == 20002, "Failed: interner count");
+	assert(string_interner_get(&interner, player).data == player_string.data, "Failed: interned string moved");
+	assert(strings_match(string_interner_get(&interner, 12345+2), STR("string number 12345")), "Failed: interned string contents");
+	String_Id found;
+	assert(string_interner_find(&interner, STR("string number 777"), &found) && found == 777+2, "Failed: string_interner_find");
+	assert(!string_interner_find(&interner, STR("string number 20000"), &found), "Failed: string_interner_find should miss");
+	assert(interner.count == 20002, "Failed: string_interner_find should not add");
+	string_interner_destroy(&interner);
+	assert(interner.count == 0 && !interner.table, "Failed: string_interner_destroy");
+	
+	// Threads racing to intern the same strings all agree on one id per string
+	const u64 thread_count = 4;
+	Thread threads[4];
+	Test_Interner_Thread *data = (Test_Interner_Thread*)alloc(get_heap_allocator(), thread_count*sizeof(Test_Interner_Thread));
+	for (u64 i = 0; i < thread_count; i++) {
+		data[i].interner = &interner;
+		data[i].start = i*TEST_INTERNER_STRINGS/thread_count;
+		os_thread_init(&threads[i], test_string_interner_thread);
+		threads[i].data = &data[i];
+	}
+	for (u64 i = 0; i < thread_count; i++) os_thread_start(&threads[i]);
+	for (u64 i = 0; i < thread_count; i++) {
+		os_thread_join(&threads[i]);
+		os_thread_destroy(&threads[i]);
+	}
+	assert(interner.count == TEST_INTERNER_STRINGS, "Failed: threaded interning, expected %d strings got %llu", TEST_INTERNER_STRINGS, interner.count);
+	for (u64 s = 0; s < TEST_INTERNER_STRINGS; s++) {
+		for (u64 i = 1; i < thread_count; i++) {
+			assert(data[i].ids[s] == data[0].ids[s], "Failed: threads got different ids for string %llu", s);
+		}
+		u64 length = format_string_to_buffer_va(buffer, sizeof(buffer), "res/sprites/thing_%llu.png", s);
+		assert(strings_match(string_interner_get(&interner, data[0].ids[s]), (string){length, (u8*)buffer}), "Failed: threaded interned string %llu", s);
+	}
+	dealloc(get_heap_allocator(), data);
+	string_interner_destroy(&interner);
+	
+	// The global one
+	String_Id a = intern_string(STR("global interned"));
+	assert(intern_string(STR("global interned")) == a, "Failed: intern_string");
+	assert(strings_match(get_interned_string(a), STR("global interned")), "Failed: get_interned_string");
+	assert(find_interned_string(STR("global interned"), &found) && found == a, "Failed: find_interned_string");
+}
 void test_hash_table() {
     Hash_Table table = make_hash_table(string, int, get_heap_allocator());
     
@@ -1227,7 +2301,6 @@ void test_mutex() {
     mutex_destroy(&data.mutex);
 }
 
-#ifndef OOGABOOGA_HEADLESS
 int compare_draw_quads(const void *a, const void *b) {
     return ((Draw_Quad*)a)->z-((Draw_Quad*)b)->z;
 }
@@ -1297,7 +2370,315 @@ void test_sort() {
     
     print("Merge sort took on average %llu cycles and %.2f ms\n", cycles / num_samples, (seconds * 1000.0) / (float64)num_samples);
 }
-#endif /* OOGABOOGA_HEADLESS */
+
+int _test_compare_u32(const void *a, const void *b) {
+	u32 x = *(const u32*)a;
+	u32 y = *(const u32*)b;
+	return (x > y) - (x < y);
+}
+int _test_compare_s64(const void *a, const void *b) {
+	s64 x = *(const s64*)a;
+	s64 y = *(const s64*)b;
+	return (x > y) - (x < y);
+}
+// Total order, what radix sort promises for floats
+int _test_compare_f32_bits(const void *a, const void *b) {
+	u32 x = _radix_key_f32(*(const f32*)a);
+	u32 y = _radix_key_f32(*(const f32*)b);
+	return (x > y) - (x < y);
+}
+int _test_compare_f64_bits(const void *a, const void *b) {
+	u64 x = _radix_key_f64(*(const f64*)a);
+	u64 y = _radix_key_f64(*(const f64*)b);
+	return (x > y) - (x < y);
+}
+
+typedef struct Test_Sort_Item {
+	s32 key;
+	u32 index;
+} Test_Sort_Item;
+#define _test_sort_item_key(x) ((x).key)
+#define _test_sort_item_greater(a, b) ((a).key > (b).key)
+define_sort_by_key(_test_sort_items_by_key, Test_Sort_Item, _test_sort_item_key);
+define_sort(_test_sort_items_descending, Test_Sort_Item, _test_sort_item_greater);
+define_radix_sort(_test_radix_sort_items, Test_Sort_Item, s32, _test_sort_item_key);
+
+void test_typed_sorts() {
+	Allocator heap = get_heap_allocator();
+	u64 seed = 6969;
+	#define TEST_NEXT_RANDOM() (seed = seed*6364136223846793005ull + 1442695040888963407ull, seed >> 32)
+	
+	u64 max_count = 200000;
+	u32 *src      = (u32*)alloc(heap, max_count*sizeof(u64));
+	u32 *expected = (u32*)alloc(heap, max_count*sizeof(u64));
+	u32 *items    = (u32*)alloc(heap, max_count*sizeof(u64));
+	u32 *buffer   = (u32*)alloc(heap, max_count*sizeof(u64));
+	
+	// Every sort matches merge_sort on inputs that are known to trip up quicksorts
+	u64 counts[] = {0, 1, 2, 3, 5, 8, 16, 23, 24, 25, 31, 32, 33, 64, 100, 127, 128, 129, 1000, 5000, 70000};
+	const u64 pattern_count = 8;
+	for (u64 c = 0; c < sizeof(counts)/sizeof(counts[0]); c++) {
+		u64 count = counts[c];
+		for (u64 pattern = 0; pattern < pattern_count; pattern++) {
+			for (u64 i = 0; i < count; i++) {
+				switch (pattern) {
+					case 0: src[i] = (u32)TEST_NEXT_RANDOM(); break;
+					case 1: src[i] = (u32)i; break;
+					case 2: src[i] = (u32)(count-i); break;
+					case 3: src[i] = (u32)TEST_NEXT_RANDOM() % 4; break;
+					case 4: src[i] = 7; break;
+					case 5: src[i] = (u32)(i < count/2 ? i : count-i); break; // Organ pipe
+					case 6: src[i] = (u32)i + ((TEST_NEXT_RANDOM() % 50 == 0) ? 1000 : 0); break; // Mostly sorted
+					case 7: src[i] = (u32)(i%16)*1000000u + (u32)(TEST_NEXT_RANDOM()%3); break; // Sawtooth
+				}
+			}
+			memcpy(expected, src, count*sizeof(u32));
+			merge_sort(expected, buffer, count, sizeof(u32), _test_compare_u32);
+			
+			memcpy(items, src, count*sizeof(u32));
+			sort_u32(items, count);
+			assert(bytes_match(items, expected, count*sizeof(u32)), "Failed: sort_u32 (count %llu, pattern %llu)", count, pattern);
+			
+			memcpy(items, src, count*sizeof(u32));
+			radix_sort_u32(items, buffer, count);
+			assert(bytes_match(items, expected, count*sizeof(u32)), "Failed: radix_sort_u32 (count %llu, pattern %llu)", count, pattern);
+			
+			memcpy(items, src, count*sizeof(u32));
+			sort_u32_heapsort(items, count);
+			assert(bytes_match(items, expected, count*sizeof(u32)), "Failed: sort_u32_heapsort (count %llu, pattern %llu)", count, pattern);
+			
+			// 2 and 4 threads end in the buffer after an odd and even number of merge rounds
+			for (u64 threads = 2; threads <= 4; threads *= 2) {
+				memcpy(items, src, count*sizeof(u32));
+				sort_u32_parallel_threads(items, buffer, count, threads);
+				assert(bytes_match(items, expected, count*sizeof(u32)), "Failed: sort_u32_parallel_threads (count %llu, pattern %llu, %llu threads)", count, pattern, threads);
+			}
+		}
+	}
+	
+	// Uneven chunks and more threads than the rounding keeps
+	{
+		s64 *s = (s64*)src;
+		s64 *e = (s64*)expected;
+		s64 *it = (s64*)items;
+		u64 count = max_count-7;
+		for (u64 i = 0; i < count; i++) s[i] = (s64)(TEST_NEXT_RANDOM() | (TEST_NEXT_RANDOM() << 32));
+		memcpy(e, s, count*sizeof(s64));
+		merge_sort(e, buffer, count, sizeof(s64), _test_compare_s64);
+		
+		u64 thread_counts[] = {1, 3, 8, 13, 16, 100};
+		for (u64 t = 0; t < sizeof(thread_counts)/sizeof(thread_counts[0]); t++) {
+			memcpy(it, s, count*sizeof(s64));
+			sort_s64_parallel_threads(it, (s64*)buffer, count, thread_counts[t]);
+			assert(bytes_match(it, e, count*sizeof(s64)), "Failed: sort_s64_parallel_threads (%llu threads)", thread_counts[t]);
+		}
+		memcpy(it, s, count*sizeof(s64));
+		sort_s64_parallel(it, (s64*)buffer, count);
+		assert(bytes_match(it, e, count*sizeof(s64)), "Failed: sort_s64_parallel");
+		memcpy(it, s, count*sizeof(s64));
+		radix_sort_s64(it, (s64*)buffer, count);
+		assert(bytes_match(it, e, count*sizeof(s64)), "Failed: radix_sort_s64");
+		memcpy(it, s, count*sizeof(s64));
+		sort_s64(it, count);
+		assert(bytes_match(it, e, count*sizeof(s64)), "Failed: sort_s64");
+		
+		s32 small[] = {5, -3, 0, -2147483647-1, 2147483647, -1, 1, -3};
+		s32 small_expected[] = {-2147483647-1, -3, -3, -1, 0, 1, 5, 2147483647};
+		s32 small_buffer[8];
+		radix_sort_s32(small, small_buffer, 8);
+		assert(bytes_match(small, small_expected, sizeof(small)), "Failed: radix_sort_s32");
+	}
+	
+	// Floats
+	{
+		f32 specials32[] = {0.0f, -0.0f, 1.0f, -1.0f, 1e-40f, -1e-40f, 3.4e38f, -3.4e38f};
+		f64 specials64[] = {0.0, -0.0, 1.0, -1.0, 1e-310, -1e-310, 1.7e308, -1.7e308};
+		f32 *s32s = (f32*)src;
+		f32 *e32 = (f32*)expected;
+		f32 *it32 = (f32*)items;
+		u64 count = 3000;
+		for (u64 i = 0; i < count; i++) {
+			u64 r = TEST_NEXT_RANDOM();
+			if (r % 8 == 0) s32s[i] = specials32[(r >> 8) % 8];
+			else s32s[i] = ((f32)(r % 20000) - 10000.0f) * 0.37f;
+		}
+		memcpy(e32, s32s, count*sizeof(f32));
+		merge_sort(e32, buffer, count, sizeof(f32), _test_compare_f32_bits);
+		
+		memcpy(it32, s32s, count*sizeof(f32));
+		radix_sort_f32(it32, (f32*)buffer, count);
+		assert(bytes_match(it32, e32, count*sizeof(f32)), "Failed: radix_sort_f32");
+		
+		// Comparison sort has -0.0 == 0.0 so only the values have to match
+		memcpy(it32, s32s, count*sizeof(f32));
+		sort_f32(it32, count);
+		for (u64 i = 0; i < count; i++) assert(it32[i] == e32[i], "Failed: sort_f32 at %llu", i);
+		
+		f64 *s64s = (f64*)src;
+		f64 *e64 = (f64*)expected;
+		f64 *it64 = (f64*)items;
+		for (u64 i = 0; i < count; i++) {
+			u64 r = TEST_NEXT_RANDOM();
+			if (r % 8 == 0) s64s[i] = specials64[(r >> 8) % 8];
+			else s64s[i] = ((f64)(r % 20000) - 10000.0) * 0.37;
+		}
+		memcpy(e64, s64s, count*sizeof(f64));
+		merge_sort(e64, buffer, count, sizeof(f64), _test_compare_f64_bits);
+		
+		memcpy(it64, s64s, count*sizeof(f64));
+		radix_sort_f64(it64, (f64*)buffer, count);
+		assert(bytes_match(it64, e64, count*sizeof(f64)), "Failed: radix_sort_f64");
+		
+		memcpy(it64, s64s, count*sizeof(f64));
+		sort_f64(it64, count);
+		for (u64 i = 0; i < count; i++) assert(it64[i] == e64[i], "Failed: sort_f64 at %llu", i);
+		
+		f32 nan = 0.0f/0.0f;
+		f32 inf = 1.0f/0.0f;
+		f32 total[] = {nan, 1.0f, -inf, 0.0f, -nan, inf, -0.0f, -1.0f};
+		f32 total_buffer[8];
+		radix_sort_f32(total, total_buffer, 8);
+		assert(total[1] == -inf && total[2] == -1.0f && total[5] == 1.0f && total[6] == inf, "Failed: radix_sort_f32 total order");
+		assert(signbit(total[3]) && !signbit(total[4]) && total[3] == 0.0f, "Failed: radix_sort_f32 -0.0 before 0.0");
+		assert(isnan(total[0]) && signbit(total[0]) && isnan(total[7]) && !signbit(total[7]), "Failed: radix_sort_f32 NaNs at the ends");
+	}
+	
+	// Structs sorted by a key
+	{
+		Test_Sort_Item *s = (Test_Sort_Item*)src;
+		Test_Sort_Item *it = (Test_Sort_Item*)items;
+		u64 count = 20000;
+		for (u64 i = 0; i < count; i++) {
+			s[i].key = (s32)(TEST_NEXT_RANDOM() % 101) - 50;
+			s[i].index = (u32)i;
+		}
+		
+		memcpy(it, s, count*sizeof(Test_Sort_Item));
+		_test_radix_sort_items(it, (Test_Sort_Item*)buffer, count);
+		for (u64 i = 1; i < count; i++) {
+			assert(it[i-1].key <= it[i].key, "Failed: radix sort by key");
+			if (it[i-1].key == it[i].key) assert(it[i-1].index < it[i].index, "Failed: radix sort by key is not stable");
+		}
+		
+		// Not stable, but every item is still there
+		u64 index_sum = 0;
+		memcpy(it, s, count*sizeof(Test_Sort_Item));
+		_test_sort_items_by_key(it, count);
+		for (u64 i = 0; i < count; i++) {
+			if (i > 0) assert(it[i-1].key <= it[i].key, "Failed: sort by key");
+			assert(s[it[i].index].key == it[i].key, "Failed: sort by key lost an item");
+			index_sum += it[i].index;
+		}
+		assert(index_sum == count*(count-1)/2, "Failed: sort by key lost an item");
+		
+		memcpy(it, s, count*sizeof(Test_Sort_Item));
+		_test_sort_items_descending_parallel_threads(it, (Test_Sort_Item*)buffer, count, 4);
+		for (u64 i = 1; i < count; i++) assert(it[i-1].key >= it[i].key, "Failed: sort with custom LESS");
+	}
+	
+	#undef TEST_NEXT_RANDOM
+	dealloc(heap, src);
+	dealloc(heap, expected);
+	dealloc(heap, items);
+	dealloc(heap, buffer);
+}
+
+void test_quad_pipeline() {
+	Allocator heap = get_heap_allocator();
+	s32 last_width = window.width;
+	s32 last_height = window.height;
+	window.width = 801; // Uneven for the uv fixup
+	window.height = 600;
+	reset_draw_frame(&draw_frame);
+	draw_frame.enable_z_sorting = true;
+	
+	// More images than texture slots so we get a flush
+	const u64 image_count = QUAD_BATCH_MAX_TEXTURES+8;
+	Gfx_Image *images[QUAD_BATCH_MAX_TEXTURES+8];
+	for (u64 i = 0; i < image_count; i++) images[i] = make_image(4+i, 4, 4, 0, heap);
+	
+	for (u64 i = 0; i < 100; i++) {
+		push_z_layer((s32)(i%7));
+		draw_rect(v2(-0.5+(float)i*0.01, 0), v2(0.1, 0.1), v4(1, 0, 0, 1));
+		pop_z_layer();
+	}
+	for (u64 i = 0; i < image_count; i++) {
+		draw_image(images[i], v2(-0.5+(float)i*0.02, 0.2), v2(0.1, 0.1), COLOR_WHITE);
+		draw_image(images[image_count-1-i], v2(-0.5+(float)i*0.02, -0.2), v2(0.1, 0.1), COLOR_WHITE);
+	}
+	u64 num_quads = draw_frame.num_quads;
+	assert(num_quads == 100+image_count*2, "Expected %llu quads, got %llu", 100+image_count*2, num_quads);
+	
+	string path = STR("test_draw_frame.capture");
+	bool ok = draw_frame_capture_write(path, &draw_frame, quad_buffer, window.width, window.height);
+	assert(ok, "Failed writing draw frame capture");
+	
+	// Process live
+	Quad_Pipeline live = ZERO(Quad_Pipeline);
+	Draw_Quad *quads = (Draw_Quad*)alloc(heap, num_quads*sizeof(Draw_Quad));
+	memcpy(quads, quad_buffer, num_quads*sizeof(Draw_Quad));
+	quad_pipeline_process(&live, &draw_frame, quads, window.width, window.height);
+	
+	assert(live.quad_count == num_quads);
+	u64 batch_count = growing_array_get_valid_count(live.batches);
+	assert(batch_count >= 2, "Expected a texture flush");
+	assert(live.texture_flushes == batch_count-1);
+	assert(live.batches[0].texture_count == QUAD_BATCH_MAX_TEXTURES);
+	u64 batched_quads = 0;
+	for (u64 i = 0; i < batch_count; i++) {
+		Quad_Batch *batch = &live.batches[i];
+		assert(batch->first_quad == batched_quads, "Batches should be contiguous");
+		assert(batch->texture_count <= QUAD_BATCH_MAX_TEXTURES);
+		for (u64 q = batch->first_quad; q < batch->first_quad+batch->quad_count; q++) {
+			s8 texture_index = live.vertices[q*6].texture_index;
+			assert(texture_index < (s64)batch->texture_count, "Vertex uses texture slot %d but batch has %llu textures", texture_index, batch->texture_count);
+			if (texture_index >= 0) assert(batch->textures[texture_index] == quads[q].image->gfx_handle, "Vertex uses wrong texture slot");
+		}
+		batched_quads += batch->quad_count;
+	}
+	assert(batched_quads == num_quads);
+	for (u64 i = 1; i < num_quads; i++) assert(quads[i].z >= quads[i-1].z, "Quads not sorted");
+	
+	// Replay the capture offline, it should give the exact same vertices & batches
+	Draw_Frame_Capture capture;
+	ok = draw_frame_capture_load(path, &capture, heap);
+	assert(ok, "Failed loading draw frame capture");
+	assert(capture.window_width == 801 && capture.window_height == 600);
+	assert(capture.frame.num_quads == num_quads && capture.frame.enable_z_sorting);
+	assert(capture.image_count == image_count, "Expected %llu captured images, got %llu", image_count, capture.image_count);
+	
+	Quad_Pipeline replayed = ZERO(Quad_Pipeline);
+	for (u64 run = 0; run < 2; run++) {
+		draw_frame_capture_replay(&capture, &replayed);
+		
+		assert(replayed.quad_count == num_quads);
+		assert(growing_array_get_valid_count(replayed.batches) == batch_count);
+		for (u64 i = 0; i < batch_count; i++) {
+			assert(replayed.batches[i].first_quad == live.batches[i].first_quad);
+			assert(replayed.batches[i].quad_count == live.batches[i].quad_count);
+			assert(replayed.batches[i].texture_count == live.batches[i].texture_count);
+		}
+		for (u64 i = 0; i < num_quads*6; i++) {
+			Quad_Vertex a = live.vertices[i];
+			Quad_Vertex b = replayed.vertices[i];
+			assert(bytes_match(&a.position, &b.position, sizeof(a.position)), "Replayed vertex %llu position differs", i);
+			assert(bytes_match(&a.uv, &b.uv, sizeof(a.uv)), "Replayed vertex %llu uv differs", i);
+			assert(bytes_match(&a.color, &b.color, sizeof(a.color)), "Replayed vertex %llu color differs", i);
+			assert(a.texture_index == b.texture_index && a.sampler == b.sampler && a.type == b.type);
+		}
+	}
+	
+	draw_frame_capture_destroy(&capture);
+	quad_pipeline_destroy(&replayed);
+	quad_pipeline_destroy(&live);
+	dealloc(heap, quads);
+	os_file_delete(path);
+	
+	for (u64 i = 0; i < image_count; i++) delete_image(images[i]);
+	window.width = last_width;
+	window.height = last_height;
+	reset_draw_frame(&draw_frame);
+}
 
 typedef struct Test_Thing {
     int foo;
@@ -1363,6 +2744,684 @@ void test_growing_array() {
     assert(!bytes_match(&copy, thing, sizeof(Test_Thing)), "Failed: growing_array_unordered_remove_by_pointer");
     
     assert(growing_array_get_valid_count(things) == 99, "Failed: growing_array_get_valid_count");
+    
+    growing_array_deinit((void**)&things);
+    
+    // Virtual memory backed, the array should never move
+    growing_array_init_virtual((void**)&things, sizeof(Test_Thing), 1000000);
+    Test_Thing *first = things;
+    for (u32 i = 0; i < 100000; i += 1) {
+        new_thing.foo = i;
+        new_thing.bar = i * 4.0;
+        growing_array_add((void**)&things, &new_thing);
+    }
+    assert(things == first, "Failed: virtual growing array moved");
+    assert(growing_array_get_valid_count(things) == 100000, "Failed: growing_array_get_valid_count");
+    assert(growing_array_get_allocated_count(things) >= 100000, "Failed: growing_array_get_allocated_count");
+    for (u32 i = 0; i < 100000; i += 1) {
+        assert(things[i].foo == i && floats_roughly_match(things[i].bar, i*4.0), "Failed: virtual growing array add");
+    }
+    growing_array_deinit((void**)&things);
+    
+    // Grow a 100M element array in 1M steps, touching every item like a real user would
+    const u64 huge_count = 100000000;
+    const u64 step = 1000000;
+    u8 *huge = 0;
+    
+    growing_array_init((void**)&huge, sizeof(u8), get_heap_allocator());
+    u64 start = rdtsc();
+    for (u64 n = step; n <= huge_count; n += step) {
+        growing_array_resize((void**)&huge, n);
+        memset(huge+n-step, (u8)n, step);
+    }
+    u64 heap_cycles = rdtsc()-start;
+    assert(huge[huge_count-1] == (u8)huge_count, "Failed: growing array resize");
+    growing_array_deinit((void**)&huge);
+    
+    growing_array_init_virtual((void**)&huge, sizeof(u8), huge_count);
+    start = rdtsc();
+    for (u64 n = step; n <= huge_count; n += step) {
+        growing_array_resize((void**)&huge, n);
+        memset(huge+n-step, (u8)n, step);
+    }
+    u64 virtual_cycles = rdtsc()-start;
+    assert(huge[huge_count-1] == (u8)huge_count, "Failed: virtual growing array resize");
+    growing_array_deinit((void**)&huge);
+    
+    // Ordered remove shifts a range onto itself
+    u32 *numbers;
+    growing_array_init((void**)&numbers, sizeof(u32), get_heap_allocator());
+    for (u32 i = 0; i < 1000; i++) growing_array_add((void**)&numbers, &i);
+    growing_array_ordered_remove_by_index((void**)&numbers, 3);
+    for (u32 i = 0; i < 999; i++) {
+        assert(numbers[i] == (i < 3 ? i : i+1), "Failed: growing_array_ordered_remove_by_index on overlapping range");
+    }
+    growing_array_deinit((void**)&numbers);
+    
+    print("growing to 100M items took %llu cycles on heap, %llu cycles in virtual memory... ", heap_cycles, virtual_cycles);
+}
+
+define_array(Test_Thing);
+
+void test_array() {
+    Allocator heap = get_heap_allocator();
+    
+    Array(Test_Thing) things;
+    array_init(&things, heap);
+    
+    Test_Thing new_thing = {5, 420.69};
+    array_push(&things, new_thing);
+    new_thing = (Test_Thing){1, 123.45};
+    array_push(&things, new_thing);
+    assert(things.count == 2, "Failed: array_push");
+    assert(things.data[0].foo == 5 && things.data[1].foo == 1, "Failed: array_push");
+    
+    Test_Thing *empty = array_push_empty(&things);
+    assert(empty->foo == 0 && empty->bar == 0 && things.count == 3, "Failed: array_push_empty");
+    empty->foo = 7;
+    assert(array_last(&things)->foo == 7, "Failed: array_last");
+    assert(array_at(&things, 1)->foo == 1, "Failed: array_at");
+    
+    Test_Thing popped = array_pop(&things);
+    assert(popped.foo == 7 && things.count == 2, "Failed: array_pop");
+    
+    Test_Thing to_find = {1, 123.45};
+    assert(array_find(&things, &to_find) == 1, "Failed: array_find");
+    to_find.foo = 2;
+    assert(array_find(&things, &to_find) == -1, "Failed: array_find");
+    
+    array_ordered_remove(&things, 0);
+    assert(things.count == 1 && things.data[0].foo == 1, "Failed: array_ordered_remove");
+    
+    u64 sum = 0;
+    array_foreach(Test_Thing, thing, &things) sum += thing->foo;
+    assert(sum == 1, "Failed: array_foreach");
+    
+    array_deinit(&things);
+    
+    // Zero initialized arrays just work
+    Array(u32) numbers = {0};
+    for (u32 i = 0; i < 1000; i++) array_push(&numbers, i);
+    assert(numbers.count == 1000 && numbers.capacity >= 1000, "Failed: array_push growing");
+    for (u32 i = 0; i < 1000; i++) assert(numbers.data[i] == i, "Failed: array_push growing");
+    
+    // Bulk insert & append
+    u32 more[] = {5000, 5001, 5002};
+    array_insert(&numbers, 10, more, 3);
+    assert(numbers.count == 1003, "Failed: array_insert");
+    assert(numbers.data[9] == 9 && numbers.data[10] == 5000 && numbers.data[12] == 5002 && numbers.data[13] == 10, "Failed: array_insert");
+    array_append(&numbers, more, 3);
+    assert(numbers.count == 1006 && numbers.data[1005] == 5002, "Failed: array_append");
+    array_ordered_remove_range(&numbers, 10, 3);
+    for (u32 i = 0; i < 1000; i++) assert(numbers.data[i] == i, "Failed: array_ordered_remove_range");
+    
+    // Inserting a range of the array into itself, across the insertion point
+    array_insert(&numbers, 2, numbers.data, 4);
+    u32 expected[] = {0, 1, 0, 1, 2, 3, 2, 3, 4};
+    for (u32 i = 0; i < 9; i++) assert(numbers.data[i] == expected[i], "Failed: array_insert from itself");
+    array_ordered_remove_range(&numbers, 2, 4);
+    
+    array_unordered_remove(&numbers, 0);
+    assert(numbers.data[0] == 5002 && numbers.count == 1002, "Failed: array_unordered_remove");
+    
+    // Find at every position & size so we hit the unrolled, single vector and scalar loops
+    for (u32 count = 0; count < 200; count += 7) {
+        array_clear(&numbers);
+        for (u32 i = 0; i < count; i++) array_push(&numbers, i*3);
+        for (u32 i = 0; i < count; i++) {
+            u32 value = i*3;
+            assert(array_find(&numbers, &value) == i, "Failed: array_find u32 (%u in %u)", i, count);
+        }
+        u32 missing = 1;
+        assert(array_find(&numbers, &missing) == -1, "Failed: array_find u32 missing");
+    }
+    array_deinit(&numbers);
+    
+    Array(u8) bytes = {0};
+    Array(u16) shorts = {0};
+    Array(u64) longs = {0};
+    for (u64 i = 0; i < 300; i++) {
+        array_push(&bytes, (u8)(i%200));
+        array_push(&shorts, (u16)(i*1000));
+        array_push(&longs, i << 40 | 0xFFFFFFFF);
+    }
+    for (u64 i = 0; i < 200; i++) {
+        u8 b = (u8)i;
+        u16 sh = (u16)(i*1000);
+        u64 l = i << 40 | 0xFFFFFFFF;
+        assert(array_find(&bytes, &b) == i, "Failed: array_find u8");
+        assert(array_find(&shorts, &sh) == i, "Failed: array_find u16");
+        assert(array_find(&longs, &l) == i, "Failed: array_find u64");
+    }
+    // Only one half of the 64 bit value matches
+    u64 half = 0xFFFFFFFF;
+    assert(array_find(&longs, &half) == 0, "Failed: array_find u64");
+    half = 5ull << 40;
+    assert(array_find(&longs, &half) == -1, "Failed: array_find u64 with half a match");
+    array_deinit(&bytes);
+    array_deinit(&shorts);
+    array_deinit(&longs);
+    
+    Array(u64) big;
+    array_init_reserve(&big, 16, heap);
+    array_resize(&big, 5000);
+    assert(big.count == 5000 && big.data[4999] == 0, "Failed: array_resize");
+    array_deinit(&big);
+}
+
+void _test_audio_dsp_proc(float32 *frames, u64 number_of_frames, Audio_Format format, void *data) {
+	*(u64*)data += 1;
+	for (u64 i = 0; i < number_of_frames*format.channels; i++) frames[i] *= 2.0f;
+}
+void test_input_recording() {
+	// We're stomping on the real input & window state here
+	Input_Frame *last_input_frame = (Input_Frame*)alloc(get_heap_allocator(), sizeof(Input_Frame));
+	*last_input_frame = input_frame;
+	Os_Window last_window = window;
+	u64 last_seed = seed_for_random;
+	
+	string path = STR("test_input_recording.bin");
+	string frame_times_path = STR("test_input_recording_times.txt");
+	
+	seed_for_random = 1234;
+	bool ok = input_record_begin(path);
+	assert(ok, "Failed starting input recording");
+	
+	float64 recorded_delta_t[4];
+	for (u64 frame = 0; frame < 4; frame++) {
+		input_frame.number_of_events = 0;
+		window.width = frame < 2 ? 800 : 1024;
+		window.height = 600;
+		input_frame.mouse_x = frame == 3 ? 50.5f : 10.0f;
+		input_frame.mouse_y = 20.0f;
+		
+		if (frame == 1) {
+			Input_Event e = ZERO(Input_Event);
+			e.kind = INPUT_EVENT_KEY;
+			e.key_code = 'W';
+			e.key_state = INPUT_STATE_DOWN | INPUT_STATE_JUST_PRESSED;
+			input_frame.events[input_frame.number_of_events++] = e;
+			e = ZERO(Input_Event);
+			e.kind = INPUT_EVENT_TEXT;
+			e.utf32 = 0x00E5;
+			input_frame.events[input_frame.number_of_events++] = e;
+		} else if (frame == 3) {
+			Input_Event e = ZERO(Input_Event);
+			e.kind = INPUT_EVENT_SCROLL;
+			e.yscroll = -2.0;
+			input_frame.events[input_frame.number_of_events++] = e;
+		}
+		
+		os_update();
+		recorded_delta_t[frame] = get_frame_delta_time();
+		os_sleep(1);
+	}
+	input_recording_stop();
+	
+	// Should be compact: header + 4 frames of flags & delta_t + 2 window sizes + 2 mouse positions + events
+	u64 expected_size = 16 + 4*9 + 2*8 + 2*8 + (2 + 3 + 5) + (2 + 9);
+	assert(os_file_get_size_from_path(path) == expected_size, "Input recording size was %lld, expected %llu", os_file_get_size_from_path(path), expected_size);
+	
+	// Replay
+	input_frame = ZERO(Input_Frame);
+	window.width = 1;
+	window.height = 1;
+	seed_for_random = 1;
+	
+	ok = input_replay_begin(path, frame_times_path);
+	assert(ok, "Failed starting input replay");
+	assert(input_is_replaying());
+	assert(seed_for_random == 1234, "Replay didn't restore random seed");
+	
+	for (u64 frame = 0; frame < 4; frame++) {
+		os_update();
+		assert(!window.should_close);
+		assert(get_frame_delta_time() == recorded_delta_t[frame], "Replayed delta_t doesn't match");
+		assert(window.width == (frame < 2 ? 800 : 1024) && window.height == 600, "Replayed window size doesn't match");
+		assert(input_frame.mouse_x == (frame == 3 ? 50.5f : 10.0f) && input_frame.mouse_y == 20.0f, "Replayed mouse doesn't match");
+		
+		if (frame == 0) {
+			assert(input_frame.number_of_events == 0);
+			assert(!is_key_down('W'));
+		} else if (frame == 1) {
+			assert(input_frame.number_of_events == 2);
+			assert(input_frame.events[0].kind == INPUT_EVENT_KEY && input_frame.events[0].key_code == 'W');
+			assert(input_frame.events[1].kind == INPUT_EVENT_TEXT && input_frame.events[1].utf32 == 0x00E5);
+			assert(is_key_just_pressed('W'));
+		} else if (frame == 2) {
+			assert(input_frame.number_of_events == 0);
+			assert(is_key_down('W') && !is_key_just_pressed('W'), "Replayed key state didn't carry over");
+		} else if (frame == 3) {
+			assert(input_frame.number_of_events == 1);
+			assert(input_frame.events[0].kind == INPUT_EVENT_SCROLL && input_frame.events[0].yscroll == -2.0);
+		}
+	}
+	
+	// Out of frames
+	os_update();
+	assert(window.should_close, "Replay should close the window when it's done");
+	assert(!input_is_replaying());
+	
+	string frame_times;
+	ok = os_read_entire_file(frame_times_path, &frame_times, get_heap_allocator());
+	assert(ok, "Replay didn't write frame times");
+	u64 lines = 0;
+	for (u64 i = 0; i < frame_times.count; i++) if (frame_times.data[i] == '\n') lines += 1;
+	assert(lines == 4, "Expected 4 frame times, got %llu", lines);
+	dealloc_string(get_heap_allocator(), frame_times);
+	
+	// A recording cut off in the middle of the last frame should end the replay, not read past the end
+	string recording;
+	ok = os_read_entire_file(path, &recording, get_heap_allocator());
+	assert(ok, "Failed reading input recording");
+	ok = os_write_entire_file(path, (string){recording.count-3, recording.data});
+	assert(ok, "Failed writing truncated input recording");
+	dealloc_string(get_heap_allocator(), recording);
+	
+	window.should_close = false;
+	ok = input_replay_begin(path, frame_times_path);
+	assert(ok, "Failed starting truncated input replay");
+	for (u64 frame = 0; frame < 3; frame++) {
+		os_update();
+		assert(!window.should_close, "Truncated replay ended too early");
+	}
+	os_update();
+	assert(window.should_close, "Truncated replay should close the window");
+	assert(!input_is_replaying());
+	assert(input_frame.number_of_events == 0, "Truncated event should not be applied");
+	
+	os_file_delete(path);
+	os_file_delete(frame_times_path);
+	
+	input_frame = *last_input_frame;
+	window = last_window;
+	seed_for_random = last_seed;
+	dealloc(get_heap_allocator(), last_input_frame);
+}
+
+void test_audio() {
+	Allocator heap = get_heap_allocator();
+	
+	// Keep the device output (if any) from mixing our players between renders
+	Audio_Output_Kind last_output_kind = audio_output_kind;
+	audio_output_kind = AUDIO_OUTPUT_NULL;
+	
+	Audio_Format format = (Audio_Format){AUDIO_BITS_32, 2, 48000};
+	u64 frame_size = get_audio_bit_width_byte_size(format.bit_width)*format.channels;
+	
+	// Make a wav file with a known signal
+	const u64 source_frames = 48000;
+	f32 *signal = (f32*)alloc(heap, source_frames*frame_size);
+	for (u64 i = 0; i < source_frames; i++) {
+		signal[i*2+0] = (f32)(i%1000)/1000.0f - 0.5f;
+		signal[i*2+1] = 0.5f - (f32)(i%700)/700.0f;
+	}
+	bool ok = audio_write_wav_file(STR("audio_test.wav"), signal, source_frames, format);
+	assert(ok, "Failed: audio_write_wav_file");
+	
+	Audio_Source src;
+	ok = audio_open_source_load_format(&src, STR("audio_test.wav"), format, heap);
+	assert(ok, "Failed: audio_open_source_load_format");
+	assert(src.number_of_frames == source_frames, "Failed: wav frame count mismatch, got %d", src.number_of_frames);
+	assert(bytes_match(src.pcm_frames, signal, source_frames*frame_size), "Failed: wav write/read mismatch");
+	
+	const u64 mix_frames = 1024;
+	f32 *output = (f32*)alloc(heap, mix_frames*frame_size);
+	
+	// s16 volume, more than one chunk and saturating
+	{
+		s16 pcm[3001];
+		for (u64 i = 0; i < 3001; i++) pcm[i] = (s16)((s64)(i*37 % 65536)-32768);
+		apply_audio_volume(pcm, (Audio_Format){AUDIO_BITS_16, 1, 48000}, 3001, 0.5f);
+		for (u64 i = 0; i < 3001; i++) {
+			s16 expected = (s16)(((f32)((s64)(i*37 % 65536)-32768)/32768.0f)*0.5f*32768.0f);
+			assert(pcm[i] == expected, "Failed: s16 volume at %d, expected %d got %d", i, expected, pcm[i]);
+		}
+		pcm[0] = 30000;
+		apply_audio_volume(pcm, (Audio_Format){AUDIO_BITS_16, 1, 48000}, 1, 2.0f);
+		assert(pcm[0] == S16_MAX, "Failed: s16 volume should saturate, got %d", pcm[0]);
+	}
+	
+	Audio_Player *p = audio_player_get_one();
+	audio_player_set_source(p, src);
+	audio_player_set_state(p, AUDIO_PLAYER_STATE_PLAYING);
+	
+	// Commands are applied at the start of the next mix
+	assert(!p->has_source, "Failed: player command applied before mix");
+	
+	// Get past the fade in
+	u64 played = 0;
+	while (played < 4800) {
+		audio_render_offline(output, mix_frames, format);
+		played += mix_frames;
+	}
+	assert(p->has_source && p->state == AUDIO_PLAYER_STATE_PLAYING, "Failed: player commands");
+	assert(p->frame_index == played, "Failed: expected frame index %d, got %d", played, p->frame_index);
+	
+	// Same format & volume 1 so the output should be exactly the source
+	audio_render_offline(output, mix_frames, format);
+	assert(bytes_match(output, signal+played*2, mix_frames*frame_size), "Failed: mixed output does not match source");
+	
+	audio_player_set_progression_factor(p, 0.5);
+	audio_render_offline(output, mix_frames, format);
+	assert(p->frame_index == source_frames/2 + mix_frames, "Failed: audio_player_set_progression_factor");
+	assert(bytes_match(output, signal+(source_frames/2)*2, mix_frames*frame_size), "Failed: output after seek does not match source");
+	
+	// Wrap around when looping
+	audio_player_set_looping(p, true);
+	audio_player_set_time_stamp(p, (f64)(source_frames-100)/(f64)format.sample_rate);
+	audio_render_offline(output, mix_frames, format);
+	assert(p->frame_index == mix_frames-100, "Failed: looping frame index, got %d", p->frame_index);
+	assert(bytes_match(output+100*2, signal, (mix_frames-100)*frame_size), "Failed: looping output does not match source");
+	
+	// Buses
+	audio_sfx_bus.gain = 0.5;
+	u64 expected_index = p->frame_index;
+	audio_render_offline(output, mix_frames, format);
+	for (u64 i = 0; i < mix_frames*2; i++) {
+		assert(output[i] == signal[expected_index*2+i]*0.5f, "Failed: bus gain");
+	}
+	
+	u64 dsp_calls = 0;
+	Audio_Dsp *dsp = audio_bus_add_dsp(&audio_sfx_bus, audio_dsp_make_user(_test_audio_dsp_proc, &dsp_calls));
+	expected_index = p->frame_index;
+	audio_render_offline(output, mix_frames, format);
+	assert(dsp_calls == 1, "Failed: DSP should run once per bus per mix, ran %d times", dsp_calls);
+	assert(bytes_match(output, signal+expected_index*2, mix_frames*frame_size), "Failed: user DSP on bus");
+	dsp->bypass = true;
+	audio_sfx_bus.gain = 1.0;
+	
+	Audio_Bus *child_bus = audio_bus_make(&audio_music_bus);
+	assert(child_bus->parent == &audio_music_bus, "Failed: audio_bus_make parent");
+	p->config.bus = child_bus;
+	audio_music_bus.muted = true;
+	audio_render_offline(output, mix_frames, format);
+	for (u64 i = 0; i < mix_frames*2; i++) assert(output[i] == 0, "Failed: muted parent bus should silence child bus");
+	audio_music_bus.muted = false;
+	
+	Audio_Dsp *limiter = audio_bus_add_dsp(&audio_master_bus, audio_dsp_make_limiter(0.0));
+	p->config.volume = 4.0;
+	for (u64 i = 0; i < 5; i++) audio_render_offline(output, mix_frames, format);
+	for (u64 i = 0; i < mix_frames*2; i++) assert(fabsf(output[i]) < 1.1f, "Failed: limiter let through %f", output[i]);
+	limiter->bypass = true;
+	p->config.volume = 1.0;
+	p->config.bus = 0;
+	
+	// Voice limits: only the most important voices are mixed, the rest just advance
+	Audio_Voice_Limits last_limits = audio_voice_limits;
+	audio_voice_limits.max_voices = 2;
+	audio_player_set_looping(p, false);
+	audio_player_set_state(p, AUDIO_PLAYER_STATE_PAUSED);
+	for (u64 i = 0; i < 3; i++) audio_render_offline(output, mix_frames, format); // Fade out
+	
+	Audio_Player *voices[3];
+	f32 priorities[3] = {1, 3, 2};
+	for (u64 i = 0; i < 3; i++) {
+		voices[i] = audio_player_get_one();
+		voices[i]->config.priority = priorities[i];
+		audio_player_set_source(voices[i], src);
+		audio_player_set_state(voices[i], AUDIO_PLAYER_STATE_PLAYING);
+		// Different start frames so phase cancellation doesn't kick in
+		audio_player_set_progression_factor(voices[i], 0.1*(f64)(i+1));
+	}
+	audio_render_offline(output, mix_frames, format);
+	
+	assert(voices[0]->is_virtual, "Failed: least important voice should be virtual");
+	assert(!voices[1]->is_virtual && !voices[2]->is_virtual, "Failed: most important voices should be real");
+	assert(audio_voice_stats.real_voices == 2 && audio_voice_stats.virtual_voices == 1, "Failed: voice stats");
+	assert(voices[0]->frame_index == (u64)round(source_frames*0.1) + mix_frames, "Failed: virtual voice did not advance");
+	
+	audio_voice_limits.max_voices_per_category[AUDIO_VOICE_CATEGORY_SFX] = 1;
+	audio_render_offline(output, mix_frames, format);
+	assert(voices[0]->is_virtual && !voices[1]->is_virtual && voices[2]->is_virtual, "Failed: category voice limit");
+	
+	audio_voice_limits = last_limits;
+	voices[1]->config.volume = 0.00001;
+	audio_render_offline(output, mix_frames, format);
+	assert(voices[1]->is_virtual && !voices[0]->is_virtual && !voices[2]->is_virtual, "Failed: inaudible voice should be virtual");
+	
+	for (u64 i = 0; i < 3; i++) audio_player_release(voices[i]);
+	
+	// Benchmark a busy graph: 64 voices over 3 buses with filters, compression & reverb
+	{
+		Audio_Bus *reverb_bus = audio_bus_make(&audio_sfx_bus);
+		Audio_Dsp *bench_dsp[5];
+		bench_dsp[0] = audio_bus_add_dsp(reverb_bus, audio_dsp_make_reverb(0.8, 0.5, 0.3));
+		bench_dsp[1] = audio_bus_add_dsp(&audio_sfx_bus, audio_dsp_make_biquad(AUDIO_BIQUAD_LOW_PASS, 5000, 0.7071));
+		bench_dsp[2] = audio_bus_add_dsp(&audio_music_bus, audio_dsp_make_biquad(AUDIO_BIQUAD_HIGH_PASS, 80, 0.7071));
+		bench_dsp[3] = audio_bus_add_dsp(&audio_music_bus, audio_dsp_make_compressor(-12, 4, 10, 100));
+		bench_dsp[4] = audio_bus_add_dsp(&audio_master_bus, audio_dsp_make_limiter(-1));
+		
+		Audio_Player *bench_players[64];
+		for (u64 i = 0; i < 64; i++) {
+			bench_players[i] = audio_player_get_one();
+			bench_players[i]->config.volume = 0.05;
+			bench_players[i]->config.category = i%3 == 0 ? AUDIO_VOICE_CATEGORY_MUSIC : AUDIO_VOICE_CATEGORY_SFX;
+			if (i%3 == 1) bench_players[i]->config.bus = reverb_bus;
+			audio_player_set_source(bench_players[i], src);
+			audio_player_set_looping(bench_players[i], true);
+			audio_player_set_time_stamp(bench_players[i], 0.01*(f64)i);
+			audio_player_set_state(bench_players[i], AUDIO_PLAYER_STATE_PLAYING);
+		}
+		audio_render_offline(output, mix_frames, format);
+		
+		const u64 mixes = 100;
+		u64 start = rdtsc();
+		for (u64 i = 0; i < mixes; i++) audio_render_offline(output, mix_frames, format);
+		u64 cycles = rdtsc()-start;
+		assert(audio_voice_stats.real_voices == 64, "Failed: expected 64 real voices in benchmark, got %d", audio_voice_stats.real_voices);
+		print("audio mix of %d voices through buses with DSP took %llu cycles per %d frames\n", 64, cycles/mixes, mix_frames);
+		
+		for (u64 i = 0; i < 64; i++) audio_player_release(bench_players[i]);
+		for (u64 i = 0; i < 5; i++) bench_dsp[i]->bypass = true;
+	}
+	
+	// One shot clips are decoded once, shared and evicted when they're not playing
+	{
+		string clip_path = STR("audio_test.wav");
+		Audio_Clip_Cache_Stats last_stats = audio_clip_cache_stats;
+		u64 last_budget = audio_clip_cache_budget_bytes;
+		
+		play_one_audio_clip(clip_path);
+		play_one_audio_clip(clip_path);
+		String_Id clip_id = intern_string(clip_path);
+		Audio_Clip *clip = *(Audio_Clip**)hash_table_find(&just_audio_clips, clip_id);
+		assert(clip->loaded && !clip->loading && !clip->streamed && clip->source.kind == AUDIO_SOURCE_MEMORY, "Failed: short clip should be decoded to memory");
+		assert(clip->refcount == 2, "Failed: clip refcount, expected 2 got %d", clip->refcount);
+		assert(audio_clip_cache_stats.misses == last_stats.misses+1, "Failed: clip cache misses");
+		assert(audio_clip_cache_stats.hits == last_stats.hits+1, "Failed: clip cache hits");
+		assert(audio_clip_cache_stats.bytes == last_stats.bytes+clip->bytes, "Failed: clip cache bytes");
+		
+		// Still playing so it stays even if we're over budget
+		audio_clip_cache_trim(0);
+		assert(clip->loaded, "Failed: playing clip was evicted");
+		
+		for (u64 played = 0; played <= source_frames+mix_frames; played += mix_frames) {
+			audio_render_offline(output, mix_frames, format);
+		}
+		assert(clip->refcount == 0, "Failed: clip refcount after playing, expected 0 got %d", clip->refcount);
+		
+		audio_clip_cache_trim(0);
+		assert(!clip->loaded, "Failed: clip was not evicted");
+		assert(audio_clip_cache_stats.evictions == last_stats.evictions+1, "Failed: clip cache evictions");
+		assert(audio_clip_cache_stats.bytes == last_stats.bytes, "Failed: clip cache bytes after eviction");
+		
+		play_one_audio_clip(clip_path);
+		assert(clip->loaded && audio_clip_cache_stats.misses == last_stats.misses+2, "Failed: evicted clip should load again");
+		for (u64 played = 0; played <= source_frames+mix_frames; played += mix_frames) {
+			audio_render_offline(output, mix_frames, format);
+		}
+		
+		// Setting a clip on an already released player should still let go of the reference
+		Audio_Player *stale = audio_player_get_one();
+		audio_player_release(stale);
+		audio_clip_add_reference(clip);
+		audio_player_set_source_with_clip(stale, clip->source, clip);
+		audio_render_offline(output, mix_frames, format);
+		assert(clip->refcount == 0, "Failed: stale set source leaked a clip reference, refcount %d", clip->refcount);
+		
+		audio_clip_cache_trim(0);
+		audio_clip_cache_budget_bytes = last_budget;
+	}
+	
+	// ADPCM sources are much smaller than pcm and decode close to the original
+	{
+		Audio_Source adpcm;
+		ok = audio_open_source_load_adpcm_format(&adpcm, STR("audio_test.wav"), format, heap);
+		assert(ok, "Failed: audio_open_source_load_adpcm_format");
+		assert(adpcm.kind == AUDIO_SOURCE_ADPCM && adpcm.number_of_frames == source_frames, "Failed: ADPCM source");
+		
+		u64 adpcm_bytes = adpcm.adpcm_block_count*audio_adpcm_block_size(format.channels);
+		u64 pcm_bytes = source_frames*frame_size;
+		assert(adpcm_bytes*7 < pcm_bytes, "Failed: ADPCM is %d bytes, f32 is %d bytes", adpcm_bytes, pcm_bytes);
+		
+		Audio_Source_Cursor *cursor = audio_make_cursor_for_source(&adpcm);
+		assert(cursor, "Failed: ADPCM sources should get a cursor");
+		f32 *decoded = (f32*)alloc(heap, pcm_bytes);
+		
+		u64 index = 0;
+		u64 start = rdtsc();
+		for (u64 done = 0; done < source_frames; done += mix_frames) {
+			u64 count = min(mix_frames, source_frames-done);
+			index = audio_source_sample_next_frames_with_cursor(&adpcm, cursor, index, count, decoded+done*2, false);
+		}
+		u64 cycles = rdtsc()-start;
+		assert(index == source_frames, "Failed: ADPCM frame index, got %d", index);
+		
+		f64 total_error = 0;
+		for (u64 i = 0; i < source_frames*2; i++) total_error += fabs(decoded[i]-signal[i]);
+		f64 mean_error = total_error / (f64)(source_frames*2);
+		assert(mean_error < 0.01, "Failed: ADPCM mean error is %f", mean_error);
+		
+		// Random access without a cursor decodes the same
+		f32 *part = (f32*)alloc(heap, 100*frame_size);
+		audio_adpcm_get_frames(&adpcm, 0, 12345, 100, part);
+		assert(bytes_match(part, decoded+12345*2, 100*frame_size), "Failed: ADPCM random access");
+		
+		print("ADPCM decode took %llu cycles per %d frames, %llu bytes vs %llu bytes f32\n", cycles/(source_frames/mix_frames), mix_frames, adpcm_bytes, pcm_bytes);
+		
+		// One-shots hand their cursor back as soon as they're done instead of keeping it
+		play_one_audio_clip_source(adpcm);
+		for (u64 played = 0; played <= source_frames+mix_frames; played += mix_frames) {
+			audio_render_offline(output, mix_frames, format);
+		}
+		assert(audio_released_cursors != 0, "Failed: finished one-shot kept its cursor");
+		audio_collect_retired();
+		assert(audio_released_cursors == 0, "Failed: released cursors were not freed");
+		
+		dealloc(heap, part);
+		dealloc(heap, decoded);
+		audio_source_cursor_destroy(cursor);
+		dealloc(heap, cursor);
+		audio_source_destroy(&adpcm);
+	}
+	
+	// A full command queue spills over instead of blocking, and keeps the order
+	{
+		Audio_Player *busy = audio_player_get_one();
+		for (u64 i = 0; i <= AUDIO_PLAYER_COMMAND_QUEUE_SIZE*2; i++) audio_player_set_looping(busy, (i & 1) == 0);
+		assert(audio_player_command_queue.overflow_count > 0, "Failed: player commands should overflow");
+		audio_render_offline(output, mix_frames, format);
+		assert(audio_player_command_queue.overflow_count == 0, "Failed: overflow was not drained");
+		assert(audio_player_command_queue.read_pos == audio_player_command_queue.write_pos, "Failed: command queue was not drained");
+		assert(busy->looping, "Failed: overflowed player commands applied out of order");
+		audio_player_release(busy);
+	}
+	
+	// The mixer times itself
+	{
+		audio_reset_timing_stats();
+		Audio_Player *timed = audio_player_get_one();
+		audio_player_set_source(timed, src);
+		audio_player_set_looping(timed, true);
+		audio_player_set_state(timed, AUDIO_PLAYER_STATE_PLAYING);
+		for (u64 i = 0; i < 10; i++) audio_render_offline(output, mix_frames, format);
+		
+		Audio_Timing_Stats timing = audio_get_timing_stats();
+		assert(timing.mix_count == 10, "Failed: timing mix count, expected 10 got %d", timing.mix_count);
+		assert(timing.voices_mixed_last == 1 && timing.voices_mixed_max == 1, "Failed: timing voices mixed");
+		assert(timing.mix_seconds_min > 0, "Failed: timing mix seconds");
+		assert(timing.mix_seconds_min <= timing.mix_seconds_avg && timing.mix_seconds_avg <= timing.mix_seconds_max, "Failed: timing mix avg out of range");
+		assert(timing.mix_seconds_p99 >= timing.mix_seconds_min && timing.mix_seconds_p99 <= timing.mix_seconds_max, "Failed: timing mix p99 out of range");
+		assert(timing.voice_seconds_avg > 0 && timing.voice_seconds_avg <= timing.mix_seconds_max, "Failed: timing voice cost");
+		assert(timing.underruns == 0, "Failed: offline rendering can't underrun");
+		
+		bool acquired = audio_mixer_try_acquire();
+		assert(acquired, "Failed: audio_mixer_try_acquire");
+		audio_timing_report_output(256, false);
+		audio_timing_report_output(0, true);
+		audio_mixer_release();
+		timing = audio_get_timing_stats();
+		assert(timing.underruns == 1, "Failed: timing underruns");
+		assert(timing.buffer_padding_frames_last == 0 && timing.buffer_padding_frames_min == 0, "Failed: timing buffer padding");
+		
+		audio_player_release(timed);
+	}
+	
+	// Destroying a source detaches players still using it
+	audio_source_destroy(&src);
+	audio_render_offline(output, mix_frames, format);
+	assert(!p->has_source, "Failed: player still has destroyed source");
+	for (u64 i = 0; i < mix_frames*2; i++) assert(output[i] == 0, "Failed: expected silence after source was destroyed");
+	
+	audio_player_release(p);
+	audio_render_offline(output, mix_frames, format);
+	assert(!p->allocated, "Failed: audio_player_release");
+	
+	// Null output running as fast as it can, recorded to a file
+	Audio_Null_Output_Config config = ZERO(Audio_Null_Output_Config);
+	config.format = format;
+	config.max_frames = 10000;
+	config.wav_path = STR("audio_null_output.wav");
+	ok = audio_output_start_null(config);
+	assert(ok, "Failed: audio_output_start_null");
+	while (audio_null_output.running) os_yield_thread();
+	audio_output_stop_null();
+	assert(audio_null_output.frames_mixed == config.max_frames, "Failed: null output mixed %d frames, expected %d", audio_null_output.frames_mixed, config.max_frames);
+	
+	Audio_Source recorded;
+	ok = audio_open_source_load_format(&recorded, STR("audio_null_output.wav"), format, heap);
+	assert(ok, "Failed: could not load wav recorded by null output");
+	assert(recorded.number_of_frames == config.max_frames, "Failed: recorded wav has %d frames, expected %d", recorded.number_of_frames, config.max_frames);
+	
+#ifdef OOGABOOGA_HEADLESS
+	// No audio thread here, so os_update() applies the player commands, even with the null output
+	Audio_Player *busy = audio_player_get_one();
+	for (u64 k = 0; k < 2; k++) {
+		audio_output_kind = k == 0 ? AUDIO_OUTPUT_DEVICE : AUDIO_OUTPUT_NULL;
+		for (u64 i = 0; i <= AUDIO_PLAYER_COMMAND_QUEUE_SIZE*2; i++) audio_player_set_looping(busy, (i & 1) == 0);
+		os_update();
+		assert(audio_player_command_queue.read_pos == audio_player_command_queue.write_pos, "Failed: os_update should apply player commands in headless");
+		assert(audio_player_command_queue.overflow_count == 0, "Failed: os_update should apply overflowed player commands in headless");
+		assert(busy->looping, "Failed: player commands applied out of order");
+	}
+	audio_player_set_looping(busy, false);
+	audio_player_set_source(busy, recorded);
+	audio_player_set_state(busy, AUDIO_PLAYER_STATE_PLAYING);
+	audio_player_release_when_done(busy);
+	os_update();
+	assert(busy->allocated && busy->has_source, "Failed: os_update released a one-shot before it was played");
+	
+	// Rendered to the end, but not released by the mixer yet
+	for (u64 i = 0; i < 100 && busy->frame_index < recorded.number_of_frames; i++) {
+		audio_render_offline(output, mix_frames, format);
+	}
+	assert(busy->frame_index >= recorded.number_of_frames, "Failed: one-shot did not play to the end");
+	os_update();
+	assert(!busy->allocated, "Failed: finished release_when_done players should be released in headless");
+#endif
+	
+	audio_source_destroy(&recorded);
+	
+	dealloc(heap, signal);
+	dealloc(heap, output);
+	
+	bool delete_ok = os_file_delete("audio_test.wav");
+	assert(delete_ok, "Failed: could not delete audio_test.wav");
+	delete_ok = os_file_delete("audio_null_output.wav");
+	assert(delete_ok, "Failed: could not delete audio_null_output.wav");
+	
+	audio_output_kind = last_output_kind;
 }
 
 void oogabooga_run_tests() {
@@ -1370,11 +3429,23 @@ void oogabooga_run_tests() {
 	print("Testing growing array... ");
 	test_growing_array();
 	print("OK!\n");
+	
+	print("Testing array... ");
+	test_array();
+	print("OK!\n");
     
 	print("Testing allocator... ");
 	test_allocator(true);
 	print("OK!\n");
 	
+	print("Testing profiler... ");
+	test_profiler();
+	print("OK!\n");
+	
+	print("Testing allocation tracking... ");
+	test_allocation_tracking();
+	print("OK!\n");
+	
 	print("Testing threads... ");
 	test_threads();
 	print("OK!\n");
@@ -1383,6 +3454,14 @@ void oogabooga_run_tests() {
 	test_strings();
 	print("OK!\n");
 	
+	print("Testing string kernels... ");
+	test_string_kernels();
+	print("OK!\n");
+	
+	print("Testing string formatting... ");
+	test_string_format();
+	print("OK!\n");
+	
 	print("Testing file IO... ");
 	test_file_io();
 	print("OK!\n");
@@ -1399,6 +3478,18 @@ void oogabooga_run_tests() {
 	test_simd();
 	print("OK!\n");
 	
+	print("Testing cpu dispatch... ");
+	test_cpu_dispatch();
+	print("OK!\n");
+	
+	print("Testing hash... ");
+	test_hash();
+	print("OK!\n");
+	
+	print("Testing string interner... ");
+	test_string_interner();
+	print("OK!\n");
+	
 	print("Testing hash table... ");
 	test_hash_table();
 	print("OK!\n");
@@ -1410,12 +3501,26 @@ void oogabooga_run_tests() {
 	print("Testing mutex... ");
 	test_mutex();
 	print("OK!\n");
+	
+	print("Testing input recording... ");
+	test_input_recording();
+	print("OK!\n");
+	
+	print("Testing audio... ");
+	test_audio();
+	print("OK!\n");
 
-#ifndef OOGABOOGA_HEADLESS
 	print("Testing radix sort... ");
 	test_sort();
 	print("OK!\n");
-#endif
+
+	print("Testing typed sorts... ");
+	test_typed_sorts();
+	print("OK!\n");
+	
+	print("Testing quad pipeline... ");
+	test_quad_pipeline();
+	print("OK!\n");
 
 	
 	
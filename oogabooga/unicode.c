@@ -99,6 +99,16 @@ Utf8_To_Utf32_Result utf8_to_utf32(u8 *s, s64 source_length, bool strict) {
 
 // Returns 0 on fail
 u32 next_utf8(string *s) {
+	if (s->count == 0) return 0;
+	
+	// Ascii fast path
+	if (s->data[0] < 0x80) {
+		u32 c = s->data[0];
+		s->data  += 1;
+		s->count -= 1;
+		return c;
+	}
+	
 	Utf8_To_Utf32_Result result = utf8_to_utf32(s->data, s->count, false);
 
     s->data  += result.continuation_bytes;
@@ -108,4 +118,415 @@ u32 next_utf8(string *s) {
 	if (result.error) return 0;
 
     return result.utf32;
-}
\ No newline at end of file
+}
+
+///
+// Bulk validation & decoding
+//
+// Text is mostly ascii, so every kernel skips through whole vectors of ascii at a time and
+// only goes byte by byte around the rest. The AVX2 validator doesn't need to go byte by
+// byte at all, it's the lookup table algorithm from Keiser & Lemire, "Validating UTF-8 In
+// Less Than One Instruction Per Byte".
+//
+// Valid means what the Unicode standard says: shortest form, no surrogates, nothing above
+// U+10FFFF.
+//
+
+// Length of the valid sequence at s (which starts with a non-ascii byte), or 0 if it's invalid
+inline u64
+_utf8_sequence_length(const u8 *s, u64 count) {
+	u8 b = s[0];
+	if (b < 0xC2) return 0;
+	if (b < 0xE0) {
+		if (count < 2 || (s[1] & 0xC0) != 0x80) return 0;
+		return 2;
+	}
+	if (b < 0xF0) {
+		if (count < 3) return 0;
+		u8 min = b == 0xE0 ? 0xA0 : 0x80;
+		u8 max = b == 0xED ? 0x9F : 0xBF;
+		if (s[1] < min || s[1] > max || (s[2] & 0xC0) != 0x80) return 0;
+		return 3;
+	}
+	if (b < 0xF5) {
+		if (count < 4) return 0;
+		u8 min = b == 0xF0 ? 0x90 : 0x80;
+		u8 max = b == 0xF4 ? 0x8F : 0xBF;
+		if (s[1] < min || s[1] > max || (s[2] & 0xC0) != 0x80 || (s[3] & 0xC0) != 0x80) return 0;
+		return 4;
+	}
+	return 0;
+}
+
+// Decodes the sequence at s (which starts with a non-ascii byte). Invalid bytes decode to
+// UNI_REPLACEMENT_CHAR one at a time. Returns bytes consumed.
+inline u64
+_utf8_decode_one(const u8 *s, u64 count, u32 *codepoint) {
+	u64 length = _utf8_sequence_length(s, count);
+	switch (length) {
+		case 2: *codepoint = ((u32)(s[0] & 0x1F) << 6)  |  (u32)(s[1] & 0x3F); return 2;
+		case 3: *codepoint = ((u32)(s[0] & 0x0F) << 12) | ((u32)(s[1] & 0x3F) << 6)  |  (u32)(s[2] & 0x3F); return 3;
+		case 4: *codepoint = ((u32)(s[0] & 0x07) << 18) | ((u32)(s[1] & 0x3F) << 12) | ((u32)(s[2] & 0x3F) << 6) | (u32)(s[3] & 0x3F); return 4;
+		default: *codepoint = UNI_REPLACEMENT_CHAR; return 1;
+	}
+}
+
+typedef u64 (*Ascii_Prefix_Proc)(const u8 *s, u64 count);
+typedef bool(*Utf8_Validate_Proc)(const u8 *s, u64 count);
+typedef u64 (*Utf8_Decode_Proc)(const u8 *s, u64 count, u64 *consumed, u32 *codepoints, u64 max_codepoints);
+
+typedef struct Utf8_Kernels {
+	Ascii_Prefix_Proc ascii_prefix;
+	Utf8_Validate_Proc validate;
+	Utf8_Decode_Proc decode;
+} Utf8_Kernels;
+Utf8_Kernels utf8_kernels = {0};
+
+u64
+_ascii_prefix_basic(const u8 *s, u64 count) {
+	u64 i = 0;
+	// 8 at a time, no vector needed for that
+	for (; i + 8 <= count; i += 8) {
+		u64 x;
+		memcpy(&x, s+i, 8);
+		if (x & 0x8080808080808080ull) break;
+	}
+	while (i < count && s[i] < 0x80) i += 1;
+	return i;
+}
+bool
+_utf8_validate_basic(const u8 *s, u64 count) {
+	u64 i = 0;
+	while (i < count) {
+		i += _ascii_prefix_basic(s+i, count-i);
+		if (i == count) break;
+		u64 length = _utf8_sequence_length(s+i, count-i);
+		if (!length) return false;
+		i += length;
+	}
+	return true;
+}
+u64
+_utf8_decode_basic(const u8 *s, u64 count, u64 *consumed, u32 *codepoints, u64 max_codepoints) {
+	u64 i = 0;
+	u64 n = 0;
+	while (i < count && n < max_codepoints) {
+		if (s[i] < 0x80) {
+			codepoints[n++] = s[i++];
+		} else {
+			i += _utf8_decode_one(s+i, count-i, &codepoints[n++]);
+		}
+	}
+	*consumed = i;
+	return n;
+}
+
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+u64
+_ascii_prefix_sse2(const u8 *s, u64 count) {
+	u64 i = 0;
+	for (; i + 16 <= count; i += 16) {
+		u32 mask = (u32)_mm_movemask_epi8(_mm_loadu_si128((__m128i*)(s+i)));
+		if (mask) return i + bit_scan_forward_64(mask);
+	}
+	return i + _ascii_prefix_basic(s+i, count-i);
+}
+bool
+_utf8_validate_sse2(const u8 *s, u64 count) {
+	u64 i = 0;
+	while (i < count) {
+		i += _ascii_prefix_sse2(s+i, count-i);
+		if (i == count) break;
+		u64 length = _utf8_sequence_length(s+i, count-i);
+		if (!length) return false;
+		i += length;
+	}
+	return true;
+}
+u64
+_utf8_decode_sse2(const u8 *s, u64 count, u64 *consumed, u32 *codepoints, u64 max_codepoints) {
+	u64 i = 0;
+	u64 n = 0;
+	__m128i zero = _mm_setzero_si128();
+	while (i < count && n < max_codepoints) {
+		if (i + 16 <= count && n + 16 <= max_codepoints) {
+			// Zero extend all 16 bytes but only keep the ascii run at the start. What's
+			// written past it is overwritten by the next codepoints.
+			__m128i v = _mm_loadu_si128((__m128i*)(s+i));
+			u32 mask = (u32)_mm_movemask_epi8(v);
+			__m128i lo = _mm_unpacklo_epi8(v, zero);
+			__m128i hi = _mm_unpackhi_epi8(v, zero);
+			_mm_storeu_si128((__m128i*)(codepoints+n),    _mm_unpacklo_epi16(lo, zero));
+			_mm_storeu_si128((__m128i*)(codepoints+n+4),  _mm_unpackhi_epi16(lo, zero));
+			_mm_storeu_si128((__m128i*)(codepoints+n+8),  _mm_unpacklo_epi16(hi, zero));
+			_mm_storeu_si128((__m128i*)(codepoints+n+12), _mm_unpackhi_epi16(hi, zero));
+			u64 ascii = mask ? bit_scan_forward_64(mask) : 16;
+			i += ascii;
+			n += ascii;
+			if (ascii == 16) continue;
+			i += _utf8_decode_one(s+i, count-i, &codepoints[n++]);
+			continue;
+		}
+		if (s[i] < 0x80) {
+			codepoints[n++] = s[i++];
+		} else {
+			i += _utf8_decode_one(s+i, count-i, &codepoints[n++]);
+		}
+	}
+	*consumed = i;
+	return n;
+}
+
+TARGET_AVX2 u64
+_ascii_prefix_avx2(const u8 *s, u64 count) {
+	u64 i = 0;
+	for (; i + 32 <= count; i += 32) {
+		u32 mask = (u32)_mm256_movemask_epi8(_mm256_loadu_si256((__m256i*)(s+i)));
+		if (mask) return i + bit_scan_forward_64(mask);
+	}
+	return i + _ascii_prefix_sse2(s+i, count-i);
+}
+
+// The byte n positions before each byte in input, continuing from the previous block
+#define _utf8_prev_avx2(input, previous, n) \
+	_mm256_alignr_epi8((input), _mm256_permute2x128_si256((previous), (input), 0x21), 16-(n))
+
+#define _UTF8_TOO_SHORT      (1 << 0) // 11______ 0_______ or 11______ 11______
+#define _UTF8_TOO_LONG       (1 << 1) // 0_______ 10______
+#define _UTF8_OVERLONG_3     (1 << 2) // 11100000 100_____
+#define _UTF8_TOO_LARGE      (1 << 3) // 11110100 1001____ and up
+#define _UTF8_SURROGATE      (1 << 4) // 11101101 101_____
+#define _UTF8_OVERLONG_2     (1 << 5) // 1100000_ 10______
+#define _UTF8_TOO_LARGE_1000 (1 << 6) // 11110101 1000____ and up
+#define _UTF8_OVERLONG_4     (1 << 6) // 11110000 1000____
+#define _UTF8_TWO_CONTS      (1 << 7) // 10______ 10______
+#define _UTF8_CARRY (_UTF8_TOO_SHORT | _UTF8_TOO_LONG | _UTF8_TWO_CONTS)
+
+// Nonzero bytes where there's an error in input, given the block before it
+TARGET_AVX2 __m256i
+_utf8_block_errors_avx2(__m256i input, __m256i previous) {
+	const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+	
+	// What each (high nibble of previous byte, low nibble of previous byte, high nibble of
+	// this byte) could mean. Each is a set of error bits and the error is where all three agree.
+	const __m256i byte_1_high_table = _mm256_setr_epi8(
+		_UTF8_TOO_LONG, _UTF8_TOO_LONG, _UTF8_TOO_LONG, _UTF8_TOO_LONG,
+		_UTF8_TOO_LONG, _UTF8_TOO_LONG, _UTF8_TOO_LONG, _UTF8_TOO_LONG,
+		_UTF8_TWO_CONTS, _UTF8_TWO_CONTS, _UTF8_TWO_CONTS, _UTF8_TWO_CONTS,
+		_UTF8_TOO_SHORT | _UTF8_OVERLONG_2,
+		_UTF8_TOO_SHORT,
+		_UTF8_TOO_SHORT | _UTF8_OVERLONG_3 | _UTF8_SURROGATE,
+		_UTF8_TOO_SHORT | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000 | _UTF8_OVERLONG_4,
+		_UTF8_TOO_LONG, _UTF8_TOO_LONG, _UTF8_TOO_LONG, _UTF8_TOO_LONG,
+		_UTF8_TOO_LONG, _UTF8_TOO_LONG, _UTF8_TOO_LONG, _UTF8_TOO_LONG,
+		_UTF8_TWO_CONTS, _UTF8_TWO_CONTS, _UTF8_TWO_CONTS, _UTF8_TWO_CONTS,
+		_UTF8_TOO_SHORT | _UTF8_OVERLONG_2,
+		_UTF8_TOO_SHORT,
+		_UTF8_TOO_SHORT | _UTF8_OVERLONG_3 | _UTF8_SURROGATE,
+		_UTF8_TOO_SHORT | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000 | _UTF8_OVERLONG_4
+	);
+	const __m256i byte_1_low_table = _mm256_setr_epi8(
+		_UTF8_CARRY | _UTF8_OVERLONG_3 | _UTF8_OVERLONG_2 | _UTF8_OVERLONG_4,
+		_UTF8_CARRY | _UTF8_OVERLONG_2,
+		_UTF8_CARRY,
+		_UTF8_CARRY,
+		_UTF8_CARRY | _UTF8_TOO_LARGE,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000 | _UTF8_SURROGATE,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_OVERLONG_3 | _UTF8_OVERLONG_2 | _UTF8_OVERLONG_4,
+		_UTF8_CARRY | _UTF8_OVERLONG_2,
+		_UTF8_CARRY,
+		_UTF8_CARRY,
+		_UTF8_CARRY | _UTF8_TOO_LARGE,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000 | _UTF8_SURROGATE,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000,
+		_UTF8_CARRY | _UTF8_TOO_LARGE | _UTF8_TOO_LARGE_1000
+	);
+	const __m256i byte_2_high_table = _mm256_setr_epi8(
+		_UTF8_TOO_SHORT, _UTF8_TOO_SHORT, _UTF8_TOO_SHORT, _UTF8_TOO_SHORT,
+		_UTF8_TOO_SHORT, _UTF8_TOO_SHORT, _UTF8_TOO_SHORT, _UTF8_TOO_SHORT,
+		_UTF8_TOO_LONG | _UTF8_OVERLONG_2 | _UTF8_TWO_CONTS | _UTF8_OVERLONG_3 | _UTF8_TOO_LARGE_1000 | _UTF8_OVERLONG_4,
+		_UTF8_TOO_LONG | _UTF8_OVERLONG_2 | _UTF8_TWO_CONTS | _UTF8_OVERLONG_3 | _UTF8_TOO_LARGE,
+		_UTF8_TOO_LONG | _UTF8_OVERLONG_2 | _UTF8_TWO_CONTS | _UTF8_SURROGATE | _UTF8_TOO_LARGE,
+		_UTF8_TOO_LONG | _UTF8_OVERLONG_2 | _UTF8_TWO_CONTS | _UTF8_SURROGATE | _UTF8_TOO_LARGE,
+		_UTF8_TOO_SHORT, _UTF8_TOO_SHORT, _UTF8_TOO_SHORT, _UTF8_TOO_SHORT,
+		_UTF8_TOO_SHORT, _UTF8_TOO_SHORT, _UTF8_TOO_SHORT, _UTF8_TOO_SHORT,
+		_UTF8_TOO_SHORT, _UTF8_TOO_SHORT, _UTF8_TOO_SHORT, _UTF8_TOO_SHORT,
+		_UTF8_TOO_LONG | _UTF8_OVERLONG_2 | _UTF8_TWO_CONTS | _UTF8_OVERLONG_3 | _UTF8_TOO_LARGE_1000 | _UTF8_OVERLONG_4,
+		_UTF8_TOO_LONG | _UTF8_OVERLONG_2 | _UTF8_TWO_CONTS | _UTF8_OVERLONG_3 | _UTF8_TOO_LARGE,
+		_UTF8_TOO_LONG | _UTF8_OVERLONG_2 | _UTF8_TWO_CONTS | _UTF8_SURROGATE | _UTF8_TOO_LARGE,
+		_UTF8_TOO_LONG | _UTF8_OVERLONG_2 | _UTF8_TWO_CONTS | _UTF8_SURROGATE | _UTF8_TOO_LARGE,
+		_UTF8_TOO_SHORT, _UTF8_TOO_SHORT, _UTF8_TOO_SHORT, _UTF8_TOO_SHORT
+	);
+	
+	__m256i prev1 = _utf8_prev_avx2(input, previous, 1);
+	__m256i byte_1_high = _mm256_shuffle_epi8(byte_1_high_table, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble));
+	__m256i byte_1_low  = _mm256_shuffle_epi8(byte_1_low_table,  _mm256_and_si256(prev1, low_nibble));
+	__m256i byte_2_high = _mm256_shuffle_epi8(byte_2_high_table, _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibble));
+	__m256i special_cases = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+	
+	// Third and fourth bytes of 3 & 4 byte sequences must be continuations, and continuations
+	// can't come anywhere else. 
+	__m256i prev2 = _utf8_prev_avx2(input, previous, 2);
+	__m256i prev3 = _utf8_prev_avx2(input, previous, 3);
+	__m256i is_third_byte  = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0-0x80)));
+	__m256i is_fourth_byte = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0-0x80)));
+	__m256i must_be_continuation = _mm256_and_si256(_mm256_or_si256(is_third_byte, is_fourth_byte), _mm256_set1_epi8((char)0x80));
+	
+	return _mm256_xor_si256(must_be_continuation, special_cases);
+}
+
+// Nonzero if the block ends in the middle of a sequence
+TARGET_AVX2 __m256i
+_utf8_block_incomplete_avx2(__m256i input) {
+	const __m256i max_complete = _mm256_setr_epi8(
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		(char)(0xF0-1), (char)(0xE0-1), (char)(0xC0-1)
+	);
+	return _mm256_subs_epu8(input, max_complete);
+}
+
+TARGET_AVX2 bool
+_utf8_validate_avx2(const u8 *s, u64 count) {
+	__m256i error = _mm256_setzero_si256();
+	__m256i previous = _mm256_setzero_si256();
+	__m256i previous_incomplete = _mm256_setzero_si256();
+	
+	u64 i = 0;
+	while (i < count) {
+		__m256i input;
+		if (i + 32 <= count) {
+			input = _mm256_loadu_si256((__m256i*)(s+i));
+		} else {
+			// Pad the tail with zeroes, which are ascii and catch anything left unfinished
+			alignat(32) u8 tail[32] = {0};
+			memcpy(tail, s+i, count-i);
+			input = _mm256_load_si256((__m256i*)tail);
+		}
+		
+		if (!_mm256_movemask_epi8(input)) {
+			error = _mm256_or_si256(error, previous_incomplete);
+		} else {
+			error = _mm256_or_si256(error, _utf8_block_errors_avx2(input, previous));
+			previous_incomplete = _utf8_block_incomplete_avx2(input);
+			previous = input;
+		}
+		
+		// Bail out early on errors every so often
+		if ((i & 4095) == 0 && !_mm256_testz_si256(error, error)) return false;
+		
+		i += 32;
+	}
+	error = _mm256_or_si256(error, previous_incomplete);
+	return _mm256_testz_si256(error, error);
+}
+
+TARGET_AVX2 u64
+_utf8_decode_avx2(const u8 *s, u64 count, u64 *consumed, u32 *codepoints, u64 max_codepoints) {
+	u64 i = 0;
+	u64 n = 0;
+	while (i < count && n < max_codepoints) {
+		if (i + 32 <= count && n + 32 <= max_codepoints) {
+			// Same as sse2: widen the whole block, keep the ascii run at the start
+			__m256i v = _mm256_loadu_si256((__m256i*)(s+i));
+			u32 mask = (u32)_mm256_movemask_epi8(v);
+			__m128i lo = _mm256_castsi256_si128(v);
+			__m128i hi = _mm256_extracti128_si256(v, 1);
+			_mm256_storeu_si256((__m256i*)(codepoints+n),    _mm256_cvtepu8_epi32(lo));
+			_mm256_storeu_si256((__m256i*)(codepoints+n+8),  _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+			_mm256_storeu_si256((__m256i*)(codepoints+n+16), _mm256_cvtepu8_epi32(hi));
+			_mm256_storeu_si256((__m256i*)(codepoints+n+24), _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+			u64 ascii = mask ? bit_scan_forward_64(mask) : 32;
+			i += ascii;
+			n += ascii;
+			if (ascii == 32) continue;
+			i += _utf8_decode_one(s+i, count-i, &codepoints[n++]);
+			continue;
+		}
+		if (s[i] < 0x80) {
+			codepoints[n++] = s[i++];
+		} else {
+			i += _utf8_decode_one(s+i, count-i, &codepoints[n++]);
+		}
+	}
+	*consumed = i;
+	return n;
+}
+
+#endif // ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+void
+utf8_kernels_select(Cpu_Isa isa) {
+	Utf8_Kernels k = {0};
+	switch (isa) {
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+		case CPU_ISA_AVX2:
+			k.ascii_prefix = _ascii_prefix_avx2;
+			k.validate     = _utf8_validate_avx2;
+			k.decode       = _utf8_decode_avx2;
+			break;
+		case CPU_ISA_SSE2:
+			k.ascii_prefix = _ascii_prefix_sse2;
+			k.validate     = _utf8_validate_sse2;
+			k.decode       = _utf8_decode_sse2;
+			break;
+#endif
+		default:
+			k.ascii_prefix = _ascii_prefix_basic;
+			k.validate     = _utf8_validate_basic;
+			k.decode       = _utf8_decode_basic;
+			break;
+	}
+	utf8_kernels = k;
+}
+inline Utf8_Kernels*
+get_utf8_kernels() {
+	get_cpu_dispatch();
+	return &utf8_kernels;
+}
+
+// Number of leading bytes which are ascii
+u64
+ascii_prefix_length(string s) {
+	return get_utf8_kernels()->ascii_prefix(s.data, s.count);
+}
+bool
+string_is_ascii(string s) {
+	return ascii_prefix_length(s) == s.count;
+}
+bool
+utf8_validate(string s) {
+	return get_utf8_kernels()->validate(s.data, s.count);
+}
+// Decodes up to max_codepoints from the start of s and advances s past them.
+// Invalid bytes decode to UNI_REPLACEMENT_CHAR, one per byte. Returns number of codepoints.
+//     u32 codepoints[256];
+//     u64 n;
+//     while ((n = utf8_decode(&text, codepoints, 256))) { ... }
+u64
+utf8_decode(string *s, u32 *codepoints, u64 max_codepoints) {
+	u64 consumed;
+	u64 n = get_utf8_kernels()->decode(s->data, s->count, &consumed, codepoints, max_codepoints);
+	s->data  += consumed;
+	s->count -= consumed;
+	return n;
+}